@@ -101,19 +101,177 @@ const u_int8_t kBits_11000000 = 0xC0;
 const u_int8_t kBits_11110000 = 0xF0;
 const u_int8_t kBits_11111100 = 0xFC;
 
+/* Input bytes and output characters per encoded line, before the CRLF */
+#define kBase64LineInputSize 54
+#define kBase64LineOutputSize 72
+
+/*
+ * The vector kernels handle runs of whole groups within a line; the scalar code does the rest,
+ * so the output is the same whichever kernel is compiled in. The kernel is chosen at compile
+ * time: every arm64 device has NEON and every x86_64 Mac has SSSE3. Defining BASE64_SCALAR
+ * builds the scalar code alone, which the tests compare the kernels against.
+ */
+#if defined(BASE64_SCALAR)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define BASE64_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define BASE64_SSSE3 1
+#endif
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wsign-conversion"
 
+#if BASE64_NEON
+/* kBase64DecodeTable with everything that isn't base64 as 0xFF */
+static const u_int8_t kBase64VectorDecodeTable[128] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+	0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+#endif
+
+static inline int8_t Base64Sextet(u_int8_t inOctet)
+{
+return(inOctet < 128 ? kBase64DecodeTable[inOctet] : -3);
+}
+
+/* Encodes inInputDataSize bytes, a multiple of 3, without line breaks. Returns the characters written. */
+static size_t Base64EncodeRun(const u_int8_t *inInputData, size_t inInputDataSize, char *outOutputData)
+{
+const u_int8_t *theInPtr = inInputData;
+char *theOutPtr = outOutputData;
+#if BASE64_NEON
+const uint8x16x4_t theTable = {{ vld1q_u8(kBase64EncodeTable), vld1q_u8(kBase64EncodeTable + 16), vld1q_u8(kBase64EncodeTable + 32), vld1q_u8(kBase64EncodeTable + 48) }};
+const uint8x16_t theMask = vdupq_n_u8(kBits_00111111);
+for (; inInputDataSize >= 48; inInputDataSize -= 48, theInPtr += 48, theOutPtr += 64)
+	{
+	const uint8x16x3_t theIn = vld3q_u8(theInPtr);
+	uint8x16x4_t theOut;
+	theOut.val[0] = vshrq_n_u8(theIn.val[0], 2);
+	theOut.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(theIn.val[0], 4), vshrq_n_u8(theIn.val[1], 4)), theMask);
+	theOut.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(theIn.val[1], 2), vshrq_n_u8(theIn.val[2], 6)), theMask);
+	theOut.val[3] = vandq_u8(theIn.val[2], theMask);
+	theOut.val[0] = vqtbl4q_u8(theTable, theOut.val[0]);
+	theOut.val[1] = vqtbl4q_u8(theTable, theOut.val[1]);
+	theOut.val[2] = vqtbl4q_u8(theTable, theOut.val[2]);
+	theOut.val[3] = vqtbl4q_u8(theTable, theOut.val[3]);
+	vst4q_u8((u_int8_t *)theOutPtr, theOut);
+	}
+#elif BASE64_SSSE3
+// Loads 16 bytes to encode 12 of them
+for (; inInputDataSize >= 16; inInputDataSize -= 12, theInPtr += 12, theOutPtr += 16)
+	{
+	__m128i theIn = _mm_loadu_si128((const __m128i *)theInPtr);
+	// Each 32 bit lane gets bytes 1 0 2 1 of a group, then the sextets are moved into place
+	theIn = _mm_shuffle_epi8(theIn, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	const __m128i theHigh = _mm_mulhi_epu16(_mm_and_si128(theIn, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	const __m128i theLow = _mm_mullo_epi16(_mm_and_si128(theIn, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	const __m128i theSextets = _mm_or_si128(theHigh, theLow);
+	// Offset from sextet to character: 0-25 'A', 26-51 'a', 52-61 '0', 62 '+', 63 '/'
+	__m128i theIndices = _mm_subs_epu8(theSextets, _mm_set1_epi8(51));
+	theIndices = _mm_sub_epi8(theIndices, _mm_cmpgt_epi8(theSextets, _mm_set1_epi8(25)));
+	const __m128i theOffsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+	_mm_storeu_si128((__m128i *)theOutPtr, _mm_add_epi8(theSextets, _mm_shuffle_epi8(theOffsets, theIndices)));
+	}
+#endif
+for (; inInputDataSize >= 3; inInputDataSize -= 3, theInPtr += 3)
+	{
+	*theOutPtr++ = kBase64EncodeTable[(theInPtr[0] & kBits_11111100) >> 2];
+	*theOutPtr++ = kBase64EncodeTable[(theInPtr[0] & kBits_00000011) << 4 | (theInPtr[1] & kBits_11110000) >> 4];
+	*theOutPtr++ = kBase64EncodeTable[(theInPtr[1] & kBits_00001111) << 2 | (theInPtr[2] & kBits_11000000) >> 6];
+	*theOutPtr++ = kBase64EncodeTable[(theInPtr[2] & kBits_00111111) >> 0];
+	}
+return(theOutPtr - outOutputData);
+}
+
+/* Encodes the last 1 or 2 bytes with padding */
+static void Base64EncodeTail(const u_int8_t *inInputData, size_t inInputDataSize, char *outOutputData)
+{
+const u_int8_t theSecond = inInputDataSize > 1 ? inInputData[1] : 0;
+outOutputData[0] = kBase64EncodeTable[(inInputData[0] & kBits_11111100) >> 2];
+outOutputData[1] = kBase64EncodeTable[(inInputData[0] & kBits_00000011) << 4 | (theSecond & kBits_11110000) >> 4];
+outOutputData[2] = inInputDataSize > 1 ? kBase64EncodeTable[(theSecond & kBits_00001111) << 2] : '=';
+outOutputData[3] = '=';
+}
+
+/*
+ * Decodes the leading whole blocks of base64 characters with the vector kernel and stops at the
+ * first block holding anything else. Returns the characters consumed; 3 bytes are written for
+ * every 4 of them.
+ */
+static size_t Base64DecodeRun(const u_int8_t *inInputData, size_t inInputDataSize, u_int8_t *outOutputData)
+{
+size_t theInIndex = 0;
+#if BASE64_NEON
+const u_int8_t *theTableBytes = kBase64VectorDecodeTable;
+const uint8x16x4_t theLowTable = {{ vld1q_u8(theTableBytes), vld1q_u8(theTableBytes + 16), vld1q_u8(theTableBytes + 32), vld1q_u8(theTableBytes + 48) }};
+const uint8x16x4_t theHighTable = {{ vld1q_u8(theTableBytes + 64), vld1q_u8(theTableBytes + 80), vld1q_u8(theTableBytes + 96), vld1q_u8(theTableBytes + 112) }};
+for (; inInputDataSize - theInIndex >= 64; theInIndex += 64, outOutputData += 48)
+	{
+	const uint8x16x4_t theIn = vld4q_u8(inInputData + theInIndex);
+	uint8x16_t theSextets[4];
+	uint8x16_t theInvalid = vdupq_n_u8(0);
+	for (int theLane = 0; theLane < 4; theLane++)
+		{
+		// Characters 0-63 come from the low table, 64-127 from the high one and 128-255 from neither
+		theSextets[theLane] = vorrq_u8(vqtbl4q_u8(theLowTable, theIn.val[theLane]), vqtbl4q_u8(theHighTable, vsubq_u8(theIn.val[theLane], vdupq_n_u8(64))));
+		theInvalid = vorrq_u8(theInvalid, vorrq_u8(theSextets[theLane], vandq_u8(theIn.val[theLane], vdupq_n_u8(0x80))));
+		}
+	if (vmaxvq_u8(theInvalid) > 63)
+		break;
+	uint8x16x3_t theOut;
+	theOut.val[0] = vorrq_u8(vshlq_n_u8(theSextets[0], 2), vshrq_n_u8(theSextets[1], 4));
+	theOut.val[1] = vorrq_u8(vshlq_n_u8(theSextets[1], 4), vshrq_n_u8(theSextets[2], 2));
+	theOut.val[2] = vorrq_u8(vshlq_n_u8(theSextets[2], 6), theSextets[3]);
+	vst3q_u8(outOutputData, theOut);
+	}
+#elif BASE64_SSSE3
+const __m128i theSlash = _mm_set1_epi8(0x2F);
+for (; inInputDataSize - theInIndex >= 16; theInIndex += 16, outOutputData += 12)
+	{
+	__m128i theIn = _mm_loadu_si128((const __m128i *)(inInputData + theInIndex));
+	// A character is base64 when the flags for its high and low nibbles have no bit in common
+	const __m128i theHighNibbles = _mm_and_si128(_mm_srli_epi32(theIn, 4), theSlash);
+	const __m128i theLowNibbles = _mm_and_si128(theIn, theSlash);
+	const __m128i theHighFlags = _mm_shuffle_epi8(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), theHighNibbles);
+	const __m128i theLowFlags = _mm_shuffle_epi8(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A), theLowNibbles);
+	if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(theHighFlags, theLowFlags), _mm_setzero_si128())) != 0)
+		break;
+	// Offset from character to sextet by high nibble, '/' having its own
+	const __m128i theOffsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	theIn = _mm_add_epi8(theIn, _mm_shuffle_epi8(theOffsets, _mm_add_epi8(_mm_cmpeq_epi8(theIn, theSlash), theHighNibbles)));
+	// Pack the 4 sextets of each 32 bit lane into 3 bytes, then put them in order
+	theIn = _mm_madd_epi16(_mm_maddubs_epi16(theIn, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+	theIn = _mm_shuffle_epi8(theIn, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	const int theLast = _mm_cvtsi128_si32(_mm_srli_si128(theIn, 8));
+	_mm_storel_epi64((__m128i *)outOutputData, theIn);
+	memcpy(outOutputData + 8, &theLast, 4);
+	}
+#else
+(void)inInputData;
+(void)inInputDataSize;
+(void)outOutputData;
+#endif
+return(theInIndex);
+}
+
 size_t EstimateBas64EncodedDataSize(size_t inDataSize)
 {
-size_t theEncodedDataSize = (int)ceil(inDataSize / 3.0) * 4;
+size_t theEncodedDataSize = (inDataSize + 2) / 3 * 4;
 theEncodedDataSize = theEncodedDataSize / 72 * 74 + theEncodedDataSize % 72;
 return(theEncodedDataSize);
 }
 
 size_t EstimateBas64DecodedDataSize(size_t inDataSize)
 {
-size_t theDecodedDataSize = (int)ceil(inDataSize / 4.0) * 3;
+size_t theDecodedDataSize = (inDataSize + 3) / 4 * 3;
 //theDecodedDataSize = theDecodedDataSize / 72 * 74 + theDecodedDataSize % 72;
 return(theDecodedDataSize);
 }
@@ -124,45 +282,12 @@ size_t theEncodedDataSize = EstimateBas64EncodedDataSize(inInputDataSize);
 if (*ioOutputDataSize < theEncodedDataSize)
 	return(false);
 *ioOutputDataSize = theEncodedDataSize;
-const u_int8_t *theInPtr = (const u_int8_t *)inInputData;
-u_int32_t theInIndex = 0, theOutIndex = 0;
-for (; theInIndex < (inInputDataSize / 3) * 3; theInIndex += 3)
-	{
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_11111100) >> 2];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_00000011) << 4 | (theInPtr[theInIndex + 1] & kBits_11110000) >> 4];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex + 1] & kBits_00001111) << 2 | (theInPtr[theInIndex + 2] & kBits_11000000) >> 6];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex + 2] & kBits_00111111) >> 0];
-	if (theOutIndex % 74 == 72)
-		{
-		outOutputData[theOutIndex++] = '\r';
-		outOutputData[theOutIndex++] = '\n';
-		}
-	}
-const size_t theRemainingBytes = inInputDataSize - theInIndex;
-if (theRemainingBytes == 1)
-	{
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_11111100) >> 2];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_00000011) << 4 | (0 & kBits_11110000) >> 4];
-	outOutputData[theOutIndex++] = '=';
-	outOutputData[theOutIndex++] = '=';
-	if (theOutIndex % 74 == 72)
-		{
-		outOutputData[theOutIndex++] = '\r';
-		outOutputData[theOutIndex] = '\n';
-		}
-	}
-else if (theRemainingBytes == 2)
-	{
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_11111100) >> 2];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex] & kBits_00000011) << 4 | (theInPtr[theInIndex + 1] & kBits_11110000) >> 4];
-	outOutputData[theOutIndex++] = kBase64EncodeTable[(theInPtr[theInIndex + 1] & kBits_00001111) << 2 | (0 & kBits_11000000) >> 6];
-	outOutputData[theOutIndex++] = '=';
-	if (theOutIndex % 74 == 72)
-		{
-		outOutputData[theOutIndex++] = '\r';
-		outOutputData[theOutIndex] = '\n';
-		}
-	}
+Base64EncodeState theState;
+Base64EncodeInit(&theState);
+size_t theUpdateSize = theEncodedDataSize;
+Base64EncodeUpdate(&theState, inInputData, inInputDataSize, outOutputData, &theUpdateSize);
+size_t theFinalSize = theEncodedDataSize - theUpdateSize;
+Base64EncodeFinal(&theState, outOutputData + theUpdateSize, &theFinalSize);
 return(true);
 }
 
@@ -177,33 +302,41 @@ if (*ioOutputDataSize < theDecodedDataSize)
 const u_int8_t *theInPtr = (const u_int8_t *)inInputData;
 u_int8_t *theOutPtr = (u_int8_t *)ioOutputData;
 size_t theInIndex = 0, theOutIndex = 0;
-u_int8_t theOutputOctet;
+u_int8_t theOutputOctet = 0;
 size_t theSequence = 0;
-for (; theInIndex < inInputDataSize; )
+while (theInIndex < inInputDataSize)
 	{
-	int8_t theSextet = 0;
-	
-	int8_t theCurrentInputOctet = theInPtr[theInIndex];
-	theSextet = kBase64DecodeTable[theCurrentInputOctet];
-	if (theSextet == -1)
-		break;
-	while (theSextet == -2)
+	if (theSequence == 0)
 		{
-		theCurrentInputOctet = theInPtr[++theInIndex];
-		theSextet = kBase64DecodeTable[theCurrentInputOctet];
+		// Between quads; line breaks are skipped here so the next line can start in the vector kernel
+		while (theInIndex < inInputDataSize && Base64Sextet(theInPtr[theInIndex]) < -1)
+			theInIndex++;
+		size_t theRunSize = Base64DecodeRun(theInPtr + theInIndex, inInputDataSize - theInIndex, theOutPtr + theOutIndex);
+		theInIndex += theRunSize;
+		theOutIndex += theRunSize / 4 * 3;
+		if (theInIndex >= inInputDataSize)
+			break;
 		}
-	while (theSextet == -3)
+
+	int8_t theSextet = Base64Sextet(theInPtr[theInIndex]);
+	if (theSextet == -1)
+		break;
+	// Whitespace, noise and NUL bytes alike, as Base64DecodeUpdate does
+	while (theSextet < -1)
 		{
-		theCurrentInputOctet = theInPtr[++theInIndex];
-		theSextet = kBase64DecodeTable[theCurrentInputOctet];
+		if (++theInIndex >= inInputDataSize)
+			break;
+		theSextet = Base64Sextet(theInPtr[theInIndex]);
 		}
+	if (theInIndex >= inInputDataSize || theSextet == -1)
+		break;
 	if (theSequence == 0)
 		{
 		theOutputOctet = (theSextet >= 0 ? theSextet : 0) << 2 & kBits_11111100;
 		}
 	else if (theSequence == 1)
 		{
-		theOutputOctet |= (theSextet >- 0 ? theSextet : 0) >> 4 & kBits_00000011;
+		theOutputOctet |= (theSextet >= 0 ? theSextet : 0) >> 4 & kBits_00000011;
 		theOutPtr[theOutIndex++] = theOutputOctet;
 		}
 	else if (theSequence == 2)
@@ -232,4 +365,156 @@ for (; theInIndex < inInputDataSize; )
 return(true);
 }
 
-#pragma clang diagnostic pop
\ No newline at end of file
+void Base64EncodeInit(Base64EncodeState *outState)
+{
+memset(outState, 0, sizeof(*outState));
+}
+
+bool Base64EncodeUpdate(Base64EncodeState *ioState, const void *inInputData, size_t inInputDataSize, char *outOutputData, size_t *ioOutputDataSize)
+{
+const size_t theGroupsSize = (ioState->pendingSize + inInputDataSize) / 3 * 4;
+const size_t theRequiredSize = theGroupsSize + (ioState->lineLength + theGroupsSize) / kBase64LineOutputSize * 2;
+if (*ioOutputDataSize < theRequiredSize)
+	{
+	*ioOutputDataSize = theRequiredSize;
+	return(false);
+	}
+*ioOutputDataSize = theRequiredSize;
+
+const u_int8_t *theInPtr = (const u_int8_t *)inInputData;
+char *theOutPtr = outOutputData;
+if (ioState->pendingSize > 0)
+	{
+	// Complete the group left over from the last call
+	while (ioState->pendingSize < 3 && inInputDataSize > 0)
+		{
+		ioState->pending[ioState->pendingSize++] = *theInPtr++;
+		inInputDataSize--;
+		}
+	if (ioState->pendingSize < 3)
+		return(true);
+	theOutPtr += Base64EncodeRun(ioState->pending, 3, theOutPtr);
+	ioState->pendingSize = 0;
+	ioState->lineLength += 4;
+	if (ioState->lineLength == kBase64LineOutputSize)
+		{
+		*theOutPtr++ = '\r';
+		*theOutPtr++ = '\n';
+		ioState->lineLength = 0;
+		}
+	}
+while (inInputDataSize >= 3)
+	{
+	// As many groups as fit on the current line, a whole line's worth once the lines line up
+	size_t theRunSize = (kBase64LineOutputSize - ioState->lineLength) / 4 * 3;
+	if (theRunSize > inInputDataSize / 3 * 3)
+		theRunSize = inInputDataSize / 3 * 3;
+	const size_t theWritten = Base64EncodeRun(theInPtr, theRunSize, theOutPtr);
+	theInPtr += theRunSize;
+	inInputDataSize -= theRunSize;
+	theOutPtr += theWritten;
+	ioState->lineLength += theWritten;
+	if (ioState->lineLength == kBase64LineOutputSize)
+		{
+		*theOutPtr++ = '\r';
+		*theOutPtr++ = '\n';
+		ioState->lineLength = 0;
+		}
+	}
+memcpy(ioState->pending, theInPtr, inInputDataSize);
+ioState->pendingSize = inInputDataSize;
+return(true);
+}
+
+bool Base64EncodeFinal(Base64EncodeState *ioState, char *outOutputData, size_t *ioOutputDataSize)
+{
+size_t theRequiredSize = 0;
+if (ioState->pendingSize > 0)
+	theRequiredSize = ioState->lineLength + 4 == kBase64LineOutputSize ? 6 : 4;
+if (*ioOutputDataSize < theRequiredSize)
+	{
+	*ioOutputDataSize = theRequiredSize;
+	return(false);
+	}
+*ioOutputDataSize = theRequiredSize;
+
+if (ioState->pendingSize > 0)
+	{
+	Base64EncodeTail(ioState->pending, ioState->pendingSize, outOutputData);
+	if (theRequiredSize == 6)
+		{
+		outOutputData[4] = '\r';
+		outOutputData[5] = '\n';
+		}
+	}
+Base64EncodeInit(ioState);
+return(true);
+}
+
+void Base64DecodeInit(Base64DecodeState *outState)
+{
+memset(outState, 0, sizeof(*outState));
+}
+
+bool Base64DecodeUpdate(Base64DecodeState *ioState, const void *inInputData, size_t inInputDataSize, void *outOutputData, size_t *ioOutputDataSize)
+{
+const size_t theRequiredSize = ioState->finished ? 0 : (ioState->sextetCount + inInputDataSize) / 4 * 3;
+if (*ioOutputDataSize < theRequiredSize)
+	{
+	*ioOutputDataSize = theRequiredSize;
+	return(false);
+	}
+
+const u_int8_t *theInPtr = (const u_int8_t *)inInputData;
+u_int8_t *theOutPtr = (u_int8_t *)outOutputData;
+size_t theInIndex = 0, theOutIndex = 0;
+while (theInIndex < inInputDataSize && !ioState->finished)
+	{
+	if (ioState->sextetCount == 0)
+		{
+		size_t theRunSize = Base64DecodeRun(theInPtr + theInIndex, inInputDataSize - theInIndex, theOutPtr + theOutIndex);
+		theInIndex += theRunSize;
+		theOutIndex += theRunSize / 4 * 3;
+		if (theInIndex >= inInputDataSize)
+			break;
+		}
+
+	const int8_t theSextet = Base64Sextet(theInPtr[theInIndex++]);
+	if (theSextet == -1)
+		ioState->finished = true;
+	if (theSextet < 0)
+		continue;
+	ioState->sextets[ioState->sextetCount++] = theSextet;
+	if (ioState->sextetCount == 4)
+		{
+		theOutPtr[theOutIndex++] = ioState->sextets[0] << 2 | ioState->sextets[1] >> 4;
+		theOutPtr[theOutIndex++] = ioState->sextets[1] << 4 | ioState->sextets[2] >> 2;
+		theOutPtr[theOutIndex++] = ioState->sextets[2] << 6 | ioState->sextets[3];
+		ioState->sextetCount = 0;
+		}
+	}
+*ioOutputDataSize = theOutIndex;
+return(true);
+}
+
+bool Base64DecodeFinal(Base64DecodeState *ioState, void *outOutputData, size_t *ioOutputDataSize)
+{
+// A partial quad holds as many whole bytes as the padding it lacks would have left
+const size_t theRequiredSize = ioState->sextetCount > 1 ? ioState->sextetCount - 1 : 0;
+if (*ioOutputDataSize < theRequiredSize)
+	{
+	*ioOutputDataSize = theRequiredSize;
+	return(false);
+	}
+*ioOutputDataSize = theRequiredSize;
+
+u_int8_t *theOutPtr = (u_int8_t *)outOutputData;
+if (theRequiredSize > 0)
+	theOutPtr[0] = ioState->sextets[0] << 2 | ioState->sextets[1] >> 4;
+if (theRequiredSize > 1)
+	theOutPtr[1] = ioState->sextets[1] << 4 | ioState->sextets[2] >> 2;
+Base64DecodeInit(ioState);
+return(true);
+}
+
+#pragma clang diagnostic pop
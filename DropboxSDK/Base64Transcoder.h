@@ -27,10 +27,41 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 extern size_t EstimateBas64EncodedDataSize(size_t inDataSize);
 extern size_t EstimateBas64DecodedDataSize(size_t inDataSize);
 
 extern bool Base64EncodeData(const void *inInputData, size_t inInputDataSize, char *outOutputData, size_t *ioOutputDataSize);
+/*
+ *  The decoder stops at the first '=' and skips every other byte that isn't base64: whitespace,
+ *  other punctuation, control characters, NUL bytes and bytes above 0x7F.
+ */
 extern bool Base64DecodeData(const void *inInputData, size_t inInputDataSize, void *ioOutputData, size_t *ioOutputDataSize);
 
+/*
+ *  Incremental variants. Feeding the input in pieces gives the same result as one
+ *  Base64EncodeData or Base64DecodeData call on all of it, line breaks included. The update and
+ *  final calls return false, with the size they need in *ioOutputDataSize, if the output buffer is
+ *  too small.
+ */
+
+typedef struct Base64EncodeState {
+	uint8_t pending[3];
+	size_t pendingSize;
+	size_t lineLength;
+} Base64EncodeState;
+
+extern void Base64EncodeInit(Base64EncodeState *outState);
+extern bool Base64EncodeUpdate(Base64EncodeState *ioState, const void *inInputData, size_t inInputDataSize, char *outOutputData, size_t *ioOutputDataSize);
+extern bool Base64EncodeFinal(Base64EncodeState *ioState, char *outOutputData, size_t *ioOutputDataSize);
+
+typedef struct Base64DecodeState {
+	uint8_t sextets[4];
+	size_t sextetCount;
+	bool finished;
+} Base64DecodeState;
+
+extern void Base64DecodeInit(Base64DecodeState *outState);
+extern bool Base64DecodeUpdate(Base64DecodeState *ioState, const void *inInputData, size_t inInputDataSize, void *outOutputData, size_t *ioOutputDataSize);
+extern bool Base64DecodeFinal(Base64DecodeState *ioState, void *outOutputData, size_t *ioOutputDataSize);
@@ -0,0 +1,30 @@
+//
+//  DBChunkedUploadSession.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* DBChunkedUploadSession holds the state of an upload made through /chunked_upload: the upload
+   id handed out by the server and the last offset it acknowledged. DBRestClient updates it after
+   every chunk and reports it to the delegate; archive it and pass it back to
+   -[DBRestClient resumeChunkedUpload:completion:] to continue after a failure or an app restart. */
+@interface DBChunkedUploadSession : NSObject <NSCoding>
+
+- (id)initWithSourcePath:(NSString *)sourcePath destinationPath:(NSString *)destinationPath parentRev:(NSString *)parentRev;
+
+@property (nonatomic, readonly) NSString *sourcePath;
+@property (nonatomic, readonly) NSString *destinationPath; // Dropbox path, including the filename
+@property (nonatomic, readonly) NSString *parentRev;
+@property (nonatomic) NSUInteger chunkSize; // Default is 4 MB
+
+@property (nonatomic, readonly) NSString *uploadId; // nil until the first chunk has been accepted
+@property (nonatomic, readonly) unsigned long long offset; // Bytes acknowledged by the server
+@property (nonatomic, readonly) unsigned long long fileSize;
+@property (nonatomic, readonly) NSDate *fileModificationDate;
+@property (nonatomic, readonly) NSDate *expires;
+@property (nonatomic, readonly, getter = isComplete) BOOL complete;
+
+@end
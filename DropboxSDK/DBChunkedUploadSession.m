@@ -0,0 +1,75 @@
+//
+//  DBChunkedUploadSession.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBChunkedUploadSession.h"
+
+#define kDBChunkedUploadDefaultChunkSize (4 * 1024 * 1024)
+
+// Also declared by DBRestClient, which drives the session
+@interface DBChunkedUploadSession ()
+
+@property (nonatomic, copy) NSString *uploadId;
+@property (nonatomic) unsigned long long offset;
+@property (nonatomic) unsigned long long fileSize;
+@property (nonatomic, copy) NSDate *fileModificationDate;
+@property (nonatomic, copy) NSDate *expires;
+@property (nonatomic, getter = isComplete) BOOL complete;
+
+@end
+
+
+@implementation DBChunkedUploadSession
+
+- (id)initWithSourcePath:(NSString *)sourcePath destinationPath:(NSString *)destinationPath parentRev:(NSString *)parentRev {
+	if ((self = [super init])) {
+		_sourcePath = [sourcePath copy];
+		_destinationPath = [destinationPath copy];
+		_parentRev = [parentRev copy];
+		_chunkSize = kDBChunkedUploadDefaultChunkSize;
+	}
+	return self;
+}
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<%@: %p %@ -> %@ %llu/%llu>", NSStringFromClass([self class]), self, _sourcePath, _destinationPath, _offset, _fileSize];
+}
+
+
+#pragma mark NSCoding methods
+
+- (id)initWithCoder:(NSCoder*)coder {
+	if ((self = [super init])) {
+		_sourcePath = [coder decodeObjectForKey:@"sourcePath"];
+		_destinationPath = [coder decodeObjectForKey:@"destinationPath"];
+		_parentRev = [coder decodeObjectForKey:@"parentRev"];
+		_chunkSize = (NSUInteger)[coder decodeInt64ForKey:@"chunkSize"];
+		_uploadId = [coder decodeObjectForKey:@"uploadId"];
+		_offset = (unsigned long long)[coder decodeInt64ForKey:@"offset"];
+		_fileSize = (unsigned long long)[coder decodeInt64ForKey:@"fileSize"];
+		_fileModificationDate = [coder decodeObjectForKey:@"fileModificationDate"];
+		_expires = [coder decodeObjectForKey:@"expires"];
+		_complete = [coder decodeBoolForKey:@"complete"];
+
+		if (_chunkSize == 0) _chunkSize = kDBChunkedUploadDefaultChunkSize;
+	}
+	return self;
+}
+
+- (void)encodeWithCoder:(NSCoder*)coder {
+	[coder encodeObject:_sourcePath forKey:@"sourcePath"];
+	[coder encodeObject:_destinationPath forKey:@"destinationPath"];
+	[coder encodeObject:_parentRev forKey:@"parentRev"];
+	[coder encodeInt64:(int64_t)_chunkSize forKey:@"chunkSize"];
+	[coder encodeObject:_uploadId forKey:@"uploadId"];
+	[coder encodeInt64:(int64_t)_offset forKey:@"offset"];
+	[coder encodeInt64:(int64_t)_fileSize forKey:@"fileSize"];
+	[coder encodeObject:_fileModificationDate forKey:@"fileModificationDate"];
+	[coder encodeObject:_expires forKey:@"expires"];
+	[coder encodeBool:_complete forKey:@"complete"];
+}
+
+@end
@@ -0,0 +1,36 @@
+//
+//  DBConcurrencyController.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBHostConcurrencyGate;
+@class DBRequestMetrics;
+
+/* DBConcurrencyController sizes the number of parallel requests per host (api.dropbox.com and
+   api-content.dropbox.com) from the requests it is shown, AIMD style. Every request that comes
+   back quickly adds 1/limit to the host's limit, so the limit grows by about one per round of
+   requests. It is cut by half on a 429 or 503 or a timeout, and by a tenth when the time to first
+   byte climbs to twice its baseline, at most once per round trip. Increases are held back while
+   per-request throughput has fallen well below its best, as more parallel transfers then only
+   split the same link. The limits are applied to the host gate. */
+@interface DBConcurrencyController : NSObject
+
+- (id)initWithHostGate:(DBHostConcurrencyGate *)gate;
+
+@property (nonatomic) NSUInteger minLimit; // Default is 1
+@property (nonatomic) NSUInteger maxLimit; // Default is 16
+@property (nonatomic) NSUInteger initialLimit; // For hosts not seen yet, default is 4
+
+- (void)recordMetrics:(DBRequestMetrics *)metrics;
+
+- (NSUInteger)limitForHost:(NSString *)host;
+- (NSUInteger)totalLimit; // Sum of the limits of all hosts seen, at least initialLimit
+
+/* Called after a limit changed, on the thread that reported the metrics */
+@property (atomic, copy) void (^limitsChangedBlock)(DBConcurrencyController *controller);
+
+@end
@@ -0,0 +1,156 @@
+//
+//  DBConcurrencyController.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBConcurrencyController.h"
+
+#import "DBHostConcurrencyGate.h"
+#import "DBLog.h"
+#import "DBRequestMetrics.h"
+
+#define kDBConcurrencyLatencyTolerance 2.0 // Time to first byte over baseline that counts as queueing
+#define kDBConcurrencyThroughputFloor 0.5 // Share of the best per-request throughput below which the link is full
+#define kDBConcurrencyBackoffFactor 0.5
+#define kDBConcurrencyLatencyFactor 0.9
+#define kDBConcurrencyMinDecreaseInterval 0.25
+
+
+@interface DBConcurrencyHost : NSObject
+
+@property (nonatomic) double limit;
+@property (nonatomic) NSTimeInterval baselineLatency; // Lowest time to first byte seen lately
+@property (nonatomic) NSTimeInterval averageLatency; // Moving average of time to first byte
+@property (nonatomic) double averageThroughput; // Moving average of bytes per second per request
+@property (nonatomic) double peakThroughput;
+@property (nonatomic) CFAbsoluteTime lastDecrease;
+
+@end
+
+
+@interface DBConcurrencyController () {
+	DBHostConcurrencyGate *_gate;
+	NSMutableDictionary *_hosts;
+}
+
+- (void)updateHost:(DBConcurrencyHost *)host withMetrics:(DBRequestMetrics *)metrics;
+
+@end
+
+
+@implementation DBConcurrencyController
+
+- (id)initWithHostGate:(DBHostConcurrencyGate *)gate {
+	if ((self = [super init])) {
+		_gate = gate;
+		_hosts = [NSMutableDictionary new];
+		_minLimit = 1;
+		_maxLimit = 16;
+		_initialLimit = 4;
+	}
+	return self;
+}
+
+- (void)recordMetrics:(DBRequestMetrics *)metrics {
+	NSString *hostName = [metrics.URL host];
+	if (!hostName) return;
+
+	NSUInteger limit = 0;
+	BOOL changed = NO;
+	@synchronized (self) {
+		DBConcurrencyHost *host = [_hosts objectForKey:hostName];
+		if (!host) {
+			host = [DBConcurrencyHost new];
+			host.limit = _initialLimit;
+			[_hosts setObject:host forKey:hostName];
+		}
+
+		NSUInteger oldLimit = (NSUInteger)host.limit;
+		[self updateHost:host withMetrics:metrics];
+		limit = (NSUInteger)host.limit;
+		changed = limit != oldLimit;
+	}
+
+	if (!changed) return;
+
+	DBLogInfo(@"DropboxSDK: concurrency limit for %@ is now %lu", hostName, (unsigned long)limit);
+	[_gate setMaxRequests:limit forHost:hostName];
+
+	void (^block)(DBConcurrencyController *) = self.limitsChangedBlock;
+	if (block) block(self);
+}
+
+- (NSUInteger)limitForHost:(NSString *)hostName {
+	@synchronized (self) {
+		DBConcurrencyHost *host = [_hosts objectForKey:hostName];
+		return host ? (NSUInteger)host.limit : _initialLimit;
+	}
+}
+
+- (NSUInteger)totalLimit {
+	@synchronized (self) {
+		NSUInteger total = 0;
+		for (DBConcurrencyHost *host in [_hosts allValues]) total += (NSUInteger)host.limit;
+		return MAX(total, _initialLimit);
+	}
+}
+
+
+#pragma mark private methods
+
+// Callers must hold the controller lock
+- (void)updateHost:(DBConcurrencyHost *)host withMetrics:(DBRequestMetrics *)metrics {
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	NSInteger status = metrics.statusCode;
+	BOOL throttled = status == 429 || status == 503 ||
+		([metrics.error.domain isEqual:NSURLErrorDomain] && metrics.error.code == NSURLErrorTimedOut);
+
+	// Concurrent requests that were all in flight together report the same overload; only react
+	// once per round trip
+	NSTimeInterval decreaseInterval = MAX(2 * host.averageLatency, kDBConcurrencyMinDecreaseInterval);
+	BOOL mayDecrease = now - host.lastDecrease > decreaseInterval;
+
+	if (throttled) {
+		if (mayDecrease) {
+			host.limit = MAX(host.limit * kDBConcurrencyBackoffFactor, _minLimit);
+			host.lastDecrease = now;
+		}
+		return;
+	}
+
+	// Other failures say nothing about load
+	if (metrics.error || metrics.timeToFirstByte <= 0) return;
+
+	NSTimeInterval latency = metrics.timeToFirstByte;
+	host.averageLatency = host.averageLatency > 0 ? 0.8 * host.averageLatency + 0.2 * latency : latency;
+	// Let the baseline drift up slowly, so a route that got slower for good isn't held against
+	// its old best forever
+	host.baselineLatency = host.baselineLatency > 0 ? MIN(host.baselineLatency * 1.01, latency) : latency;
+
+	if (metrics.transferTime > 0.05) {
+		double throughput = (metrics.bytesReceived + metrics.bytesSent) / metrics.transferTime;
+		host.averageThroughput = host.averageThroughput > 0 ? 0.8 * host.averageThroughput + 0.2 * throughput : throughput;
+		host.peakThroughput = MAX(host.peakThroughput * 0.999, host.averageThroughput);
+	}
+
+	if (host.averageLatency > kDBConcurrencyLatencyTolerance * host.baselineLatency) {
+		if (mayDecrease) {
+			host.limit = MAX(host.limit * kDBConcurrencyLatencyFactor, _minLimit);
+			host.lastDecrease = now;
+		}
+		return;
+	}
+
+	BOOL linkFull = host.peakThroughput > 0 && host.averageThroughput < kDBConcurrencyThroughputFloor * host.peakThroughput;
+	if (!linkFull) {
+		host.limit = MIN(host.limit + 1.0 / host.limit, _maxLimit);
+	}
+}
+
+@end
+
+
+@implementation DBConcurrencyHost
+@end
@@ -0,0 +1,27 @@
+//
+//  DBConnectionEngine.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* DBConnectionEngine owns a small, fixed set of worker threads, each running its own run loop.
+   In-flight DBRequests schedule their NSURLConnection on one of these run loops instead of parking
+   an operation queue thread per request, so hundreds of concurrent transfers share a handful of
+   threads. Connection callbacks are delivered on the worker thread that started the connection. */
+@interface DBConnectionEngine : NSObject
+
++ (DBConnectionEngine *)sharedEngine;
+
+- (id)initWithWorkerCount:(NSUInteger)workerCount;
+
+/* Runs the block on the next worker (round-robin) and returns the thread it was scheduled on.
+   Use performBlock:onThread: afterwards to talk to anything created on that thread. */
+- (NSThread *)scheduleBlock:(void (^)(void))block;
+- (void)performBlock:(void (^)(void))block onThread:(NSThread *)thread;
+
+@property (nonatomic, readonly) NSUInteger workerCount;
+
+@end
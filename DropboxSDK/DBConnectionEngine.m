@@ -0,0 +1,98 @@
+//
+//  DBConnectionEngine.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBConnectionEngine.h"
+
+#include <libkern/OSAtomic.h>
+
+
+@interface DBConnectionEngine () {
+	NSArray *_workers;
+	volatile int32_t _nextWorker;
+}
+
++ (void)workerMain:(dispatch_semaphore_t)readySemaphore;
++ (void)runBlock:(void (^)(void))block;
+
+@end
+
+
+@implementation DBConnectionEngine
+
++ (DBConnectionEngine *)sharedEngine {
+	static DBConnectionEngine *sharedEngine = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		NSUInteger processorCount = [[NSProcessInfo processInfo] activeProcessorCount];
+		sharedEngine = [[DBConnectionEngine alloc] initWithWorkerCount:MIN(MAX(processorCount, 2), 4)];
+	});
+	return sharedEngine;
+}
+
+- (id)initWithWorkerCount:(NSUInteger)workerCount {
+	if ((self = [super init])) {
+		if (workerCount == 0) workerCount = 1;
+
+		NSMutableArray *workers = [[NSMutableArray alloc] initWithCapacity:workerCount];
+		dispatch_semaphore_t readySemaphore = dispatch_semaphore_create(0);
+		for (NSUInteger i = 0; i < workerCount; i++) {
+			NSThread *thread = [[NSThread alloc] initWithTarget:[DBConnectionEngine class] selector:@selector(workerMain:) object:readySemaphore];
+			thread.name = [NSString stringWithFormat:@"dropbox-connection-%lu", (unsigned long)i];
+			[thread start];
+			[workers addObject:thread];
+		}
+
+		// Wait until every run loop is up so that the first performSelector:onThread: is never lost
+		for (NSUInteger i = 0; i < workerCount; i++) {
+			dispatch_semaphore_wait(readySemaphore, DISPATCH_TIME_FOREVER);
+		}
+
+		_workers = workers;
+	}
+	return self;
+}
+
+- (NSUInteger)workerCount {
+	return [_workers count];
+}
+
+- (NSThread *)scheduleBlock:(void (^)(void))block {
+	uint32_t index = (uint32_t)OSAtomicIncrement32Barrier(&_nextWorker);
+	NSThread *thread = [_workers objectAtIndex:(index % [_workers count])];
+	[self performBlock:block onThread:thread];
+	return thread;
+}
+
+- (void)performBlock:(void (^)(void))block onThread:(NSThread *)thread {
+	if (!block || !thread) return;
+	[DBConnectionEngine performSelector:@selector(runBlock:) onThread:thread withObject:[block copy] waitUntilDone:NO];
+}
+
+
+#pragma mark private methods
+
++ (void)workerMain:(dispatch_semaphore_t)readySemaphore {
+	NSRunLoop *runLoop = [NSRunLoop currentRunLoop];
+
+	@autoreleasepool {
+		// A run loop with no sources returns immediately, so keep a port around to park on
+		[runLoop addPort:[NSPort port] forMode:NSDefaultRunLoopMode];
+	}
+	dispatch_semaphore_signal(readySemaphore);
+
+	while (YES) {
+		@autoreleasepool {
+			[runLoop runMode:NSDefaultRunLoopMode beforeDate:[NSDate distantFuture]];
+		}
+	}
+}
+
++ (void)runBlock:(void (^)(void))block {
+	block();
+}
+
+@end
@@ -0,0 +1,63 @@
+//
+//  DBDeltaStore.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBDeltaEntry;
+@class DBMetadata;
+
+/* DBDeltaStore is the local copy of an account's file tree as built from /delta. Instead of keeping
+   a DBMetadata per file, it packs rev, size, folder flag, modification time and folder hash into a
+   fixed size record in a memory-mapped file, keyed by lowercase path through an open-addressing
+   hash table in a second one. Each folder's record links the records of its children, so removing
+   a folder only touches what is below it. The paths themselves live in a third file. Only the
+   pages that are touched count towards the app's memory, so millions of entries cost a few hundred
+   bytes each on disk and next to nothing in RAM.
+
+   Changes are written straight into the mapped files. The cursor is only saved after they have been
+   flushed, so after a crash the store either has the cursor that matches its entries or is empty
+   and has no cursor, and the next /delta call starts over. */
+@interface DBDeltaStore : NSObject
+
+/* Opens or creates a store in the given directory. Returns nil and sets error if it can't be mapped. */
+- (id)initWithDirectory:(NSString *)directory error:(NSError **)error;
+
+@property (nonatomic, readonly) NSString *directory;
+@property (nonatomic, readonly) NSUInteger count;
+
+/* Setting the cursor first flushes all the entries applied so far */
+@property (nonatomic, copy) NSString *cursor;
+
+/* Applies a /delta entry: stores its metadata, or removes the path and everything below it if the
+   entry has no metadata. A file replacing a folder also removes the folder's children. Returns NO
+   if the entry couldn't be stored because the files couldn't grow; don't save a cursor that
+   includes it then. applyDeltaEntries: stops at the first such entry. */
+- (BOOL)applyDeltaEntry:(DBDeltaEntry *)entry;
+- (BOOL)applyDeltaEntries:(NSArray *)entries;
+
+/* Same as applyDeltaEntry:, straight from the JSON of a /delta entry; metadataDict may be nil */
+- (BOOL)setMetadataDictionary:(NSDictionary *)metadataDict forLowercasePath:(NSString *)lowercasePath;
+
+/* Removes lowercasePath and everything below it */
+- (void)removeEntriesWithPrefix:(NSString *)lowercasePath;
+
+/* Removes every entry and the cursor, as a /delta reset requires */
+- (void)reset;
+
+- (BOOL)containsPath:(NSString *)lowercasePath;
+- (NSString *)revForPath:(NSString *)lowercasePath;
+
+/* Builds a DBMetadata with the stored fields: path, rev, bytes, is_dir, modified, hash and
+   thumb_exists */
+- (DBMetadata *)metadataForPath:(NSString *)lowercasePath;
+
+- (void)enumerateEntriesUsingBlock:(void (^)(NSString *lowercasePath, DBMetadata *metadata, BOOL *stop))block;
+
+/* Flushes the mapped files to disk */
+- (void)synchronize;
+
+@end
@@ -0,0 +1,736 @@
+//
+//  DBDeltaStore.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBDeltaStore.h"
+
+#import "DBDeltaEntry.h"
+#import "DBError.h"
+#import "DBLog.h"
+#import "DBMetadata.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kDBDeltaStoreMagic 0x53444244 // "DBDS"
+#define kDBDeltaStoreVersion 2
+#define kDBDeltaStoreHeaderSize 4096
+#define kDBDeltaStoreMinimumBuckets 1024
+#define kDBDeltaStoreMinimumRecords 1024
+#define kDBDeltaStoreMinimumPathsSize (64 * 1024)
+#define kDBDeltaStoreTombstone UINT32_MAX
+#define kDBDeltaStoreOrphan UINT32_MAX // parentRecord of an entry whose folder wasn't stored when it arrived
+
+#define kDBDeltaRecordDirectory 0x1
+#define kDBDeltaRecordThumbnail 0x2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t dirty; // Set while there are changes that haven't been synchronized
+	uint32_t cursorLength;
+	uint64_t bucketCount;
+	uint64_t tombstones;
+	uint64_t recordCount; // Records in use or on the free list
+	uint64_t liveCount;
+	uint64_t freeRecord; // Index + 1 of the first free record
+	uint64_t pathsLength;
+	uint64_t garbageLength; // Bytes of the paths file no record points at any more
+	uint32_t firstOrphan; // Index + 1 of the first entry whose folder isn't stored
+	uint32_t reserved;
+	char cursor[kDBDeltaStoreHeaderSize - 80];
+} DBDeltaStoreHeader;
+
+typedef struct {
+	uint64_t pathHash; // 0 for a free record
+	uint64_t pathOffset; // The lowercase path followed by the display path, in the paths file
+	uint32_t pathLength;
+	uint32_t displayPathLength;
+	int64_t bytes;
+	int64_t modified; // Seconds since 1970
+	uint32_t flags;
+	uint32_t nextFreeRecord;
+	uint32_t parentRecord; // Index + 1 of the folder's record, 0 at the top level, or kDBDeltaStoreOrphan
+	uint32_t firstChild; // Index + 1, the children of a folder are a doubly linked list
+	uint32_t nextSibling;
+	uint32_t prevSibling;
+	char rev[32];
+	char hash[32];
+} DBDeltaStoreRecord;
+
+typedef struct {
+	int fd;
+	void *bytes;
+	size_t length;
+} DBMappedFile;
+
+
+static uint64_t DBDeltaStorePathHash(const char *path, size_t length) {
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)path[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+static void DBUnmapFile(DBMappedFile *file) {
+	if (file->bytes) munmap(file->bytes, file->length);
+	if (file->fd >= 0) close(file->fd);
+	file->bytes = NULL;
+	file->length = 0;
+	file->fd = -1;
+}
+
+// Grows or shrinks the file to length and maps it again; on failure the old mapping is kept
+static BOOL DBRemapFile(DBMappedFile *file, size_t length) {
+	if (ftruncate(file->fd, length) != 0) return NO;
+
+	void *bytes = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (bytes == MAP_FAILED) return NO;
+
+	if (file->bytes) munmap(file->bytes, file->length);
+	file->bytes = bytes;
+	file->length = length;
+	return YES;
+}
+
+static BOOL DBMapFile(DBMappedFile *file, NSString *path, size_t minimumLength) {
+	file->bytes = NULL;
+	file->length = 0;
+	file->fd = open([path fileSystemRepresentation], O_RDWR | O_CREAT, 0644);
+	if (file->fd < 0) return NO;
+
+	struct stat st;
+	if (fstat(file->fd, &st) != 0) return NO;
+	size_t length = MAX((size_t)st.st_size, minimumLength);
+	return DBRemapFile(file, length);
+}
+
+
+@interface DBDeltaStore () {
+	DBMappedFile _index; // Header followed by the buckets
+	DBMappedFile _records;
+	DBMappedFile _paths;
+}
+
+- (DBDeltaStoreHeader *)header;
+- (uint32_t *)buckets;
+- (DBDeltaStoreRecord *)records;
+
+- (BOOL)findPath:(const char *)path length:(uint32_t)length hash:(uint64_t)pathHash bucket:(uint64_t *)bucket;
+- (void)growBucketsIfNeeded;
+- (BOOL)rebuildBucketsWithCount:(uint64_t)bucketCount;
+- (uint32_t)allocateRecord;
+- (uint64_t)appendPath:(const char *)path length:(uint32_t)length displayPath:(const char *)displayPath length:(uint32_t)displayLength;
+- (void)freeRecord:(uint32_t)recordIndex;
+- (void)removeRecordInBucket:(uint64_t)bucket;
+- (void)removeRecord:(uint32_t)recordIndex;
+- (uint32_t *)childListOfParent:(uint32_t)parentRecord;
+- (void)linkRecord:(uint32_t)recordIndex path:(const char *)path length:(uint32_t)length;
+- (void)unlinkRecord:(uint32_t)recordIndex;
+- (void)removeDescendantsOfRecord:(uint32_t)recordIndex;
+- (void)removeChildrenOfPath:(const char *)path length:(uint32_t)length;
+- (void)compactPathsIfNeeded;
+- (void)markDirty;
+- (void)clear;
+- (DBMetadata *)metadataForRecord:(DBDeltaStoreRecord *)record;
+
+@end
+
+
+@implementation DBDeltaStore
+
+- (id)initWithDirectory:(NSString *)directory error:(NSError **)error {
+	if ((self = [super init])) {
+		_directory = [directory copy];
+		_index.fd = _records.fd = _paths.fd = -1;
+
+		[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+
+		size_t indexLength = kDBDeltaStoreHeaderSize + kDBDeltaStoreMinimumBuckets * sizeof(uint32_t);
+		if (!DBMapFile(&_index, [directory stringByAppendingPathComponent:@"index"], indexLength) ||
+			!DBMapFile(&_records, [directory stringByAppendingPathComponent:@"records"], kDBDeltaStoreMinimumRecords * sizeof(DBDeltaStoreRecord)) ||
+			!DBMapFile(&_paths, [directory stringByAppendingPathComponent:@"paths"], kDBDeltaStoreMinimumPathsSize)) {
+			DBLogError(@"DBDeltaStore: unable to map %@, error: %d", directory, errno);
+			if (error) *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:[NSDictionary dictionaryWithObject:directory forKey:@"path"]];
+			return nil;
+		}
+
+		DBDeltaStoreHeader *header = [self header];
+		BOOL valid = header->magic == kDBDeltaStoreMagic && header->version == kDBDeltaStoreVersion &&
+			kDBDeltaStoreHeaderSize + header->bucketCount * sizeof(uint32_t) <= _index.length &&
+			header->recordCount * sizeof(DBDeltaStoreRecord) <= _records.length &&
+			header->pathsLength <= _paths.length;
+
+		if (!valid || header->dirty) {
+			if (header->magic == kDBDeltaStoreMagic && header->version != kDBDeltaStoreVersion) {
+				DBLogInfo(@"DBDeltaStore: %@ is in an older format, starting over", directory);
+			}
+			else if (header->magic == kDBDeltaStoreMagic) {
+				DBLogWarning(@"DBDeltaStore: %@ was not closed cleanly, starting over", directory);
+			}
+			[self clear];
+		}
+	}
+	return self;
+}
+
+- (void)dealloc {
+	[self synchronize];
+	DBUnmapFile(&_index);
+	DBUnmapFile(&_records);
+	DBUnmapFile(&_paths);
+}
+
+- (NSUInteger)count {
+	@synchronized (self) {
+		return (NSUInteger)[self header]->liveCount;
+	}
+}
+
+- (NSString *)cursor {
+	@synchronized (self) {
+		DBDeltaStoreHeader *header = [self header];
+		if (header->cursorLength == 0) return nil;
+		return [[NSString alloc] initWithBytes:header->cursor length:header->cursorLength encoding:NSUTF8StringEncoding];
+	}
+}
+
+- (void)setCursor:(NSString *)cursor {
+	const char *cursorBytes = [cursor UTF8String];
+	size_t cursorLength = cursorBytes ? strlen(cursorBytes) : 0;
+
+	@synchronized (self) {
+		DBDeltaStoreHeader *header = [self header];
+		if (cursorLength > sizeof(header->cursor)) {
+			DBLogError(@"DBDeltaStore: cursor of %lu bytes is too long to store", (unsigned long)cursorLength);
+			cursorLength = 0;
+		}
+
+		// The entries have to be on disk before a cursor that claims to include them
+		msync(_records.bytes, _records.length, MS_SYNC);
+		msync(_paths.bytes, _paths.length, MS_SYNC);
+		msync(_index.bytes, _index.length, MS_SYNC);
+
+		memcpy(header->cursor, cursorBytes, cursorLength);
+		header->cursorLength = (uint32_t)cursorLength;
+		header->dirty = 0;
+		msync(_index.bytes, kDBDeltaStoreHeaderSize, MS_SYNC);
+	}
+}
+
+- (BOOL)applyDeltaEntry:(DBDeltaEntry *)entry {
+	return [self setMetadataDictionary:[entry.metadata dictionary] forLowercasePath:entry.lowercasePath];
+}
+
+- (BOOL)applyDeltaEntries:(NSArray *)entries {
+	@synchronized (self) {
+		for (DBDeltaEntry *entry in entries) {
+			@autoreleasepool {
+				if (![self applyDeltaEntry:entry]) return NO;
+			}
+		}
+		return YES;
+	}
+}
+
+- (BOOL)setMetadataDictionary:(NSDictionary *)metadataDict forLowercasePath:(NSString *)lowercasePath {
+	if (!metadataDict) {
+		[self removeEntriesWithPrefix:lowercasePath];
+		return YES;
+	}
+
+	const char *path = [lowercasePath UTF8String];
+	uint32_t pathLength = (uint32_t)strlen(path);
+	NSString *displayPathString = [metadataDict objectForKey:@"path"];
+	const char *displayPath = displayPathString ? [displayPathString UTF8String] : path;
+	uint32_t displayPathLength = (uint32_t)strlen(displayPath);
+	uint64_t pathHash = DBDeltaStorePathHash(path, pathLength);
+
+	NSString *rev = [metadataDict objectForKey:@"rev"];
+	NSString *hash = [metadataDict objectForKey:@"hash"];
+	NSString *modified = [metadataDict objectForKey:@"modified"];
+	BOOL isDirectory = [[metadataDict objectForKey:@"is_dir"] boolValue];
+
+	uint32_t flags = 0;
+	if (isDirectory) flags |= kDBDeltaRecordDirectory;
+	if ([[metadataDict objectForKey:@"thumb_exists"] boolValue]) flags |= kDBDeltaRecordThumbnail;
+	int64_t modifiedTime = 0;
+	if ([modified isKindOfClass:[NSString class]] && ![DBMetadata getSeconds:&modifiedTime fromDateString:modified]) modifiedTime = 0;
+
+	@synchronized (self) {
+		[self markDirty];
+		[self growBucketsIfNeeded];
+
+		uint64_t bucket = 0;
+		DBDeltaStoreRecord *record = NULL;
+
+		if ([self findPath:path length:pathLength hash:pathHash bucket:&bucket]) {
+			record = [self records] + ([self buckets][bucket] - 1);
+
+			// A file replacing a folder takes the folder's contents with it
+			if ((record->flags & kDBDeltaRecordDirectory) && !isDirectory) {
+				[self removeChildrenOfPath:path length:pathLength];
+				[self findPath:path length:pathLength hash:pathHash bucket:&bucket];
+				record = [self records] + ([self buckets][bucket] - 1);
+			}
+
+			const char *stored = (const char *)_paths.bytes + record->pathOffset + record->pathLength;
+			if (record->displayPathLength != displayPathLength || memcmp(stored, displayPath, displayPathLength) != 0) {
+				uint64_t pathOffset = [self appendPath:path length:pathLength displayPath:displayPath length:displayPathLength];
+				if (pathOffset == UINT64_MAX) {
+					DBLogError(@"DBDeltaStore: out of space storing %@", lowercasePath);
+					return NO;
+				}
+
+				record = [self records] + ([self buckets][bucket] - 1);
+				[self header]->garbageLength += record->pathLength + record->displayPathLength;
+				record->pathOffset = pathOffset;
+				record->displayPathLength = displayPathLength;
+			}
+		}
+		else {
+			// Full if the buckets couldn't grow
+			uint32_t recordIndex = bucket != UINT64_MAX ? [self allocateRecord] : kDBDeltaStoreTombstone;
+			if (recordIndex == kDBDeltaStoreTombstone) {
+				DBLogError(@"DBDeltaStore: out of space storing %@", lowercasePath);
+				return NO;
+			}
+
+			uint64_t pathOffset = [self appendPath:path length:pathLength displayPath:displayPath length:displayPathLength];
+			if (pathOffset == UINT64_MAX) {
+				DBLogError(@"DBDeltaStore: out of space storing %@", lowercasePath);
+				[self freeRecord:recordIndex];
+				return NO;
+			}
+
+			record = [self records] + recordIndex;
+			record->pathHash = pathHash;
+			record->pathOffset = pathOffset;
+			record->pathLength = pathLength;
+			record->displayPathLength = displayPathLength;
+			record->nextFreeRecord = 0;
+
+			DBDeltaStoreHeader *header = [self header];
+			if ([self buckets][bucket] == kDBDeltaStoreTombstone) header->tombstones--;
+			[self buckets][bucket] = recordIndex + 1;
+			header->liveCount++;
+
+			[self linkRecord:recordIndex path:path length:pathLength];
+		}
+
+		record->bytes = [[metadataDict objectForKey:@"bytes"] longLongValue];
+		record->modified = modifiedTime;
+		record->flags = flags;
+		memset(record->rev, 0, sizeof(record->rev));
+		memset(record->hash, 0, sizeof(record->hash));
+		if ([rev isKindOfClass:[NSString class]]) strncpy(record->rev, [rev UTF8String], sizeof(record->rev));
+		if ([hash isKindOfClass:[NSString class]]) strncpy(record->hash, [hash UTF8String], sizeof(record->hash));
+		return YES;
+	}
+}
+
+- (void)removeEntriesWithPrefix:(NSString *)lowercasePath {
+	const char *path = [lowercasePath UTF8String];
+	uint32_t pathLength = (uint32_t)strlen(path);
+	uint64_t pathHash = DBDeltaStorePathHash(path, pathLength);
+
+	@synchronized (self) {
+		[self markDirty];
+
+		// If the path is unknown there may still be children of it from an earlier page
+		[self removeChildrenOfPath:path length:pathLength];
+
+		uint64_t bucket = 0;
+		if ([self findPath:path length:pathLength hash:pathHash bucket:&bucket]) [self removeRecordInBucket:bucket];
+
+		[self compactPathsIfNeeded];
+	}
+}
+
+- (void)reset {
+	@synchronized (self) {
+		[self clear];
+	}
+}
+
+- (BOOL)containsPath:(NSString *)lowercasePath {
+	const char *path = [lowercasePath UTF8String];
+	uint32_t pathLength = (uint32_t)strlen(path);
+
+	@synchronized (self) {
+		uint64_t bucket = 0;
+		return [self findPath:path length:pathLength hash:DBDeltaStorePathHash(path, pathLength) bucket:&bucket];
+	}
+}
+
+- (NSString *)revForPath:(NSString *)lowercasePath {
+	const char *path = [lowercasePath UTF8String];
+	uint32_t pathLength = (uint32_t)strlen(path);
+
+	@synchronized (self) {
+		uint64_t bucket = 0;
+		if (![self findPath:path length:pathLength hash:DBDeltaStorePathHash(path, pathLength) bucket:&bucket]) return nil;
+
+		DBDeltaStoreRecord *record = [self records] + ([self buckets][bucket] - 1);
+		return [[NSString alloc] initWithBytes:record->rev length:strnlen(record->rev, sizeof(record->rev)) encoding:NSUTF8StringEncoding];
+	}
+}
+
+- (DBMetadata *)metadataForPath:(NSString *)lowercasePath {
+	const char *path = [lowercasePath UTF8String];
+	uint32_t pathLength = (uint32_t)strlen(path);
+
+	@synchronized (self) {
+		uint64_t bucket = 0;
+		if (![self findPath:path length:pathLength hash:DBDeltaStorePathHash(path, pathLength) bucket:&bucket]) return nil;
+		return [self metadataForRecord:[self records] + ([self buckets][bucket] - 1)];
+	}
+}
+
+- (void)enumerateEntriesUsingBlock:(void (^)(NSString *lowercasePath, DBMetadata *metadata, BOOL *stop))block {
+	@synchronized (self) {
+		BOOL stop = NO;
+		uint64_t recordCount = [self header]->recordCount;
+		for (uint64_t i = 0; i < recordCount && !stop; i++) {
+			@autoreleasepool {
+				DBDeltaStoreRecord *record = [self records] + i;
+				if (!record->pathHash) continue;
+
+				NSString *lowercasePath = [[NSString alloc] initWithBytes:(const char *)_paths.bytes + record->pathOffset length:record->pathLength encoding:NSUTF8StringEncoding];
+				block(lowercasePath, [self metadataForRecord:record], &stop);
+			}
+		}
+	}
+}
+
+- (void)synchronize {
+	@synchronized (self) {
+		if (!_index.bytes) return;
+
+		msync(_records.bytes, _records.length, MS_SYNC);
+		msync(_paths.bytes, _paths.length, MS_SYNC);
+		msync(_index.bytes, _index.length, MS_SYNC);
+
+		[self header]->dirty = 0;
+		msync(_index.bytes, kDBDeltaStoreHeaderSize, MS_SYNC);
+	}
+}
+
+
+#pragma mark private methods
+
+- (DBDeltaStoreHeader *)header {
+	return (DBDeltaStoreHeader *)_index.bytes;
+}
+
+- (uint32_t *)buckets {
+	return (uint32_t *)((char *)_index.bytes + kDBDeltaStoreHeaderSize);
+}
+
+- (DBDeltaStoreRecord *)records {
+	return (DBDeltaStoreRecord *)_records.bytes;
+}
+
+// Returns YES and the bucket holding path if it's there, otherwise NO and the bucket to insert it in
+- (BOOL)findPath:(const char *)path length:(uint32_t)length hash:(uint64_t)pathHash bucket:(uint64_t *)bucket {
+	DBDeltaStoreHeader *header = [self header];
+	uint32_t *buckets = [self buckets];
+	DBDeltaStoreRecord *records = [self records];
+	uint64_t mask = header->bucketCount - 1;
+	uint64_t insertBucket = UINT64_MAX;
+
+	for (uint64_t i = pathHash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+		uint32_t slot = buckets[i];
+		if (slot == 0) {
+			*bucket = insertBucket != UINT64_MAX ? insertBucket : i;
+			return NO;
+		}
+		if (slot == kDBDeltaStoreTombstone) {
+			if (insertBucket == UINT64_MAX) insertBucket = i;
+			continue;
+		}
+
+		DBDeltaStoreRecord *record = records + (slot - 1);
+		if (record->pathHash == pathHash && record->pathLength == length &&
+			memcmp((const char *)_paths.bytes + record->pathOffset, path, length) == 0) {
+			*bucket = i;
+			return YES;
+		}
+	}
+
+	*bucket = insertBucket;
+	return NO;
+}
+
+- (void)growBucketsIfNeeded {
+	DBDeltaStoreHeader *header = [self header];
+	if ((header->liveCount + header->tombstones + 1) * 10 < header->bucketCount * 7) return;
+
+	uint64_t bucketCount = header->bucketCount;
+	while ((header->liveCount + 1) * 10 >= bucketCount * 7 / 2) bucketCount *= 2;
+	[self rebuildBucketsWithCount:bucketCount];
+}
+
+- (BOOL)rebuildBucketsWithCount:(uint64_t)bucketCount {
+	if (!DBRemapFile(&_index, kDBDeltaStoreHeaderSize + bucketCount * sizeof(uint32_t))) {
+		DBLogError(@"DBDeltaStore: unable to grow the index to %llu buckets", bucketCount);
+		return NO;
+	}
+
+	DBDeltaStoreHeader *header = [self header];
+	uint32_t *buckets = [self buckets];
+	DBDeltaStoreRecord *records = [self records];
+	uint64_t mask = bucketCount - 1;
+
+	header->bucketCount = bucketCount;
+	header->tombstones = 0;
+	memset(buckets, 0, bucketCount * sizeof(uint32_t));
+
+	for (uint64_t r = 0; r < header->recordCount; r++) {
+		if (!records[r].pathHash) continue;
+
+		uint64_t i = records[r].pathHash & mask;
+		while (buckets[i]) i = (i + 1) & mask;
+		buckets[i] = (uint32_t)(r + 1);
+	}
+	return YES;
+}
+
+- (uint32_t)allocateRecord {
+	DBDeltaStoreHeader *header = [self header];
+
+	if (header->freeRecord) {
+		uint32_t recordIndex = (uint32_t)(header->freeRecord - 1);
+		header->freeRecord = [self records][recordIndex].nextFreeRecord;
+		return recordIndex;
+	}
+
+	if ((header->recordCount + 1) * sizeof(DBDeltaStoreRecord) > _records.length) {
+		if (header->recordCount + 1 >= kDBDeltaStoreTombstone ||
+			!DBRemapFile(&_records, 2 * _records.length)) return kDBDeltaStoreTombstone;
+	}
+	return (uint32_t)header->recordCount++;
+}
+
+- (uint64_t)appendPath:(const char *)path length:(uint32_t)length displayPath:(const char *)displayPath length:(uint32_t)displayLength {
+	DBDeltaStoreHeader *header = [self header];
+
+	size_t needed = header->pathsLength + length + displayLength;
+	if (needed > _paths.length) {
+		size_t newLength = _paths.length;
+		while (newLength < needed) newLength *= 2;
+		if (!DBRemapFile(&_paths, newLength)) return UINT64_MAX;
+	}
+
+	uint64_t offset = header->pathsLength;
+	memcpy((char *)_paths.bytes + offset, path, length);
+	memcpy((char *)_paths.bytes + offset + length, displayPath, displayLength);
+	header->pathsLength += length + displayLength;
+	return offset;
+}
+
+- (void)freeRecord:(uint32_t)recordIndex {
+	DBDeltaStoreHeader *header = [self header];
+	DBDeltaStoreRecord *record = [self records] + recordIndex;
+
+	memset(record, 0, sizeof(DBDeltaStoreRecord));
+	record->nextFreeRecord = (uint32_t)header->freeRecord;
+	header->freeRecord = recordIndex + 1;
+}
+
+// The record's children have to be removed first
+- (void)removeRecordInBucket:(uint64_t)bucket {
+	DBDeltaStoreHeader *header = [self header];
+	uint32_t recordIndex = [self buckets][bucket] - 1;
+	DBDeltaStoreRecord *record = [self records] + recordIndex;
+
+	header->garbageLength += record->pathLength + record->displayPathLength;
+	[self unlinkRecord:recordIndex];
+	[self freeRecord:recordIndex];
+
+	[self buckets][bucket] = kDBDeltaStoreTombstone;
+	header->tombstones++;
+	header->liveCount--;
+}
+
+- (void)removeChildrenOfPath:(const char *)path length:(uint32_t)length {
+	if (length == 1 && path[0] == '/') {
+		NSString *cursor = [self cursor];
+		[self clear];
+		[self header]->cursorLength = (uint32_t)[cursor lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+		memcpy([self header]->cursor, [cursor UTF8String], [self header]->cursorLength);
+		// The old cursor doesn't describe an empty store; until the next setCursor: it is only kept
+		// for cursor, and a store reopened before then starts over
+		[self markDirty];
+		return;
+	}
+
+	uint64_t bucket = 0;
+	if ([self findPath:path length:length hash:DBDeltaStorePathHash(path, length) bucket:&bucket]) {
+		[self removeDescendantsOfRecord:[self buckets][bucket] - 1];
+	}
+
+	// Entries that arrived before their folder aren't in its list; there are rarely any
+	DBDeltaStoreRecord *records = [self records];
+	uint32_t orphan = [self header]->firstOrphan;
+	while (orphan) {
+		DBDeltaStoreRecord *record = records + (orphan - 1);
+		uint32_t next = record->nextSibling; // Never one of the orphan's descendants, they are in its own list
+		const char *orphanPath = (const char *)_paths.bytes + record->pathOffset;
+		if (record->pathLength > length && orphanPath[length] == '/' && memcmp(orphanPath, path, length) == 0) {
+			[self removeDescendantsOfRecord:orphan - 1];
+			[self removeRecord:orphan - 1];
+		}
+		orphan = next;
+	}
+}
+
+- (void)removeRecord:(uint32_t)recordIndex {
+	DBDeltaStoreRecord *record = [self records] + recordIndex;
+	uint64_t bucket = 0;
+	if ([self findPath:(const char *)_paths.bytes + record->pathOffset length:record->pathLength hash:record->pathHash bucket:&bucket]) {
+		[self removeRecordInBucket:bucket];
+	}
+	else {
+		// Not in the index, which shouldn't happen; take it out of its list all the same
+		[self header]->garbageLength += record->pathLength + record->displayPathLength;
+		[self unlinkRecord:recordIndex];
+		[self freeRecord:recordIndex];
+		[self header]->liveCount--;
+	}
+}
+
+// Depth first, so every record is unlinked from a folder that is still there
+- (void)removeDescendantsOfRecord:(uint32_t)recordIndex {
+	uint32_t child = 0;
+	while ((child = [self records][recordIndex].firstChild)) {
+		[self removeDescendantsOfRecord:child - 1];
+		[self removeRecord:child - 1];
+	}
+}
+
+- (uint32_t *)childListOfParent:(uint32_t)parentRecord {
+	if (parentRecord == kDBDeltaStoreOrphan) return &[self header]->firstOrphan;
+	if (parentRecord) return &[self records][parentRecord - 1].firstChild;
+	return NULL; // The top level is only ever removed all at once
+}
+
+// Adds a new record to the list of its folder, or to the orphans if the folder isn't stored
+- (void)linkRecord:(uint32_t)recordIndex path:(const char *)path length:(uint32_t)length {
+	DBDeltaStoreRecord *records = [self records];
+	DBDeltaStoreRecord *record = records + recordIndex;
+
+	uint32_t parentLength = length;
+	while (parentLength > 0 && path[parentLength - 1] != '/') parentLength--;
+	if (parentLength > 0) parentLength--;
+
+	uint64_t bucket = 0;
+	if (parentLength == 0) record->parentRecord = 0;
+	else if ([self findPath:path length:parentLength hash:DBDeltaStorePathHash(path, parentLength) bucket:&bucket]) record->parentRecord = [self buckets][bucket];
+	else record->parentRecord = kDBDeltaStoreOrphan;
+
+	record->prevSibling = 0;
+	record->nextSibling = 0;
+	uint32_t *list = [self childListOfParent:record->parentRecord];
+	if (!list) return;
+
+	record->nextSibling = *list;
+	if (*list) records[*list - 1].prevSibling = recordIndex + 1;
+	*list = recordIndex + 1;
+}
+
+- (void)unlinkRecord:(uint32_t)recordIndex {
+	DBDeltaStoreRecord *records = [self records];
+	DBDeltaStoreRecord *record = records + recordIndex;
+	uint32_t *list = [self childListOfParent:record->parentRecord];
+	if (!list) return;
+
+	if (record->prevSibling) records[record->prevSibling - 1].nextSibling = record->nextSibling;
+	else *list = record->nextSibling;
+	if (record->nextSibling) records[record->nextSibling - 1].prevSibling = record->prevSibling;
+}
+
+// Renames and removals leave stale paths behind; rewrite the file once they are most of it
+- (void)compactPathsIfNeeded {
+	DBDeltaStoreHeader *header = [self header];
+	if (header->garbageLength < kDBDeltaStoreMinimumPathsSize || header->garbageLength * 2 < header->pathsLength) return;
+
+	NSString *compactedPath = [_directory stringByAppendingPathComponent:@"paths.compact"];
+	DBMappedFile compacted;
+	size_t liveLength = (size_t)(header->pathsLength - header->garbageLength);
+	if (!DBMapFile(&compacted, compactedPath, MAX(liveLength, (size_t)kDBDeltaStoreMinimumPathsSize))) {
+		DBUnmapFile(&compacted);
+		return;
+	}
+
+	DBDeltaStoreRecord *records = [self records];
+	uint64_t offset = 0;
+	for (uint64_t r = 0; r < header->recordCount; r++) {
+		DBDeltaStoreRecord *record = records + r;
+		if (!record->pathHash) continue;
+
+		uint32_t length = record->pathLength + record->displayPathLength;
+		memcpy((char *)compacted.bytes + offset, (const char *)_paths.bytes + record->pathOffset, length);
+		record->pathOffset = offset;
+		offset += length;
+	}
+
+	DBUnmapFile(&_paths);
+	rename([compactedPath fileSystemRepresentation], [[_directory stringByAppendingPathComponent:@"paths"] fileSystemRepresentation]);
+	_paths = compacted;
+	header->pathsLength = offset;
+	header->garbageLength = 0;
+}
+
+- (void)markDirty {
+	DBDeltaStoreHeader *header = [self header];
+	if (header->dirty) return;
+
+	header->dirty = 1;
+	msync(_index.bytes, kDBDeltaStoreHeaderSize, MS_SYNC);
+}
+
+- (void)clear {
+	DBRemapFile(&_records, kDBDeltaStoreMinimumRecords * sizeof(DBDeltaStoreRecord));
+	DBRemapFile(&_paths, kDBDeltaStoreMinimumPathsSize);
+	DBRemapFile(&_index, kDBDeltaStoreHeaderSize + kDBDeltaStoreMinimumBuckets * sizeof(uint32_t));
+	memset(_index.bytes, 0, _index.length);
+	memset(_records.bytes, 0, _records.length);
+
+	DBDeltaStoreHeader *header = [self header];
+	header->magic = kDBDeltaStoreMagic;
+	header->version = kDBDeltaStoreVersion;
+	header->bucketCount = kDBDeltaStoreMinimumBuckets;
+	[self synchronize];
+}
+
+- (DBMetadata *)metadataForRecord:(DBDeltaStoreRecord *)record {
+	const char *paths = (const char *)_paths.bytes + record->pathOffset;
+	NSString *displayPath = [[NSString alloc] initWithBytes:paths + record->pathLength length:record->displayPathLength encoding:NSUTF8StringEncoding];
+	NSString *rev = [[NSString alloc] initWithBytes:record->rev length:strnlen(record->rev, sizeof(record->rev)) encoding:NSUTF8StringEncoding];
+
+	NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithCapacity:7];
+	[dict setObject:displayPath forKey:@"path"];
+	[dict setObject:rev forKey:@"rev"];
+	[dict setObject:[NSNumber numberWithLongLong:record->bytes] forKey:@"bytes"];
+	[dict setObject:[NSNumber numberWithBool:(record->flags & kDBDeltaRecordDirectory) != 0] forKey:@"is_dir"];
+	[dict setObject:[NSNumber numberWithBool:(record->flags & kDBDeltaRecordThumbnail) != 0] forKey:@"thumb_exists"];
+	if (record->modified) {
+		NSDate *modified = [NSDate dateWithTimeIntervalSince1970:record->modified];
+		[dict setObject:[DBMetadata stringFromDate:modified] forKey:@"modified"];
+	}
+	if (record->hash[0]) {
+		[dict setObject:[[NSString alloc] initWithBytes:record->hash length:strnlen(record->hash, sizeof(record->hash)) encoding:NSUTF8StringEncoding] forKey:@"hash"];
+	}
+
+	return [[DBMetadata alloc] initWithDictionary:dict];
+}
+
+@end
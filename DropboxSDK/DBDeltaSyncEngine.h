@@ -0,0 +1,46 @@
+//
+//  DBDeltaSyncEngine.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBDeltaStore;
+@class DBRestClient;
+
+/* entries holds DBDeltaEntry objects. reset is YES for the first batch after the server asked for a
+   reset, which may be empty; throw away everything you have before applying it. */
+typedef void (^DBDeltaSyncBatchBlock)(NSArray *entries, BOOL reset);
+typedef void (^DBDeltaSyncCompletionBlock)(NSError *error, NSString *cursor);
+
+/* DBDeltaSyncEngine calls /delta until has_more is NO. Each page is parsed as it downloads, and the
+   request for the next page goes out as soon as the previous one has arrived, while its entries
+   are still being applied; at most two pages are held at a time. Entries are applied in order on
+   a serial queue: into the store, if there is one, and then to batchHandler. The cursor is only
+   saved once its page has been applied completely. */
+@interface DBDeltaSyncEngine : NSObject
+
+/* store may be nil, in which case set cursor and save it yourself from the completion block */
+- (id)initWithRestClient:(DBRestClient *)restClient store:(DBDeltaStore *)store;
+
+@property (nonatomic, readonly) DBRestClient *restClient;
+@property (nonatomic, readonly) DBDeltaStore *store;
+
+@property (atomic, copy) NSString *cursor; // The store's cursor if there is a store
+@property (nonatomic) NSUInteger batchSize; // Default is 500
+@property (nonatomic, copy) DBDeltaSyncBatchBlock batchHandler; // Called on the engine's serial queue
+@property (atomic, readonly, getter = isSyncing) BOOL syncing;
+
+/* Drains all pending changes. completion is called on the engine's serial queue with the cursor of
+   the last page applied. Does nothing if a sync is already running, unless the rest client's
+   cancelAllRequests has been called since: that sync then completes with NSURLErrorCancelled and
+   the new one starts. On a cancelled rest client, syncs fail with NSURLErrorCancelled. */
+- (void)syncWithCompletion:(DBDeltaSyncCompletionBlock)completion;
+
+/* Cancels the page request in flight and stops after the batch being applied; no further
+   callbacks are sent, and nothing from the cancelled sync reaches a later one */
+- (void)cancel;
+
+@end
@@ -0,0 +1,233 @@
+//
+//  DBDeltaSyncEngine.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBDeltaSyncEngine.h"
+
+#import "DBDeltaEntry.h"
+#import "DBDeltaStore.h"
+#import "DBError.h"
+#import "DBLog.h"
+#import "DBRestClient.h"
+
+#define kDBDeltaSyncDefaultBatchSize 500
+#define kDBDeltaSyncMaxPagesAhead 2
+
+
+@interface DBDeltaSyncEngine () {
+	dispatch_queue_t _applyQueue;
+	NSUInteger _pagesPending; // Requested or received, but not applied yet
+	NSString *_deferredCursor; // Cursor of the next page, waiting for the apply queue to catch up
+	NSUInteger _generation; // Bumped by every sync and cancel; callbacks of other generations are ignored
+	NSString *_loadingCursor; // Cursor of the request in flight, to cancel it
+	BOOL _loading; // Whether there is a request in flight; _loadingCursor is nil for the first page
+	DBDeltaSyncCompletionBlock _completion;
+}
+
+@property (atomic, readwrite, getter = isSyncing) BOOL syncing;
+
+- (void)loadPageAfterCursor:(NSString *)cursor generation:(NSUInteger)generation;
+- (void)applyPage:(NSArray *)entries reset:(BOOL)reset cursor:(NSString *)cursor hasMore:(BOOL)hasMore generation:(NSUInteger)generation;
+- (void)finishWithError:(NSError *)error generation:(NSUInteger)generation;
+- (NSError *)cancelledError;
+- (BOOL)isCurrentGeneration:(NSUInteger)generation;
+
+@end
+
+
+@implementation DBDeltaSyncEngine
+
+- (id)initWithRestClient:(DBRestClient *)restClient store:(DBDeltaStore *)store {
+	if ((self = [super init])) {
+		_restClient = restClient;
+		_store = store;
+		_batchSize = kDBDeltaSyncDefaultBatchSize;
+		_applyQueue = dispatch_queue_create("com.dropbox.sdk.delta-sync", DISPATCH_QUEUE_SERIAL);
+		if (store) self.cursor = store.cursor;
+	}
+	return self;
+}
+
+- (void)syncWithCompletion:(DBDeltaSyncCompletionBlock)completion {
+	NSUInteger generation = 0;
+	DBDeltaSyncCompletionBlock abandoned = nil;
+	@synchronized (self) {
+		if (self.syncing) {
+			if (!_restClient.canceled) {
+				DBLogWarning(@"DBDeltaSyncEngine: sync already running");
+				return;
+			}
+			// cancelAllRequests dropped that sync's request without calling back, so it never finishes
+			abandoned = _completion;
+		}
+		self.syncing = YES;
+		generation = ++_generation;
+		_pagesPending = 0;
+		_deferredCursor = nil;
+		_loadingCursor = nil;
+		_loading = NO;
+		_completion = [completion copy];
+	}
+
+	if (abandoned) {
+		NSString *cursor = self.cursor;
+		dispatch_async(_applyQueue, ^{
+			abandoned([self cancelledError], cursor);
+		});
+	}
+
+	[self loadPageAfterCursor:self.cursor generation:generation];
+}
+
+- (void)cancel {
+	NSString *loadingCursor = nil;
+	BOOL loading = NO;
+	@synchronized (self) {
+		if (!self.syncing) return;
+		_generation++;
+		_completion = nil;
+		_deferredCursor = nil;
+		loadingCursor = _loadingCursor;
+		loading = _loading;
+		_loadingCursor = nil;
+		_loading = NO;
+		self.syncing = NO;
+	}
+
+	if (loading) [_restClient cancelDeltaLoad:loadingCursor];
+}
+
+
+#pragma mark private methods
+
+- (BOOL)isCurrentGeneration:(NSUInteger)generation {
+	@synchronized (self) {
+		return generation == _generation;
+	}
+}
+
+- (void)loadPageAfterCursor:(NSString *)cursor generation:(NSUInteger)generation {
+	// loadDelta: doesn't call back on a cancelled client
+	if (_restClient.canceled) {
+		dispatch_async(_applyQueue, ^{
+			[self finishWithError:[self cancelledError] generation:generation];
+		});
+		return;
+	}
+
+	@synchronized (self) {
+		if (generation != _generation) return;
+		_pagesPending++;
+		_loadingCursor = cursor;
+		_loading = YES;
+	}
+
+	// The entry handler runs on the request's parse queue, strictly before the completion block
+	NSMutableArray *page = [NSMutableArray array];
+
+	[_restClient loadDelta:cursor entryHandler:^(DBDeltaEntry *entry) {
+		[page addObject:entry];
+	} completion:^(NSError *error, NSArray *entryArrays, BOOL reset, NSString *nextCursor, BOOL hasMore) {
+		// A cancelled sync's request can still complete, after another sync has started
+		@synchronized (self) {
+			if (generation != _generation) return;
+			if (_loading && _loadingCursor == cursor) {
+				_loadingCursor = nil;
+				_loading = NO;
+			}
+		}
+
+		if (error) {
+			dispatch_async(_applyQueue, ^{
+				[self finishWithError:error generation:generation];
+			});
+			return;
+		}
+
+		// Ask for the next page right away, unless the apply queue is already a page behind
+		if (hasMore) {
+			BOOL loadNow = NO;
+			@synchronized (self) {
+				loadNow = _pagesPending < kDBDeltaSyncMaxPagesAhead;
+				if (!loadNow) _deferredCursor = nextCursor;
+			}
+			if (loadNow) [self loadPageAfterCursor:nextCursor generation:generation];
+		}
+
+		dispatch_async(_applyQueue, ^{
+			[self applyPage:page reset:reset cursor:nextCursor hasMore:hasMore generation:generation];
+		});
+	}];
+}
+
+// Runs on the apply queue
+- (void)applyPage:(NSArray *)entries reset:(BOOL)reset cursor:(NSString *)cursor hasMore:(BOOL)hasMore generation:(NSUInteger)generation {
+	if (![self isCurrentGeneration:generation]) return;
+
+	if (reset) [_store reset];
+
+	NSUInteger batchSize = MAX(_batchSize, 1);
+	NSUInteger count = [entries count];
+	for (NSUInteger start = 0; start < count || (reset && start == 0); start += batchSize) {
+		if (![self isCurrentGeneration:generation]) return;
+
+		@autoreleasepool {
+			NSArray *batch = [entries subarrayWithRange:NSMakeRange(start, MIN(batchSize, count - start))];
+			if (_store && ![_store applyDeltaEntries:batch]) {
+				// The page is applied again from the old cursor next time
+				NSDictionary *userInfo = cursor ? [NSDictionary dictionaryWithObject:cursor forKey:@"cursor"] : nil;
+				[self finishWithError:[NSError errorWithDomain:DBErrorDomain code:DBErrorInsufficientDiskSpace userInfo:userInfo] generation:generation];
+				return;
+			}
+			if (_batchHandler) _batchHandler(batch, reset && start == 0);
+		}
+	}
+
+	NSString *deferredCursor = nil;
+	@synchronized (self) {
+		if (generation != _generation) return;
+		_store.cursor = cursor;
+		self.cursor = cursor;
+		_pagesPending--;
+		deferredCursor = _deferredCursor;
+		_deferredCursor = nil;
+	}
+
+	if (deferredCursor) [self loadPageAfterCursor:deferredCursor generation:generation];
+	if (!hasMore) [self finishWithError:nil generation:generation];
+}
+
+// Runs on the apply queue
+- (void)finishWithError:(NSError *)error generation:(NSUInteger)generation {
+	DBDeltaSyncCompletionBlock completion = nil;
+	NSString *loadingCursor = nil;
+	BOOL loading = NO;
+	@synchronized (self) {
+		if (generation != _generation) return;
+		// A page requested before the failure must not be applied past the entries that failed, nor
+		// keep the sync going after completion has been called
+		_generation++;
+		completion = _completion;
+		_completion = nil;
+		_deferredCursor = nil;
+		loadingCursor = _loadingCursor;
+		loading = _loading;
+		_loadingCursor = nil;
+		_loading = NO;
+		self.syncing = NO;
+	}
+
+	if (loading) [_restClient cancelDeltaLoad:loadingCursor];
+
+	if (error) DBLogWarning(@"DBDeltaSyncEngine: sync stopped at cursor %@: %@", self.cursor, error);
+	if (completion) completion(error, self.cursor);
+}
+
+- (NSError *)cancelledError {
+	return [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+}
+
+@end
@@ -0,0 +1,75 @@
+//
+//  DBDownloadSink.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* Where DBRequest puts the body of a successful response when its downloadSink is set. The methods
+   are called on the connection thread, one at a time, in the order open, write..., then either
+   finish or abort. If the request is retried, open is called again after abort and the sink starts
+   over. Methods that return NO should set error; the request then fails with that error. */
+@protocol DBDownloadSink <NSObject>
+
+/* expectedLength is the size of the body as announced by the server, 0 if unknown */
+- (BOOL)openWithExpectedLength:(long long)expectedLength error:(NSError **)error;
+- (BOOL)writeData:(NSData *)data error:(NSError **)error;
+
+/* All of the body has arrived */
+- (BOOL)finish:(NSError **)error;
+
+/* The transfer failed or was cancelled */
+- (void)abort;
+
+@end
+
+
+/* Collects the body in one buffer, allocated up front when the size is known */
+@interface DBMemorySink : NSObject <DBDownloadSink>
+
+@property (nonatomic, readonly) NSData *data; // Set once the body has arrived
+
+@end
+
+
+typedef BOOL (^DBDownloadSinkDataBlock)(NSData *data);
+
+/* Hands each piece of the body to a block as it arrives. Returning NO from the block fails the
+   request. abortBlock, if set, is called when a transfer is abandoned or about to be retried. */
+@interface DBBlockSink : NSObject <DBDownloadSink>
+
+- (id)initWithDataBlock:(DBDownloadSinkDataBlock)dataBlock;
+
+@property (nonatomic, copy) void (^abortBlock)(void);
+
+@end
+
+
+/* Writes the body to a temporary file next to path, which is renamed over path when the body is
+   complete. See DBFileWriter. */
+@interface DBFileSink : NSObject <DBDownloadSink>
+
+- (id)initWithPath:(NSString *)path;
+
+@property (nonatomic, readonly) NSString *path;
+
+@end
+
+
+typedef enum {
+	DBDigestAlgorithmSHA1,
+	DBDigestAlgorithmSHA256,
+} DBDigestAlgorithm;
+
+/* Hashes the body as it passes through, on its way to nextSink if one is given */
+@interface DBDigestSink : NSObject <DBDownloadSink>
+
+- (id)initWithAlgorithm:(DBDigestAlgorithm)algorithm nextSink:(id<DBDownloadSink>)nextSink;
+
+@property (nonatomic, readonly) id<DBDownloadSink> nextSink;
+@property (nonatomic, readonly) NSData *digest; // Set once the body has arrived
+@property (nonatomic, readonly) NSString *hexDigest;
+
+@end
@@ -0,0 +1,266 @@
+//
+//  DBDownloadSink.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBDownloadSink.h"
+
+#import <CommonCrypto/CommonDigest.h>
+
+#import "DBError.h"
+#import "DBFileWriter.h"
+#import "DBLog.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#define kDBMemorySinkMinimumCapacity (16 * 1024)
+
+
+static NSError *DBDownloadSinkError(NSInteger code, NSString *path) {
+	NSDictionary *userInfo = path ? [NSDictionary dictionaryWithObject:path forKey:@"path"] : nil;
+	return [NSError errorWithDomain:DBErrorDomain code:code userInfo:userInfo];
+}
+
+
+@interface DBMemorySink () {
+	char *_bytes;
+	NSUInteger _length;
+	NSUInteger _capacity;
+}
+@end
+
+
+@implementation DBMemorySink
+
+- (void)dealloc {
+	free(_bytes);
+}
+
+- (BOOL)openWithExpectedLength:(long long)expectedLength error:(NSError **)error {
+	[self abort];
+	_data = nil;
+
+	if (expectedLength > 0) {
+		_bytes = (expectedLength <= (long long)(NSUIntegerMax / 2)) ? malloc((size_t)expectedLength) : NULL;
+		if (!_bytes) {
+			if (error) *error = DBDownloadSinkError(DBErrorGenericError, nil);
+			return NO;
+		}
+		_capacity = (NSUInteger)expectedLength;
+	}
+	return YES;
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError **)error {
+	NSUInteger length = [data length];
+	if (_length + length > _capacity) {
+		// Only when the announced size was missing or wrong
+		NSUInteger capacity = MAX(MAX(_capacity * 2, _length + length), kDBMemorySinkMinimumCapacity);
+		char *bytes = realloc(_bytes, capacity);
+		if (!bytes) {
+			if (error) *error = DBDownloadSinkError(DBErrorGenericError, nil);
+			return NO;
+		}
+		_bytes = bytes;
+		_capacity = capacity;
+	}
+
+	[data getBytes:_bytes + _length length:length];
+	_length += length;
+	return YES;
+}
+
+- (BOOL)finish:(NSError **)error {
+	if (!_bytes) {
+		_data = [NSData data];
+		return YES;
+	}
+
+	if (_capacity > _length) {
+		char *bytes = realloc(_bytes, MAX(_length, 1));
+		if (bytes) _bytes = bytes;
+	}
+
+	_data = [[NSData alloc] initWithBytesNoCopy:_bytes length:_length freeWhenDone:YES];
+	_bytes = NULL;
+	_length = 0;
+	_capacity = 0;
+	return YES;
+}
+
+- (void)abort {
+	free(_bytes);
+	_bytes = NULL;
+	_length = 0;
+	_capacity = 0;
+}
+
+@end
+
+
+@interface DBBlockSink () {
+	DBDownloadSinkDataBlock _dataBlock;
+}
+@end
+
+
+@implementation DBBlockSink
+
+- (id)initWithDataBlock:(DBDownloadSinkDataBlock)dataBlock {
+	if ((self = [super init])) {
+		_dataBlock = [dataBlock copy];
+	}
+	return self;
+}
+
+- (BOOL)openWithExpectedLength:(long long)expectedLength error:(NSError **)error {
+	return YES;
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError **)error {
+	if (_dataBlock(data)) return YES;
+	if (error) *error = DBDownloadSinkError(DBErrorGenericError, nil);
+	return NO;
+}
+
+- (BOOL)finish:(NSError **)error {
+	return YES;
+}
+
+- (void)abort {
+	if (_abortBlock) _abortBlock();
+}
+
+@end
+
+
+@interface DBFileSink () {
+	DBFileWriter *_writer;
+}
+@end
+
+
+@implementation DBFileSink
+
+- (id)initWithPath:(NSString *)path {
+	if ((self = [super init])) {
+		_path = [path copy];
+	}
+	return self;
+}
+
+- (void)dealloc {
+	[_writer discard];
+}
+
+- (BOOL)openWithExpectedLength:(long long)expectedLength error:(NSError **)error {
+	[_writer discard];
+	_writer = [[DBFileWriter alloc] initTemporaryFileForPath:_path];
+	if (!_writer) {
+		if (error) *error = DBDownloadSinkError(DBErrorGenericError, _path);
+		return NO;
+	}
+
+	if (expectedLength > 0) [_writer preallocateLength:expectedLength];
+	return YES;
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError **)error {
+	if ([_writer writeData:data]) return YES;
+
+	int writeError = _writer.lastError;
+	DBLogError(@"DBFileSink: error writing %@: %s", _path, strerror(writeError));
+	if (error) *error = DBDownloadSinkError((writeError == ENOSPC || writeError == EDQUOT) ? DBErrorInsufficientDiskSpace : DBErrorGenericError, _path);
+	return NO;
+}
+
+- (BOOL)finish:(NSError **)error {
+	DBFileWriter *writer = _writer;
+	_writer = nil;
+	if ([writer moveToPath:_path]) return YES;
+
+	int writeError = writer.lastError;
+	DBLogError(@"DBFileSink: error finishing %@: %s", _path, strerror(writeError));
+	[writer discard];
+	if (error) *error = DBDownloadSinkError((writeError == ENOSPC || writeError == EDQUOT) ? DBErrorInsufficientDiskSpace : DBErrorGenericError, _path);
+	return NO;
+}
+
+- (void)abort {
+	[_writer discard];
+	_writer = nil;
+}
+
+@end
+
+
+@interface DBDigestSink () {
+	DBDigestAlgorithm _algorithm;
+	union {
+		CC_SHA1_CTX sha1;
+		CC_SHA256_CTX sha256;
+	} _context;
+}
+@end
+
+
+@implementation DBDigestSink
+
+- (id)initWithAlgorithm:(DBDigestAlgorithm)algorithm nextSink:(id<DBDownloadSink>)nextSink {
+	if ((self = [super init])) {
+		_algorithm = algorithm;
+		_nextSink = nextSink;
+	}
+	return self;
+}
+
+- (BOOL)openWithExpectedLength:(long long)expectedLength error:(NSError **)error {
+	_digest = nil;
+	if (_algorithm == DBDigestAlgorithmSHA256) CC_SHA256_Init(&_context.sha256);
+	else CC_SHA1_Init(&_context.sha1);
+
+	return _nextSink ? [_nextSink openWithExpectedLength:expectedLength error:error] : YES;
+}
+
+- (BOOL)writeData:(NSData *)data error:(NSError **)error {
+	if (_algorithm == DBDigestAlgorithmSHA256) CC_SHA256_Update(&_context.sha256, [data bytes], (CC_LONG)[data length]);
+	else CC_SHA1_Update(&_context.sha1, [data bytes], (CC_LONG)[data length]);
+
+	return _nextSink ? [_nextSink writeData:data error:error] : YES;
+}
+
+- (BOOL)finish:(NSError **)error {
+	if (_nextSink && ![_nextSink finish:error]) return NO;
+
+	if (_algorithm == DBDigestAlgorithmSHA256) {
+		unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+		CC_SHA256_Final(digest, &_context.sha256);
+		_digest = [NSData dataWithBytes:digest length:sizeof(digest)];
+	}
+	else {
+		unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+		CC_SHA1_Final(digest, &_context.sha1);
+		_digest = [NSData dataWithBytes:digest length:sizeof(digest)];
+	}
+	return YES;
+}
+
+- (void)abort {
+	[_nextSink abort];
+}
+
+- (NSString *)hexDigest {
+	if (!_digest) return nil;
+
+	const unsigned char *bytes = [_digest bytes];
+	NSMutableString *hex = [NSMutableString stringWithCapacity:[_digest length] * 2];
+	for (NSUInteger i = 0; i < [_digest length]; i++) {
+		[hex appendFormat:@"%02x", bytes[i]];
+	}
+	return hex;
+}
+
+@end
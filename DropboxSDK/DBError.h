@@ -18,4 +18,5 @@ typedef enum {
     DBErrorInsufficientDiskSpace,
     DBErrorIllegalFileType, // Error sent if you try to upload a directory
     DBErrorInvalidResponse, // Sent when the client does not get valid JSON when it's expecting it
+    DBErrorFileChanged, // Sent if the file being uploaded in chunks changes before all of it is sent
 } DBErrorCode;
@@ -0,0 +1,55 @@
+//
+//  DBFileWriter.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* DBFileWriter writes a download to disk with plain POSIX calls. Bytes are gathered into a page
+   aligned buffer and written in whole buffers at buffer aligned file offsets, so a download costs
+   a few large writes instead of one per network read. A temporary file is made in the directory of
+   its destination, which lets moveToPath: finish with a single rename(2) instead of a copy across
+   volumes. No method throws; on failure lastError holds the errno. Not thread safe. */
+@interface DBFileWriter : NSObject
+
+/* Creates and opens an empty file with a unique hidden name next to destinationPath */
+- (id)initTemporaryFileForPath:(NSString *)destinationPath;
+
+/* Opens path for writing at offset 0, creating it if needed. If truncate is YES it is emptied. */
+- (id)initWithPath:(NSString *)path truncate:(BOOL)truncate;
+
+@property (nonatomic, readonly) NSString *path;
+@property (nonatomic, readonly) int fileDescriptor; // -1 once closed
+@property (nonatomic, readonly) long long offset; // Where the next byte goes, including buffered bytes
+@property (nonatomic, readonly) int lastError;
+
+/* Flushes, then continues writing at offset */
+- (BOOL)seekToOffset:(long long)offset;
+- (BOOL)seekToEndOfFile;
+
+/* Reserves disk space for length more bytes from the current offset, so the file is laid out in
+   one piece and a full disk is noticed before the transfer rather than in the middle of it. The
+   file size doesn't change. It's a hint: where the file system can't do it, it returns NO and
+   writing works as before. */
+- (BOOL)preallocateLength:(long long)length;
+
+/* Sets the size of the file, writing out buffered bytes first */
+- (BOOL)truncateAtOffset:(long long)length;
+
+- (BOOL)writeBytes:(const void *)bytes length:(NSUInteger)length;
+- (BOOL)writeData:(NSData *)data;
+
+- (BOOL)flush;
+
+/* Flushes and closes the file. Returns NO if the buffered bytes couldn't be written. */
+- (BOOL)close;
+
+/* Closes the file and atomically puts it at path, replacing what is there */
+- (BOOL)moveToPath:(NSString *)path;
+
+/* Closes and deletes the file */
+- (void)discard;
+
+@end
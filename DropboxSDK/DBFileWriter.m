@@ -0,0 +1,249 @@
+//
+//  DBFileWriter.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBFileWriter.h"
+
+#import "DBLog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kDBFileWriterBufferSize (1024 * 1024)
+
+
+@interface DBFileWriter () {
+	int _fd;
+	char *_buffer;
+	NSUInteger _bufferLength;
+	long long _bufferOffset; // File offset of the first buffered byte
+}
+
+- (NSUInteger)bufferLimit;
+- (BOOL)writeFully:(const char *)bytes length:(size_t)length atOffset:(long long)offset;
+
+@end
+
+
+@implementation DBFileWriter
+
+- (id)initTemporaryFileForPath:(NSString *)destinationPath {
+	if ((self = [super init])) {
+		NSString *directory = [destinationPath stringByDeletingLastPathComponent];
+		if ([directory length] == 0) directory = @".";
+		NSString *filenameTemplate = [directory stringByAppendingPathComponent:@".dropbox.XXXXXXXXXX"];
+
+		char *filename = strdup([filenameTemplate fileSystemRepresentation]);
+		_fd = mkstemp(filename);
+		if (_fd < 0) {
+			_lastError = errno;
+			DBLogError(@"DBFileWriter: Failed to create temp file %s, error: %d", filename, _lastError);
+			free(filename);
+			return nil;
+		}
+
+		_path = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:filename length:strlen(filename)];
+		free(filename);
+	}
+	return self;
+}
+
+- (id)initWithPath:(NSString *)path truncate:(BOOL)truncate {
+	if ((self = [super init])) {
+		_fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+		if (_fd < 0) {
+			_lastError = errno;
+			return nil;
+		}
+		_path = path;
+	}
+	return self;
+}
+
+- (void)dealloc {
+	[self close];
+}
+
+- (int)fileDescriptor {
+	return _fd;
+}
+
+- (long long)offset {
+	return _bufferOffset + _bufferLength;
+}
+
+- (BOOL)seekToOffset:(long long)offset {
+	if (![self flush]) return NO;
+	_bufferOffset = offset;
+	return YES;
+}
+
+- (BOOL)seekToEndOfFile {
+	struct stat st;
+	if (![self flush]) return NO;
+	if (fstat(_fd, &st) != 0) {
+		_lastError = errno;
+		return NO;
+	}
+	_bufferOffset = st.st_size;
+	return YES;
+}
+
+- (BOOL)preallocateLength:(long long)length {
+#ifdef F_PREALLOCATE
+	struct stat st;
+	if (fstat(_fd, &st) != 0) {
+		_lastError = errno;
+		return NO;
+	}
+
+	// Measured from the end of the space already allocated to the file
+	long long extra = [self offset] + length - st.st_size;
+	if (extra <= 0) return YES;
+
+	fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, extra, 0 };
+	if (fcntl(_fd, F_PREALLOCATE, &store) == -1) {
+		// Not enough contiguous space, settle for any
+		store.fst_flags = F_ALLOCATEALL;
+		if (fcntl(_fd, F_PREALLOCATE, &store) == -1) {
+			_lastError = errno;
+			return NO;
+		}
+	}
+	return YES;
+#else
+	_lastError = ENOTSUP;
+	return NO;
+#endif
+}
+
+- (BOOL)truncateAtOffset:(long long)length {
+	if (![self flush]) return NO;
+	if (ftruncate(_fd, length) != 0) {
+		_lastError = errno;
+		return NO;
+	}
+	return YES;
+}
+
+- (BOOL)writeBytes:(const void *)bytes length:(NSUInteger)length {
+	if (_fd < 0) {
+		_lastError = EBADF;
+		return NO;
+	}
+
+	const char *next = bytes;
+	while (length > 0) {
+		NSUInteger limit = [self bufferLimit];
+
+		if (_bufferLength == 0 && length >= limit) {
+			// A whole aligned chunk can go straight from the caller's memory
+			if (![self writeFully:next length:limit atOffset:_bufferOffset]) return NO;
+			_bufferOffset += limit;
+			next += limit;
+			length -= limit;
+			continue;
+		}
+
+		if (!_buffer && posix_memalign((void **)&_buffer, (size_t)getpagesize(), kDBFileWriterBufferSize) != 0) {
+			_buffer = NULL;
+			_lastError = ENOMEM;
+			return NO;
+		}
+
+		NSUInteger count = MIN(length, limit - _bufferLength);
+		memcpy(_buffer + _bufferLength, next, count);
+		_bufferLength += count;
+		next += count;
+		length -= count;
+
+		if (_bufferLength == limit && ![self flush]) return NO;
+	}
+	return YES;
+}
+
+- (BOOL)writeData:(NSData *)data {
+	return [self writeBytes:[data bytes] length:[data length]];
+}
+
+- (BOOL)flush {
+	if (_bufferLength == 0) return YES;
+	if (![self writeFully:_buffer length:_bufferLength atOffset:_bufferOffset]) return NO;
+	_bufferOffset += _bufferLength;
+	_bufferLength = 0;
+	return YES;
+}
+
+- (BOOL)close {
+	BOOL success = YES;
+	if (_fd >= 0) {
+		success = [self flush];
+		if (close(_fd) != 0 && success) {
+			_lastError = errno;
+			success = NO;
+		}
+		_fd = -1;
+	}
+	free(_buffer);
+	_buffer = NULL;
+	_bufferLength = 0;
+	return success;
+}
+
+- (BOOL)moveToPath:(NSString *)path {
+	if (![self close]) return NO;
+	if (rename([_path fileSystemRepresentation], [path fileSystemRepresentation]) == 0) return YES;
+
+	if (errno != EXDEV) {
+		_lastError = errno;
+		return NO;
+	}
+
+	// Only when the file couldn't be made next to its destination
+	NSFileManager *fileManager = [NSFileManager new];
+	NSError *moveError = nil;
+	[fileManager removeItemAtPath:path error:nil];
+	if (![fileManager moveItemAtPath:_path toPath:path error:&moveError]) {
+		_lastError = [moveError.domain isEqual:NSPOSIXErrorDomain] ? (int)moveError.code : EIO;
+		return NO;
+	}
+	return YES;
+}
+
+- (void)discard {
+	[self close];
+	unlink([_path fileSystemRepresentation]);
+}
+
+
+#pragma mark private methods
+
+// The buffer fills up to the next multiple of its size in the file, so after the first flush every
+// write starts on a buffer boundary
+- (NSUInteger)bufferLimit {
+	return kDBFileWriterBufferSize - (NSUInteger)(_bufferOffset % kDBFileWriterBufferSize);
+}
+
+- (BOOL)writeFully:(const char *)bytes length:(size_t)length atOffset:(long long)offset {
+	while (length > 0) {
+		ssize_t written = pwrite(_fd, bytes, length, offset);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			_lastError = errno;
+			return NO;
+		}
+		bytes += written;
+		length -= (size_t)written;
+		offset += written;
+	}
+	return YES;
+}
+
+@end
@@ -0,0 +1,215 @@
+//
+//  DBHMAC.c
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#include "DBHMAC.h"
+
+#include <string.h>
+
+#define kDBHashBlockSize 64
+
+#define DBRotateLeft(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define DBRotateRight(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static const uint32_t kDBSHA256RoundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+
+static inline uint32_t DBReadBigEndian32(const uint8_t *bytes) {
+	return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+static inline void DBWriteBigEndian32(uint8_t *bytes, uint32_t value) {
+	bytes[0] = (uint8_t)(value >> 24);
+	bytes[1] = (uint8_t)(value >> 16);
+	bytes[2] = (uint8_t)(value >> 8);
+	bytes[3] = (uint8_t)value;
+}
+
+static void DBSHA1Compress(uint32_t *state, const uint8_t *block) {
+	uint32_t w[80];
+	for (int i = 0; i < 16; i++) w[i] = DBReadBigEndian32(block + 4 * i);
+	for (int i = 16; i < 80; i++) w[i] = DBRotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t t = DBRotateLeft(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = DBRotateLeft(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void DBSHA256Compress(uint32_t *state, const uint8_t *block) {
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++) w[i] = DBReadBigEndian32(block + 4 * i);
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = DBRotateRight(w[i - 15], 7) ^ DBRotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = DBRotateRight(w[i - 2], 17) ^ DBRotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t s1 = DBRotateRight(e, 6) ^ DBRotateRight(e, 11) ^ DBRotateRight(e, 25);
+		uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + kDBSHA256RoundConstants[i] + w[i];
+		uint32_t s0 = DBRotateRight(a, 2) ^ DBRotateRight(a, 13) ^ DBRotateRight(a, 22);
+		uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+static inline void DBHashCompress(DBHashContext *context, const uint8_t *block) {
+	if (context->algorithm == DBHashAlgorithmSHA256) DBSHA256Compress(context->state, block);
+	else DBSHA1Compress(context->state, block);
+}
+
+
+size_t DBHashDigestLength(DBHashAlgorithm algorithm) {
+	return algorithm == DBHashAlgorithmSHA256 ? kDBSHA256DigestLength : kDBSHA1DigestLength;
+}
+
+void DBHashInit(DBHashContext *context, DBHashAlgorithm algorithm) {
+	static const uint32_t sha1State[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	static const uint32_t sha256State[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memset(context, 0, sizeof(*context));
+	context->algorithm = algorithm;
+	if (algorithm == DBHashAlgorithmSHA256) memcpy(context->state, sha256State, sizeof(sha256State));
+	else memcpy(context->state, sha1State, sizeof(sha1State));
+}
+
+void DBHashUpdate(DBHashContext *context, const void *data, size_t length) {
+	const uint8_t *bytes = data;
+	context->length += length;
+
+	if (context->blockLength > 0) {
+		size_t count = kDBHashBlockSize - context->blockLength;
+		if (count > length) count = length;
+		memcpy(context->block + context->blockLength, bytes, count);
+		context->blockLength += count;
+		bytes += count;
+		length -= count;
+		if (context->blockLength < kDBHashBlockSize) return;
+		DBHashCompress(context, context->block);
+		context->blockLength = 0;
+	}
+
+	for (; length >= kDBHashBlockSize; bytes += kDBHashBlockSize, length -= kDBHashBlockSize) {
+		DBHashCompress(context, bytes);
+	}
+
+	memcpy(context->block, bytes, length);
+	context->blockLength = length;
+}
+
+void DBHashFinal(DBHashContext *context, uint8_t *digest) {
+	uint64_t bitLength = context->length * 8;
+
+	// A 1 bit, zeros up to 8 bytes short of a block, then the length in bits
+	context->block[context->blockLength++] = 0x80;
+	if (context->blockLength > kDBHashBlockSize - 8) {
+		memset(context->block + context->blockLength, 0, kDBHashBlockSize - context->blockLength);
+		DBHashCompress(context, context->block);
+		context->blockLength = 0;
+	}
+	memset(context->block + context->blockLength, 0, kDBHashBlockSize - 8 - context->blockLength);
+	DBWriteBigEndian32(context->block + kDBHashBlockSize - 8, (uint32_t)(bitLength >> 32));
+	DBWriteBigEndian32(context->block + kDBHashBlockSize - 4, (uint32_t)bitLength);
+	DBHashCompress(context, context->block);
+
+	size_t words = DBHashDigestLength(context->algorithm) / 4;
+	for (size_t i = 0; i < words; i++) DBWriteBigEndian32(digest + 4 * i, context->state[i]);
+}
+
+
+void DBHMACKeyInit(DBHMACKey *key, DBHashAlgorithm algorithm, const void *secret, size_t secretLength) {
+	uint8_t pad[kDBHashBlockSize];
+	memset(pad, 0, sizeof(pad));
+
+	if (secretLength > kDBHashBlockSize) {
+		// Longer keys are hashed first
+		DBHashContext context;
+		DBHashInit(&context, algorithm);
+		DBHashUpdate(&context, secret, secretLength);
+		DBHashFinal(&context, pad);
+	} else if (secretLength > 0) {
+		memcpy(pad, secret, secretLength);
+	}
+
+	for (size_t i = 0; i < kDBHashBlockSize; i++) pad[i] ^= 0x36;
+	DBHashInit(&key->inner, algorithm);
+	DBHashUpdate(&key->inner, pad, kDBHashBlockSize);
+
+	for (size_t i = 0; i < kDBHashBlockSize; i++) pad[i] ^= 0x36 ^ 0x5c;
+	DBHashInit(&key->outer, algorithm);
+	DBHashUpdate(&key->outer, pad, kDBHashBlockSize);
+
+	memset(pad, 0, sizeof(pad));
+}
+
+void DBHMACSign(const DBHMACKey *key, const void *data, size_t length, uint8_t *digest) {
+	uint8_t innerDigest[kDBHMACMaxDigestLength];
+	size_t digestLength = DBHashDigestLength(key->inner.algorithm);
+
+	DBHashContext context = key->inner;
+	DBHashUpdate(&context, data, length);
+	DBHashFinal(&context, innerDigest);
+
+	context = key->outer;
+	DBHashUpdate(&context, innerDigest, digestLength);
+	DBHashFinal(&context, digest);
+}
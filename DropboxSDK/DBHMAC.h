@@ -0,0 +1,46 @@
+//
+//  DBHMAC.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* SHA-1, SHA-256 and HMAC in portable C, so request signing doesn't depend on CommonCrypto. A
+   DBHMACKey holds the hash states after the inner and outer padded keys, computed once per secret.
+   Each signature starts from copies of them and only hashes the text. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define kDBSHA1DigestLength 20
+#define kDBSHA256DigestLength 32
+#define kDBHMACMaxDigestLength kDBSHA256DigestLength
+
+typedef enum {
+	DBHashAlgorithmSHA1,
+	DBHashAlgorithmSHA256,
+} DBHashAlgorithm;
+
+typedef struct {
+	DBHashAlgorithm algorithm;
+	uint32_t state[8];
+	uint64_t length; // Bytes hashed so far
+	uint8_t block[64];
+	size_t blockLength;
+} DBHashContext;
+
+size_t DBHashDigestLength(DBHashAlgorithm algorithm);
+void DBHashInit(DBHashContext *context, DBHashAlgorithm algorithm);
+void DBHashUpdate(DBHashContext *context, const void *data, size_t length);
+void DBHashFinal(DBHashContext *context, uint8_t *digest); // DBHashDigestLength bytes
+
+typedef struct {
+	DBHashContext inner;
+	DBHashContext outer;
+} DBHMACKey;
+
+void DBHMACKeyInit(DBHMACKey *key, DBHashAlgorithm algorithm, const void *secret, size_t secretLength);
+
+/* Writes DBHashDigestLength bytes to digest. key isn't changed, so it can be shared between threads. */
+void DBHMACSign(const DBHMACKey *key, const void *data, size_t length, uint8_t *digest);
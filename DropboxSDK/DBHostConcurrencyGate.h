@@ -0,0 +1,54 @@
+//
+//  DBHostConcurrencyGate.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBHostSlot;
+
+typedef void (^DBHostSlotBlock)(DBHostSlot *slot);
+
+/* DBHostConcurrencyGate limits how many requests talk to each host at once (api.dropbox.com and
+   api-content.dropbox.com in practice). A request holds one of the host's slots for the life of its
+   transfer; once they are all taken, further requests wait for one to be released instead of
+   having the URL loading system open another socket. It only counts requests: the sockets, and
+   whether they are reused, stay with the URL loading system. */
+@interface DBHostConcurrencyGate : NSObject
+
++ (DBHostConcurrencyGate *)sharedGate;
+
+@property (nonatomic) NSUInteger maxRequestsPerHost; // Default for hosts without their own limit, 4
+
+/* Slots per host that only requests of priority 0 or less (DBRequestPriorityInteractive) get, so
+   long transfers can't hold all of a host's slots. Never more than the host's limit minus one.
+   Default is 1. */
+@property (nonatomic) NSUInteger reservedSlotsPerHost;
+
+- (void)setMaxRequests:(NSUInteger)maxRequests forHost:(NSString *)host;
+- (NSUInteger)maxRequestsForHost:(NSString *)host;
+- (void)removeMaxRequestsForAllHosts; // Every host goes back to maxRequestsPerHost
+
+/* The handler is called with the slot as soon as one is free, possibly synchronously. Waiters are
+   served lowest priority value first, and in order of arrival within a priority. Pass the same
+   owner to cancelPendingRequestForOwner: to give up a place in line, or to
+   setPriority:forPendingRequestOfOwner: to move to another one. */
+- (void)acquireSlotForHost:(NSString *)host owner:(id)owner priority:(NSInteger)priority handler:(DBHostSlotBlock)handler;
+- (BOOL)cancelPendingRequestForOwner:(id)owner;
+- (void)setPriority:(NSInteger)priority forPendingRequestOfOwner:(id)owner;
+
+- (void)releaseSlot:(DBHostSlot *)slot;
+
+/* Map from host to an NSDictionary with @"active" and @"waiting" */
+- (NSDictionary *)statistics;
+
+@end
+
+
+@interface DBHostSlot : NSObject
+
+@property (nonatomic, readonly) NSString *host;
+
+@end
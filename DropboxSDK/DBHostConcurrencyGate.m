@@ -0,0 +1,308 @@
+//
+//  DBHostConcurrencyGate.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBHostConcurrencyGate.h"
+
+
+@interface DBHostSlot ()
+
+- (id)initWithHost:(NSString *)host;
+
+@end
+
+
+@interface DBHostConcurrencyGateWaiter : NSObject
+
+@property (nonatomic, weak) id owner;
+@property (nonatomic) NSInteger priority;
+@property (nonatomic, copy) DBHostSlotBlock handler;
+
+@end
+
+
+@interface DBHostConcurrencyGateHost : NSObject
+
+@property (nonatomic) NSUInteger maxRequests; // 0 means use the gate default
+@property (nonatomic) NSUInteger activeCount;
+@property (nonatomic, readonly) NSMutableArray *waiters;
+
+@end
+
+
+@interface DBHostConcurrencyGate () {
+	NSMutableDictionary *_hosts;
+}
+
+- (DBHostConcurrencyGateHost *)gateHostForName:(NSString *)host;
+- (NSUInteger)limitForGateHost:(DBHostConcurrencyGateHost *)gateHost;
+- (BOOL)gateHost:(DBHostConcurrencyGateHost *)gateHost hasSlotForPriority:(NSInteger)priority;
+- (DBHostSlot *)checkOutSlotForGateHost:(DBHostConcurrencyGateHost *)gateHost host:(NSString *)host;
+- (void)insertWaiter:(DBHostConcurrencyGateWaiter *)waiter intoGateHost:(DBHostConcurrencyGateHost *)gateHost;
+- (void)grantWaitersOfGateHost:(DBHostConcurrencyGateHost *)gateHost host:(NSString *)host into:(NSMutableArray *)granted;
+- (void)runGrants:(NSArray *)granted;
+
+@end
+
+
+@implementation DBHostConcurrencyGate
+
++ (DBHostConcurrencyGate *)sharedGate {
+	static DBHostConcurrencyGate *sharedGate = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedGate = [DBHostConcurrencyGate new];
+	});
+	return sharedGate;
+}
+
+- (id)init {
+	if ((self = [super init])) {
+		_hosts = [NSMutableDictionary new];
+		_maxRequestsPerHost = 4;
+		_reservedSlotsPerHost = 1;
+	}
+	return self;
+}
+
+- (void)setMaxRequestsPerHost:(NSUInteger)maxRequestsPerHost {
+	NSMutableArray *granted = [NSMutableArray array];
+
+	@synchronized (self) {
+		_maxRequestsPerHost = maxRequestsPerHost;
+		[_hosts enumerateKeysAndObjectsUsingBlock:^(NSString *host, DBHostConcurrencyGateHost *gateHost, BOOL *stop) {
+			[self grantWaitersOfGateHost:gateHost host:host into:granted];
+		}];
+	}
+
+	[self runGrants:granted];
+}
+
+- (void)setReservedSlotsPerHost:(NSUInteger)reservedSlotsPerHost {
+	NSMutableArray *granted = [NSMutableArray array];
+
+	@synchronized (self) {
+		_reservedSlotsPerHost = reservedSlotsPerHost;
+		[_hosts enumerateKeysAndObjectsUsingBlock:^(NSString *host, DBHostConcurrencyGateHost *gateHost, BOOL *stop) {
+			[self grantWaitersOfGateHost:gateHost host:host into:granted];
+		}];
+	}
+
+	[self runGrants:granted];
+}
+
+- (void)setMaxRequests:(NSUInteger)maxRequests forHost:(NSString *)host {
+	NSMutableArray *granted = [NSMutableArray array];
+
+	@synchronized (self) {
+		DBHostConcurrencyGateHost *gateHost = [self gateHostForName:host];
+		gateHost.maxRequests = maxRequests;
+		[self grantWaitersOfGateHost:gateHost host:host into:granted];
+	}
+
+	[self runGrants:granted];
+}
+
+- (void)removeMaxRequestsForAllHosts {
+	NSMutableArray *granted = [NSMutableArray array];
+
+	@synchronized (self) {
+		[_hosts enumerateKeysAndObjectsUsingBlock:^(NSString *host, DBHostConcurrencyGateHost *gateHost, BOOL *stop) {
+			gateHost.maxRequests = 0;
+			[self grantWaitersOfGateHost:gateHost host:host into:granted];
+		}];
+	}
+
+	[self runGrants:granted];
+}
+
+- (NSUInteger)maxRequestsForHost:(NSString *)host {
+	@synchronized (self) {
+		return [self limitForGateHost:[self gateHostForName:host]];
+	}
+}
+
+- (void)acquireSlotForHost:(NSString *)host owner:(id)owner priority:(NSInteger)priority handler:(DBHostSlotBlock)handler {
+	if (!host) host = @"";
+
+	DBHostSlot *slot = nil;
+	@synchronized (self) {
+		DBHostConcurrencyGateHost *gateHost = [self gateHostForName:host];
+		if ([self gateHost:gateHost hasSlotForPriority:priority]) {
+			slot = [self checkOutSlotForGateHost:gateHost host:host];
+		}
+		else {
+			DBHostConcurrencyGateWaiter *waiter = [DBHostConcurrencyGateWaiter new];
+			waiter.owner = owner;
+			waiter.priority = priority;
+			waiter.handler = handler;
+			[self insertWaiter:waiter intoGateHost:gateHost];
+		}
+	}
+
+	if (slot) handler(slot);
+}
+
+- (BOOL)cancelPendingRequestForOwner:(id)owner {
+	if (!owner) return NO;
+
+	@synchronized (self) {
+		for (DBHostConcurrencyGateHost *gateHost in [_hosts allValues]) {
+			NSUInteger index = [gateHost.waiters indexOfObjectPassingTest:^BOOL(DBHostConcurrencyGateWaiter *waiter, NSUInteger idx, BOOL *stop) {
+				return waiter.owner == owner;
+			}];
+			if (index != NSNotFound) {
+				[gateHost.waiters removeObjectAtIndex:index];
+				return YES;
+			}
+		}
+	}
+	return NO;
+}
+
+- (void)setPriority:(NSInteger)priority forPendingRequestOfOwner:(id)owner {
+	if (!owner) return;
+
+	@synchronized (self) {
+		for (DBHostConcurrencyGateHost *gateHost in [_hosts allValues]) {
+			NSUInteger index = [gateHost.waiters indexOfObjectPassingTest:^BOOL(DBHostConcurrencyGateWaiter *waiter, NSUInteger idx, BOOL *stop) {
+				return waiter.owner == owner;
+			}];
+			if (index == NSNotFound) continue;
+
+			DBHostConcurrencyGateWaiter *waiter = [gateHost.waiters objectAtIndex:index];
+			if (waiter.priority == priority) return;
+			[gateHost.waiters removeObjectAtIndex:index];
+			waiter.priority = priority;
+			[self insertWaiter:waiter intoGateHost:gateHost];
+			return;
+		}
+	}
+}
+
+- (void)releaseSlot:(DBHostSlot *)slot {
+	if (!slot) return;
+
+	DBHostConcurrencyGateWaiter *waiter = nil;
+	DBHostSlot *granted = nil;
+	@synchronized (self) {
+		DBHostConcurrencyGateHost *gateHost = [self gateHostForName:slot.host];
+		if (gateHost.activeCount > 0) gateHost.activeCount--;
+
+		DBHostConcurrencyGateWaiter *first = [gateHost.waiters count] > 0 ? [gateHost.waiters objectAtIndex:0] : nil;
+		if (first && [self gateHost:gateHost hasSlotForPriority:first.priority]) {
+			waiter = first;
+			[gateHost.waiters removeObjectAtIndex:0];
+			granted = [self checkOutSlotForGateHost:gateHost host:slot.host];
+		}
+	}
+
+	if (waiter) waiter.handler(granted);
+}
+
+- (NSDictionary *)statistics {
+	@synchronized (self) {
+		NSMutableDictionary *statistics = [NSMutableDictionary dictionaryWithCapacity:[_hosts count]];
+		[_hosts enumerateKeysAndObjectsUsingBlock:^(NSString *host, DBHostConcurrencyGateHost *gateHost, BOOL *stop) {
+			[statistics setObject:@{
+				@"active" : @(gateHost.activeCount),
+				@"waiting" : @([gateHost.waiters count])
+			} forKey:host];
+		}];
+		return statistics;
+	}
+}
+
+
+#pragma mark private methods
+
+// Callers must hold the gate lock. Keeps the waiters sorted by priority, in order of arrival within one.
+- (void)insertWaiter:(DBHostConcurrencyGateWaiter *)waiter intoGateHost:(DBHostConcurrencyGateHost *)gateHost {
+	NSMutableArray *waiters = gateHost.waiters;
+	NSUInteger index = [waiters count];
+	while (index > 0 && [(DBHostConcurrencyGateWaiter *)[waiters objectAtIndex:index - 1] priority] > waiter.priority) {
+		index--;
+	}
+	[waiters insertObject:waiter atIndex:index];
+}
+
+// Callers must hold the gate lock. A raised limit can let some of the waiters through right away.
+- (void)grantWaitersOfGateHost:(DBHostConcurrencyGateHost *)gateHost host:(NSString *)host into:(NSMutableArray *)granted {
+	// The waiters are sorted by priority, so once the first has to wait all of them do
+	while ([gateHost.waiters count] > 0) {
+		DBHostConcurrencyGateWaiter *waiter = [gateHost.waiters objectAtIndex:0];
+		if (![self gateHost:gateHost hasSlotForPriority:waiter.priority]) break;
+		[gateHost.waiters removeObjectAtIndex:0];
+		[granted addObject:@[waiter, [self checkOutSlotForGateHost:gateHost host:host]]];
+	}
+}
+
+// Outside the gate lock, the handlers start requests
+- (void)runGrants:(NSArray *)granted {
+	for (NSArray *grant in granted) {
+		DBHostConcurrencyGateWaiter *waiter = [grant objectAtIndex:0];
+		waiter.handler([grant objectAtIndex:1]);
+	}
+}
+
+// Callers must hold the gate lock
+- (DBHostConcurrencyGateHost *)gateHostForName:(NSString *)host {
+	DBHostConcurrencyGateHost *gateHost = [_hosts objectForKey:host];
+	if (!gateHost) {
+		gateHost = [DBHostConcurrencyGateHost new];
+		[_hosts setObject:gateHost forKey:host];
+	}
+	return gateHost;
+}
+
+- (NSUInteger)limitForGateHost:(DBHostConcurrencyGateHost *)gateHost {
+	NSUInteger limit = gateHost.maxRequests ? gateHost.maxRequests : _maxRequestsPerHost;
+	return MAX(limit, 1);
+}
+
+// The reserved slots are the last ones, whoever holds the others
+- (BOOL)gateHost:(DBHostConcurrencyGateHost *)gateHost hasSlotForPriority:(NSInteger)priority {
+	NSUInteger limit = [self limitForGateHost:gateHost];
+	if (priority <= 0) return gateHost.activeCount < limit;
+
+	NSUInteger reserved = MIN(_reservedSlotsPerHost, limit - 1);
+	return gateHost.activeCount < limit - reserved;
+}
+
+- (DBHostSlot *)checkOutSlotForGateHost:(DBHostConcurrencyGateHost *)gateHost host:(NSString *)host {
+	gateHost.activeCount++;
+	return [[DBHostSlot alloc] initWithHost:host];
+}
+
+@end
+
+
+@implementation DBHostSlot
+
+- (id)initWithHost:(NSString *)host {
+	if ((self = [super init])) {
+		_host = [host copy];
+	}
+	return self;
+}
+
+@end
+
+
+@implementation DBHostConcurrencyGateWaiter
+@end
+
+
+@implementation DBHostConcurrencyGateHost
+
+- (id)init {
+	if ((self = [super init])) {
+		_waiters = [NSMutableArray new];
+	}
+	return self;
+}
+
+@end
@@ -0,0 +1,29 @@
+//
+//  DBJSONStreamParser.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef void (^DBJSONStreamValueBlock)(id value);
+
+/* DBJSONStreamParser is a push-style JSON parser: feed it the response body chunk by chunk as it
+   arrives and it builds the same mutable containers NSJSONSerialization would. Arrays stored under
+   a registered top level key (e.g. "entries" in a /delta page or "contents" in a folder listing)
+   are not accumulated; each element is handed to the handler as soon as it is complete and then
+   dropped, so peak memory is bounded by the largest single element rather than the whole body. */
+@interface DBJSONStreamParser : NSObject
+
+/* Must be called before the first parseData: call. The array is left empty in rootObject. */
+- (void)streamElementsOfArrayForKey:(NSString *)key handler:(DBJSONStreamValueBlock)handler;
+
+/* Both return NO and set error as soon as the input is not valid JSON */
+- (BOOL)parseData:(NSData *)data;
+- (BOOL)finish;
+
+@property (nonatomic, readonly) id rootObject; // nil until finish succeeds
+@property (nonatomic, readonly) NSError *error;
+
+@end
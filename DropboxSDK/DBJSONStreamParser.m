@@ -0,0 +1,488 @@
+//
+//  DBJSONStreamParser.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBJSONStreamParser.h"
+
+#import "DBError.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kDBJSONStreamMaxDepth 512
+#define kDBJSONStreamMaxNumberLength 64
+
+typedef enum {
+	DBJSONStateValue = 0,	// Expecting any value
+	DBJSONStateArrayFirst,	// After '[', expecting a value or ']'
+	DBJSONStateObjectFirst,	// After '{', expecting a key or '}'
+	DBJSONStateKey,			// After ',' in an object, expecting a key
+	DBJSONStateColon,
+	DBJSONStateAfterValue,	// Expecting ',' or the end of the enclosing container
+	DBJSONStateString,
+	DBJSONStateStringEscape,
+	DBJSONStateStringUnicode,
+	DBJSONStateNumber,
+	DBJSONStateLiteral,
+	DBJSONStateError
+} DBJSONState;
+
+
+@interface DBJSONStreamParser () {
+	DBJSONState _state;
+	NSMutableArray *_stack;
+	NSMutableArray *_keyStack;
+	id _root;
+	BOOL _hasRoot;
+	BOOL _finished;
+
+	char *_token;
+	size_t _tokenLength;
+	size_t _tokenCapacity;
+	BOOL _stringIsKey;
+	uint32_t _unicodeValue;
+	int _unicodeDigits;
+	uint32_t _highSurrogate;
+
+	unsigned long long _offset;
+
+	NSMutableDictionary *_handlers;
+	__unsafe_unretained id _streamingArray;
+	DBJSONStreamValueBlock _streamingHandler;
+}
+
+- (BOOL)failWithReason:(NSString *)reason;
+- (void)appendTokenBytes:(const char *)bytes length:(size_t)length;
+- (void)appendCodePoint:(uint32_t)codePoint;
+- (void)flushSurrogate;
+- (BOOL)addValue:(id)value;
+- (BOOL)pushContainer:(id)container;
+- (BOOL)popContainer;
+- (BOOL)finishString;
+- (BOOL)finishNumber;
+- (BOOL)finishLiteral;
+
+@end
+
+
+@implementation DBJSONStreamParser
+
+- (id)init {
+	if ((self = [super init])) {
+		_stack = [[NSMutableArray alloc] initWithCapacity:8];
+		_keyStack = [[NSMutableArray alloc] initWithCapacity:8];
+		_handlers = [NSMutableDictionary new];
+		_state = DBJSONStateValue;
+	}
+	return self;
+}
+
+- (void)dealloc {
+	free(_token);
+}
+
+- (void)streamElementsOfArrayForKey:(NSString *)key handler:(DBJSONStreamValueBlock)handler {
+	if (!key || !handler) return;
+	[_handlers setObject:[handler copy] forKey:key];
+}
+
+- (id)rootObject {
+	return _finished ? _root : nil;
+}
+
+- (BOOL)parseData:(NSData *)data {
+	if (_state == DBJSONStateError) return NO;
+	if (_finished) return [self failWithReason:@"data after end of input"];
+
+	const char *bytes = [data bytes];
+	size_t length = [data length];
+	size_t i = 0;
+
+	while (i < length) {
+		char c = bytes[i];
+
+		switch (_state) {
+			case DBJSONStateString: {
+				// Copy runs of plain characters in one go, this is where most of the bytes are
+				size_t start = i;
+				while (i < length) {
+					c = bytes[i];
+					if (c == '"' || c == '\\' || (unsigned char)c < 0x20) break;
+					i++;
+				}
+				if (i > start) {
+					[self flushSurrogate];
+					[self appendTokenBytes:bytes + start length:i - start];
+				}
+				if (i == length) break;
+
+				if (c == '"') {
+					if (![self finishString]) return NO;
+				}
+				else if (c == '\\') {
+					_state = DBJSONStateStringEscape;
+				}
+				else {
+					return [self failWithReason:@"control character in string"];
+				}
+				i++;
+				break;
+			}
+
+			case DBJSONStateStringEscape: {
+				char unescaped = 0;
+				switch (c) {
+					case '"': unescaped = '"'; break;
+					case '\\': unescaped = '\\'; break;
+					case '/': unescaped = '/'; break;
+					case 'b': unescaped = '\b'; break;
+					case 'f': unescaped = '\f'; break;
+					case 'n': unescaped = '\n'; break;
+					case 'r': unescaped = '\r'; break;
+					case 't': unescaped = '\t'; break;
+					case 'u':
+						_unicodeValue = 0;
+						_unicodeDigits = 0;
+						_state = DBJSONStateStringUnicode;
+						break;
+					default:
+						return [self failWithReason:@"invalid escape sequence"];
+				}
+				if (unescaped) {
+					[self flushSurrogate];
+					[self appendTokenBytes:&unescaped length:1];
+					_state = DBJSONStateString;
+				}
+				i++;
+				break;
+			}
+
+			case DBJSONStateStringUnicode: {
+				uint32_t digit;
+				if (c >= '0' && c <= '9') digit = c - '0';
+				else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+				else return [self failWithReason:@"invalid \\u escape"];
+
+				_unicodeValue = (_unicodeValue << 4) | digit;
+				if (++_unicodeDigits == 4) {
+					if (_unicodeValue >= 0xD800 && _unicodeValue <= 0xDBFF) {
+						[self flushSurrogate];
+						_highSurrogate = _unicodeValue;
+					}
+					else if (_unicodeValue >= 0xDC00 && _unicodeValue <= 0xDFFF) {
+						if (_highSurrogate) {
+							[self appendCodePoint:0x10000 + ((_highSurrogate - 0xD800) << 10) + (_unicodeValue - 0xDC00)];
+							_highSurrogate = 0;
+						}
+						else {
+							[self appendCodePoint:0xFFFD];
+						}
+					}
+					else {
+						[self flushSurrogate];
+						[self appendCodePoint:_unicodeValue];
+					}
+					_state = DBJSONStateString;
+				}
+				i++;
+				break;
+			}
+
+			case DBJSONStateNumber:
+				if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+					if (_tokenLength >= kDBJSONStreamMaxNumberLength) return [self failWithReason:@"number too long"];
+					[self appendTokenBytes:&c length:1];
+					i++;
+				}
+				else if (![self finishNumber]) {
+					return NO;
+				}
+				// Otherwise reprocess c in the after-value state
+				break;
+
+			case DBJSONStateLiteral:
+				if (c >= 'a' && c <= 'z') {
+					if (_tokenLength >= 5) return [self failWithReason:@"invalid literal"];
+					[self appendTokenBytes:&c length:1];
+					i++;
+				}
+				else if (![self finishLiteral]) {
+					return NO;
+				}
+				break;
+
+			default:
+				if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+					i++;
+					break;
+				}
+
+				switch (_state) {
+					case DBJSONStateArrayFirst:
+						if (c == ']') {
+							if (![self popContainer]) return NO;
+							i++;
+							break;
+						}
+						// Fall through, anything else has to be a value
+					case DBJSONStateValue:
+						if (c == '{') {
+							if (![self pushContainer:[NSMutableDictionary new]]) return NO;
+							_state = DBJSONStateObjectFirst;
+						}
+						else if (c == '[') {
+							if (![self pushContainer:[NSMutableArray new]]) return NO;
+							_state = DBJSONStateArrayFirst;
+						}
+						else if (c == '"') {
+							_tokenLength = 0;
+							_stringIsKey = NO;
+							_state = DBJSONStateString;
+						}
+						else if (c == '-' || (c >= '0' && c <= '9')) {
+							_tokenLength = 0;
+							[self appendTokenBytes:&c length:1];
+							_state = DBJSONStateNumber;
+						}
+						else if (c == 't' || c == 'f' || c == 'n') {
+							_tokenLength = 0;
+							[self appendTokenBytes:&c length:1];
+							_state = DBJSONStateLiteral;
+						}
+						else {
+							return [self failWithReason:@"unexpected character"];
+						}
+						i++;
+						break;
+
+					case DBJSONStateObjectFirst:
+					case DBJSONStateKey:
+						if (c == '"') {
+							_tokenLength = 0;
+							_stringIsKey = YES;
+							_state = DBJSONStateString;
+						}
+						else if (c == '}' && _state == DBJSONStateObjectFirst) {
+							if (![self popContainer]) return NO;
+						}
+						else {
+							return [self failWithReason:@"expected object key"];
+						}
+						i++;
+						break;
+
+					case DBJSONStateColon:
+						if (c != ':') return [self failWithReason:@"expected ':'"];
+						_state = DBJSONStateValue;
+						i++;
+						break;
+
+					case DBJSONStateAfterValue: {
+						id top = [_stack lastObject];
+						if (!top) return [self failWithReason:@"unexpected data after value"];
+
+						BOOL isArray = [top isKindOfClass:[NSArray class]];
+						if (c == ',') {
+							_state = isArray ? DBJSONStateValue : DBJSONStateKey;
+						}
+						else if ((c == ']' && isArray) || (c == '}' && !isArray)) {
+							if (![self popContainer]) return NO;
+						}
+						else {
+							return [self failWithReason:@"expected ',' or end of container"];
+						}
+						i++;
+						break;
+					}
+
+					default:
+						return NO;
+				}
+				break;
+		}
+	}
+
+	_offset += length;
+	return YES;
+}
+
+- (BOOL)finish {
+	if (_state == DBJSONStateError) return NO;
+	if (_finished) return YES;
+
+	if (_state == DBJSONStateNumber) {
+		if (![self finishNumber]) return NO;
+	}
+	else if (_state == DBJSONStateLiteral) {
+		if (![self finishLiteral]) return NO;
+	}
+
+	if (!_hasRoot || [_stack count] > 0 || _state != DBJSONStateAfterValue) {
+		return [self failWithReason:@"unexpected end of input"];
+	}
+
+	_finished = YES;
+	return YES;
+}
+
+
+#pragma mark private methods
+
+- (BOOL)failWithReason:(NSString *)reason {
+	_state = DBJSONStateError;
+	NSString *message = [NSString stringWithFormat:@"Failed to parse JSON: %@ (near byte %llu)", reason, _offset];
+	_error = [NSError errorWithDomain:DBErrorDomain code:DBErrorInvalidResponse userInfo:[NSDictionary dictionaryWithObject:message forKey:@"errorMessage"]];
+	return NO;
+}
+
+- (void)appendTokenBytes:(const char *)bytes length:(size_t)length {
+	if (_tokenLength + length > _tokenCapacity) {
+		size_t capacity = MAX(_tokenCapacity * 2, 64);
+		while (capacity < _tokenLength + length) capacity *= 2;
+		_token = reallocf(_token, capacity);
+		_tokenCapacity = capacity;
+	}
+	memcpy(_token + _tokenLength, bytes, length);
+	_tokenLength += length;
+}
+
+- (void)appendCodePoint:(uint32_t)codePoint {
+	char utf8[4];
+	size_t length;
+	if (codePoint < 0x80) {
+		utf8[0] = (char)codePoint;
+		length = 1;
+	}
+	else if (codePoint < 0x800) {
+		utf8[0] = (char)(0xC0 | (codePoint >> 6));
+		utf8[1] = (char)(0x80 | (codePoint & 0x3F));
+		length = 2;
+	}
+	else if (codePoint < 0x10000) {
+		utf8[0] = (char)(0xE0 | (codePoint >> 12));
+		utf8[1] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		utf8[2] = (char)(0x80 | (codePoint & 0x3F));
+		length = 3;
+	}
+	else {
+		utf8[0] = (char)(0xF0 | (codePoint >> 18));
+		utf8[1] = (char)(0x80 | ((codePoint >> 12) & 0x3F));
+		utf8[2] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		utf8[3] = (char)(0x80 | (codePoint & 0x3F));
+		length = 4;
+	}
+	[self appendTokenBytes:utf8 length:length];
+}
+
+// A high surrogate that isn't followed by a low one is replaced, like NSJSONSerialization does
+- (void)flushSurrogate {
+	if (_highSurrogate) {
+		_highSurrogate = 0;
+		[self appendCodePoint:0xFFFD];
+	}
+}
+
+- (BOOL)addValue:(id)value {
+	id top = [_stack lastObject];
+	if (!top) {
+		_root = value;
+		_hasRoot = YES;
+	}
+	else if (top == _streamingArray) {
+		@autoreleasepool {
+			_streamingHandler(value);
+		}
+	}
+	else if ([top isKindOfClass:[NSMutableArray class]]) {
+		[(NSMutableArray *)top addObject:value];
+	}
+	else {
+		[(NSMutableDictionary *)top setObject:value forKey:[_keyStack lastObject]];
+	}
+
+	_state = DBJSONStateAfterValue;
+	return YES;
+}
+
+- (BOOL)pushContainer:(id)container {
+	if ([_stack count] >= kDBJSONStreamMaxDepth) return [self failWithReason:@"nesting too deep"];
+
+	if (!_streamingArray && [_stack count] == 1 && [container isKindOfClass:[NSArray class]]) {
+		id top = [_stack lastObject];
+		if ([top isKindOfClass:[NSDictionary class]]) {
+			DBJSONStreamValueBlock handler = [_handlers objectForKey:[_keyStack lastObject]];
+			if (handler) {
+				_streamingArray = container;
+				_streamingHandler = handler;
+			}
+		}
+	}
+
+	[_stack addObject:container];
+	[_keyStack addObject:[NSNull null]];
+	return YES;
+}
+
+- (BOOL)popContainer {
+	id container = [_stack lastObject];
+	if (container == _streamingArray) {
+		_streamingArray = nil;
+		_streamingHandler = nil;
+	}
+	[_stack removeLastObject];
+	[_keyStack removeLastObject];
+	return [self addValue:container];
+}
+
+- (BOOL)finishString {
+	[self flushSurrogate];
+
+	NSString *string = [[NSString alloc] initWithBytes:_token length:_tokenLength encoding:NSUTF8StringEncoding];
+	if (!string) return [self failWithReason:@"invalid UTF-8 in string"];
+
+	if (_stringIsKey) {
+		[_keyStack replaceObjectAtIndex:([_keyStack count] - 1) withObject:string];
+		_state = DBJSONStateColon;
+		return YES;
+	}
+	return [self addValue:string];
+}
+
+- (BOOL)finishNumber {
+	char buffer[kDBJSONStreamMaxNumberLength + 1];
+	memcpy(buffer, _token, _tokenLength);
+	buffer[_tokenLength] = '\0';
+
+	BOOL isInteger = (strpbrk(buffer, ".eE") == NULL);
+	char *end = NULL;
+	NSNumber *number = nil;
+
+	if (isInteger) {
+		errno = 0;
+		long long value = strtoll(buffer, &end, 10);
+		if (errno != ERANGE) number = [NSNumber numberWithLongLong:value];
+	}
+	if (!number) {
+		double value = strtod(buffer, &end);
+		number = [NSNumber numberWithDouble:value];
+	}
+
+	if (end != buffer + _tokenLength || buffer[_tokenLength - 1] == '.' || (buffer[0] == '-' && _tokenLength == 1)) {
+		return [self failWithReason:@"invalid number"];
+	}
+	return [self addValue:number];
+}
+
+- (BOOL)finishLiteral {
+	if (_tokenLength == 4 && memcmp(_token, "true", 4) == 0) return [self addValue:[NSNumber numberWithBool:YES]];
+	if (_tokenLength == 5 && memcmp(_token, "false", 5) == 0) return [self addValue:[NSNumber numberWithBool:NO]];
+	if (_tokenLength == 4 && memcmp(_token, "null", 4) == 0) return [self addValue:[NSNull null]];
+	return [self failWithReason:@"invalid literal"];
+}
+
+@end
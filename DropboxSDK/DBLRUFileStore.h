@@ -0,0 +1,48 @@
+//
+//  DBLRUFileStore.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* DBLRUFileStore keeps one file per entry in a directory. When the files add up to more than
+   maxSize, the least recently used ones are deleted. The order is kept in the files' modification
+   times, so it survives a relaunch. The directory is only listed on first use. It is the disk tier
+   of DBMetadataCache and DBThumbnailCache.
+
+   It has no lock of its own: the cache that owns it calls it, and removalBlock runs, under the
+   cache's lock. */
+@interface DBLRUFileStore : NSObject
+
+/* The cache of the given class in the app's Caches directory, in <name>/<userId>, created with
+   initWithDirectory:maxSize: the first time it is asked for */
++ (id)sharedCacheOfClass:(Class)cacheClass name:(NSString *)name userId:(NSString *)userId maxSize:(unsigned long long)maxSize;
+
+/* A digest of root and path, usable as a filename. Paths that differ only in case get the same one. */
++ (NSString *)filenameForPath:(NSString *)path root:(NSString *)root;
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize;
+
+@property (nonatomic, readonly) NSString *directory;
+@property (nonatomic) unsigned long long maxSize; // Lowering it deletes files right away
+@property (nonatomic, readonly) unsigned long long currentSize;
+
+/* Called with the name of every file removed, also by the trimming that follows a write */
+@property (nonatomic, copy) void (^removalBlock)(NSString *filename);
+
+/* Marks the file as just used. Returns NO if there is no such file. */
+- (BOOL)touchFilename:(NSString *)filename;
+
+/* nil if there is no such file; a file that can't be read is removed */
+- (NSData *)dataForFilename:(NSString *)filename;
+
+/* Returns NO, and removes the old file, if data can't be written or is larger than maxSize */
+- (BOOL)setData:(NSData *)data forFilename:(NSString *)filename;
+
+- (void)removeFilename:(NSString *)filename;
+- (void)removeFilenamesPassingTest:(BOOL (^)(NSString *filename))predicate;
+- (void)removeAllFiles;
+
+@end
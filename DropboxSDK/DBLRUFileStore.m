@@ -0,0 +1,220 @@
+//
+//  DBLRUFileStore.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBLRUFileStore.h"
+
+#import <CommonCrypto/CommonDigest.h>
+
+#import "NSString+Dropbox.h"
+
+#include <sys/time.h>
+
+
+@interface DBLRUFileStoreEntry : NSObject
+
+@property (nonatomic) unsigned long long size;
+@property (nonatomic) NSTimeInterval lastAccess;
+
+@end
+
+
+@interface DBLRUFileStore () {
+	NSMutableDictionary *_entries; // Filename to DBLRUFileStoreEntry, loaded on first use
+	unsigned long long _currentSize;
+}
+
+- (void)loadEntriesIfNeeded;
+- (void)removeEntryWithFilename:(NSString *)filename;
+- (void)trimToSize:(unsigned long long)size;
+
+@end
+
+
+@implementation DBLRUFileStore
+
++ (id)sharedCacheOfClass:(Class)cacheClass name:(NSString *)name userId:(NSString *)userId maxSize:(unsigned long long)maxSize {
+	static NSMutableDictionary *caches = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		caches = [NSMutableDictionary new];
+	});
+
+	if (!userId) userId = @"unknown";
+	NSString *relativePath = [name stringByAppendingPathComponent:userId];
+	@synchronized (caches) {
+		id cache = [caches objectForKey:relativePath];
+		if (!cache) {
+			NSString *cachesDirectory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+			cache = [[cacheClass alloc] initWithDirectory:[cachesDirectory stringByAppendingPathComponent:relativePath] maxSize:maxSize];
+			[caches setObject:cache forKey:relativePath];
+		}
+		return cache;
+	}
+}
+
++ (NSString *)filenameForPath:(NSString *)path root:(NSString *)root {
+	NSString *key = [NSString stringWithFormat:@"%@:%@", root, [path normalizedDropboxPath]];
+	NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+
+	unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+	CC_SHA1([keyData bytes], (CC_LONG)[keyData length], digest);
+
+	NSMutableString *filename = [NSMutableString stringWithCapacity:2 * CC_SHA1_DIGEST_LENGTH];
+	for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+		[filename appendFormat:@"%02x", digest[i]];
+	}
+	return filename;
+}
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize {
+	if ((self = [super init])) {
+		_directory = [directory copy];
+		_maxSize = maxSize;
+	}
+	return self;
+}
+
+- (void)setMaxSize:(unsigned long long)maxSize {
+	_maxSize = maxSize;
+	[self loadEntriesIfNeeded];
+	if (_currentSize > _maxSize) [self trimToSize:_maxSize];
+}
+
+- (unsigned long long)currentSize {
+	[self loadEntriesIfNeeded];
+	return _currentSize;
+}
+
+- (BOOL)touchFilename:(NSString *)filename {
+	[self loadEntriesIfNeeded];
+
+	DBLRUFileStoreEntry *entry = [_entries objectForKey:filename];
+	if (!entry) return NO;
+
+	entry.lastAccess = [NSDate timeIntervalSinceReferenceDate];
+	utimes([[_directory stringByAppendingPathComponent:filename] fileSystemRepresentation], NULL); // So the order survives a relaunch
+	return YES;
+}
+
+- (NSData *)dataForFilename:(NSString *)filename {
+	[self loadEntriesIfNeeded];
+	if (![_entries objectForKey:filename]) return nil;
+
+	NSData *data = [NSData dataWithContentsOfFile:[_directory stringByAppendingPathComponent:filename]];
+	if (!data) [self removeEntryWithFilename:filename];
+	return data;
+}
+
+- (BOOL)setData:(NSData *)data forFilename:(NSString *)filename {
+	[self loadEntriesIfNeeded];
+
+	if ([data length] > _maxSize) {
+		[self removeEntryWithFilename:filename];
+		return NO;
+	}
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:nil];
+	if (![data writeToFile:[_directory stringByAppendingPathComponent:filename] atomically:YES]) {
+		[self removeEntryWithFilename:filename];
+		return NO;
+	}
+
+	DBLRUFileStoreEntry *entry = [_entries objectForKey:filename];
+	if (entry) {
+		_currentSize -= entry.size;
+	}
+	else {
+		entry = [DBLRUFileStoreEntry new];
+		[_entries setObject:entry forKey:filename];
+	}
+	entry.size = [data length];
+	entry.lastAccess = [NSDate timeIntervalSinceReferenceDate];
+	_currentSize += entry.size;
+
+	// Trim a little further than needed so a full store doesn't sort its entries on every write
+	if (_currentSize > _maxSize) [self trimToSize:_maxSize - _maxSize / 4];
+	return YES;
+}
+
+- (void)removeFilename:(NSString *)filename {
+	[self loadEntriesIfNeeded];
+	[self removeEntryWithFilename:filename];
+}
+
+- (void)removeFilenamesPassingTest:(BOOL (^)(NSString *filename))predicate {
+	[self loadEntriesIfNeeded];
+	for (NSString *filename in [_entries allKeys]) {
+		if (predicate(filename)) [self removeEntryWithFilename:filename];
+	}
+}
+
+- (void)removeAllFiles {
+	[self loadEntriesIfNeeded];
+	NSArray *filenames = [_entries allKeys];
+
+	[[NSFileManager defaultManager] removeItemAtPath:_directory error:nil];
+	_entries = [NSMutableDictionary new];
+	_currentSize = 0;
+
+	if (_removalBlock) {
+		for (NSString *filename in filenames) _removalBlock(filename);
+	}
+}
+
+
+#pragma mark private methods
+
+- (void)loadEntriesIfNeeded {
+	if (_entries) return;
+
+	_entries = [NSMutableDictionary new];
+	_currentSize = 0;
+
+	NSArray *keys = [NSArray arrayWithObjects:NSURLFileSizeKey, NSURLContentModificationDateKey, nil];
+	NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[NSURL fileURLWithPath:_directory] includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+
+	for (NSURL *file in files) {
+		NSDictionary *values = [file resourceValuesForKeys:keys error:nil];
+
+		DBLRUFileStoreEntry *entry = [DBLRUFileStoreEntry new];
+		entry.size = [[values objectForKey:NSURLFileSizeKey] unsignedLongLongValue];
+		entry.lastAccess = [[values objectForKey:NSURLContentModificationDateKey] timeIntervalSinceReferenceDate];
+
+		[_entries setObject:entry forKey:[file lastPathComponent]];
+		_currentSize += entry.size;
+	}
+}
+
+- (void)removeEntryWithFilename:(NSString *)filename {
+	DBLRUFileStoreEntry *entry = [_entries objectForKey:filename];
+	if (entry) {
+		_currentSize -= entry.size;
+		[_entries removeObjectForKey:filename];
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:[_directory stringByAppendingPathComponent:filename] error:nil];
+	if (_removalBlock) _removalBlock(filename);
+}
+
+- (void)trimToSize:(unsigned long long)size {
+	NSArray *filenames = [_entries keysSortedByValueUsingComparator:^NSComparisonResult(DBLRUFileStoreEntry *a, DBLRUFileStoreEntry *b) {
+		if (a.lastAccess < b.lastAccess) return NSOrderedAscending;
+		if (a.lastAccess > b.lastAccess) return NSOrderedDescending;
+		return NSOrderedSame;
+	}];
+
+	for (NSString *filename in filenames) {
+		if (_currentSize <= size) break;
+		[self removeEntryWithFilename:filename];
+	}
+}
+
+@end
+
+
+@implementation DBLRUFileStoreEntry
+@end
@@ -7,13 +7,37 @@
 //
 
 
+typedef enum {
+	DBMetadataSortByName, // Case-insensitive, numbers compared by value
+	DBMetadataSortByModifiedDate,
+	DBMetadataSortBySize,
+} DBMetadataSortKey;
+
 @interface DBMetadata : NSObject <NSCoding>
 
++ (NSDateFormatter *)dateFormatter; // Parses the dates the API returns, one instance per thread
+
+/* Parses dates in the API's format ("Sat, 21 Aug 2010 22:31:20 +0000") without going through
+   NSDateFormatter; anything else is handed to dateFormatter. getSeconds: returns NO if neither
+   can make sense of the string. */
++ (NSDate *)dateFromString:(NSString *)string;
++ (BOOL)getSeconds:(int64_t *)seconds fromDateString:(NSString *)string;
+
+/* Formats a date the way the API does, in UTC */
++ (NSString *)stringFromDate:(NSDate *)date;
+
 - (id)initWithDictionary:(NSDictionary *)dict;
 - (NSDictionary *)dictionary;
 
+/* Looks up a child of a folder by name, ignoring case as Dropbox does */
 - (DBMetadata *)metadataForFilename:(NSString *)filename;
 
+/* Views of a folder's contents, built on first use and kept until contents changes. Sorts are
+   ascending, ties broken by name; walk them with reverseObjectEnumerator for descending order. */
+- (NSArray *)contentsSortedBy:(DBMetadataSortKey)sortKey;
+@property (nonatomic, readonly) NSArray* directoryContents; // Sorted by name
+@property (nonatomic, readonly) NSArray* fileContents; // Sorted by name
+
 @property (nonatomic, readonly) BOOL thumbnailExists;
 @property (nonatomic, readonly) long long totalBytes;
 @property (nonatomic, readonly) NSDate* lastModifiedDate;
@@ -8,13 +8,133 @@
 
 #import "DBMetadata.h"
 
+#include <libkern/OSAtomic.h>
+#include <time.h>
+
+static const char *kDBMonthNames[12] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *kDBDayNames[7] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+// Days between 1970-01-01 and the given date in the proleptic Gregorian calendar
+static int64_t DBDaysFromCivil(int64_t year, int month, int day) {
+	year -= month <= 2;
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t yearOfEra = year - era * 400;
+	int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
+
+static BOOL DBParseDigits(const char **cursor, const char *end, int count, int *value) {
+	if (end - *cursor < count) return NO;
+	int result = 0;
+	for (int i = 0; i < count; i++) {
+		char c = (*cursor)[i];
+		if (c < '0' || c > '9') return NO;
+		result = result * 10 + (c - '0');
+	}
+	*cursor += count;
+	*value = result;
+	return YES;
+}
+
+static BOOL DBParseChar(const char **cursor, const char *end, char c) {
+	if (*cursor >= end || **cursor != c) return NO;
+	(*cursor)++;
+	return YES;
+}
+
+/* Parses "EEE, dd MMM yyyy HH:mm:ss Z" with a numeric zone, the only form the API sends. The
+   weekday is optional; it must be a day name but isn't checked against the date, like
+   NSDateFormatter. Returns NO for anything else, including leap seconds, so the caller can fall
+   back to the formatter. */
+static BOOL DBParseRFC1123Date(const char *string, size_t length, int64_t *seconds) {
+	const char *cursor = string;
+	const char *end = string + length;
+
+	if (end - cursor >= 5 && cursor[3] == ',') {
+		int weekday = 0;
+		for (; weekday < 7; weekday++) {
+			if (strncasecmp(cursor, kDBDayNames[weekday], 3) == 0) break;
+		}
+		if (weekday == 7) return NO;
+		cursor += 4;
+		if (!DBParseChar(&cursor, end, ' ')) return NO;
+	}
+
+	int day;
+	if (!DBParseDigits(&cursor, end, 2, &day) && !DBParseDigits(&cursor, end, 1, &day)) return NO;
+	if (!DBParseChar(&cursor, end, ' ')) return NO;
+
+	if (end - cursor < 4) return NO;
+	int month = 0;
+	for (; month < 12; month++) {
+		if (strncasecmp(cursor, kDBMonthNames[month], 3) == 0) break;
+	}
+	if (month == 12) return NO;
+	cursor += 3;
+	if (!DBParseChar(&cursor, end, ' ')) return NO;
+
+	int year, hour, minute, second;
+	if (!DBParseDigits(&cursor, end, 4, &year)) return NO;
+	if (!DBParseChar(&cursor, end, ' ')) return NO;
+	if (!DBParseDigits(&cursor, end, 2, &hour) || !DBParseChar(&cursor, end, ':')) return NO;
+	if (!DBParseDigits(&cursor, end, 2, &minute) || !DBParseChar(&cursor, end, ':')) return NO;
+	if (!DBParseDigits(&cursor, end, 2, &second)) return NO;
+	if (!DBParseChar(&cursor, end, ' ')) return NO;
+
+	if (cursor >= end || (*cursor != '+' && *cursor != '-')) return NO;
+	int sign = *cursor++ == '-' ? -1 : 1;
+	int zoneHours, zoneMinutes;
+	if (!DBParseDigits(&cursor, end, 2, &zoneHours) || !DBParseDigits(&cursor, end, 2, &zoneMinutes)) return NO;
+	if (cursor != end) return NO;
+
+	static const int daysInMonth[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	BOOL leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	if (day < 1 || day > daysInMonth[month] || (month == 1 && day == 29 && !leapYear)) return NO;
+	if (hour > 23 || minute > 59 || second > 59 || zoneMinutes > 59) return NO;
+
+	int64_t days = DBDaysFromCivil(year, month + 1, day);
+	*seconds = days * 86400 + hour * 3600 + minute * 60 + second - sign * (zoneHours * 3600 + zoneMinutes * 60);
+	return YES;
+}
+
 @interface DBMetadata () {
-	NSMutableDictionary *_contentsByFilename;
+	NSMutableDictionary *_contentsByFilename; // Keyed by lowercase filename
 	NSMutableArray *_contents;
+	NSMutableDictionary *_contentViews; // Sorted and partitioned copies of _contents
+	BOOL _contentsChanged; // _dict still has the contents from before setContents:
+
+	// Fields decoded from _dict on first use. Metadata objects are shared between threads, so the
+	// flags are only set, behind a barrier, once every field they cover has been written.
+	volatile BOOL _fieldsDecoded;
+	volatile BOOL _datesDecoded;
+	BOOL _thumbnailExists;
+	BOOL _isDirectory;
+	BOOL _isDeleted;
+	long long _totalBytes;
+	long long _revision;
+	NSString *_path;
+	NSString *_filename;
+	NSString *_hash;
+	NSString *_humanReadableSize;
+	NSString *_root;
+	NSString *_icon;
+	NSString *_rev;
+	NSDate *_lastModifiedDate;
+	NSDate *_clientMtime;
 }
 
 @property (nonatomic, strong) NSDictionary * dict;
-@property (nonatomic, strong) NSDate * cachedClientMtime;
+
+- (void)decodeFieldsIfNeeded;
+- (void)decodeDatesIfNeeded;
+- (NSArray *)contentViewForKey:(NSString *)key;
+
 @end
 
 @implementation DBMetadata
@@ -36,6 +156,38 @@
     return dateFormatter;
 }
 
++ (NSDate *)dateFromString:(NSString *)string {
+	int64_t seconds;
+	if ([string isKindOfClass:[NSString class]] && [self getSeconds:&seconds fromDateString:string]) {
+		return [NSDate dateWithTimeIntervalSince1970:seconds];
+	}
+	return nil;
+}
+
++ (BOOL)getSeconds:(int64_t *)seconds fromDateString:(NSString *)string {
+	char buffer[64];
+	const char *bytes = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingASCII);
+	if (!bytes && [string getCString:buffer maxLength:sizeof(buffer) encoding:NSASCIIStringEncoding]) {
+		bytes = buffer;
+	}
+	if (bytes && DBParseRFC1123Date(bytes, strlen(bytes), seconds)) return YES;
+
+	NSDate *date = [[self dateFormatter] dateFromString:string];
+	if (!date) return NO;
+	*seconds = (int64_t)[date timeIntervalSince1970];
+	return YES;
+}
+
++ (NSString *)stringFromDate:(NSDate *)date {
+	time_t time = (time_t)floor([date timeIntervalSince1970]);
+	struct tm components;
+	if (!gmtime_r(&time, &components)) return nil;
+
+	return [NSString stringWithFormat:@"%s, %02d %s %04d %02d:%02d:%02d +0000",
+			kDBDayNames[components.tm_wday], components.tm_mday, kDBMonthNames[components.tm_mon],
+			components.tm_year + 1900, components.tm_hour, components.tm_min, components.tm_sec];
+}
+
 - (id)initWithDictionary:(NSDictionary*)dictionary {
     if ((self = [super init])) {
 		_dict = dictionary;
@@ -45,112 +197,149 @@
 }
 
 - (NSDictionary *)dictionary {
-	return _dict;
+	@synchronized (self) {
+		// setContents: only swaps the children; their dictionaries are collected when someone asks
+		if (_contentsChanged) {
+			NSMutableArray *dicts = [[NSMutableArray alloc] initWithCapacity:[_contents count]];
+			for (DBMetadata *metadata in _contents) {
+				[dicts addObject:[metadata dictionary]];
+			}
+
+			NSMutableDictionary *mutableDict = [_dict mutableCopy];
+			mutableDict[@"contents"] = dicts;
+
+			_dict = mutableDict;
+			_contentsChanged = NO;
+		}
+		return _dict;
+	}
 }
 
 - (DBMetadata *)metadataForFilename:(NSString *)filename {
-	if (_contentsByFilename == nil) {
-		NSArray *contents = [self contents];
-		_contentsByFilename = [[NSMutableDictionary alloc] initWithCapacity:(1 + [contents count])];
-		for (DBMetadata *m in [self contents]) {
-			if (m.filename) [_contentsByFilename setObject:m forKey:m.filename];
+	@synchronized (self) {
+		if (_contentsByFilename == nil) {
+			NSArray *contents = [self contents];
+			_contentsByFilename = [[NSMutableDictionary alloc] initWithCapacity:(1 + [contents count])];
+			for (DBMetadata *m in contents) {
+				if (m.filename) [_contentsByFilename setObject:m forKey:[m.filename lowercaseString]];
+			}
 		}
+
+		return [_contentsByFilename objectForKey:[filename lowercaseString]];
+	}
+}
+
+- (NSArray *)contentsSortedBy:(DBMetadataSortKey)sortKey {
+	switch (sortKey) {
+		case DBMetadataSortByModifiedDate:
+			return [self contentViewForKey:@"modified"];
+		case DBMetadataSortBySize:
+			return [self contentViewForKey:@"bytes"];
+		case DBMetadataSortByName:
+		default:
+			return [self contentViewForKey:@"name"];
 	}
+}
 
-	return [_contentsByFilename objectForKey:filename];
+- (NSArray *)directoryContents {
+	return [self contentViewForKey:@"directories"];
+}
+
+- (NSArray *)fileContents {
+	return [self contentViewForKey:@"files"];
 }
 
 
 - (BOOL)thumbnailExists {
-	return [[_dict objectForKey:@"thumb_exists"] boolValue];
+	[self decodeFieldsIfNeeded];
+	return _thumbnailExists;
 }
 
 - (long long)totalBytes {
-	return [[_dict objectForKey:@"bytes"] longLongValue];
+	[self decodeFieldsIfNeeded];
+	return _totalBytes;
 }
 
 - (NSDate *)lastModifiedDate {
-	if ([_dict objectForKey:@"modified"]) {
-		return [[DBMetadata dateFormatter] dateFromString:[_dict objectForKey:@"modified"]];
-	}
-
-	return nil;
+	[self decodeDatesIfNeeded];
+	return _lastModifiedDate;
 }
 
 - (NSDate *)clientMtime {
-	if (_cachedClientMtime) return _cachedClientMtime;
-	
  	// file's mtime for display purposes only
-	if ([_dict objectForKey:@"client_mtime"]) {
-		_cachedClientMtime = [[DBMetadata dateFormatter] dateFromString:[_dict objectForKey:@"client_mtime"]];
-	}
-	
-	return _cachedClientMtime;
+	[self decodeDatesIfNeeded];
+	return _clientMtime;
 }
 
 - (NSString *)path {
-	return [_dict objectForKey:@"path"];
+	[self decodeFieldsIfNeeded];
+	return _path;
 }
 
 - (BOOL)isDirectory {
-	return [[_dict objectForKey:@"is_dir"] boolValue];
+	[self decodeFieldsIfNeeded];
+	return _isDirectory;
 }
 
 - (NSArray *)contents {
-	if (_contents) return _contents;
-	if (![_dict objectForKey:@"contents"]) return nil;
-
-	NSArray *subfileDicts = [_dict objectForKey:@"contents"];
-	_contents = [[NSMutableArray alloc] initWithCapacity:[subfileDicts count]];
-	for (NSDictionary *subfileDict in subfileDicts) {
-		DBMetadata *subfile = [[DBMetadata alloc] initWithDictionary:subfileDict];
-		[_contents addObject:subfile];
-	}
+	@synchronized (self) {
+		if (_contents || _contentsChanged) return _contents;
+		if (![_dict objectForKey:@"contents"]) return nil;
+
+		NSArray *subfileDicts = [_dict objectForKey:@"contents"];
+		_contents = [[NSMutableArray alloc] initWithCapacity:[subfileDicts count]];
+		for (NSDictionary *subfileDict in subfileDicts) {
+			DBMetadata *subfile = [[DBMetadata alloc] initWithDictionary:subfileDict];
+			[_contents addObject:subfile];
+		}
 
-	return _contents;
+		return _contents;
+	}
 }
 
 - (void)setContents:(NSArray *)contents {
-	_contents = [contents mutableCopy];
-	
-	NSMutableArray *dicts = [[NSMutableArray alloc] initWithCapacity:[_contents count]];
-	for (DBMetadata *metadata in _contents) {
-		[dicts addObject:[metadata dictionary]];
+	@synchronized (self) {
+		_contents = [contents mutableCopy];
+		_contentsChanged = YES;
+		_contentsByFilename = nil;
+		_contentViews = nil;
 	}
-	
-	NSMutableDictionary *mutableDict = [_dict mutableCopy];
-	mutableDict[@"contents"] = dicts;
-	
-	_dict = mutableDict;
 }
 
 - (NSString *)hash {
-	return [_dict objectForKey:@"hash"];
+	[self decodeFieldsIfNeeded];
+	return _hash;
 }
 
 - (NSString *)humanReadableSize {
-	return [_dict objectForKey:@"size"];
+	[self decodeFieldsIfNeeded];
+	return _humanReadableSize;
 }
 
 - (NSString *)root {
-	return [_dict objectForKey:@"root"];
+	[self decodeFieldsIfNeeded];
+	return _root;
 }
 
 - (NSString *)icon {
-	return [_dict objectForKey:@"icon"];
+	[self decodeFieldsIfNeeded];
+	return _icon;
 }
 
 - (NSString *)rev {
-	return [_dict objectForKey:@"rev"];
+	[self decodeFieldsIfNeeded];
+	return _rev;
 }
 
 - (long long)revision {
  	// Deprecated; will be removed in version 2. Use rev whenever possible
-	return [[_dict objectForKey:@"revision"] longLongValue];
+	[self decodeFieldsIfNeeded];
+	return _revision;
 }
 
 - (BOOL)isDeleted {
-	return [[_dict objectForKey:@"is_deleted"] boolValue];
+	[self decodeFieldsIfNeeded];
+	return _isDeleted;
 }
 
 - (BOOL)isEqual:(id)object {
@@ -161,7 +350,98 @@
 }
 
 - (NSString *)filename {
-	return [self.path lastPathComponent];
+	[self decodeFieldsIfNeeded];
+	return _filename;
+}
+
+#pragma mark private methods
+
+- (NSArray *)contentViewForKey:(NSString *)key {
+	@synchronized (self) {
+		NSArray *view = [_contentViews objectForKey:key];
+		if (view) return view;
+
+		NSArray *contents = [self contents];
+		if (!contents) return nil;
+		if (!_contentViews) _contentViews = [NSMutableDictionary new];
+
+		NSComparator byName = ^NSComparisonResult(DBMetadata *a, DBMetadata *b) {
+			return [a.filename compare:b.filename options:NSCaseInsensitiveSearch | NSNumericSearch];
+		};
+
+		if ([key isEqualToString:@"name"]) {
+			view = [contents sortedArrayUsingComparator:byName];
+		}
+		else if ([key isEqualToString:@"modified"]) {
+			view = [[self contentViewForKey:@"name"] sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(DBMetadata *a, DBMetadata *b) {
+				NSTimeInterval aTime = [a.lastModifiedDate timeIntervalSinceReferenceDate];
+				NSTimeInterval bTime = [b.lastModifiedDate timeIntervalSinceReferenceDate];
+				if (aTime < bTime) return NSOrderedAscending;
+				if (aTime > bTime) return NSOrderedDescending;
+				return NSOrderedSame;
+			}];
+		}
+		else if ([key isEqualToString:@"bytes"]) {
+			view = [[self contentViewForKey:@"name"] sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(DBMetadata *a, DBMetadata *b) {
+				long long aBytes = a.totalBytes, bBytes = b.totalBytes;
+				if (aBytes < bBytes) return NSOrderedAscending;
+				if (aBytes > bBytes) return NSOrderedDescending;
+				return NSOrderedSame;
+			}];
+		}
+		else {
+			NSMutableArray *directories = [NSMutableArray new];
+			NSMutableArray *files = [NSMutableArray new];
+			for (DBMetadata *m in [self contentViewForKey:@"name"]) {
+				[(m.isDirectory ? directories : files) addObject:m];
+			}
+			[_contentViews setObject:directories forKey:@"directories"];
+			[_contentViews setObject:files forKey:@"files"];
+			return [_contentViews objectForKey:key];
+		}
+
+		[_contentViews setObject:view forKey:key];
+		return view;
+	}
+}
+
+- (void)decodeFieldsIfNeeded {
+	if (_fieldsDecoded) return;
+
+	@synchronized (self) {
+		if (_fieldsDecoded) return;
+
+		_thumbnailExists = [[_dict objectForKey:@"thumb_exists"] boolValue];
+		_isDirectory = [[_dict objectForKey:@"is_dir"] boolValue];
+		_isDeleted = [[_dict objectForKey:@"is_deleted"] boolValue];
+		_totalBytes = [[_dict objectForKey:@"bytes"] longLongValue];
+		_revision = [[_dict objectForKey:@"revision"] longLongValue];
+		_path = [_dict objectForKey:@"path"];
+		_filename = [_path lastPathComponent];
+		_hash = [_dict objectForKey:@"hash"];
+		_humanReadableSize = [_dict objectForKey:@"size"];
+		_root = [_dict objectForKey:@"root"];
+		_icon = [_dict objectForKey:@"icon"];
+		_rev = [_dict objectForKey:@"rev"];
+
+		OSMemoryBarrier();
+		_fieldsDecoded = YES;
+	}
+}
+
+// Dates are decoded separately, as most listings never look at them
+- (void)decodeDatesIfNeeded {
+	if (_datesDecoded) return;
+
+	@synchronized (self) {
+		if (_datesDecoded) return;
+
+		_lastModifiedDate = [DBMetadata dateFromString:[_dict objectForKey:@"modified"]];
+		_clientMtime = [DBMetadata dateFromString:[_dict objectForKey:@"client_mtime"]];
+
+		OSMemoryBarrier();
+		_datesDecoded = YES;
+	}
 }
 
 #pragma mark NSCoding methods
@@ -174,7 +454,7 @@
 }
 
 - (void)encodeWithCoder:(NSCoder*)coder {
-	[coder encodeObject:_dict forKey:@"dict"];
+	[coder encodeObject:[self dictionary] forKey:@"dict"];
 }
 
 @end
@@ -0,0 +1,33 @@
+//
+//  DBMetadataCache.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBMetadata;
+
+/* DBMetadataCache keeps the metadata of recently loaded paths on disk, one small file per root and
+   path named after a digest of the two, so a lookup reads only the entry it needs. When the files
+   add up to more than maxSize, the least recently used ones are deleted. Set it as the metadataCache
+   of a DBRestClient to have loadMetadata: revalidate against the cached hash on its own. The cache
+   doesn't know about accounts: use a separate directory per user. */
+@interface DBMetadataCache : NSObject
+
+/* A cache in the app's Caches directory for the given user, 10 MB */
++ (DBMetadataCache *)cacheForUserId:(NSString *)userId;
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize;
+
+@property (nonatomic, readonly) NSString *directory;
+@property (nonatomic) unsigned long long maxSize;
+@property (nonatomic, readonly) unsigned long long currentSize;
+
+- (DBMetadata *)metadataForPath:(NSString *)path root:(NSString *)root;
+- (void)setMetadata:(DBMetadata *)metadata forPath:(NSString *)path root:(NSString *)root;
+- (void)removeMetadataForPath:(NSString *)path root:(NSString *)root;
+- (void)removeAllMetadata;
+
+@end
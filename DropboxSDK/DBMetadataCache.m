@@ -0,0 +1,122 @@
+//
+//  DBMetadataCache.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBMetadataCache.h"
+
+#import "DBLog.h"
+#import "DBLRUFileStore.h"
+#import "DBMetadata.h"
+
+#define kDBMetadataCacheDefaultMaxSize (10 * 1024 * 1024)
+
+
+@interface DBMetadataCache () {
+	DBLRUFileStore *_store;
+	NSCache *_memoryCache; // Filename to DBMetadata
+}
+
+@end
+
+
+@implementation DBMetadataCache
+
++ (DBMetadataCache *)cacheForUserId:(NSString *)userId {
+	return [DBLRUFileStore sharedCacheOfClass:self name:@"DropboxMetadata" userId:userId maxSize:kDBMetadataCacheDefaultMaxSize];
+}
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize {
+	if ((self = [super init])) {
+		_memoryCache = [NSCache new];
+		_memoryCache.countLimit = 64;
+
+		NSCache *memoryCache = _memoryCache;
+		_store = [[DBLRUFileStore alloc] initWithDirectory:directory maxSize:maxSize];
+		_store.removalBlock = ^(NSString *filename) {
+			[memoryCache removeObjectForKey:filename];
+		};
+	}
+	return self;
+}
+
+- (NSString *)directory {
+	return _store.directory;
+}
+
+- (unsigned long long)maxSize {
+	@synchronized (self) {
+		return _store.maxSize;
+	}
+}
+
+- (void)setMaxSize:(unsigned long long)maxSize {
+	@synchronized (self) {
+		_store.maxSize = maxSize;
+	}
+}
+
+- (unsigned long long)currentSize {
+	@synchronized (self) {
+		return _store.currentSize;
+	}
+}
+
+- (DBMetadata *)metadataForPath:(NSString *)path root:(NSString *)root {
+	NSString *filename = [DBLRUFileStore filenameForPath:path root:root];
+
+	@synchronized (self) {
+		if (![_store touchFilename:filename]) return nil;
+
+		DBMetadata *metadata = [_memoryCache objectForKey:filename];
+		if (metadata) return metadata;
+
+		NSData *data = [_store dataForFilename:filename];
+		NSDictionary *dict = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+		if (![dict isKindOfClass:[NSDictionary class]]) {
+			DBLogWarning(@"DropboxSDK: dropping unreadable metadata cache entry for %@", path);
+			[_store removeFilename:filename];
+			return nil;
+		}
+
+		metadata = [[DBMetadata alloc] initWithDictionary:dict];
+		[_memoryCache setObject:metadata forKey:filename];
+		return metadata;
+	}
+}
+
+- (void)setMetadata:(DBMetadata *)metadata forPath:(NSString *)path root:(NSString *)root {
+	NSDictionary *dict = [metadata dictionary];
+	if (!dict) return;
+
+	NSData *data = [NSJSONSerialization dataWithJSONObject:dict options:0 error:nil];
+	if (!data) return;
+
+	NSString *filename = [DBLRUFileStore filenameForPath:path root:root];
+
+	@synchronized (self) {
+		if (![_store setData:data forFilename:filename]) {
+			DBLogWarning(@"DropboxSDK: unable to write metadata cache entry for %@", path);
+			return;
+		}
+		[_memoryCache setObject:metadata forKey:filename];
+	}
+}
+
+- (void)removeMetadataForPath:(NSString *)path root:(NSString *)root {
+	NSString *filename = [DBLRUFileStore filenameForPath:path root:root];
+
+	@synchronized (self) {
+		[_store removeFilename:filename];
+	}
+}
+
+- (void)removeAllMetadata {
+	@synchronized (self) {
+		[_store removeAllFiles];
+	}
+}
+
+@end
@@ -7,20 +7,39 @@
 //
 //	March 2012. Roustem Karimov. Changed DBRequest to subclass NSOperation
 
+@class DBHostConcurrencyGate;
+@class DBJSONStreamParser;
 @class DBRequest;
+@class DBRequestMetrics;
+@class DBRetryPolicy;
+@protocol DBDownloadSink;
 @protocol DBNetworkRequestDelegate;
 
 typedef void (^DBRequestBlock)(DBRequest *request);
 
+/* Lower values are served first, both by DBRestClient's queues and by the host gate */
+typedef enum {
+	DBRequestPriorityInteractive, // Someone is waiting for it on screen
+	DBRequestPriorityNormal,
+	DBRequestPriorityBulk, // Transfers and syncing in the background
+} DBRequestPriority;
+typedef void (^DBRequestMetricsBlock)(DBRequestMetrics *metrics);
+
 /* DBRestRequest will download a URL either into a file that you provied the name to or it will
    create an NSData object with the result. When it has completed downloading the URL, it will
-   notify the target with a selector that takes the DBRestRequest as the only parameter. */
+   notify the target with a selector that takes the DBRestRequest as the only parameter.
+   DBRequest is a concurrent operation: the connection runs on one of the shared DBConnectionEngine
+   run loops and the completion blocks are called on a global dispatch queue. */
 @interface DBRequest : NSOperation
 
 /*  Set this to get called when _any_ request starts or stops. This should hook into whatever
-    network activity indicator system you have. */
+    network activity indicator system you have. Every start is matched by a stop, also for
+    cancelled requests; both may be called on any thread. */
 + (void)setNetworkRequestDelegate:(id<DBNetworkRequestDelegate>)delegate;
 
+/* Deletes the hidden files that resumable downloads into directory have left behind */
++ (void)removePartialDownloadsInDirectory:(NSString *)directory;
+
 /*  This constructor downloads the URL into the resultData object */
 - (id)initWithURLRequest:(NSURLRequest *)aRequest completionBlock:(DBRequestBlock)completionBlock;
 
@@ -32,12 +51,35 @@ typedef void (^DBRequestBlock)(DBRequest *request);
 - (id)parseResponseAsType:(Class)cls;
 
 @property (nonatomic) NSString* resultFilename; // The file to put the HTTP body in, otherwise body is stored in resultData
+@property (nonatomic) BOOL resumable; // If the download of resultFilename fails, keep what arrived and continue from there with a Range request next time
+@property (nonatomic) long long rangeOffset; // If rangeLength is set, only those bytes are requested and written at rangeOffset into resultFilename, which must exist
+@property (nonatomic) long long rangeLength;
+@property (nonatomic) DBJSONStreamParser* streamParser; // If set, a successful JSON body is fed to it as it arrives instead of being stored in resultData
+@property (nonatomic) id<DBDownloadSink> downloadSink; // If set, a 200 body is written to it as it arrives instead of to resultFilename or resultData
+@property (nonatomic) NSString* sourceFilename; // The file the HTTPBodyStream reads, so a retry can read it again
 @property (nonatomic) NSDictionary* userInfo;
+@property (nonatomic) DBHostConcurrencyGate* hostGate; // Where the request waits for a slot on its host, default is the shared gate
+
+/* Default is DBRequestPriorityNormal. Raising it while the request is still queued or waiting for a
+   host slot moves it ahead of the requests of lower priority. */
+@property (atomic) DBRequestPriority priority;
 
 @property (nonatomic, copy) DBRequestBlock completionBlock;
 @property (nonatomic, copy) DBRequestBlock failureBlock;
 @property (nonatomic, copy) DBRequestBlock uploadProgressBlock;
 @property (nonatomic, copy) DBRequestBlock downloadProgressBlock;
+@property (nonatomic, copy) DBRequestMetricsBlock metricsBlock; // Called just before the completion or failure block, not for cancelled requests
+
+/* If retryPolicy considers a failure temporary, a copy of the request is made and passed to
+   retryBlock right away, with retryDelay set to the policy's delay; retryBlock must start it once
+   the delay is up, e.g. by adding it to a queue. The completion or failure block is then called by
+   that copy instead, and cancelling this request cancels the copy. A resumable download continues
+   where the failed attempt stopped. This request finishes as soon as the copy has been handed to
+   retryBlock, so it doesn't hold its queue's slot while the copy waits. */
+@property (nonatomic) DBRetryPolicy* retryPolicy;
+@property (nonatomic, copy) DBRequestBlock retryBlock;
+@property (nonatomic, readonly) NSUInteger retryCount; // Number of attempts before this one
+@property (nonatomic, readonly) NSTimeInterval retryDelay; // How long to wait before starting this retry
 
 @property (nonatomic, readonly) NSURLRequest* request;
 @property (nonatomic, readonly) NSHTTPURLResponse* response;
@@ -48,13 +90,14 @@ typedef void (^DBRequestBlock)(DBRequest *request);
 @property (nonatomic, readonly) NSData* resultData;
 
 @property (nonatomic, readonly) NSString* resultString;
-@property (nonatomic, readonly) NSObject* resultJSON;
+@property (nonatomic, readonly) NSObject* resultJSON; // Mutable containers, parsed once and shared by every caller
 @property (nonatomic, readonly) NSError* error;
+@property (nonatomic, readonly) DBRequestMetrics* metrics; // Set once the request has stopped
 
 @property (nonatomic, readonly, getter = isCancelled) BOOL cancelled;
 
 // NSOperation methods
-- (void)main;
+- (void)start;
 
 @end
 
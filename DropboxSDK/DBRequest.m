@@ -7,10 +7,25 @@
 //
 
 #import "DBRequest.h"
+#import "DBConnectionEngine.h"
+#import "DBHostConcurrencyGate.h"
+#import "DBDownloadSink.h"
 #import "DBLog.h"
 #import "DBError.h"
+#import "DBFileWriter.h"
+#import "DBJSONStreamParser.h"
+#import "DBRequestMetrics.h"
+#import "DBRetryPolicy.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/xattr.h>
+
+// The ETag of the response a partial download came from, so it is only continued if the file is unchanged
+static const char *kDBPartialFileETagAttribute = "com.dropbox.sdk.etag";
+
+#define kDBPartialFilePrefix @".dropbox.partial."
 
 id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 
@@ -19,12 +34,21 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 
 @interface DBRequest () {
     NSURLRequest* request;
+	BOOL executing;
 	BOOL finished;
+	BOOL stopped;
     NSURLConnection* urlConnection;
-    NSFileHandle* fileHandle;
+    NSThread* connectionThread;
+    DBHostSlot* hostSlot;
+    DBFileWriter* fileWriter;
 	
     NSString* resultFilename;
     NSString* tempFilename;
+    NSString* partialFilename;
+    long long resumeOffset;
+    long long expectedLength;
+    BOOL writesToFile;
+    BOOL writesToSink;
     NSDictionary* userInfo;
 	
     NSHTTPURLResponse* response;
@@ -34,10 +58,43 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
     CGFloat uploadProgress;
     NSMutableData* resultData;
     NSError* error;
-	
+
+    dispatch_queue_t parseQueue;
+    BOOL parseFailed;
+
+    NSObject* cachedResultJSON;
+    BOOL resultJSONParsed;
+
+    CFAbsoluteTime createdTime;
+    CFAbsoluteTime connectionStartTime;
+    CFAbsoluteTime responseTime;
+    long long bytesSent;
+    long long bytesReceived;
+    BOOL networkStarted;
+    DBRequestMetrics* metrics;
+
+    NSUInteger retryCount;
+    NSTimeInterval retryDelay;
+    DBRequest* retryRequest;
 }
 
 - (void)setError:(NSError *)error;
+- (void)startConnection;
+- (void)cancelConnection;
+- (void)finishOperation;
+- (void)releaseHostSlot;
+- (dispatch_queue_t)streamParseQueue;
+- (void)parseStreamData:(NSData *)data;
+- (NSURLRequest *)connectionRequest;
+- (NSString *)partialFilenameForRequest;
+- (BOOL)openFileForResponse;
+- (NSError *)errorForWriteError:(int)writeError;
+- (NSError *)errorForSinkError:(NSError *)sinkError;
+- (void)abortSink;
+- (BOOL)getContentRangeStart:(long long *)start total:(long long *)total;
+- (DBRequestMetrics *)collectMetrics;
+- (DBRequest *)requestForRetry;
+- (void)retryAfterDelay:(NSTimeInterval)delay;
 
 @end
 
@@ -48,6 +105,7 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 @synthesize failureBlock = _failureBlock;
 @synthesize downloadProgressBlock = _downloadProgressBlock;
 @synthesize uploadProgressBlock = _uploadProgressBlock;
+@synthesize metricsBlock = _metricsBlock;
 
 @synthesize userInfo;
 @synthesize request;
@@ -57,17 +115,41 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 @synthesize uploadProgress;
 @synthesize resultData;
 @synthesize resultFilename;
+@synthesize resumable = _resumable;
+@synthesize rangeOffset = _rangeOffset;
+@synthesize rangeLength = _rangeLength;
+@synthesize streamParser;
 @synthesize error;
+@synthesize metrics;
+@synthesize priority = _priority;
+@synthesize sourceFilename = _sourceFilename;
+@synthesize downloadSink = _downloadSink;
+@synthesize retryPolicy = _retryPolicy;
+@synthesize retryBlock = _retryBlock;
+@synthesize retryCount;
+@synthesize retryDelay;
+@synthesize hostGate = _hostGate;
 
 + (void)setNetworkRequestDelegate:(id<DBNetworkRequestDelegate>)delegate {
     dbNetworkRequestDelegate = delegate;
 }
 
++ (void)removePartialDownloadsInDirectory:(NSString *)directory {
+	NSFileManager *fileManager = [NSFileManager new];
+	for (NSString *filename in [fileManager contentsOfDirectoryAtPath:directory error:nil]) {
+		if ([filename hasPrefix:kDBPartialFilePrefix]) {
+			[fileManager removeItemAtPath:[directory stringByAppendingPathComponent:filename] error:nil];
+		}
+	}
+}
+
 - (id)initWithURLRequest:(NSURLRequest *)aRequest completionBlock:(DBRequestBlock)completionBlock {
     if ((self = [super init])) {
         request = aRequest;
 		_completionBlock = [completionBlock copy];
+		createdTime = CFAbsoluteTimeGetCurrent();
 		
+		_priority = DBRequestPriorityNormal;
 		[super setThreadPriority:0.25];
 		[super setQueuePriority:NSOperationQueuePriorityLow];
     }
@@ -81,21 +163,91 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 
 - (void)networkRequestStopped 
 {
-    if (!_cancelled)  {
-    	if ([self error] && _failureBlock) {
-    		_failureBlock(self);
-    	}
-    	else if (_completionBlock) {
-    		_completionBlock(self);
-    	}
-	
-    	_failureBlock = nil;
-    	_completionBlock = nil;
-	
-        [dbNetworkRequestDelegate networkRequestStopped];
-    }
-    
-	CFRunLoopStop(CFRunLoopGetCurrent());
+	@synchronized (self) {
+		if (stopped) return;
+		stopped = YES;
+	}
+
+	[self releaseHostSlot];
+	metrics = [self collectMetrics];
+
+	if (_cancelled) {
+		if (networkStarted) [dbNetworkRequestDelegate networkRequestStopped];
+		_metricsBlock = nil;
+		_retryBlock = nil;
+		[self finishOperation];
+		return;
+	}
+
+	NSTimeInterval retryDelay = 0;
+	if (error && _retryPolicy && _retryBlock && [_retryPolicy shouldRetryRequest:self retryCount:retryCount delay:&retryDelay]) {
+		[self retryAfterDelay:retryDelay];
+		return;
+	}
+
+	// Hand the callbacks off the connection thread so a slow completion block can't stall the
+	// other transfers multiplexed onto the same run loop. The operation only finishes once the
+	// callbacks have run, so waitUntilAllOperationsAreFinished still covers them.
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		if (!_cancelled) {
+			if (_metricsBlock) _metricsBlock(metrics);
+
+			if ([self error] && _failureBlock) {
+				_failureBlock(self);
+			}
+			else if (_completionBlock) {
+				_completionBlock(self);
+			}
+		}
+
+		if (networkStarted) [dbNetworkRequestDelegate networkRequestStopped];
+
+		_failureBlock = nil;
+		_completionBlock = nil;
+		_metricsBlock = nil;
+		_retryBlock = nil;
+
+		[self finishOperation];
+	});
+}
+
+- (void)setPriority:(DBRequestPriority)priority {
+	@synchronized (self) {
+		_priority = priority;
+	}
+
+	switch (priority) {
+		case DBRequestPriorityInteractive:
+			[super setQueuePriority:NSOperationQueuePriorityVeryHigh];
+			[super setThreadPriority:0.5];
+			break;
+		case DBRequestPriorityBulk:
+			[super setQueuePriority:NSOperationQueuePriorityVeryLow];
+			[super setThreadPriority:0.25];
+			break;
+		default:
+			[super setQueuePriority:NSOperationQueuePriorityLow];
+			[super setThreadPriority:0.25];
+			break;
+	}
+
+	[self.hostGate setPriority:priority forPendingRequestOfOwner:self];
+
+	DBRequest *retry = nil;
+	@synchronized (self) {
+		retry = retryRequest;
+	}
+	retry.priority = priority;
+}
+
+- (DBRequestPriority)priority {
+	@synchronized (self) {
+		return _priority;
+	}
+}
+
+- (DBHostConcurrencyGate *)hostGate {
+	return _hostGate ? _hostGate : [DBHostConcurrencyGate sharedGate];
 }
 
 - (NSString*)resultString {
@@ -105,15 +257,23 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 }
 
 - (NSObject*)resultJSON {
-	if (!resultData) return nil;
-	
-	NSError *jsonError = nil;
-	NSObject *result = [NSJSONSerialization JSONObjectWithData:resultData options:NSJSONReadingMutableContainers error:&jsonError];
-	if (!result && jsonError) {
-		NSLog(@"Failed to parse JSON: %@", jsonError);
+	if (streamParser && [self statusCode] == 200) return [streamParser rootObject];
+
+	// Parsed once and shared: parseResponseAsType:, the error path and the DBRestClient completion
+	// blocks all ask for it
+	@synchronized (self) {
+		if (resultJSONParsed) return cachedResultJSON;
+		if (!resultData) return nil;
+
+		NSError *jsonError = nil;
+		cachedResultJSON = [NSJSONSerialization JSONObjectWithData:resultData options:NSJSONReadingMutableContainers error:&jsonError];
+		if (!cachedResultJSON && jsonError) {
+			NSLog(@"Failed to parse JSON: %@", jsonError);
+		}
+		resultJSONParsed = YES;
+
+		return cachedResultJSON;
 	}
-	
-	return result;
 } 
 
 - (NSInteger)statusCode {
@@ -144,21 +304,28 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 
 	_failureBlock = nil;
 	_completionBlock = nil;
-    
-    [urlConnection cancel];
+	_metricsBlock = nil;
 
-    if (tempFilename) {
-		[fileHandle closeFile], fileHandle = nil;
-		
-        NSError *rmError;
-        if (![[NSFileManager defaultManager] removeItemAtPath:tempFilename error:&rmError]) {
-            DBLogError(@"DBRequest#cancel Error removing temp file '%@: %@", tempFilename, rmError);
-        }
-		
-		tempFilename = nil;
-    }
-    
-	[self networkRequestStopped];
+	DBRequest *retry = nil;
+	@synchronized (self) {
+		retry = retryRequest;
+	}
+	[retry cancel];
+
+	// A request still waiting for a host slot gives up its place in line
+	if ([self.hostGate cancelPendingRequestForOwner:self]) {
+		[self networkRequestStopped];
+		return;
+	}
+
+	// A request that hasn't started yet is finished from -start, once the queue gets to it
+	NSThread *thread = nil;
+	@synchronized (self) {
+		thread = connectionThread;
+	}
+	[[DBConnectionEngine sharedEngine] performBlock:^{
+		[self cancelConnection];
+	} onThread:thread];
 }
 
 - (id)parseResponseAsType:(Class)cls {
@@ -177,6 +344,7 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 	if (_cancelled) return;
 	
     response = (NSHTTPURLResponse *)aResponse;
+    responseTime = CFAbsoluteTimeGetCurrent();
 
     // Parse out the x-response-metadata as JSON.
 	NSString *xDropboxMetadataString = [[response allHeaderFields] objectForKey:@"X-Dropbox-Metadata"];
@@ -185,45 +353,64 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 		xDropboxMetadataJSON = [NSJSONSerialization JSONObjectWithData:xDropboxMetadataData options:NSJSONReadingMutableContainers error:nil];
 	}
 
-    if (resultFilename && [self statusCode] == 200) {
-        // Create the file here so it's created in case it's zero length
-        // File is downloaded into a temporary file and then moved over when completed successfully
+    expectedLength = [self responseBodySize];
 
-		NSString *filenameTemplate = [NSString stringWithFormat:@"%@/dropbox.XXXXXXXXXX", NSTemporaryDirectory()];
-		NSUInteger len = [filenameTemplate lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
-		NSMutableData *filename = [NSMutableData dataWithBytes:[filenameTemplate UTF8String] length:(len + 1)];
-		
-		int fd = mkstemp([filename mutableBytes]);
-		if (fd < 0) {
-            DBLogError(@"DBRequest#connection:didReceiveData: Failed to create temp file %s, error: %jd", [filename bytes], (intmax_t)errno);
+    if (_downloadSink && [self statusCode] == 200) {
+        NSError *sinkError = nil;
+        if ([_downloadSink openWithExpectedLength:expectedLength error:&sinkError]) {
+            writesToSink = YES;
+        }
+        else {
             [urlConnection cancel];
-		}
-		else {
-			tempFilename = [[NSString alloc] initWithData:filename encoding:NSUTF8StringEncoding];
-			fileHandle = [[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
-		}
+            [self setError:[self errorForSinkError:sinkError]];
+            [self networkRequestStopped];
+        }
+    }
+    else if (resultFilename && ([self statusCode] == 200 || [self statusCode] == 206)) {
+        if (![self openFileForResponse]) {
+            [urlConnection cancel];
+            [self networkRequestStopped];
+        }
+    }
+    else if (partialFilename && [self statusCode] == 416) {
+        // The partial file doesn't match the file on the server any more
+        [[NSFileManager defaultManager] removeItemAtPath:partialFilename error:nil];
     }
 }
 
 - (void)connection:(NSURLConnection*)connection didReceiveData:(NSData*)data {
 	if (_cancelled) return;
 
-    if (resultFilename && [self statusCode] == 200) {
-        @try {
-            [fileHandle writeData:data];
-        } 
-		@catch (NSException* e) {
-            // In case we run out of disk space
+    if (writesToSink) {
+        NSError *sinkError = nil;
+        if (![_downloadSink writeData:data error:&sinkError]) {
             [urlConnection cancel];
-            [fileHandle closeFile];
-            [[NSFileManager defaultManager] removeItemAtPath:tempFilename error:nil];
-            [self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorInsufficientDiskSpace userInfo:userInfo]];
+            [self abortSink];
+            [self setError:[self errorForSinkError:sinkError]];
+            
+			[self networkRequestStopped];
+            
+            return;
+        }
+    }
+	else if (writesToFile) {
+        if (![fileWriter writeData:data]) {
+            int writeError = fileWriter.lastError;
+            [urlConnection cancel];
+            if (tempFilename) [fileWriter discard];
+            else [fileWriter close];
+            fileWriter = nil;
+            tempFilename = nil;
+            [self setError:[self errorForWriteError:writeError]];
             
 			[self networkRequestStopped];
             
             return;
         }
     } 
+	else if (streamParser && [self statusCode] == 200) {
+		[self parseStreamData:data];
+	}
 	else {
         if (resultData == nil) {
             resultData = [NSMutableData new];
@@ -232,10 +419,10 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
     }
 
     bytesDownloaded += [data length];
+    bytesReceived += [data length];
 
-    long long responseBodySize = [self responseBodySize];
-    if (responseBodySize > 0) {
-        downloadProgress = (CGFloat)bytesDownloaded / (CGFloat)responseBodySize;
+    if (expectedLength > 0) {
+        downloadProgress = (CGFloat)bytesDownloaded / (CGFloat)expectedLength;
 		if (_downloadProgressBlock) _downloadProgressBlock(self);
     }
 }
@@ -243,16 +430,16 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 - (void)connectionDidFinishLoading:(NSURLConnection*)connection {
 	if (_cancelled) return;
 
-    [fileHandle closeFile];
-    fileHandle = nil;
+    // Buffered bytes only reach the disk here, so this is where a full disk can show up
+    int writeError = 0;
+    if (fileWriter && ![fileWriter close]) writeError = fileWriter.lastError;
     
-    if (self.statusCode != 200) {
+    if (self.statusCode != 200 && self.statusCode != 206) {
         NSMutableDictionary* errorUserInfo = [NSMutableDictionary dictionaryWithDictionary:userInfo];
         // To get error userInfo, first try and make sense of the response as JSON, if that
         // fails then send back the string as an error message
         if ([resultData length] > 0) {
-			NSError *jsonError = nil;
-			NSDictionary *resultJSON = [NSJSONSerialization JSONObjectWithData:resultData options:NSJSONReadingMutableContainers error:&jsonError];
+			NSDictionary *resultJSON = (NSDictionary *)[self resultJSON];
 			if ([resultJSON isKindOfClass:[NSDictionary class]]) {
 				[errorUserInfo addEntriesFromDictionary:resultJSON];
 			}
@@ -262,50 +449,85 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
         }
         [self setError:[NSError errorWithDomain:DBErrorDomain code:self.statusCode userInfo:errorUserInfo]];
     } 
+	else if (writeError) {
+        if (tempFilename) [[NSFileManager defaultManager] removeItemAtPath:tempFilename error:nil];
+        tempFilename = nil;
+        [self setError:[self errorForWriteError:writeError]];
+    }
+	else if (writesToSink) {
+        NSError *sinkError = nil;
+        if (expectedLength != 0 && expectedLength != bytesDownloaded) {
+            [self abortSink];
+            [self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:self.userInfo]];
+        }
+        else if (![_downloadSink finish:&sinkError]) {
+            [self setError:[self errorForSinkError:sinkError]];
+        }
+        writesToSink = NO;
+    }
+	else if (writesToFile && _rangeLength > 0) {
+        // The segment was written in place, just make sure all of it arrived
+        if (expectedLength != 0 && expectedLength != bytesDownloaded) {
+            [self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:self.userInfo]];
+        }
+    }
 	else if (tempFilename) {
-        NSFileManager* fileManager = [NSFileManager new];
-        NSError* moveError;
-        
-        // Check that the file size is the same as the Content-Length
-        NSDictionary* fileAttrs = [fileManager attributesOfItemAtPath:tempFilename error:&moveError];
-        
-        if (!fileAttrs) {
-            DBLogError(@"DBRequest#connectionDidFinishLoading: error getting file attrs: %@", moveError);
-            [fileManager removeItemAtPath:tempFilename error:nil];
-            [self setError:[NSError errorWithDomain:moveError.domain code:moveError.code userInfo:self.userInfo]];
-        } 
-		else if ([self responseBodySize] != 0 && [self responseBodySize] != [fileAttrs fileSize]) {
+        // Check that the file size is the same as the Content-Length. The writer knows where the
+        // file ends, so there's no need to stat it.
+        if (expectedLength != 0 && expectedLength != fileWriter.offset) {
             // This happens in iOS 4.0 when the network connection changes while loading
-            [fileManager removeItemAtPath:tempFilename error:nil];
+            [[NSFileManager defaultManager] removeItemAtPath:tempFilename error:nil];
             [self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:self.userInfo]];
         } 
 		else {        
-            // Everything's OK, move temp file over to desired file
-            [fileManager removeItemAtPath:resultFilename error:nil];
+            // Everything's OK, the temp file is next to the desired file so it can be renamed over it
+            if (partialFilename) removexattr([tempFilename fileSystemRepresentation], kDBPartialFileETagAttribute, 0);
             
-            BOOL success = [fileManager moveItemAtPath:tempFilename toPath:resultFilename error:&moveError];
-			if (!success) {
-                DBLogError(@"DBRequest#connectionDidFinishLoading: error moving temp file to desired location: %@", [moveError localizedDescription]);
-                [self setError:[NSError errorWithDomain:moveError.domain code:moveError.code userInfo:self.userInfo]];
+			if (![fileWriter moveToPath:resultFilename]) {
+                DBLogError(@"DBRequest#connectionDidFinishLoading: error moving temp file to desired location: %s", strerror(fileWriter.lastError));
+                [[NSFileManager defaultManager] removeItemAtPath:tempFilename error:nil];
+                [self setError:[NSError errorWithDomain:NSPOSIXErrorDomain code:fileWriter.lastError userInfo:self.userInfo]];
             }
         }
         
         tempFilename = nil;
     }
+	else if (streamParser) {
+		// Let the parser catch up with the data queued for it before reporting the result
+		dispatch_async([self streamParseQueue], ^{
+			if (parseFailed) return;
+			if (![streamParser finish]) {
+				NSMutableDictionary *errorUserInfo = [NSMutableDictionary dictionaryWithDictionary:userInfo];
+				[errorUserInfo addEntriesFromDictionary:[streamParser.error userInfo]];
+				[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorInvalidResponse userInfo:errorUserInfo]];
+			}
+			[self networkRequestStopped];
+		});
+		return;
+	}
     
+    fileWriter = nil;
     [self networkRequestStopped];
 }
 
 - (void)connection:(NSURLConnection*)connection didFailWithError:(NSError*)anError {
 	if (_cancelled) return;
 
-    [fileHandle closeFile];
+    // Flushes what arrived, so a partial download keeps all of it
+    [fileWriter close];
+    fileWriter = nil;
+    [self abortSink];
     [self setError:[NSError errorWithDomain:anError.domain code:anError.code userInfo:self.userInfo]];
     bytesDownloaded = 0;
     downloadProgress = 0;
     uploadProgress = 0;
     
-    if (tempFilename) {
+    if (tempFilename && [tempFilename isEqualToString:partialFilename]) {
+        // Keep what we have, the next attempt continues from there
+        DBLogInfo(@"DropboxSDK: keeping partial download of %@", resultFilename);
+        tempFilename = nil;
+    }
+    else if (tempFilename) {
         NSFileManager* fileManager = [NSFileManager new];
         NSError* removeError;
         BOOL success = [fileManager removeItemAtPath:tempFilename error:&removeError];
@@ -324,6 +546,7 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 {
 	if (_cancelled) return;
 
+    bytesSent = totalBytesWritten;
     uploadProgress = (CGFloat)totalBytesWritten / (CGFloat)totalBytesExpectedToWrite;
     if (_uploadProgressBlock) _uploadProgressBlock(self);
 }
@@ -335,13 +558,351 @@ id<DBNetworkRequestDelegate> dbNetworkRequestDelegate = nil;
 
 #pragma mark - NSOperation methods
 
-- (void)main {
-	urlConnection = [[NSURLConnection alloc] initWithRequest:request delegate:self startImmediately:YES];
-	CFRunLoopRun();
+- (BOOL)isConcurrent {
+	return YES;
+}
+
+- (BOOL)isExecuting {
+	return executing;
+}
+
+- (BOOL)isFinished {
+	return finished;
+}
+
+- (void)start {
+	if (_cancelled) {
+		[self finishOperation];
+		return;
+	}
+
+	[self willChangeValueForKey:@"isExecuting"];
+	executing = YES;
+	[self didChangeValueForKey:@"isExecuting"];
+
+	NSString *host = [[request URL] host];
+	[self.hostGate acquireSlotForHost:host owner:self priority:self.priority handler:^(DBHostSlot *slot) {
+		@synchronized (self) {
+			hostSlot = slot;
+			connectionThread = [[DBConnectionEngine sharedEngine] scheduleBlock:^{
+				[self startConnection];
+			}];
+		}
+	}];
 }
 
 #pragma mark - private methods
 
+- (void)startConnection {
+	if (_cancelled) {
+		[self networkRequestStopped];
+		return;
+	}
+
+	connectionStartTime = CFAbsoluteTimeGetCurrent();
+	networkStarted = YES;
+	[dbNetworkRequestDelegate networkRequestStarted];
+
+	urlConnection = [[NSURLConnection alloc] initWithRequest:[self connectionRequest] delegate:self startImmediately:NO];
+	[urlConnection scheduleInRunLoop:[NSRunLoop currentRunLoop] forMode:NSDefaultRunLoopMode];
+	[urlConnection start];
+}
+
+// Always runs on the connection thread, so it can't race the NSURLConnection delegate callbacks
+- (void)cancelConnection {
+    [urlConnection cancel];
+    [self abortSink];
+
+    if (tempFilename) {
+		[fileWriter close], fileWriter = nil;
+		
+        NSError *rmError;
+        if (![[NSFileManager defaultManager] removeItemAtPath:tempFilename error:&rmError]) {
+            DBLogError(@"DBRequest#cancel Error removing temp file '%@: %@", tempFilename, rmError);
+        }
+		
+		tempFilename = nil;
+    }
+    
+	[self networkRequestStopped];
+}
+
+- (NSURLRequest *)connectionRequest {
+	if (!resultFilename || !(_rangeLength > 0 || _resumable)) return request;
+
+	NSMutableURLRequest *rangeRequest = [request mutableCopy];
+	if (_rangeLength > 0) {
+		NSString *range = [NSString stringWithFormat:@"bytes=%lld-%lld", _rangeOffset, _rangeOffset + _rangeLength - 1];
+		[rangeRequest setValue:range forHTTPHeaderField:@"Range"];
+		return rangeRequest;
+	}
+
+	partialFilename = [self partialFilenameForRequest];
+	const char *partialPath = [partialFilename fileSystemRepresentation];
+
+	char eTag[256];
+	ssize_t eTagLength = getxattr(partialPath, kDBPartialFileETagAttribute, eTag, sizeof(eTag) - 1, 0, 0);
+	NSDictionary *fileAttrs = [[NSFileManager defaultManager] attributesOfItemAtPath:partialFilename error:nil];
+
+	if (eTagLength > 0 && [fileAttrs fileSize] > 0) {
+		eTag[eTagLength] = '\0';
+		resumeOffset = [fileAttrs fileSize];
+		[rangeRequest setValue:[NSString stringWithFormat:@"bytes=%lld-", resumeOffset] forHTTPHeaderField:@"Range"];
+		// If the file changed since, the server ignores the range and sends all of it
+		[rangeRequest setValue:[NSString stringWithUTF8String:eTag] forHTTPHeaderField:@"If-Range"];
+		DBLogInfo(@"DropboxSDK: resuming download of %@ at byte %lld", resultFilename, resumeOffset);
+	}
+	else if (fileAttrs) {
+		[[NSFileManager defaultManager] removeItemAtPath:partialFilename error:nil];
+	}
+
+	return rangeRequest;
+}
+
+// Stable across launches so a download can be picked up again by a later request for the same file
+- (NSString *)partialFilenameForRequest {
+	NSString *key = [NSString stringWithFormat:@"%@\n%@", resultFilename, [[request URL] path]];
+	const unsigned char *bytes = (const unsigned char *)[key UTF8String];
+
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	for (; *bytes; bytes++) {
+		hash ^= *bytes;
+		hash *= 1099511628211ULL;
+	}
+
+	// Next to the result, so the finished download can be renamed into place
+	NSString *directory = [resultFilename stringByDeletingLastPathComponent];
+	return [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%@%016llx", kDBPartialFilePrefix, hash]];
+}
+
+// Sets up fileWriter for a 200 or 206 response to a file download, returns NO and sets the error if it can't
+- (BOOL)openFileForResponse {
+	NSInteger statusCode = [self statusCode];
+	long long rangeStart = 0, rangeTotal = 0;
+	BOOL hasContentRange = [self getContentRangeStart:&rangeStart total:&rangeTotal];
+
+	if (_rangeLength > 0) {
+		// Writing a whole body we didn't ask for at rangeOffset would corrupt the file
+		if ((statusCode == 200 && _rangeOffset != 0) || (statusCode == 206 && (!hasContentRange || rangeStart != _rangeOffset))) {
+			DBLogError(@"DBRequest#connection:didReceiveResponse: server did not honor range %lld+%lld of %@", _rangeOffset, _rangeLength, resultFilename);
+			[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:userInfo]];
+			return NO;
+		}
+
+		fileWriter = [[DBFileWriter alloc] initWithPath:resultFilename truncate:NO];
+		if (!fileWriter) {
+			DBLogError(@"DBRequest#connection:didReceiveResponse: Failed to open %@ for segment", resultFilename);
+			[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorFileNotFound userInfo:userInfo]];
+			return NO;
+		}
+		[fileWriter seekToOffset:_rangeOffset];
+		if (statusCode == 206 && rangeTotal > 0) expectedLength = MIN(_rangeLength, rangeTotal - _rangeOffset);
+		writesToFile = YES;
+		return YES;
+	}
+
+	if (partialFilename) {
+		if (statusCode == 206 && hasContentRange && rangeStart == resumeOffset) {
+			fileWriter = [[DBFileWriter alloc] initWithPath:partialFilename truncate:NO];
+			[fileWriter seekToEndOfFile];
+			bytesDownloaded = resumeOffset;
+			if (rangeTotal > 0) expectedLength = rangeTotal;
+		}
+		else if (statusCode == 200) {
+			resumeOffset = 0;
+			fileWriter = [[DBFileWriter alloc] initWithPath:partialFilename truncate:YES];
+			if (fileWriter) {
+				// Without a validator there is no safe way to continue the download later
+				NSString *eTag = [[response allHeaderFields] objectForKey:@"Etag"];
+				const char *eTagValue = [eTag UTF8String];
+				if (!eTagValue || fsetxattr(fileWriter.fileDescriptor, kDBPartialFileETagAttribute, eTagValue, strlen(eTagValue), 0, 0) != 0) {
+					partialFilename = nil;
+				}
+			}
+		}
+
+		if (!fileWriter) {
+			DBLogError(@"DBRequest#connection:didReceiveResponse: Failed to open partial file for %@, status %ld", resultFilename, (long)statusCode);
+			[[NSFileManager defaultManager] removeItemAtPath:partialFilename error:nil];
+			[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:userInfo]];
+			return NO;
+		}
+
+		tempFilename = partialFilename ? partialFilename : [self partialFilenameForRequest];
+		if (expectedLength > bytesDownloaded) [fileWriter preallocateLength:expectedLength - bytesDownloaded];
+		writesToFile = YES;
+		return YES;
+	}
+
+	if (statusCode != 200) return YES;
+
+	// Create the file here so it's created in case it's zero length
+	// File is downloaded into a temporary file next to the result and renamed over it when completed successfully
+
+	fileWriter = [[DBFileWriter alloc] initTemporaryFileForPath:resultFilename];
+	if (!fileWriter) {
+		[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:userInfo]];
+		return NO;
+	}
+
+	tempFilename = fileWriter.path;
+	if (expectedLength > 0) [fileWriter preallocateLength:expectedLength];
+	writesToFile = YES;
+	return YES;
+}
+
+- (NSError *)errorForWriteError:(int)writeError {
+	DBLogError(@"DBRequest: error writing %@: %s", resultFilename, strerror(writeError));
+	NSInteger code = (writeError == ENOSPC || writeError == EDQUOT) ? DBErrorInsufficientDiskSpace : DBErrorGenericError;
+	return [NSError errorWithDomain:DBErrorDomain code:code userInfo:userInfo];
+}
+
+- (NSError *)errorForSinkError:(NSError *)sinkError {
+	return sinkError ? sinkError : [NSError errorWithDomain:DBErrorDomain code:DBErrorGenericError userInfo:userInfo];
+}
+
+- (void)abortSink {
+	if (!writesToSink) return;
+	writesToSink = NO;
+	[_downloadSink abort];
+}
+
+- (BOOL)getContentRangeStart:(long long *)start total:(long long *)total {
+	NSString *contentRange = [[response allHeaderFields] objectForKey:@"Content-Range"];
+	long long end = 0;
+	*total = 0;
+	if (!contentRange || sscanf([contentRange UTF8String], "bytes %lld-%lld/%lld", start, &end, total) < 2) return NO;
+	return YES;
+}
+
+- (DBRequestMetrics *)collectMetrics {
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	DBRequestMetrics *requestMetrics = [[DBRequestMetrics alloc] initWithURLRequest:request];
+	requestMetrics.statusCode = [self statusCode];
+	requestMetrics.error = error;
+	requestMetrics.totalTime = now - createdTime;
+	requestMetrics.bytesReceived = bytesReceived;
+	requestMetrics.bytesSent = bytesSent > 0 ? bytesSent : (long long)[[request HTTPBody] length];
+
+	if (connectionStartTime > 0) {
+		requestMetrics.queueWait = connectionStartTime - createdTime;
+		if (responseTime > 0) {
+			requestMetrics.timeToFirstByte = responseTime - connectionStartTime;
+			requestMetrics.transferTime = now - responseTime;
+		}
+	}
+	else {
+		requestMetrics.queueWait = now - createdTime;
+	}
+
+	return requestMetrics;
+}
+
+// Same request and callbacks, as a new operation; a segment continues after the bytes already written
+- (DBRequest *)requestForRetry {
+	NSMutableURLRequest *urlRequest = [request mutableCopy];
+	if (_sourceFilename) [urlRequest setHTTPBodyStream:[NSInputStream inputStreamWithFileAtPath:_sourceFilename]];
+
+	DBRequest *retry = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:_completionBlock];
+	retry.failureBlock = _failureBlock;
+	retry.uploadProgressBlock = _uploadProgressBlock;
+	retry.downloadProgressBlock = _downloadProgressBlock;
+	retry.metricsBlock = _metricsBlock;
+	retry.retryPolicy = _retryPolicy;
+	retry.retryBlock = _retryBlock;
+	retry.userInfo = userInfo;
+	retry.resultFilename = resultFilename;
+	retry.resumable = _resumable;
+	retry.streamParser = streamParser;
+	retry.downloadSink = _downloadSink;
+	retry.sourceFilename = _sourceFilename;
+	retry.priority = self.priority;
+	retry.hostGate = _hostGate;
+	retry->retryCount = retryCount + 1;
+
+	long long offset = _rangeOffset, length = _rangeLength;
+	if (_rangeLength > 0 && writesToFile && bytesReceived > 0 && bytesReceived < _rangeLength) {
+		offset += bytesReceived;
+		length -= bytesReceived;
+	}
+	retry.rangeOffset = offset;
+	retry.rangeLength = length;
+
+	return retry;
+}
+
+- (void)retryAfterDelay:(NSTimeInterval)delay {
+	DBRequest *retry = [self requestForRetry];
+	retry->retryDelay = delay;
+	@synchronized (self) {
+		retryRequest = retry;
+	}
+	DBLogInfo(@"DropboxSDK: retrying %@ in %.1f seconds (retry %lu)", [request URL], delay, (unsigned long)retry.retryCount);
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		// The failed attempt still counts for the metrics
+		if (!_cancelled && _metricsBlock) _metricsBlock(metrics);
+		if (networkStarted) [dbNetworkRequestDelegate networkRequestStopped];
+
+		// The retry waits out the delay wherever retryBlock keeps it; this attempt is done
+		if (!_cancelled && ![retry isCancelled] && _retryBlock) _retryBlock(retry);
+
+		_failureBlock = nil;
+		_completionBlock = nil;
+		_metricsBlock = nil;
+		_retryBlock = nil;
+
+		[self finishOperation];
+	});
+}
+
+- (void)releaseHostSlot {
+	DBHostSlot *slot = nil;
+	@synchronized (self) {
+		slot = hostSlot;
+		hostSlot = nil;
+	}
+	if (slot) [self.hostGate releaseSlot:slot];
+}
+
+- (dispatch_queue_t)streamParseQueue {
+	if (!parseQueue) parseQueue = dispatch_queue_create("com.dropbox.sdk.json-stream", DISPATCH_QUEUE_SERIAL);
+	return parseQueue;
+}
+
+// Parsing happens off the connection thread so a large response doesn't hold up the other
+// transfers sharing its run loop
+- (void)parseStreamData:(NSData *)data {
+	dispatch_async([self streamParseQueue], ^{
+		if (parseFailed || _cancelled) return;
+		if ([streamParser parseData:data]) return;
+
+		parseFailed = YES;
+		[[DBConnectionEngine sharedEngine] performBlock:^{
+			if (_cancelled) return;
+			[urlConnection cancel];
+
+			NSMutableDictionary *errorUserInfo = [NSMutableDictionary dictionaryWithDictionary:userInfo];
+			[errorUserInfo addEntriesFromDictionary:[streamParser.error userInfo]];
+			[self setError:[NSError errorWithDomain:DBErrorDomain code:DBErrorInvalidResponse userInfo:errorUserInfo]];
+			[self networkRequestStopped];
+		} onThread:connectionThread];
+	});
+}
+
+- (void)finishOperation {
+	@synchronized (self) {
+		if (finished) return;
+
+		[self willChangeValueForKey:@"isFinished"];
+		[self willChangeValueForKey:@"isExecuting"];
+		executing = NO;
+		finished = YES;
+		[self didChangeValueForKey:@"isExecuting"];
+		[self didChangeValueForKey:@"isFinished"];
+	}
+}
+
 - (void)setError:(NSError *)theError {
     if (theError == error) return;
     error = theError;
@@ -0,0 +1,67 @@
+//
+//  DBRequestMetrics.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* Timings and sizes of one finished DBRequest. All times are in seconds. NSURLConnection doesn't
+   break down DNS, connect and TLS time, so those are part of timeToFirstByte. */
+@interface DBRequestMetrics : NSObject
+
+- (id)initWithURLRequest:(NSURLRequest *)request;
+
+/* The API call a URL is for: "metadata" for https://api.dropbox.com/1/metadata/dropbox/Photos */
++ (NSString *)endpointForURL:(NSURL *)URL;
+
+@property (nonatomic, readonly) NSURL *URL;
+@property (nonatomic, readonly) NSString *method;
+@property (nonatomic, readonly) NSString *endpoint; // The API call, e.g. "metadata" or "files_put"
+
+@property (nonatomic) NSInteger statusCode; // 0 if no response arrived
+@property (nonatomic) NSError *error;
+
+@property (nonatomic) NSTimeInterval queueWait; // From creation until the connection was started, including the wait for a host slot
+@property (nonatomic) NSTimeInterval timeToFirstByte; // From connection start until the response headers
+@property (nonatomic) NSTimeInterval transferTime; // From the response headers until the end of the body
+@property (nonatomic) NSTimeInterval totalTime; // From creation until the request finished
+
+@property (nonatomic) long long bytesSent;
+@property (nonatomic) long long bytesReceived;
+
+@end
+
+
+/* Summary of the most recent requests to one endpoint, as returned by DBRestClient */
+@interface DBEndpointStatistics : NSObject
+
+@property (nonatomic, readonly) NSString *endpoint;
+@property (nonatomic, readonly) NSUInteger sampleCount;
+@property (nonatomic, readonly) NSUInteger errorCount;
+
+@property (nonatomic, readonly) NSTimeInterval totalTimeP50;
+@property (nonatomic, readonly) NSTimeInterval totalTimeP95;
+@property (nonatomic, readonly) NSTimeInterval totalTimeP99;
+@property (nonatomic, readonly) NSTimeInterval timeToFirstByteP50;
+@property (nonatomic, readonly) NSTimeInterval timeToFirstByteP95;
+@property (nonatomic, readonly) NSTimeInterval timeToFirstByteP99;
+@property (nonatomic, readonly) NSTimeInterval queueWaitP50;
+@property (nonatomic, readonly) NSTimeInterval queueWaitP95;
+@property (nonatomic, readonly) NSTimeInterval queueWaitP99;
+
+@property (nonatomic, readonly) double bytesPerSecond; // Bytes moved over the time spent transferring them
+
+@end
+
+
+/* A fixed size window of the latest metrics for one endpoint. Thread safe. */
+@interface DBRequestMetricsHistory : NSObject
+
+- (id)initWithEndpoint:(NSString *)endpoint capacity:(NSUInteger)capacity;
+
+- (void)addMetrics:(DBRequestMetrics *)metrics;
+- (DBEndpointStatistics *)statistics;
+
+@end
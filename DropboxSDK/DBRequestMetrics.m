@@ -0,0 +1,183 @@
+//
+//  DBRequestMetrics.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBRequestMetrics.h"
+
+#include <stdlib.h>
+
+
+typedef struct {
+	NSTimeInterval queueWait;
+	NSTimeInterval timeToFirstByte;
+	NSTimeInterval transferTime;
+	NSTimeInterval totalTime;
+	long long bytes;
+	BOOL failed;
+} DBRequestMetricsSample;
+
+
+@interface DBEndpointStatistics ()
+
+@property (nonatomic, readwrite) NSString *endpoint;
+@property (nonatomic, readwrite) NSUInteger sampleCount;
+@property (nonatomic, readwrite) NSUInteger errorCount;
+@property (nonatomic, readwrite) NSTimeInterval totalTimeP50;
+@property (nonatomic, readwrite) NSTimeInterval totalTimeP95;
+@property (nonatomic, readwrite) NSTimeInterval totalTimeP99;
+@property (nonatomic, readwrite) NSTimeInterval timeToFirstByteP50;
+@property (nonatomic, readwrite) NSTimeInterval timeToFirstByteP95;
+@property (nonatomic, readwrite) NSTimeInterval timeToFirstByteP99;
+@property (nonatomic, readwrite) NSTimeInterval queueWaitP50;
+@property (nonatomic, readwrite) NSTimeInterval queueWaitP95;
+@property (nonatomic, readwrite) NSTimeInterval queueWaitP99;
+@property (nonatomic, readwrite) double bytesPerSecond;
+
+@end
+
+
+@interface DBRequestMetricsHistory () {
+	NSString *_endpoint;
+	DBRequestMetricsSample *_samples; // Ring buffer
+	NSUInteger _capacity;
+	NSUInteger _count;
+	NSUInteger _next;
+}
+@end
+
+
+static int DBCompareTimeIntervals(const void *a, const void *b) {
+	NSTimeInterval x = *(const NSTimeInterval *)a, y = *(const NSTimeInterval *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Nearest-rank percentile of a sorted array
+static NSTimeInterval DBPercentile(const NSTimeInterval *sorted, NSUInteger count, double percentile) {
+	if (count == 0) return 0;
+	NSUInteger rank = (NSUInteger)ceil(percentile / 100.0 * count);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+
+@implementation DBRequestMetrics
+
++ (NSString *)endpointForURL:(NSURL *)URL {
+	// API paths look like /1/<endpoint>/<root>/<path>
+	NSArray *components = [[URL path] pathComponents];
+	NSString *endpoint = [components count] > 2 ? [components objectAtIndex:2] : [URL path];
+	return endpoint ? endpoint : @"";
+}
+
+- (id)initWithURLRequest:(NSURLRequest *)request {
+	if ((self = [super init])) {
+		_URL = [request URL];
+		_method = [request HTTPMethod] ? [request HTTPMethod] : @"GET";
+		_endpoint = [DBRequestMetrics endpointForURL:_URL];
+	}
+	return self;
+}
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<%@ %@ %@ status=%ld wait=%.3f ttfb=%.3f transfer=%.3f sent=%lld received=%lld>",
+			NSStringFromClass([self class]), _method, _endpoint, (long)_statusCode, _queueWait, _timeToFirstByte,
+			_transferTime, _bytesSent, _bytesReceived];
+}
+
+@end
+
+
+@implementation DBEndpointStatistics
+
+- (NSString *)description {
+	return [NSString stringWithFormat:@"<%@ %@ n=%lu errors=%lu total p50/p95/p99=%.3f/%.3f/%.3f ttfb p50/p95/p99=%.3f/%.3f/%.3f>",
+			NSStringFromClass([self class]), _endpoint, (unsigned long)_sampleCount, (unsigned long)_errorCount,
+			_totalTimeP50, _totalTimeP95, _totalTimeP99, _timeToFirstByteP50, _timeToFirstByteP95, _timeToFirstByteP99];
+}
+
+@end
+
+
+@implementation DBRequestMetricsHistory
+
+- (id)initWithEndpoint:(NSString *)endpoint capacity:(NSUInteger)capacity {
+	if ((self = [super init])) {
+		_endpoint = [endpoint copy];
+		_capacity = MAX(capacity, 1);
+		_samples = calloc(_capacity, sizeof(DBRequestMetricsSample));
+	}
+	return self;
+}
+
+- (void)dealloc {
+	free(_samples);
+}
+
+- (void)addMetrics:(DBRequestMetrics *)metrics {
+	DBRequestMetricsSample sample;
+	sample.queueWait = metrics.queueWait;
+	sample.timeToFirstByte = metrics.timeToFirstByte;
+	sample.transferTime = metrics.transferTime;
+	sample.totalTime = metrics.totalTime;
+	sample.bytes = metrics.bytesSent + metrics.bytesReceived;
+	sample.failed = metrics.error != nil;
+
+	@synchronized (self) {
+		_samples[_next] = sample;
+		_next = (_next + 1) % _capacity;
+		if (_count < _capacity) _count++;
+	}
+}
+
+- (DBEndpointStatistics *)statistics {
+	DBEndpointStatistics *statistics = [DBEndpointStatistics new];
+	statistics.endpoint = _endpoint;
+
+	NSUInteger count = 0;
+	DBRequestMetricsSample *samples = malloc(_capacity * sizeof(DBRequestMetricsSample));
+	@synchronized (self) {
+		count = _count;
+		memcpy(samples, _samples, count * sizeof(DBRequestMetricsSample));
+	}
+
+	NSTimeInterval *totalTimes = malloc(3 * MAX(count, 1) * sizeof(NSTimeInterval));
+	NSTimeInterval *firstByteTimes = totalTimes + count;
+	NSTimeInterval *queueWaits = firstByteTimes + count;
+	NSUInteger errorCount = 0;
+	NSTimeInterval transferTime = 0;
+	long long bytes = 0;
+
+	for (NSUInteger i = 0; i < count; i++) {
+		totalTimes[i] = samples[i].totalTime;
+		firstByteTimes[i] = samples[i].timeToFirstByte;
+		queueWaits[i] = samples[i].queueWait;
+		if (samples[i].failed) errorCount++;
+		transferTime += samples[i].timeToFirstByte + samples[i].transferTime;
+		bytes += samples[i].bytes;
+	}
+
+	qsort(totalTimes, count, sizeof(NSTimeInterval), DBCompareTimeIntervals);
+	qsort(firstByteTimes, count, sizeof(NSTimeInterval), DBCompareTimeIntervals);
+	qsort(queueWaits, count, sizeof(NSTimeInterval), DBCompareTimeIntervals);
+
+	statistics.sampleCount = count;
+	statistics.errorCount = errorCount;
+	statistics.totalTimeP50 = DBPercentile(totalTimes, count, 50);
+	statistics.totalTimeP95 = DBPercentile(totalTimes, count, 95);
+	statistics.totalTimeP99 = DBPercentile(totalTimes, count, 99);
+	statistics.timeToFirstByteP50 = DBPercentile(firstByteTimes, count, 50);
+	statistics.timeToFirstByteP95 = DBPercentile(firstByteTimes, count, 95);
+	statistics.timeToFirstByteP99 = DBPercentile(firstByteTimes, count, 99);
+	statistics.queueWaitP50 = DBPercentile(queueWaits, count, 50);
+	statistics.queueWaitP95 = DBPercentile(queueWaits, count, 95);
+	statistics.queueWaitP99 = DBPercentile(queueWaits, count, 99);
+	statistics.bytesPerSecond = transferTime > 0 ? bytes / transferTime : 0;
+
+	free(totalTimes);
+	free(samples);
+	return statistics;
+}
+
+@end
@@ -0,0 +1,28 @@
+//
+//  DBRequestSigner.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class MPOAuthCredentialConcreteStore;
+
+/* Signs API requests with the credentials of one store. The OAuth parameters that are the same for
+   every request (consumer key, token, signature method and version) are encoded once. So is the
+   signature for PLAINTEXT; for HMAC-SHA1 and HMAC-SHA256 the padded signing key is hashed once.
+   Each request's parameter string is built in buffers the signer keeps, instead of going through
+   MPURLRequestParameter objects. The cache is rebuilt when the credentials in the store change.
+   Thread safe. */
+@interface DBRequestSigner : NSObject
+
+- (id)initWithCredentialStore:(MPOAuthCredentialConcreteStore *)credentialStore;
+
+@property (nonatomic, readonly) MPOAuthCredentialConcreteStore *credentialStore;
+
+/* The sorted, encoded parameters, OAuth parameters included, with oauth_signature last. urlString
+   must not have a query. */
+- (NSString *)signedParameterStringForURLString:(NSString *)urlString method:(NSString *)method parameters:(NSDictionary *)params;
+
+@end
@@ -0,0 +1,326 @@
+//
+//  DBRequestSigner.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBRequestSigner.h"
+
+#import "DBURLEncoder.h"
+#import "MPOAuthCredentialConcreteStore.h"
+#import "MPOAuthSignatureParameter.h"
+#import "MPURLRequestParameter.h"
+#include "Base64Transcoder.h"
+#include "DBHMAC.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define kDBRequestSignerNonceLength 16
+
+
+typedef struct {
+	char *bytes;
+	NSUInteger length;
+	NSUInteger capacity;
+} DBSignerBuffer;
+
+// An encoded name=value pair, at offset in its buffer
+typedef struct {
+	NSUInteger offset;
+	NSUInteger length;
+	NSUInteger nameLength;
+} DBSignerPair;
+
+typedef struct {
+	DBSignerPair *pairs;
+	NSUInteger count;
+	NSUInteger capacity;
+} DBSignerPairList;
+
+
+static void DBSignerBufferReserve(DBSignerBuffer *buffer, NSUInteger extra) {
+	if (buffer->length + extra <= buffer->capacity) return;
+
+	NSUInteger capacity = MAX(MAX(buffer->capacity * 2, buffer->length + extra), 256);
+	char *bytes = realloc(buffer->bytes, capacity);
+	if (!bytes) [NSException raise:NSMallocException format:@"DBRequestSigner: unable to grow buffer to %lu bytes", (unsigned long)capacity];
+	buffer->bytes = bytes;
+	buffer->capacity = capacity;
+}
+
+static void DBSignerBufferAppend(DBSignerBuffer *buffer, const void *bytes, NSUInteger length) {
+	DBSignerBufferReserve(buffer, length);
+	memcpy(buffer->bytes + buffer->length, bytes, length);
+	buffer->length += length;
+}
+
+static void DBSignerBufferAppendEncoded(DBSignerBuffer *buffer, const char *bytes, NSUInteger length) {
+	DBSignerBufferReserve(buffer, DBURLEncodedMaxLength(length));
+	buffer->length += DBURLEncodeBytes(bytes, length, DBURLEncodingQuery, buffer->bytes + buffer->length);
+}
+
+// Converts through scratch, which saves the autoreleased copy -UTF8String would make
+static void DBSignerBufferAppendEncodedString(DBSignerBuffer *buffer, DBSignerBuffer *scratch, NSString *string) {
+	NSUInteger maxLength = [string maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+	NSUInteger usedLength = 0;
+
+	scratch->length = 0;
+	DBSignerBufferReserve(scratch, maxLength);
+	[string getBytes:scratch->bytes maxLength:maxLength usedLength:&usedLength encoding:NSUTF8StringEncoding
+			 options:0 range:NSMakeRange(0, [string length]) remainingRange:NULL];
+	DBSignerBufferAppendEncoded(buffer, scratch->bytes, usedLength);
+}
+
+static void DBSignerPairListAdd(DBSignerPairList *list, NSUInteger offset, NSUInteger length, NSUInteger nameLength) {
+	if (list->count == list->capacity) {
+		NSUInteger capacity = MAX(list->capacity * 2, 16);
+		DBSignerPair *pairs = realloc(list->pairs, capacity * sizeof(DBSignerPair));
+		if (!pairs) [NSException raise:NSMallocException format:@"DBRequestSigner: unable to grow parameter list"];
+		list->pairs = pairs;
+		list->capacity = capacity;
+	}
+
+	DBSignerPair *pair = &list->pairs[list->count++];
+	pair->offset = offset;
+	pair->length = length;
+	pair->nameLength = nameLength;
+}
+
+static void DBSignerAddPair(DBSignerBuffer *buffer, DBSignerPairList *list, DBSignerBuffer *scratch, NSString *name, NSString *value) {
+	NSUInteger offset = buffer->length;
+	DBSignerBufferAppendEncodedString(buffer, scratch, name);
+	NSUInteger nameLength = buffer->length - offset;
+	DBSignerBufferAppend(buffer, "=", 1);
+	if (value) DBSignerBufferAppendEncodedString(buffer, scratch, value);
+	DBSignerPairListAdd(list, offset, buffer->length - offset, nameLength);
+}
+
+static void DBSignerAddEncodedPair(DBSignerBuffer *buffer, DBSignerPairList *list, const char *pair, NSUInteger length, NSUInteger nameLength) {
+	NSUInteger offset = buffer->length;
+	DBSignerBufferAppend(buffer, pair, length);
+	DBSignerPairListAdd(list, offset, length, nameLength);
+}
+
+// By name, then by value
+static int DBSignerComparePairs(const char *bytes, const DBSignerPair *a, const DBSignerPair *b) {
+	int result = memcmp(bytes + a->offset, bytes + b->offset, MIN(a->nameLength, b->nameLength));
+	if (result != 0) return result;
+	if (a->nameLength != b->nameLength) return a->nameLength < b->nameLength ? -1 : 1;
+
+	NSUInteger aLength = a->length - a->nameLength, bLength = b->length - b->nameLength;
+	result = memcmp(bytes + a->offset + a->nameLength, bytes + b->offset + b->nameLength, MIN(aLength, bLength));
+	if (result != 0) return result;
+	return aLength == bLength ? 0 : (aLength < bLength ? -1 : 1);
+}
+
+
+@interface DBRequestSigner () {
+	// The credentials the cache was built from, compared by identity on every use
+	NSString *_consumerKey;
+	NSString *_consumerSecret;
+	NSString *_accessToken;
+	NSString *_accessTokenSecret;
+	NSString *_requestToken;
+	NSString *_requestTokenSecret;
+	NSString *_signatureMethod;
+	id _versionParameter;
+	BOOL _cacheValid;
+
+	BOOL _plaintext;
+	DBHMACKey _signingKey; // Inner and outer pads already hashed
+	DBSignerBuffer _fixedBuffer; // Consumer key, token, signature method and version pairs
+	DBSignerPairList _fixedPairs;
+	DBSignerBuffer _plaintextSignature;
+
+	time_t _timestampTime;
+	char _timestamp[32];
+	NSUInteger _timestampLength;
+
+	DBSignerBuffer _buffer;
+	DBSignerPairList _pairs;
+	DBSignerBuffer _scratch;
+	DBSignerBuffer _output;
+	DBSignerBuffer _baseString;
+}
+
+- (void)updateCacheIfNeeded;
+- (void)addTimestampAndNonce;
+- (void)appendHMACSignatureForURLString:(NSString *)urlString method:(NSString *)method;
+
+@end
+
+
+@implementation DBRequestSigner
+
+- (id)initWithCredentialStore:(MPOAuthCredentialConcreteStore *)credentialStore {
+	if ((self = [super init])) {
+		_credentialStore = credentialStore;
+	}
+	return self;
+}
+
+- (void)dealloc {
+	free(_fixedBuffer.bytes);
+	free(_fixedPairs.pairs);
+	free(_plaintextSignature.bytes);
+	free(_buffer.bytes);
+	free(_pairs.pairs);
+	free(_scratch.bytes);
+	free(_output.bytes);
+	free(_baseString.bytes);
+}
+
+- (NSString *)signedParameterStringForURLString:(NSString *)urlString method:(NSString *)method parameters:(NSDictionary *)params {
+	@synchronized (self) {
+		[self updateCacheIfNeeded];
+
+		_buffer.length = 0;
+		_pairs.count = 0;
+		DBSignerBufferAppend(&_buffer, _fixedBuffer.bytes, _fixedBuffer.length);
+		for (NSUInteger i = 0; i < _fixedPairs.count; i++) {
+			DBSignerPair *pair = &_fixedPairs.pairs[i];
+			DBSignerPairListAdd(&_pairs, pair->offset, pair->length, pair->nameLength);
+		}
+
+		[self addTimestampAndNonce];
+
+		for (NSString *name in params) {
+			id value = [params objectForKey:name];
+			DBSignerAddPair(&_buffer, &_pairs, &_scratch, name, [value isKindOfClass:[NSString class]] ? value : [value description]);
+		}
+
+		// Insertion sort, there are only a dozen or so
+		for (NSUInteger i = 1; i < _pairs.count; i++) {
+			DBSignerPair pair = _pairs.pairs[i];
+			NSUInteger j = i;
+			for (; j > 0 && DBSignerComparePairs(_buffer.bytes, &_pairs.pairs[j - 1], &pair) > 0; j--) {
+				_pairs.pairs[j] = _pairs.pairs[j - 1];
+			}
+			_pairs.pairs[j] = pair;
+		}
+
+		_output.length = 0;
+		for (NSUInteger i = 0; i < _pairs.count; i++) {
+			if (i > 0) DBSignerBufferAppend(&_output, "&", 1);
+			DBSignerBufferAppend(&_output, _buffer.bytes + _pairs.pairs[i].offset, _pairs.pairs[i].length);
+		}
+
+		if (_plaintext) {
+			DBSignerBufferAppend(&_output, _plaintextSignature.bytes, _plaintextSignature.length);
+		}
+		else {
+			[self appendHMACSignatureForURLString:urlString method:method];
+		}
+
+		return [[NSString alloc] initWithBytes:_output.bytes length:_output.length encoding:NSASCIIStringEncoding];
+	}
+}
+
+
+#pragma mark private methods
+
+// Callers must hold the signer lock
+- (void)updateCacheIfNeeded {
+	MPOAuthCredentialConcreteStore *store = _credentialStore;
+	NSString *consumerKey = [store consumerKey];
+	NSString *consumerSecret = [store consumerSecret];
+	NSString *accessToken = store.accessToken;
+	NSString *accessTokenSecret = store.accessTokenSecret;
+	NSString *requestToken = store.requestToken;
+	NSString *requestTokenSecret = store.requestTokenSecret;
+	NSString *signatureMethod = [store signatureMethod];
+	id versionParameter = [store credentialNamed:@"versionParameter"];
+
+	if (_cacheValid && consumerKey == _consumerKey && consumerSecret == _consumerSecret &&
+		accessToken == _accessToken && accessTokenSecret == _accessTokenSecret &&
+		requestToken == _requestToken && requestTokenSecret == _requestTokenSecret &&
+		signatureMethod == _signatureMethod && versionParameter == _versionParameter) return;
+
+	DBHashAlgorithm algorithm = DBHashAlgorithmSHA1;
+	if ([signatureMethod isEqualToString:kMPOAuthSignatureMethodHMACSHA256]) {
+		algorithm = DBHashAlgorithmSHA256;
+	}
+	else if (![signatureMethod isEqualToString:kMPOAuthSignatureMethodPlaintext] && ![signatureMethod isEqualToString:kMPOAuthSignatureMethodHMACSHA1]) {
+		[NSException raise:@"Unsupported Signature Method" format:@"The signature method \"%@\" is not currently support by DBRequestSigner", signatureMethod];
+	}
+
+	_consumerKey = consumerKey;
+	_consumerSecret = consumerSecret;
+	_accessToken = accessToken;
+	_accessTokenSecret = accessTokenSecret;
+	_requestToken = requestToken;
+	_requestTokenSecret = requestTokenSecret;
+	_signatureMethod = signatureMethod;
+	_versionParameter = versionParameter;
+	_plaintext = [signatureMethod isEqualToString:kMPOAuthSignatureMethodPlaintext];
+
+	_fixedBuffer.length = 0;
+	_fixedPairs.count = 0;
+	DBSignerAddPair(&_fixedBuffer, &_fixedPairs, &_scratch, @"oauth_consumer_key", consumerKey);
+	if (accessToken || requestToken) {
+		DBSignerAddPair(&_fixedBuffer, &_fixedPairs, &_scratch, @"oauth_token", accessToken ? accessToken : requestToken);
+	}
+	DBSignerAddPair(&_fixedBuffer, &_fixedPairs, &_scratch, @"oauth_signature_method", signatureMethod);
+	if ([versionParameter isKindOfClass:[MPURLRequestParameter class]]) {
+		DBSignerAddPair(&_fixedBuffer, &_fixedPairs, &_scratch, [versionParameter name], [versionParameter value]);
+	}
+	else {
+		DBSignerAddPair(&_fixedBuffer, &_fixedPairs, &_scratch, @"oauth_version", @"1.0");
+	}
+
+	NSString *signingKey = store.signingKey;
+	NSData *signingKeyData = [signingKey dataUsingEncoding:NSUTF8StringEncoding];
+	DBHMACKeyInit(&_signingKey, algorithm, [signingKeyData bytes], [signingKeyData length]);
+
+	// With PLAINTEXT the signature is the signing key, the same for every request
+	_plaintextSignature.length = 0;
+	DBSignerBufferAppend(&_plaintextSignature, "&oauth_signature=", 17);
+	DBSignerBufferAppendEncodedString(&_plaintextSignature, &_scratch, signingKey);
+
+	_cacheValid = YES;
+}
+
+// Callers must hold the signer lock
+- (void)addTimestampAndNonce {
+	time_t now = time(NULL);
+	if (now != _timestampTime || _timestampLength == 0) {
+		_timestampTime = now;
+		_timestampLength = (NSUInteger)snprintf(_timestamp, sizeof(_timestamp), "oauth_timestamp=%d", (int)now);
+	}
+	DBSignerAddEncodedPair(&_buffer, &_pairs, _timestamp, _timestampLength, 15);
+
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t random[kDBRequestSignerNonceLength];
+	char nonce[12 + 2 * kDBRequestSignerNonceLength] = "oauth_nonce=";
+	arc4random_buf(random, sizeof(random));
+	for (NSUInteger i = 0; i < kDBRequestSignerNonceLength; i++) {
+		nonce[12 + 2 * i] = hex[random[i] >> 4];
+		nonce[13 + 2 * i] = hex[random[i] & 15];
+	}
+	DBSignerAddEncodedPair(&_buffer, &_pairs, nonce, sizeof(nonce), 11);
+}
+
+// Callers must hold the signer lock; _output holds the parameter string
+- (void)appendHMACSignatureForURLString:(NSString *)urlString method:(NSString *)method {
+	_baseString.length = 0;
+	DBSignerBufferAppendEncodedString(&_baseString, &_scratch, method ? method : @"GET");
+	DBSignerBufferAppend(&_baseString, "&", 1);
+	DBSignerBufferAppendEncodedString(&_baseString, &_scratch, urlString);
+	DBSignerBufferAppend(&_baseString, "&", 1);
+	DBSignerBufferAppendEncoded(&_baseString, _output.bytes, _output.length);
+
+	uint8_t digest[kDBHMACMaxDigestLength];
+	DBHMACSign(&_signingKey, _baseString.bytes, _baseString.length, digest);
+
+	char base64[64];
+	size_t base64Length = sizeof(base64);
+	Base64EncodeData(digest, DBHashDigestLength(_signingKey.inner.algorithm), base64, &base64Length);
+
+	DBSignerBufferAppend(&_output, "&oauth_signature=", 17);
+	DBSignerBufferAppendEncoded(&_output, base64, base64Length);
+}
+
+@end
@@ -15,6 +15,7 @@
 @interface DBRestClient ()
 
 - (NSMutableURLRequest *)requestWithHost:(NSString *)host path:(NSString *)path parameters:(NSDictionary *)params;
+- (void)enqueueRequest:(DBRequest *)request;
 
 @property (nonatomic, readonly) MPOAuthCredentialConcreteStore *credentialStore;
 
@@ -77,7 +78,7 @@
 		[requests addObject:operation];
 	}
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 - (BOOL)requestTokenLoaded {
@@ -145,7 +146,7 @@
 		[requests addObject:operation];
 	}
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
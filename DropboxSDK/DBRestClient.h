@@ -8,16 +8,31 @@
 
 
 #import "DBSession.h"
+#import "DBRequest.h"
 
 @protocol DBRestClientDelegate;
 
 @class DBAccountInfo;
+@class DBChunkedUploadSession;
+@class DBConcurrencyController;
+@class DBHostConcurrencyGate;
+@class DBDeltaEntry;
+@protocol DBDownloadSink;
+@class DBEndpointStatistics;
 @class DBMetadata;
+@class DBMetadataCache;
+@class DBRetryPolicy;
+@class DBThumbnailCache;
 
 typedef void (^DBMetadataCompletionBlock)(NSError *error, BOOL changed, DBMetadata *metadata);
+typedef void (^DBMetadataChildBlock)(DBMetadata *child);
+typedef void (^DBMetadataPathBlock)(NSString *path, NSError *error, BOOL changed, DBMetadata *metadata);
+typedef void (^DBBatchMetadataCompletionBlock)(NSDictionary *metadataByPath, NSArray *unchangedPaths, NSDictionary *errorsByPath);
 typedef void (^DBDeltaCompletionBlock)(NSError *error, NSArray *entryArrays, BOOL shouldReset, NSString *cursor, BOOL hasMore);
+typedef void (^DBDeltaEntryBlock)(DBDeltaEntry *entry);
 typedef void (^DBLoadFileCompletionBlock)(NSError *error, NSString *contentType, DBMetadata *metadata);
 typedef void (^DBLoadThumbnailCompletionBlock)(NSError *error, NSString *filename, DBMetadata *metadata);
+typedef void (^DBLoadThumbnailDataCompletionBlock)(NSError *error, NSData *thumbnail, NSString *size);
 typedef void (^DBUploadFileCompletionBlock)(NSError *error, DBMetadata *metadata);
 typedef void (^DBLoadRevisionsCompletionBlock)(NSError *error, NSArray *revisions);
 typedef void (^DBRestoreFileCompletionBlock)(NSError *error, DBMetadata *metadata);
@@ -36,10 +51,78 @@ typedef void (^DBLoadStreamableURLCompletionBlock)(NSError *error, NSURL *URL);
 
 @property (nonatomic, weak) id<DBRestClientDelegate> delegate;
 
-@property (nonatomic) NSInteger maxConcurrentRequests;
+/* Requests run in three lanes, one per DBRequestPriority, each with its own concurrency. Metadata,
+   account info, thumbnails, search, share links and revisions are interactive; file loads and
+   uploads, delta and loadMetadataForPaths: are bulk; the rest is normal. Wrap calls in
+   performWithPriority:block: to pick the lane yourself. The host gate also serves waiting
+   requests by priority, so interactive requests get the next free slot. */
+@property (nonatomic) NSInteger maxConcurrentRequests; // Of the normal and bulk lanes, default is 4; setting it turns adaptiveConcurrency off
+- (NSInteger)maxConcurrentRequestsForPriority:(DBRequestPriority)priority;
+- (void)setMaxConcurrentRequests:(NSInteger)maxConcurrentRequests forPriority:(DBRequestPriority)priority; // The interactive lane defaults to 4
+
+/* Requests started by the block, on this thread, get the given priority instead of their default */
+- (void)performWithPriority:(DBRequestPriority)priority block:(void (^)(void))block;
+
+/* Changes the priority of a queued or running transfer. A raised priority moves its requests to
+   the front of their lane and of the line for a host slot. */
+- (void)setPriority:(DBRequestPriority)priority forFileLoad:(NSString *)path;
+- (void)setPriority:(DBRequestPriority)priority forThumbnailLoad:(NSString *)path size:(NSString *)size;
+- (void)setPriority:(DBRequestPriority)priority forFileUpload:(NSString *)path;
+
+/* If YES, the number of parallel requests follows what the servers can take, per host, starting
+   from maxConcurrentRequests: it grows while responses stay fast and shrinks on 429, 503, timeouts
+   and rising latency. The per-host limits are applied to hostGate and the normal and bulk
+   lanes are widened to match; turning this off removes the limits and gives each lane back the
+   width it had, or was given with setMaxConcurrentRequests:forPriority: meanwhile. Default is NO. */
+@property (nonatomic) BOOL adaptiveConcurrency;
+@property (nonatomic, readonly) DBConcurrencyController *concurrencyController; // nil unless adaptiveConcurrency is on
+
+/* Decides which failed requests are sent again and after how long; see DBRetryPolicy. Applies to
+   requests made after it is set. Default is a DBRetryPolicy with its default settings, nil turns
+   retries off. */
+@property (atomic) DBRetryPolicy *retryPolicy;
 @property (readonly) BOOL active;
 @property (atomic) BOOL canceled;
 
+/* Limits how many of this client's requests talk to each host at once; each client has its own.
+   Its per-host default follows the widest of the lanes set with maxConcurrentRequests. */
+@property (nonatomic, readonly) DBHostConcurrencyGate *hostGate;
+
+/* If set, loadMetadata: stores what it loads here and sends the cached hash with the next request
+   for the same path. When the server answers 304, the cached DBMetadata is passed to
+   restClient:loadedMetadata: and to the completion block, with changed set to NO. Calls that pass
+   their own hash or other parameters keep their usual behavior. Default is nil; see
+   +[DBMetadataCache cacheForUserId:]. */
+@property (nonatomic) DBMetadataCache *metadataCache;
+
+/* If set, loadThumbnailForMetadata: answers from here when it can and stores what it loads. Default
+   is nil; see +[DBThumbnailCache cacheForUserId:]. */
+@property (nonatomic) DBThumbnailCache *thumbnailCache;
+
+/* Size of each piece sent by uploadFileChunked:. Default is 4 MB. */
+@property (nonatomic) NSUInteger uploadChunkSize;
+
+/* If YES, a loadFile:intoPath: whose connection drops keeps the bytes received so far in a hidden
+   .dropbox.partial.* file next to destinationPath, and the next load of the same file into the same
+   destinationPath continues from there, provided the file hasn't changed on the server. A load that
+   is never retried leaves its file behind; +[DBRequest removePartialDownloadsInDirectory:] deletes
+   them. Default is NO. */
+@property (nonatomic) BOOL resumableLoads;
+
+/* Number of metadata requests loadMetadataForPaths: did not have to make because the same path
+   appeared more than once in a batch */
+@property (readonly) NSUInteger batchMetadataRequestsSaved;
+
+/* Called with the DBRequestMetrics of every request this client completes, on the queue its
+   completion block runs on, before the completion block */
+@property (atomic, copy) DBRequestMetricsBlock metricsHandler;
+
+/* Latency percentiles over the last 256 requests to an endpoint ("metadata", "files", "delta", ...),
+   or nil if none has been made. endpointStatistics maps every endpoint used so far to its
+   DBEndpointStatistics. */
+- (DBEndpointStatistics *)statisticsForEndpoint:(NSString *)endpoint;
+- (NSDictionary *)endpointStatistics;
+
 - (id)initWithSession:(DBSession*)session;
 - (id)initWithSession:(DBSession *)session userId:(NSString *)userId;
 
@@ -55,21 +138,65 @@ typedef void (^DBLoadStreamableURLCompletionBlock)(NSError *error, NSURL *URL);
 - (void)loadMetadata:(NSString*)path withHash:(NSString*)hash completion:(DBMetadataCompletionBlock)completion;
 - (void)loadMetadata:(NSString*)path completion:(DBMetadataCompletionBlock)completion;
 
+/* Streams the children of a folder listing to childHandler as they are parsed, before the
+   response has finished downloading. The DBMetadata passed to completion has empty contents. */
+- (void)loadMetadata:(NSString*)path withParams:(NSDictionary *)params childHandler:(DBMetadataChildBlock)childHandler completion:(DBMetadataCompletionBlock)completion;
+
 /* This will load the metadata of a file at a given rev */
 - (void)loadMetadata:(NSString *)path atRev:(NSString *)rev completion:(DBMetadataCompletionBlock)completion;
 
+/* Loads the metadata of many paths. hashes runs parallel to paths and may be nil or hold NSNull
+   where there is no hash. Paths that differ only in case are loaded once and reported under every
+   spelling asked for; if their hashes disagree the load is made without one. Only a few requests
+   are built and queued at a time, the next one as each finishes, so a batch of thousands doesn't
+   flood the queue. pathHandler is called as each path is loaded, completion once all of them are
+   done. */
+- (void)loadMetadataForPaths:(NSArray *)paths withHashes:(NSArray *)hashes pathHandler:(DBMetadataPathBlock)pathHandler completion:(DBBatchMetadataCompletionBlock)completion;
+
 /* Loads a list of files (represented as DBDeltaEntry objects) that have changed since the cursor was generated */
 - (void)loadDelta:(NSString *)cursor completion:(DBDeltaCompletionBlock)completion;
 
-/* Loads the file contents at the given root/path and stores the result into destinationPath */
+/* Same as above, but each DBDeltaEntry is passed to entryHandler as soon as it has been parsed
+   and the whole page is never held in memory. entryArrays is nil in the completion block and
+   the delegate callback. */
+- (void)loadDelta:(NSString *)cursor entryHandler:(DBDeltaEntryBlock)entryHandler completion:(DBDeltaCompletionBlock)completion;
+- (void)cancelDeltaLoad:(NSString *)cursor;
+
+/* Loads the file contents at the given root/path and stores the result into destinationPath. See
+   resumableLoads for continuing a load whose connection dropped. */
 - (void)loadFile:(NSString *)path intoPath:(NSString *)destinationPath completion:(DBLoadFileCompletionBlock)completion;
 
 /* This will load a file as it existed at a given rev */
 - (void)loadFile:(NSString *)path atRev:(NSString *)rev intoPath:(NSString *)destPath completion:(DBLoadFileCompletionBlock)completion;
+
+/* Loads a large file as segmentCount byte ranges at the same time. The rev is looked up first so
+   all the ranges come from the same version; files under 1 MB per segment are loaded in one go. */
+- (void)loadFile:(NSString *)path atRev:(NSString *)rev intoPath:(NSString *)destPath segments:(NSUInteger)segmentCount completion:(DBLoadFileCompletionBlock)completion;
+
+/* Passes the file contents to sink as they arrive instead of storing them in a file, see
+   DBDownloadSink.h. Only the completion block is called, once the sink has finished. A failed
+   transfer that is retried starts the sink over. */
+- (void)loadFile:(NSString *)path atRev:(NSString *)rev intoSink:(id<DBDownloadSink>)sink completion:(DBLoadFileCompletionBlock)completion;
 - (void)cancelFileLoad:(NSString*)path;
 
 
+/* loadMetadata:, loadThumbnail: and loadAccountInfoWithCompletion: share a request that is already
+   running for the same path and parameters instead of sending another one; every caller still gets
+   its own callbacks. A thumbnail is copied to each caller's destinationPath. */
 - (void)loadThumbnail:(NSString *)path ofSize:(NSString *)size intoPath:(NSString *)destinationPath completion:(DBLoadThumbnailCompletionBlock)completion;
+
+/* Passes the thumbnail to sink instead of storing it in a file; with a DBMemorySink it can be
+   decoded without touching the disk. Only the completion block is called, with a nil filename.
+   Every call makes its own request. */
+- (void)loadThumbnail:(NSString *)path ofSize:(NSString *)size intoSink:(id<DBDownloadSink>)sink completion:(DBLoadThumbnailCompletionBlock)completion;
+
+/* Loads the thumbnail of metadata's rev into memory, going through thumbnailCache if it is set: a
+   cached thumbnail of that rev, of the size asked for or the next larger one, is passed back without
+   a request, and its size tells which one it is. Callers asking for the same rev and size while the
+   request runs share it. Files without a thumbnail fail with DBErrorFileNotFound. Only the
+   completion block is called, on a background queue. It is tracked apart from loadThumbnail: calls
+   for the same path and size; cancelThumbnailLoad:size: cancels both. */
+- (void)loadThumbnailForMetadata:(DBMetadata *)metadata ofSize:(NSString *)size completion:(DBLoadThumbnailDataCompletionBlock)completion;
 - (void)cancelThumbnailLoad:(NSString*)path size:(NSString*)size;
 
 /* Uploads a file that will be named filename to the given path on the server. sourcePath is the
@@ -79,6 +206,15 @@ typedef void (^DBLoadStreamableURLCompletionBlock)(NSError *error, NSURL *URL);
 - (void)uploadFile:(NSString *)filename toPath:(NSString *)path withParentRev:(NSString *)parentRev fromPath:(NSString *)sourcePath completion:(DBUploadFileCompletionBlock)completion;
 - (void)cancelFileUpload:(NSString *)path;
 
+/* Same as above, but the file is sent in uploadChunkSize pieces through /chunked_upload and then
+   committed, so a dropped connection only costs the current chunk. Progress is reported through
+   restClient:updatedChunkedUpload:; if the upload fails, pass the last session you were given to
+   resumeChunkedUpload:completion: to continue where the server left off. If the source file changes
+   size or modification date while it is sent, the upload fails with DBErrorFileChanged; resuming
+   it then starts over. */
+- (void)uploadFileChunked:(NSString *)filename toPath:(NSString *)path withParentRev:(NSString *)parentRev fromPath:(NSString *)sourcePath completion:(DBUploadFileCompletionBlock)completion;
+- (void)resumeChunkedUpload:(DBChunkedUploadSession *)uploadSession completion:(DBUploadFileCompletionBlock)completion;
+
 /* Loads a list of up to 10 DBMetadata objects representing past revisions of the file at path */
 - (void)loadRevisionsForFile:(NSString *)path completion:(DBLoadRevisionsCompletionBlock)completion;
 
@@ -146,6 +282,8 @@ typedef void (^DBLoadStreamableURLCompletionBlock)(NSError *error, NSURL *URL);
         forFile:(NSString*)destPath from:(NSString*)srcPath;
 - (void)restClient:(DBRestClient*)client uploadFileFailedWithError:(NSError*)error;
 // [error userInfo] contains the sourcePath
+- (void)restClient:(DBRestClient*)client updatedChunkedUpload:(DBChunkedUploadSession*)uploadSession;
+// Called after every acknowledged chunk and once more on commit; archive the session to resume later
 
 // Deprecated upload callback
 - (void)restClient:(DBRestClient*)client uploadedFile:(NSString*)destPath from:(NSString*)srcPath;
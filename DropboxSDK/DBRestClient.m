@@ -9,17 +9,71 @@
 
 #import "DBRestClient.h"
 
+#import "DBChunkedUploadSession.h"
+#import "DBConcurrencyController.h"
 #import "DBDeltaEntry.h"
+#import "DBDownloadSink.h"
 #import "DBAccountInfo.h"
 #import "DBError.h"
+#import "DBFileWriter.h"
+#import "DBHostConcurrencyGate.h"
+#import "DBJSONStreamParser.h"
 #import "DBLog.h"
 #import "DBMetadata.h"
+#import "DBMetadataCache.h"
 #import "DBRequest.h"
-#import "MPOAuthURLRequest.h"
-#import "MPURLRequestParameter.h"
-#import "MPOAuthSignatureParameter.h"
+#import "DBRequestMetrics.h"
+#import "DBRequestSigner.h"
+#import "DBRetryPolicy.h"
+#import "DBThumbnailCache.h"
+#import "DBURLEncoder.h"
 #import "NSString+URLEscapingAdditions.h"
 
+#include <fcntl.h>
+
+// Files smaller than this per segment are loaded with a single request
+#define kDBMinimumDownloadSegmentSize (1024 * 1024)
+
+// Number of recent requests per endpoint the latency percentiles are computed over
+#define kDBEndpointHistorySize 256
+
+// Concurrency of the interactive lane; the other two start out at maxConcurrentRequests
+#define kDBInteractiveLaneWidth 4
+
+// Thread dictionary key of the priority set by performWithPriority:block:
+static NSString * const kDBRestClientPriorityKey = @"DBRestClientPriority";
+
+
+/* The requests making up one segmented file load. Stored in loadRequests in place of a DBRequest
+   so cancelFileLoad: and cancelAllRequests stop all of them. */
+@interface DBRequestGroup : NSObject
+
+- (void)addRequest:(DBRequest *)request;
+- (void)replaceRequest:(DBRequest *)request withRequest:(DBRequest *)replacement;
+- (void)cancel;
+
+@property (nonatomic, readonly) NSArray *requests;
+@property (nonatomic, copy) NSString *temporaryFilename; // Removed on cancel, or right away if set after it
+@property (atomic, readonly, getter = isCancelled) BOOL cancelled;
+
+@end
+
+
+/* State of a loadMetadataForPaths: call. Guarded by @synchronized on itself. */
+@interface DBMetadataBatch : NSObject
+
+@property (nonatomic, readonly) NSMutableArray *pendingPaths;
+@property (nonatomic, readonly) NSMutableDictionary *hashes; // Lowercased path to hash or NSNull
+@property (nonatomic, readonly) NSMutableDictionary *spellings; // Lowercased path to the NSMutableOrderedSet of paths asked for
+@property (nonatomic, readonly) NSMutableDictionary *metadata;
+@property (nonatomic, readonly) NSMutableArray *unchangedPaths;
+@property (nonatomic, readonly) NSMutableDictionary *errors;
+@property (nonatomic) NSUInteger inFlight;
+@property (nonatomic) BOOL completed;
+@property (nonatomic) DBRequestPriority priority;
+
+@end
+
 
 @interface DBRestClient () {	
 	/* Map from path to the load request. Needs to be expanded to a general framework for cancelling
@@ -27,14 +81,32 @@
 	NSMutableDictionary* loadRequests;
 	NSMutableDictionary* imageLoadRequests;
 	NSMutableDictionary* uploadRequests;
+	NSMutableDictionary* deltaRequests; // Keyed by cursor, the empty string for none
+	
+	/* Map from single-flight key to the handlers waiting on the request for that key */
+	NSMutableDictionary* inFlightHandlers;
+	
+	/* Map from endpoint to its DBRequestMetricsHistory */
+	NSMutableDictionary* endpointHistories;
+	
+	DBConcurrencyController* concurrencyController; // Set while adaptiveConcurrency is on
+	NSInteger normalLaneWidth; // The widths the app gave the normal and bulk lanes, restored when
+	NSInteger bulkLaneWidth; // adaptiveConcurrency is turned off
+	DBHostConcurrencyGate* hostGate; // This client's own, so its limits don't change other clients'
+	
+	DBRequestSigner* requestSigner; // For the current credentialStore, see requestSigner
 	
 	DBSession* session;
 	NSString* userId;
 	NSString* root;
 	
-	NSOperationQueue *requestQueue;
+	NSOperationQueue *requestQueue; // The lane for DBRequestPriorityNormal
+	NSOperationQueue *interactiveQueue;
+	NSOperationQueue *bulkQueue;
 	
 	dispatch_semaphore_t _completionSemaphore;
+	dispatch_group_t _pendingRetries; // Retries waiting out their delay, in no queue yet
+	NSUInteger _batchMetadataRequestsSaved;
 }
 
 	// This method escapes all URI escape characters except /
@@ -44,14 +116,51 @@
 
 - (NSMutableURLRequest*)requestWithHost:(NSString *)host path:(NSString *)path parameters:(NSDictionary *)params;
 - (NSMutableURLRequest*)requestWithHost:(NSString *)host path:(NSString *)path parameters:(NSDictionary *)params method:(NSString *)method;
+- (NSMutableURLRequest *)signedRequestWithURLString:(NSString *)urlString method:(NSString *)method parameters:(NSDictionary *)params;
+- (DBRequestSigner *)requestSigner;
 
 - (void)checkForAuthenticationFailure:(DBRequest*)request;
+- (void)enqueueRequest:(DBRequest *)request;
+- (void)setRetryBlockForRequest:(DBRequest *)request;
+- (void)enqueueRetry:(DBRequest *)retry;
+- (void)replaceTrackedRequest:(DBRequest *)request withRetry:(DBRequest *)retry;
+- (NSOperationQueue *)queueForPriority:(DBRequestPriority)priority;
+- (NSArray *)queues;
+- (void)updateHostGateLimit;
++ (DBRequestPriority)defaultPriorityForRequest:(DBRequest *)request;
++ (NSNumber *)currentPriority;
+- (void)recordMetrics:(DBRequestMetrics *)metrics;
+
++ (NSDictionary *)thumbnailParametersForPath:(NSString *)path size:(NSString *)size;
+
++ (NSString *)singleFlightKeyForMethod:(NSString *)method path:(NSString *)path parameters:(NSDictionary *)params;
+- (BOOL)joinInFlightRequestForKey:(NSString *)key handler:(DBRequestBlock)handler;
+- (DBRequestBlock)fanOutBlockForKey:(NSString *)key;
+
+- (void)loadNextPathsOfBatch:(DBMetadataBatch *)batch pathHandler:(DBMetadataPathBlock)pathHandler completion:(DBBatchMetadataCompletionBlock)completion;
+
+- (void)loadSegmentsOfFile:(NSString *)path metadata:(DBMetadata *)metadata intoPath:(NSString *)destPath segments:(NSUInteger)segmentCount group:(DBRequestGroup *)group completion:(DBLoadFileCompletionBlock)completion;
+- (void)requestThumbnailDataForPath:(NSString *)path rev:(NSString *)rev size:(NSString *)size thumbnailCache:(DBThumbnailCache *)thumbnailCache completion:(DBLoadThumbnailDataCompletionBlock)completion;
+- (void)notifyLoadedFile:(NSString *)filename contentType:(NSString *)contentType metadata:(NSDictionary *)metadataDict eTag:(NSString *)eTag completion:(DBLoadFileCompletionBlock)completion;
+- (void)notifyLoadFileFailedWithError:(NSError *)error completion:(DBLoadFileCompletionBlock)completion;
 
 @property (nonatomic, readonly) MPOAuthCredentialConcreteStore *credentialStore;
 
 @end
 
 
+@interface DBChunkedUploadSession ()
+
+@property (nonatomic, copy) NSString *uploadId;
+@property (nonatomic) unsigned long long offset;
+@property (nonatomic) unsigned long long fileSize;
+@property (nonatomic, copy) NSDate *fileModificationDate;
+@property (nonatomic, copy) NSDate *expires;
+@property (nonatomic, getter = isComplete) BOOL complete;
+
+@end
+
+
 @implementation DBRestClient
 
 - (id)initWithSession:(DBSession*)aSession userId:(NSString *)theUserId {
@@ -68,12 +177,28 @@
         loadRequests = [[NSMutableDictionary alloc] init];
         imageLoadRequests = [[NSMutableDictionary alloc] init];
         uploadRequests = [[NSMutableDictionary alloc] init];
+        deltaRequests = [[NSMutableDictionary alloc] init];
+        inFlightHandlers = [[NSMutableDictionary alloc] init];
+        endpointHistories = [[NSMutableDictionary alloc] init];
+		hostGate = [[DBHostConcurrencyGate alloc] init];
 		
 		requestQueue = [[NSOperationQueue alloc] init];
 		requestQueue.name = @"dropbox-request-queue";
 		requestQueue.maxConcurrentOperationCount = 4;
 		
+		interactiveQueue = [[NSOperationQueue alloc] init];
+		interactiveQueue.name = @"dropbox-interactive-request-queue";
+		interactiveQueue.maxConcurrentOperationCount = kDBInteractiveLaneWidth;
+		
+		bulkQueue = [[NSOperationQueue alloc] init];
+		bulkQueue.name = @"dropbox-bulk-request-queue";
+		bulkQueue.maxConcurrentOperationCount = 4;
+		[self updateHostGateLimit];
+		
+		_retryPolicy = [DBRetryPolicy new];
+		
 		_completionSemaphore = dispatch_semaphore_create(0);
+		_pendingRetries = dispatch_group_create();
     }
     return self;
 }
@@ -89,7 +214,10 @@
 }
 
 - (BOOL)active {
-	return [requestQueue operationCount] > 0;
+	for (NSOperationQueue *queue in [self queues]) {
+		if ([queue operationCount] > 0) return YES;
+	}
+	return NO;
 }
 
 - (void)submitCompletionSignal {
@@ -100,12 +228,18 @@
 
 - (void)waitUntilAllRequestsAreCompleted {
 	dispatch_semaphore_wait(_completionSemaphore, DISPATCH_TIME_FOREVER);
-	[requestQueue waitUntilAllOperationsAreFinished];
+
+	// A request that fails schedules its retry before it finishes, so once the queues are empty no
+	// new retry can show up
+	do {
+		dispatch_group_wait(_pendingRetries, DISPATCH_TIME_FOREVER);
+		for (NSOperationQueue *queue in [self queues]) [queue waitUntilAllOperationsAreFinished];
+	} while (dispatch_group_wait(_pendingRetries, DISPATCH_TIME_NOW) != 0);
 }
 
 - (void)cancelAllRequests {
 	self.canceled = YES;
-	[requestQueue cancelAllOperations];
+	for (NSOperationQueue *queue in [self queues]) [queue cancelAllOperations];
 
 	@synchronized (loadRequests) {
 		for (DBRequest* request in [loadRequests allValues]) [request cancel];
@@ -122,6 +256,15 @@
 		[uploadRequests removeAllObjects];
 	}
 	
+	@synchronized (deltaRequests) {
+		for (DBRequest* request in [deltaRequests allValues]) [request cancel];
+		[deltaRequests removeAllObjects];
+	}
+	
+	@synchronized (inFlightHandlers) {
+		[inFlightHandlers removeAllObjects];
+	}
+	
 	if (_completionSemaphore) dispatch_semaphore_signal(_completionSemaphore);
 }
 
@@ -131,17 +274,155 @@
 }
 
 - (void)setMaxConcurrentRequests:(NSInteger)maxConcurrentRequests {
+	self.adaptiveConcurrency = NO;
 	requestQueue.maxConcurrentOperationCount = maxConcurrentRequests;
+	bulkQueue.maxConcurrentOperationCount = maxConcurrentRequests;
+	[self updateHostGateLimit];
+}
+
+- (NSInteger)maxConcurrentRequestsForPriority:(DBRequestPriority)priority {
+	return [self queueForPriority:priority].maxConcurrentOperationCount;
+}
+
+- (void)setMaxConcurrentRequests:(NSInteger)maxConcurrentRequests forPriority:(DBRequestPriority)priority {
+	NSOperationQueue *queue = [self queueForPriority:priority];
+	@synchronized (self) {
+		queue.maxConcurrentOperationCount = maxConcurrentRequests;
+		// While the controller sets the width, this one is kept for when it is turned off
+		if (concurrencyController && queue == requestQueue) normalLaneWidth = maxConcurrentRequests;
+		if (concurrencyController && queue == bulkQueue) bulkLaneWidth = maxConcurrentRequests;
+	}
+	[self updateHostGateLimit];
+}
+
+- (void)performWithPriority:(DBRequestPriority)priority block:(void (^)(void))block {
+	NSMutableDictionary *threadDictionary = [[NSThread currentThread] threadDictionary];
+	id previous = [threadDictionary objectForKey:kDBRestClientPriorityKey];
+	[threadDictionary setObject:[NSNumber numberWithInt:priority] forKey:kDBRestClientPriorityKey];
+	
+	block();
+	
+	if (previous) [threadDictionary setObject:previous forKey:kDBRestClientPriorityKey];
+	else [threadDictionary removeObjectForKey:kDBRestClientPriorityKey];
+}
+
+- (void)setPriority:(DBRequestPriority)priority forFileLoad:(NSString *)path {
+	@synchronized (loadRequests) {
+		id request = [loadRequests objectForKey:path];
+		NSArray *requests = [request isKindOfClass:[DBRequestGroup class]] ? [(DBRequestGroup *)request requests] : (request ? @[request] : nil);
+		for (DBRequest *r in requests) r.priority = priority;
+	}
+}
+
+- (void)setPriority:(DBRequestPriority)priority forThumbnailLoad:(NSString *)path size:(NSString *)size {
+	@synchronized (imageLoadRequests) {
+		[(DBRequest *)[imageLoadRequests objectForKey:[self thumbnailKeyForPath:path size:size]] setPriority:priority];
+		[(DBRequest *)[imageLoadRequests objectForKey:[self memoryThumbnailKeyForPath:path size:size]] setPriority:priority];
+	}
+}
+
+- (void)setPriority:(DBRequestPriority)priority forFileUpload:(NSString *)path {
+	@synchronized (uploadRequests) {
+		[(DBRequest *)[uploadRequests objectForKey:path] setPriority:priority];
+	}
+}
+
+- (BOOL)adaptiveConcurrency {
+	@synchronized (self) {
+		return concurrencyController != nil;
+	}
+}
+
+- (void)setAdaptiveConcurrency:(BOOL)adaptiveConcurrency {
+	@synchronized (self) {
+		if (adaptiveConcurrency == (concurrencyController != nil)) return;
+		if (!adaptiveConcurrency) {
+			// Back to the limits from before, or a host backed down to one connection stays there
+			concurrencyController.limitsChangedBlock = nil;
+			concurrencyController = nil;
+			[hostGate removeMaxRequestsForAllHosts];
+			requestQueue.maxConcurrentOperationCount = normalLaneWidth;
+			bulkQueue.maxConcurrentOperationCount = bulkLaneWidth;
+			[self updateHostGateLimit];
+			return;
+		}
+
+		normalLaneWidth = requestQueue.maxConcurrentOperationCount;
+		bulkLaneWidth = bulkQueue.maxConcurrentOperationCount;
+		concurrencyController = [[DBConcurrencyController alloc] initWithHostGate:hostGate];
+		concurrencyController.initialLimit = MAX(requestQueue.maxConcurrentOperationCount, 1);
+
+		// The gate holds each host to its own limit, the lanes only need to be wide enough for all of them
+		NSOperationQueue *normalQueue = requestQueue;
+		NSOperationQueue *backgroundQueue = bulkQueue;
+		concurrencyController.limitsChangedBlock = ^(DBConcurrencyController *controller) {
+			NSUInteger limit = [controller totalLimit];
+			normalQueue.maxConcurrentOperationCount = limit;
+			backgroundQueue.maxConcurrentOperationCount = limit;
+		};
+	}
+}
+
+- (DBConcurrencyController *)concurrencyController {
+	@synchronized (self) {
+		return concurrencyController;
+	}
+}
+
+- (DBHostConcurrencyGate *)hostGate {
+	return hostGate;
+}
+
+- (DBEndpointStatistics *)statisticsForEndpoint:(NSString *)endpoint {
+	DBRequestMetricsHistory *history = nil;
+	@synchronized (endpointHistories) {
+		history = [endpointHistories objectForKey:endpoint];
+	}
+	return [history statistics];
+}
+
+- (NSDictionary *)endpointStatistics {
+	NSDictionary *histories = nil;
+	@synchronized (endpointHistories) {
+		histories = [endpointHistories copy];
+	}
+
+	NSMutableDictionary *statistics = [NSMutableDictionary dictionaryWithCapacity:[histories count]];
+	for (NSString *endpoint in histories) {
+		[statistics setObject:[[histories objectForKey:endpoint] statistics] forKey:endpoint];
+	}
+	return statistics;
 }
 
 - (void)loadMetadata:(NSString*)path withParams:(NSDictionary *)params completion:(DBMetadataCompletionBlock)completion {
+	[self loadMetadata:path withParams:params childHandler:nil completion:completion];
+}
+
+- (void)loadMetadata:(NSString*)path withParams:(NSDictionary *)params childHandler:(DBMetadataChildBlock)childHandler completion:(DBMetadataCompletionBlock)completion {
     NSString* fullPath = [NSString stringWithFormat:@"/metadata/%@%@", root, path];
-    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIHost path:fullPath parameters:params];
+	
+	// Only plain listings are cached, and the cached copy is only served to callers that didn't bring
+	// their own hash; they have no copy of their own to fall back on
+	DBMetadataCache *metadataCache = childHandler ? nil : self.metadataCache;
+	BOOL cacheable = metadataCache && ([params count] == 0 || ([params count] == 1 && [params objectForKey:@"hash"]));
+	DBMetadata *cachedMetadata = nil;
+	if (cacheable && [params count] == 0) {
+		cachedMetadata = [metadataCache metadataForPath:path root:root];
+		if (cachedMetadata.hash) params = [NSDictionary dictionaryWithObject:cachedMetadata.hash forKey:@"hash"];
+		else cachedMetadata = nil;
+	}
     
-	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+	DBRequestBlock handler = ^(DBRequest *request) {
 		if (self.canceled) return;
 
-		if (request.statusCode == 304) {
+		if (request.statusCode == 304 && cachedMetadata) {
+			if ([_delegate respondsToSelector:@selector(restClient:loadedMetadata:)]) {
+				[_delegate restClient:self loadedMetadata:cachedMetadata];
+			}
+			
+			if (completion) completion(nil, NO, cachedMetadata);
+		}
+		else if (request.statusCode == 304) {
 			if ([_delegate respondsToSelector:@selector(restClient:metadataUnchangedAtPath:)]) {
 				NSString* path = [request.userInfo objectForKey:@"path"];
 				[_delegate restClient:self metadataUnchangedAtPath:path];
@@ -151,6 +432,7 @@
 		} 
 		else if (request.error) {
 			[self checkForAuthenticationFailure:request];
+			if (cacheable && request.statusCode == 404) [metadataCache removeMetadataForPath:path root:root];
 			if ([_delegate respondsToSelector:@selector(restClient:loadMetadataFailedWithError:)]) {
 				[_delegate restClient:self loadMetadataFailedWithError:request.error];
 			}
@@ -162,6 +444,8 @@
 			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
 				DBMetadata* metadata = [[DBMetadata alloc] initWithDictionary:result];
 				if (metadata) {
+					if (cacheable) [metadataCache setMetadata:metadata forPath:path root:root];
+					
 					if ([_delegate respondsToSelector:@selector(restClient:loadedMetadata:)]) {
 						[_delegate restClient:self loadedMetadata:metadata];
 					}
@@ -179,13 +463,29 @@
 				}
 			});
 		}
-	}];
+	};
+	
+	// A streamed listing goes to this caller's childHandler only, so it can't be shared
+	NSString *flightKey = childHandler ? nil : [DBRestClient singleFlightKeyForMethod:@"GET" path:fullPath parameters:params];
+	if (flightKey && [self joinInFlightRequestForKey:flightKey handler:handler]) return;
+	
+    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIHost path:fullPath parameters:params];
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:flightKey ? [self fanOutBlockForKey:flightKey] : handler];
 	
     NSMutableDictionary *userInfo = [NSMutableDictionary dictionaryWithObject:path forKey:@"path"];
     if (params) [userInfo addEntriesFromDictionary:params];
     operation.userInfo = userInfo;
 	
-	[requestQueue addOperation:operation];
+	if (childHandler) {
+		DBJSONStreamParser *parser = [DBJSONStreamParser new];
+		[parser streamElementsOfArrayForKey:@"contents" handler:^(id value) {
+			if (self.canceled || ![value isKindOfClass:[NSDictionary class]]) return;
+			childHandler([[DBMetadata alloc] initWithDictionary:value]);
+		}];
+		operation.streamParser = parser;
+	}
+	
+	[self enqueueRequest:operation];
 }
 
 - (void)loadMetadata:(NSString*)path completion:(DBMetadataCompletionBlock)completion {
@@ -204,13 +504,22 @@
 
 
 - (void)loadDelta:(NSString *)cursor completion:(DBDeltaCompletionBlock)completion
+{
+	[self loadDelta:cursor entryHandler:nil completion:completion];
+}
+
+- (void)loadDelta:(NSString *)cursor entryHandler:(DBDeltaEntryBlock)entryHandler completion:(DBDeltaCompletionBlock)completion
 {
     NSDictionary *params = cursor ? [NSDictionary dictionaryWithObject:cursor forKey:@"cursor"] : nil;
     NSString *fullPath = [NSString stringWithFormat:@"/delta"];
     NSMutableURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIHost path:fullPath parameters:params method:@"POST"];
+	NSString *requestKey = cursor ? cursor : @"";
 	
     DBRequest* operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
 		if (self.canceled) return;
+		@synchronized (deltaRequests) {
+			if ([deltaRequests objectForKey:requestKey] == request) [deltaRequests removeObjectForKey:requestKey];
+		}
 
 		if (request.error) {
 			[self checkForAuthenticationFailure:request];
@@ -224,12 +533,8 @@
 			dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
 				NSDictionary* result = [request parseResponseAsType:[NSDictionary class]];
 				if (result) {
-					NSArray *entryArrays = [result objectForKey:@"entries"];
-					NSMutableArray *entries = [NSMutableArray arrayWithCapacity:[entryArrays count]];
-					for (NSArray *entryArray in entryArrays) {
-						DBDeltaEntry *entry = [[DBDeltaEntry alloc] initWithArray:entryArray];
-						[entries addObject:entry];
-					}
+					// When streaming, the entries have already gone to the entry handler
+					NSArray *entryArrays = entryHandler ? nil : [result objectForKey:@"entries"];
 					BOOL reset = [[result objectForKey:@"reset"] boolValue];
 					NSString *cursor = [result objectForKey:@"cursor"];
 					BOOL hasMore = [[result objectForKey:@"has_more"] boolValue];
@@ -246,14 +551,131 @@
 					if ([_delegate respondsToSelector:@selector(restClient:loadDeltaFailedWithError:)]) {
 						[_delegate restClient:self loadDeltaFailedWithError:error];
 					}
-					if (completion) completion(request.error, nil, NO, nil, NO);
+					if (completion) completion(error, nil, NO, nil, NO);
 				}
 			});
 		}
 	}];
 	
     operation.userInfo = params;
-	[requestQueue addOperation:operation];
+	
+	if (entryHandler) {
+		DBJSONStreamParser *parser = [DBJSONStreamParser new];
+		[parser streamElementsOfArrayForKey:@"entries" handler:^(id value) {
+			if (self.canceled || ![value isKindOfClass:[NSArray class]] || [value count] < 2) return;
+			entryHandler([[DBDeltaEntry alloc] initWithArray:value]);
+		}];
+		operation.streamParser = parser;
+	}
+	
+	@synchronized (deltaRequests) {
+		[deltaRequests setObject:operation forKey:requestKey];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+- (void)cancelDeltaLoad:(NSString *)cursor {
+	NSString *requestKey = cursor ? cursor : @"";
+	@synchronized (deltaRequests) {
+		DBRequest *request = [deltaRequests objectForKey:requestKey];
+		if (request) {
+			[request cancel];
+			[deltaRequests removeObjectForKey:requestKey];
+		}
+	}
+}
+
+- (void)loadMetadataForPaths:(NSArray *)paths withHashes:(NSArray *)hashes pathHandler:(DBMetadataPathBlock)pathHandler completion:(DBBatchMetadataCompletionBlock)completion {
+	DBMetadataBatch *batch = [DBMetadataBatch new];
+	NSNumber *priority = [DBRestClient currentPriority];
+	batch.priority = priority ? (DBRequestPriority)[priority intValue] : DBRequestPriorityBulk;
+	NSUInteger saved = 0;
+	
+	for (NSUInteger i = 0; i < [paths count]; i++) {
+		NSString *path = [paths objectAtIndex:i];
+		id hash = i < [hashes count] ? [hashes objectAtIndex:i] : [NSNull null];
+		NSString *key = [path lowercaseString]; // Dropbox paths are case insensitive
+		
+		id knownHash = [batch.hashes objectForKey:key];
+		if (!knownHash) {
+			[batch.hashes setObject:hash forKey:key];
+			[batch.spellings setObject:[NSMutableOrderedSet orderedSetWithObject:path] forKey:key];
+			[batch.pendingPaths addObject:path];
+		}
+		else {
+			saved++;
+			if (![knownHash isEqual:hash]) [batch.hashes setObject:[NSNull null] forKey:key];
+			[[batch.spellings objectForKey:key] addObject:path];
+		}
+	}
+	
+	if (saved > 0) {
+		@synchronized (self) {
+			_batchMetadataRequestsSaved += saved;
+		}
+		DBLogInfo(@"DropboxSDK: metadata batch of %lu paths needs %lu requests", (unsigned long)[paths count], (unsigned long)[batch.pendingPaths count]);
+	}
+	
+	[self loadNextPathsOfBatch:batch pathHandler:pathHandler completion:completion];
+}
+
+- (void)loadNextPathsOfBatch:(DBMetadataBatch *)batch pathHandler:(DBMetadataPathBlock)pathHandler completion:(DBBatchMetadataCompletionBlock)completion {
+	// Keep enough requests queued to cover every slot of the lane, and no more
+	NSInteger width = [self queueForPriority:batch.priority].maxConcurrentOperationCount;
+	NSUInteger window = 2 * (width > 0 ? width : 4);
+	
+	NSMutableArray *paths = [NSMutableArray array];
+	BOOL done = NO;
+	@synchronized (batch) {
+		while (batch.inFlight < window && [batch.pendingPaths count] > 0) {
+			[paths addObject:[batch.pendingPaths objectAtIndex:0]];
+			[batch.pendingPaths removeObjectAtIndex:0];
+			batch.inFlight++;
+		}
+		
+		if (batch.inFlight == 0 && !batch.completed) {
+			batch.completed = YES;
+			done = YES;
+		}
+	}
+	
+	if (done) {
+		if (completion) completion(batch.metadata, batch.unchangedPaths, batch.errors);
+		return;
+	}
+	
+	for (NSString *path in paths) {
+		id hash = [batch.hashes objectForKey:[path lowercaseString]];
+		NSDictionary *params = (hash != [NSNull null]) ? [NSDictionary dictionaryWithObject:hash forKey:@"hash"] : nil;
+		
+		// Runs from the completion blocks of earlier paths too, so pass the batch's priority on explicitly
+		[self performWithPriority:batch.priority block:^{
+			[self loadMetadata:path withParams:params completion:^(NSError *error, BOOL changed, DBMetadata *metadata) {
+				// Every spelling of the path that was asked for gets the result
+				NSArray *spellings = [[batch.spellings objectForKey:[path lowercaseString]] array];
+				@synchronized (batch) {
+					for (NSString *spelling in spellings) {
+						if (error) [batch.errors setObject:error forKey:spelling];
+						else if (changed) [batch.metadata setObject:metadata forKey:spelling];
+						else [batch.unchangedPaths addObject:spelling];
+					}
+					batch.inFlight--;
+				}
+				
+				if (pathHandler) {
+					for (NSString *spelling in spellings) pathHandler(spelling, error, changed, metadata);
+				}
+				[self loadNextPathsOfBatch:batch pathHandler:pathHandler completion:completion];
+			}];
+		}];
+	}
+}
+
+- (NSUInteger)batchMetadataRequestsSaved {
+	@synchronized (self) {
+		return _batchMetadataRequestsSaved;
+	}
 }
 
 
@@ -271,49 +693,11 @@
 		
 		if (request.error) {
 			[self checkForAuthenticationFailure:request];
-			if ([_delegate respondsToSelector:@selector(restClient:loadFileFailedWithError:)]) {
-				[_delegate restClient:self loadFileFailedWithError:request.error];
-			}
-			
-			if (completion) completion(request.error, nil, nil);
+			[self notifyLoadFileFailedWithError:request.error completion:completion];
 		} 
 		else {
-			NSString* filename = [request.resultFilename copy];
-			NSDictionary* headers = [[request.response allHeaderFields] copy];
-			NSString* contentType = [[headers objectForKey:@"Content-Type"] copy];
-			NSDictionary* metadataDict = [[request xDropboxMetadataJSON] copy];
-			NSString* eTag = [[headers objectForKey:@"Etag"] copy];
-			DBRestClient *myself = self;
-			
-			if ([_delegate respondsToSelector:@selector(restClient:loadedFile:)]) {
-				[_delegate restClient:self loadedFile:filename];
-			} 
-			else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:metadata:)]) {
-				DBMetadata* metadata = metadataDict ? [[DBMetadata alloc] initWithDictionary:metadataDict] : nil;
-				[_delegate restClient:self loadedFile:filename contentType:contentType metadata:metadata];
-			} 
-			else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:)]) {
-				// This callback is deprecated and this block exists only for backwards compatibility.
-				[_delegate restClient:self loadedFile:filename contentType:contentType];
-			} 
-			else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:eTag:)]) {
-				// This code is for the official Dropbox client to get eTag information from the server
-				NSMethodSignature* signature = [self methodSignatureForSelector:@selector(restClient:loadedFile:contentType:eTag:)];
-				NSInvocation* invocation = [NSInvocation invocationWithMethodSignature:signature];
-				
-				[invocation setTarget:_delegate];
-				[invocation setSelector:@selector(restClient:loadedFile:contentType:eTag:)];
-				[invocation setArgument:&myself atIndex:2];
-				[invocation setArgument:&filename atIndex:3];
-				[invocation setArgument:&contentType atIndex:4];
-				[invocation setArgument:&eTag atIndex:5];
-				[invocation invoke];
-			}
-			
-			if (completion) {
-				DBMetadata* metadata = [[DBMetadata alloc] initWithDictionary:metadataDict];
-				completion(nil, contentType, metadata);
-			}
+			NSDictionary* headers = [request.response allHeaderFields];
+			[self notifyLoadedFile:request.resultFilename contentType:[headers objectForKey:@"Content-Type"] metadata:[request xDropboxMetadataJSON] eTag:[headers objectForKey:@"Etag"] completion:completion];
 		}
 		
 		@synchronized (loadRequests) {
@@ -321,9 +705,8 @@
 		}
 	}];
 	
-
-	
     operation.resultFilename = destPath;
+    operation.resumable = _resumableLoads;
 	
 	__weak DBRequest *request = operation;
     operation.downloadProgressBlock = ^(DBRequest *r) {
@@ -338,7 +721,193 @@
 		[loadRequests setObject:operation forKey:path];
 	}
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
+}
+
+- (void)loadFile:(NSString *)path atRev:(NSString *)rev intoSink:(id<DBDownloadSink>)sink completion:(DBLoadFileCompletionBlock)completion {
+	NSString *fullPath = [NSString stringWithFormat:@"/files/%@%@", root, path];
+	NSDictionary *params = rev ? [NSDictionary dictionaryWithObject:rev forKey:@"rev"] : nil;
+	NSURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
+	
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		if (self.canceled) return;
+		
+		if (request.error) {
+			[self checkForAuthenticationFailure:request];
+			if (completion) completion(request.error, nil, nil);
+		}
+		else if (completion) {
+			NSDictionary *metadataDict = [request xDropboxMetadataJSON];
+			DBMetadata *metadata = metadataDict ? [[DBMetadata alloc] initWithDictionary:metadataDict] : nil;
+			completion(nil, [[request.response allHeaderFields] objectForKey:@"Content-Type"], metadata);
+		}
+		
+		@synchronized (loadRequests) {
+			[loadRequests removeObjectForKey:path];
+		}
+	}];
+	
+	operation.downloadSink = sink;
+	operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", rev, @"rev", nil];
+	
+	@synchronized (loadRequests) {
+		[loadRequests setObject:operation forKey:path];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+- (void)loadFile:(NSString *)path atRev:(NSString *)rev intoPath:(NSString *)destPath segments:(NSUInteger)segmentCount completion:(DBLoadFileCompletionBlock)completion {
+	if (segmentCount <= 1) {
+		[self loadFile:path atRev:rev intoPath:destPath completion:completion];
+		return;
+	}
+	
+	DBRequestGroup *group = [DBRequestGroup new];
+	NSNumber *currentPriority = [DBRestClient currentPriority];
+	DBRequestPriority priority = currentPriority ? (DBRequestPriority)[currentPriority intValue] : DBRequestPriorityBulk;
+	
+	// Pin the rev and learn the size first, so all the ranges come from the same version of the file
+	NSString *fullPath = [NSString stringWithFormat:@"/metadata/%@%@", root, path];
+	NSMutableDictionary *params = [NSMutableDictionary dictionaryWithObject:@"false" forKey:@"list"];
+	if (rev) [params setObject:rev forKey:@"rev"];
+	NSURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIHost path:fullPath parameters:params];
+	
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		if (self.canceled || group.cancelled) return;
+		
+		NSDictionary *result = [request parseResponseAsType:[NSDictionary class]];
+		DBMetadata *metadata = result ? [[DBMetadata alloc] initWithDictionary:result] : nil;
+		
+		if (!metadata) {
+			[self checkForAuthenticationFailure:request];
+			[self notifyLoadFileFailedWithError:request.error completion:completion];
+			@synchronized (loadRequests) {
+				if ([loadRequests objectForKey:path] == group) [loadRequests removeObjectForKey:path];
+			}
+		}
+		else if (metadata.isDirectory || metadata.isDeleted || !metadata.rev || metadata.totalBytes < (long long)segmentCount * kDBMinimumDownloadSegmentSize) {
+			// Not worth splitting; a plain load also reports the right error for folders and deleted files
+			@synchronized (loadRequests) {
+				if ([loadRequests objectForKey:path] == group) [loadRequests removeObjectForKey:path];
+			}
+			[self performWithPriority:priority block:^{
+				[self loadFile:path atRev:metadata.rev intoPath:destPath completion:completion];
+			}];
+		}
+		else {
+			[self performWithPriority:priority block:^{
+				[self loadSegmentsOfFile:path metadata:metadata intoPath:destPath segments:segmentCount group:group completion:completion];
+			}];
+		}
+	}];
+	
+	operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", destPath, @"destinationPath", rev, @"rev", nil];
+	[group addRequest:operation];
+	
+	@synchronized (loadRequests) {
+		[loadRequests setObject:group forKey:path];
+	}
+	
+	// The metadata lookup is part of the transfer, so it doesn't get the interactive lane of its own kind
+	[self performWithPriority:priority block:^{
+		[self enqueueRequest:operation];
+	}];
+}
+
+- (void)loadSegmentsOfFile:(NSString *)path metadata:(DBMetadata *)metadata intoPath:(NSString *)destPath segments:(NSUInteger)segmentCount group:(DBRequestGroup *)group completion:(DBLoadFileCompletionBlock)completion {
+	NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", destPath, @"destinationPath", metadata.rev, @"rev", nil];
+	long long totalBytes = metadata.totalBytes;
+	
+	// Every segment writes its range in place, so the file is allocated at its full size up front,
+	// next to the destination so it can be renamed into place at the end
+	DBFileWriter *fileWriter = [[DBFileWriter alloc] initTemporaryFileForPath:destPath];
+	// Before anything else, so a cancel from another thread from here on removes the file
+	group.temporaryFilename = fileWriter.path;
+	[fileWriter preallocateLength:totalBytes];
+	if (![fileWriter truncateAtOffset:totalBytes] || ![fileWriter close]) {
+		DBLogError(@"DBRestClient#loadFile: Failed to create temp file for %@, error: %d", destPath, fileWriter ? fileWriter.lastError : errno);
+		[fileWriter discard];
+		
+		@synchronized (loadRequests) {
+			if ([loadRequests objectForKey:path] == group) [loadRequests removeObjectForKey:path];
+		}
+		[self notifyLoadFileFailedWithError:[NSError errorWithDomain:DBErrorDomain code:DBErrorInsufficientDiskSpace userInfo:userInfo] completion:completion];
+		return;
+	}
+	
+	NSString *tempFilename = fileWriter.path;
+	
+	NSString *fullPath = [NSString stringWithFormat:@"/files/%@%@", root, path];
+	NSDictionary *params = [NSDictionary dictionaryWithObject:metadata.rev forKey:@"rev"];
+	long long segmentLength = (totalBytes + segmentCount - 1) / segmentCount;
+	
+	__block NSUInteger remaining = (NSUInteger)((totalBytes + segmentLength - 1) / segmentLength);
+	__block BOOL failed = NO;
+	NSMutableArray *operations = [NSMutableArray arrayWithCapacity:remaining];
+	
+	for (long long offset = 0; offset < totalBytes; offset += segmentLength) {
+		NSURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
+		
+		DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+			if (self.canceled || group.cancelled) return;
+			
+			BOOL done = NO;
+			@synchronized (group) {
+				if (failed) return;
+				if (request.error) failed = YES;
+				else done = (--remaining == 0);
+			}
+			
+			NSError *error = request.error;
+			if (error) {
+				for (DBRequest *segment in group.requests) [segment cancel];
+				[self checkForAuthenticationFailure:request];
+			}
+			else if (done) {
+				// Each segment checked its own length, and the file was sized up front
+				if (rename([tempFilename fileSystemRepresentation], [destPath fileSystemRepresentation]) != 0) {
+					int renameError = errno;
+					DBLogError(@"DBRestClient#loadFile: error moving temp file to desired location: %s", strerror(renameError));
+					error = [NSError errorWithDomain:NSPOSIXErrorDomain code:renameError userInfo:userInfo];
+				}
+			}
+			else {
+				return;
+			}
+			
+			if (error) {
+				[[NSFileManager defaultManager] removeItemAtPath:tempFilename error:nil];
+				[self notifyLoadFileFailedWithError:error completion:completion];
+			}
+			else {
+				NSDictionary *headers = [request.response allHeaderFields];
+				[self notifyLoadedFile:destPath contentType:[headers objectForKey:@"Content-Type"] metadata:[metadata dictionary] eTag:[headers objectForKey:@"Etag"] completion:completion];
+			}
+			
+			@synchronized (loadRequests) {
+				if ([loadRequests objectForKey:path] == group) [loadRequests removeObjectForKey:path];
+			}
+		}];
+		
+		operation.resultFilename = tempFilename;
+		operation.rangeOffset = offset;
+		operation.rangeLength = MIN(segmentLength, totalBytes - offset);
+		operation.downloadProgressBlock = ^(DBRequest *r) {
+			if ([_delegate respondsToSelector:@selector(restClient:loadProgress:forFile:)]) {
+				CGFloat loaded = 0;
+				for (DBRequest *segment in group.requests) loaded += segment.downloadProgress * segment.rangeLength;
+				[_delegate restClient:self loadProgress:loaded / totalBytes forFile:destPath];
+			}
+		};
+		operation.userInfo = userInfo;
+		
+		[group addRequest:operation];
+		[operations addObject:operation];
+	}
+	
+	if (group.cancelled) return;
+	for (DBRequest *operation in operations) [self enqueueRequest:operation];
 }
 
 - (void)loadFile:(NSString *)path intoPath:(NSString *)destPath completion:(DBLoadFileCompletionBlock)completion {
@@ -355,116 +924,279 @@
 	}
 }
 
+- (void)notifyLoadedFile:(NSString *)filename contentType:(NSString *)contentType metadata:(NSDictionary *)metadataDict eTag:(NSString *)eTag completion:(DBLoadFileCompletionBlock)completion {
+	DBRestClient *myself = self;
+	
+	if ([_delegate respondsToSelector:@selector(restClient:loadedFile:)]) {
+		[_delegate restClient:self loadedFile:filename];
+	} 
+	else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:metadata:)]) {
+		DBMetadata* metadata = metadataDict ? [[DBMetadata alloc] initWithDictionary:metadataDict] : nil;
+		[_delegate restClient:self loadedFile:filename contentType:contentType metadata:metadata];
+	} 
+	else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:)]) {
+		// This callback is deprecated and this block exists only for backwards compatibility.
+		[_delegate restClient:self loadedFile:filename contentType:contentType];
+	} 
+	else if ([_delegate respondsToSelector:@selector(restClient:loadedFile:contentType:eTag:)]) {
+		// This code is for the official Dropbox client to get eTag information from the server
+		NSMethodSignature* signature = [self methodSignatureForSelector:@selector(restClient:loadedFile:contentType:eTag:)];
+		NSInvocation* invocation = [NSInvocation invocationWithMethodSignature:signature];
+		
+		[invocation setTarget:_delegate];
+		[invocation setSelector:@selector(restClient:loadedFile:contentType:eTag:)];
+		[invocation setArgument:&myself atIndex:2];
+		[invocation setArgument:&filename atIndex:3];
+		[invocation setArgument:&contentType atIndex:4];
+		[invocation setArgument:&eTag atIndex:5];
+		[invocation invoke];
+	}
+	
+	if (completion) {
+		DBMetadata* metadata = [[DBMetadata alloc] initWithDictionary:metadataDict];
+		completion(nil, contentType, metadata);
+	}
+}
+
+- (void)notifyLoadFileFailedWithError:(NSError *)error completion:(DBLoadFileCompletionBlock)completion {
+	if ([_delegate respondsToSelector:@selector(restClient:loadFileFailedWithError:)]) {
+		[_delegate restClient:self loadFileFailedWithError:error];
+	}
+	
+	if (completion) completion(error, nil, nil);
+}
+
 - (void)restClient:(DBRestClient*)restClient loadedFile:(NSString*)destPath contentType:(NSString*)contentType eTag:(NSString*)eTag {
 		// Empty selector to get the signature from
 }
 
 
 
++ (NSDictionary *)thumbnailParametersForPath:(NSString *)path size:(NSString *)size {
+	NSString *format = @"JPEG";
+	if ([path length] > 4) {
+		NSString *extension = [[path substringFromIndex:[path length] - 4] uppercaseString];
+		if ([[NSSet setWithObjects:@".PNG", @".GIF", nil] containsObject:extension]) {
+			format = @"PNG";
+		}
+	}
+	
+	NSMutableDictionary *params = [NSMutableDictionary dictionaryWithObject:format forKey:@"format"];
+	if (size) [params setObject:size forKey:@"size"];
+	return params;
+}
+
 - (NSString*)thumbnailKeyForPath:(NSString*)path size:(NSString*)size {
     return [NSString stringWithFormat:@"%@##%@", path, size];
 }
 
+// loadThumbnailForMetadata: can run alongside a loadThumbnail: of the same path and size
+- (NSString*)memoryThumbnailKeyForPath:(NSString*)path size:(NSString*)size {
+    return [NSString stringWithFormat:@"%@##%@##memory", path, size];
+}
+
 
 - (void)loadThumbnail:(NSString *)path ofSize:(NSString *)size intoPath:(NSString *)destinationPath completion:(DBLoadThumbnailCompletionBlock)completion {
     NSString* fullPath = [NSString stringWithFormat:@"/thumbnails/%@%@", root, path];
     
-    NSString* format = @"JPEG";
-    if ([path length] > 4) {
-        NSString* extension = [[path substringFromIndex:[path length] - 4] uppercaseString];
-        if ([[NSSet setWithObjects:@".PNG", @".GIF", nil] containsObject:extension]) {
-            format = @"PNG";
-        }
-    }
-    
-    NSMutableDictionary* params = [NSMutableDictionary dictionaryWithObject:format forKey:@"format"];
-    if (size) [params setObject:size forKey:@"size"];
+    NSDictionary* params = [DBRestClient thumbnailParametersForPath:path size:size];
 
-    
-    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
-	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+	DBRequestBlock handler = ^(DBRequest *request) {
 		if (self.canceled) return;
 
-		if (request.error) {
+		NSError *copyError = nil;
+		if (!request.error && ![request.resultFilename isEqualToString:destinationPath]) {
+			// Joined another caller's request, take a copy of the thumbnail it loaded
+			NSFileManager *fileManager = [NSFileManager new];
+			[fileManager removeItemAtPath:destinationPath error:nil];
+			if (![fileManager copyItemAtPath:request.resultFilename toPath:destinationPath error:&copyError]) {
+				copyError = [NSError errorWithDomain:copyError.domain code:copyError.code userInfo:request.userInfo];
+			}
+		}
+
+		if (request.error || copyError) {
+			NSError *error = request.error ? request.error : copyError;
 			[self checkForAuthenticationFailure:request];
 			if ([_delegate respondsToSelector:@selector(restClient:loadThumbnailFailedWithError:)]) {
-				[_delegate restClient:self loadThumbnailFailedWithError:request.error];
+				[_delegate restClient:self loadThumbnailFailedWithError:error];
+			}
+			
+			if (completion) completion(error, nil, nil);
+		}
+		else {
+			NSString* filename = destinationPath;
+			NSDictionary* metadataDict = [request xDropboxMetadataJSON];
+			DBMetadata* metadata = [[DBMetadata alloc] initWithDictionary:metadataDict];
+
+			if ([_delegate respondsToSelector:@selector(restClient:loadedThumbnail:metadata:)]) {
+				[_delegate restClient:self loadedThumbnail:filename metadata:metadata];
+			}
+			else if ([_delegate respondsToSelector:@selector(restClient:loadedThumbnail:)]) {
+				// This callback is deprecated and this block exists only for backwards compatibility.
+				[_delegate restClient:self loadedThumbnail:filename];
 			}
 			
+			if (completion) completion(nil, filename, metadata);
+		}
+		
+		NSString* path = [request.userInfo objectForKey:@"path"];
+		NSString* size = [request.userInfo objectForKey:@"size"];
+		
+		@synchronized (imageLoadRequests) {
+			[imageLoadRequests removeObjectForKey:[self thumbnailKeyForPath:path size:size]];
+		}
+	};
+	
+	NSString *flightKey = [DBRestClient singleFlightKeyForMethod:@"GET" path:fullPath parameters:params];
+	if ([self joinInFlightRequestForKey:flightKey handler:handler]) return;
+	
+    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:[self fanOutBlockForKey:flightKey]];
+	
+    operation.resultFilename = destinationPath;
+    operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:root, @"root", path, @"path", destinationPath, @"destinationPath", flightKey, @"singleFlightKey", size, @"size", nil];
+	
+	@synchronized (imageLoadRequests) {
+		[imageLoadRequests setObject:operation forKey:[self thumbnailKeyForPath:path size:size]];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+- (void)loadThumbnail:(NSString *)path ofSize:(NSString *)size intoSink:(id<DBDownloadSink>)sink completion:(DBLoadThumbnailCompletionBlock)completion {
+	NSString *fullPath = [NSString stringWithFormat:@"/thumbnails/%@%@", root, path];
+	
+	NSDictionary *params = [DBRestClient thumbnailParametersForPath:path size:size];
+	
+	NSURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		if (self.canceled) return;
+		
+		if (request.error) {
+			[self checkForAuthenticationFailure:request];
+			if (completion) completion(request.error, nil, nil);
+		}
+		else if (completion) {
+			completion(nil, nil, [[DBMetadata alloc] initWithDictionary:[request xDropboxMetadataJSON]]);
+		}
+		
+		@synchronized (imageLoadRequests) {
+			[imageLoadRequests removeObjectForKey:[self thumbnailKeyForPath:path size:size]];
+		}
+	}];
+	
+	operation.downloadSink = sink;
+	operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:root, @"root", path, @"path", size, @"size", nil];
+	
+	@synchronized (imageLoadRequests) {
+		[imageLoadRequests setObject:operation forKey:[self thumbnailKeyForPath:path size:size]];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+- (void)loadThumbnailForMetadata:(DBMetadata *)metadata ofSize:(NSString *)size completion:(DBLoadThumbnailDataCompletionBlock)completion {
+	NSString *path = metadata.path;
+	NSString *rev = metadata.rev;
+	
+	if (!metadata.thumbnailExists || metadata.isDeleted) {
+		NSDictionary *userInfo = path ? [NSDictionary dictionaryWithObject:path forKey:@"path"] : nil;
+		NSError *error = [NSError errorWithDomain:DBErrorDomain code:DBErrorFileNotFound userInfo:userInfo];
+		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			if (completion) completion(error, nil, nil);
+		});
+		return;
+	}
+	
+	DBThumbnailCache *thumbnailCache = self.thumbnailCache;
+	if (!thumbnailCache) {
+		[self requestThumbnailDataForPath:path rev:rev size:size thumbnailCache:nil completion:completion];
+		return;
+	}
+	
+	// A lookup can read the disk, so it is kept off the caller's thread
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		if (self.canceled) return;
+		
+		NSString *cachedSize = nil;
+		NSData *cachedThumbnail = [thumbnailCache thumbnailForPath:path root:root size:size rev:rev actualSize:&cachedSize];
+		if (cachedThumbnail) {
+			if (completion) completion(nil, cachedThumbnail, cachedSize);
+		}
+		else {
+			[self requestThumbnailDataForPath:path rev:rev size:size thumbnailCache:thumbnailCache completion:completion];
+		}
+	});
+}
+
+- (void)requestThumbnailDataForPath:(NSString *)path rev:(NSString *)rev size:(NSString *)size thumbnailCache:(DBThumbnailCache *)thumbnailCache completion:(DBLoadThumbnailDataCompletionBlock)completion {
+	NSString *fullPath = [NSString stringWithFormat:@"/thumbnails/%@%@", root, path];
+	NSDictionary *params = [DBRestClient thumbnailParametersForPath:path size:size];
+	
+	DBRequestBlock handler = ^(DBRequest *request) {
+		if (self.canceled) return;
+		
+		if (request.error) {
+			[self checkForAuthenticationFailure:request];
 			if (completion) completion(request.error, nil, nil);
 		}
-		else {
-			NSString* filename = request.resultFilename;
-			NSDictionary* metadataDict = [request xDropboxMetadataJSON];
-			DBMetadata* metadata = [[DBMetadata alloc] initWithDictionary:metadataDict];
-
-			if ([_delegate respondsToSelector:@selector(restClient:loadedThumbnail:metadata:)]) {
-				[_delegate restClient:self loadedThumbnail:filename metadata:metadata];
-			}
-			else if ([_delegate respondsToSelector:@selector(restClient:loadedThumbnail:)]) {
-				// This callback is deprecated and this block exists only for backwards compatibility.
-				[_delegate restClient:self loadedThumbnail:filename];
-			}
-			
-			if (completion) completion(nil, filename, metadata);
+		else if (completion) {
+			completion(nil, [(DBMemorySink *)request.downloadSink data], size);
 		}
 		
-		NSString* path = [request.userInfo objectForKey:@"path"];
-		NSString* size = [request.userInfo objectForKey:@"size"];
-		
+		NSString *key = [self memoryThumbnailKeyForPath:path size:size];
 		@synchronized (imageLoadRequests) {
-			[imageLoadRequests removeObjectForKey:[self thumbnailKeyForPath:path size:size]];
+			if ([imageLoadRequests objectForKey:key] == request) [imageLoadRequests removeObjectForKey:key];
+		}
+	};
+	
+	// Callers of the file-based loadThumbnail: expect a resultFilename, so they get their own flights
+	NSString *flightKey = [[DBRestClient singleFlightKeyForMethod:@"GET" path:fullPath parameters:params] stringByAppendingFormat:@" rev=%@", rev];
+	if ([self joinInFlightRequestForKey:flightKey handler:handler]) return;
+	
+	DBRequestBlock fanOut = [self fanOutBlockForKey:flightKey];
+	NSURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params];
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		NSData *thumbnail = [(DBMemorySink *)request.downloadSink data];
+		if (!request.error && thumbnail && !self.canceled) {
+			// Filed under the rev the server sent it for, which is newer than metadata's if the file changed
+			NSString *loadedRev = [[request xDropboxMetadataJSON] objectForKey:@"rev"];
+			[thumbnailCache setThumbnail:thumbnail forPath:path root:root size:size rev:loadedRev ? loadedRev : rev];
 		}
+		fanOut(request);
 	}];
 	
-    operation.resultFilename = destinationPath;
-    operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:root, @"root", path, @"path", destinationPath, @"destinationPath", size, @"size", nil];
+	operation.downloadSink = [DBMemorySink new];
+	operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:root, @"root", path, @"path", flightKey, @"singleFlightKey", size, @"size", nil];
 	
 	@synchronized (imageLoadRequests) {
-		[imageLoadRequests setObject:operation forKey:[self thumbnailKeyForPath:path size:size]];
+		[imageLoadRequests setObject:operation forKey:[self memoryThumbnailKeyForPath:path size:size]];
 	}
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 - (void)cancelThumbnailLoad:(NSString*)path size:(NSString*)size {
-    NSString* key = [self thumbnailKeyForPath:path size:size];
+	NSArray *keys = [NSArray arrayWithObjects:[self thumbnailKeyForPath:path size:size], [self memoryThumbnailKeyForPath:path size:size], nil];
 	@synchronized (imageLoadRequests) {
-		DBRequest* request = [imageLoadRequests objectForKey:key];
-		if (request) {
+		for (NSString *key in keys) {
+			DBRequest* request = [imageLoadRequests objectForKey:key];
+			if (!request) continue;
+			
 			[request cancel];
 			[imageLoadRequests removeObjectForKey:key];
+			
+			// The callers that joined it are cancelled along with it
+			NSString *flightKey = [request.userInfo objectForKey:@"singleFlightKey"];
+			if (flightKey) {
+				@synchronized (inFlightHandlers) {
+					[inFlightHandlers removeObjectForKey:flightKey];
+				}
+			}
 		}
 	}
 }
 
-- (NSString *)signatureForParams:(NSArray *)params url:(NSURL *)baseUrl {
-    NSArray* paramList = [params sortedArrayUsingSelector:@selector(compare:)];
-    NSString* paramString = [MPURLRequestParameter parameterStringForParameters:paramList];
-    
-    MPOAuthURLRequest* oauthRequest = [[MPOAuthURLRequest alloc] initWithURL:baseUrl andParameters:paramList];
-    oauthRequest.HTTPMethod = @"POST";
- 
-	MPOAuthSignatureParameter *signatureParameter = [[MPOAuthSignatureParameter alloc] initWithText:paramString andSecret:self.credentialStore.signingKey forRequest:oauthRequest usingMethod:self.credentialStore.signatureMethod];
-    return [signatureParameter URLEncodedParameterString];
-}
-
-- (NSMutableURLRequest *)requestForParams:(NSArray *)params urlString:(NSString *)urlString signature:(NSString *)sig {
-	
-    NSMutableArray *paramList = [NSMutableArray arrayWithArray:params];
-		// Then rebuild request using that signature
-    [paramList sortUsingSelector:@selector(compare:)];
-    NSMutableString* realParamString = [[NSMutableString alloc] initWithString:
-										 [MPURLRequestParameter parameterStringForParameters:paramList]];
-    [realParamString appendFormat:@"&%@", sig];
-    
-    NSURL* url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?%@", urlString, realParamString]];
-    NSMutableURLRequest* urlRequest = [NSMutableURLRequest requestWithURL:url];
-    urlRequest.HTTPMethod = @"POST";
-	
-    return urlRequest;
-}
-
 - (void)uploadFile:(NSString*)filename toPath:(NSString*)path fromPath:(NSString *)sourcePath params:(NSDictionary *)params completion:(DBUploadFileCompletionBlock)completion 
 {
     BOOL isDir = NO;
@@ -491,10 +1223,7 @@
     NSString *destPath = [path stringByAppendingPathComponent:filename];
     NSString *urlString = [NSString stringWithFormat:@"%@://%@/%@/files_put/%@%@", kDBProtocolHTTPS, kDBDropboxAPIContentHost, kDBDropboxAPIVersion, root, [DBRestClient escapePath:destPath]];
     
-    NSArray *extraParams = [MPURLRequestParameter parametersFromDictionary:params];
-    NSArray *paramList = [[self.credentialStore oauthParameters] arrayByAddingObjectsFromArray:extraParams];
-    NSString *sig = [self signatureForParams:paramList url:[NSURL URLWithString:urlString]];
-    NSMutableURLRequest *urlRequest = [self requestForParams:paramList urlString:urlString signature:sig];
+    NSMutableURLRequest *urlRequest = [self signedRequestWithURLString:urlString method:@"POST" parameters:params];
     
     NSString* contentLength = [NSString stringWithFormat: @"%qu", [fileAttrs fileSize]];
     [urlRequest addValue:contentLength forHTTPHeaderField: @"Content-Length"];
@@ -547,12 +1276,13 @@
 	};
 	
     operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:sourcePath, @"sourcePath", destPath, @"destinationPath", nil];
+    operation.sourceFilename = sourcePath;
     
 	@synchronized (uploadRequests) {
 		[uploadRequests setObject:operation forKey:destPath];
 	}
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 - (void)uploadFile:(NSString *)filename toPath:(NSString *)path withParentRev:(NSString *)parentRev fromPath:(NSString *)sourcePath completion:(DBUploadFileCompletionBlock)completion  {
@@ -576,6 +1306,235 @@
 }
 
 
+- (void)uploadFileChunked:(NSString *)filename toPath:(NSString *)path withParentRev:(NSString *)parentRev fromPath:(NSString *)sourcePath completion:(DBUploadFileCompletionBlock)completion {
+	NSString *destPath = [path stringByAppendingPathComponent:filename];
+	DBChunkedUploadSession *uploadSession = [[DBChunkedUploadSession alloc] initWithSourcePath:sourcePath destinationPath:destPath parentRev:parentRev];
+	if (_uploadChunkSize > 0) uploadSession.chunkSize = _uploadChunkSize;
+	
+	[self resumeChunkedUpload:uploadSession completion:completion];
+}
+
+- (void)resumeChunkedUpload:(DBChunkedUploadSession *)uploadSession completion:(DBUploadFileCompletionBlock)completion {
+	NSString *sourcePath = uploadSession.sourcePath;
+	NSString *destPath = uploadSession.destinationPath;
+	
+	BOOL isDir = NO;
+	BOOL fileExists = [[NSFileManager defaultManager] fileExistsAtPath:sourcePath isDirectory:&isDir];
+	NSDictionary *fileAttrs = [[NSFileManager defaultManager] attributesOfItemAtPath:sourcePath error:nil];
+	
+	if (!fileExists || isDir || !fileAttrs) {
+		NSDictionary* userInfo = [NSDictionary dictionaryWithObjectsAndKeys:sourcePath, @"sourcePath", destPath, @"destinationPath", nil];
+		NSInteger errorCode = isDir ? DBErrorIllegalFileType : DBErrorFileNotFound;
+		NSError* error = [NSError errorWithDomain:DBErrorDomain code:errorCode userInfo:userInfo];
+		NSString *errorMsg = isDir ? @"Unable to upload folders" : @"File does not exist";
+		
+		DBLogWarning(@"DropboxSDK: %@ (%@)", errorMsg, sourcePath);
+		
+		if ([_delegate respondsToSelector:@selector(restClient:uploadFileFailedWithError:)]) {
+			[_delegate restClient:self uploadFileFailedWithError:error];
+		}
+		
+		if (completion) completion(error, nil);
+		return;
+	}
+	
+	// The acknowledged bytes are only worth keeping if the source hasn't changed since
+	if (uploadSession.fileSize != [fileAttrs fileSize] || (uploadSession.fileModificationDate && ![uploadSession.fileModificationDate isEqualToDate:[fileAttrs fileModificationDate]])) {
+		uploadSession.uploadId = nil;
+		uploadSession.offset = 0;
+		uploadSession.expires = nil;
+	}
+	uploadSession.fileSize = [fileAttrs fileSize];
+	uploadSession.fileModificationDate = [fileAttrs fileModificationDate];
+	uploadSession.complete = NO;
+	
+	[self uploadNextChunkForSession:uploadSession completion:completion];
+}
+
+- (void)uploadNextChunkForSession:(DBChunkedUploadSession *)uploadSession completion:(DBUploadFileCompletionBlock)completion {
+	if (self.canceled) return;
+	
+	if (uploadSession.uploadId && uploadSession.offset >= uploadSession.fileSize) {
+		[self commitChunkedUploadForSession:uploadSession completion:completion];
+		return;
+	}
+	
+	NSString *sourcePath = uploadSession.sourcePath;
+	NSString *destPath = uploadSession.destinationPath;
+	NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:sourcePath, @"sourcePath", destPath, @"destinationPath", nil];
+	
+	// Chunks of different versions of the file would be committed as one
+	NSDictionary *fileAttrs = [[NSFileManager defaultManager] attributesOfItemAtPath:sourcePath error:nil];
+	BOOL fileChanged = fileAttrs && ([fileAttrs fileSize] != uploadSession.fileSize || (uploadSession.fileModificationDate && ![uploadSession.fileModificationDate isEqualToDate:[fileAttrs fileModificationDate]]));
+	
+	NSData *chunk = nil;
+	if (fileAttrs && !fileChanged) {
+		NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:sourcePath];
+		@try {
+			[fileHandle seekToFileOffset:uploadSession.offset];
+			chunk = [fileHandle readDataOfLength:uploadSession.chunkSize];
+		}
+		@catch (NSException *e) {
+			chunk = nil;
+		}
+		[fileHandle closeFile];
+		
+		// A file that shrank between the stat and the read ends early
+		unsigned long long expectedLength = MIN((unsigned long long)uploadSession.chunkSize, uploadSession.fileSize - uploadSession.offset);
+		if (chunk && [chunk length] < expectedLength) fileChanged = YES;
+	}
+	
+	if (!chunk || fileChanged) {
+		NSError *error = [NSError errorWithDomain:DBErrorDomain code:fileChanged ? DBErrorFileChanged : DBErrorFileNotFound userInfo:userInfo];
+		if (fileChanged) {
+			DBLogWarning(@"DropboxSDK: %@ changed during chunked upload", sourcePath);
+		}
+		else {
+			DBLogWarning(@"DropboxSDK: unable to read chunk at offset %llu (%@)", uploadSession.offset, sourcePath);
+		}
+		if ([_delegate respondsToSelector:@selector(restClient:uploadFileFailedWithError:)]) {
+			[_delegate restClient:self uploadFileFailedWithError:error];
+		}
+		if (completion) completion(error, nil);
+		
+		@synchronized (uploadRequests) {
+			[uploadRequests removeObjectForKey:destPath];
+		}
+		return;
+	}
+	
+	NSString *urlString = [NSString stringWithFormat:@"%@://%@/%@/chunked_upload", kDBProtocolHTTPS, kDBDropboxAPIContentHost, kDBDropboxAPIVersion];
+	NSMutableDictionary *params = [NSMutableDictionary dictionaryWithObject:[NSString stringWithFormat:@"%llu", uploadSession.offset] forKey:@"offset"];
+	if (uploadSession.uploadId) [params setObject:uploadSession.uploadId forKey:@"upload_id"];
+	
+	NSMutableURLRequest *urlRequest = [self signedRequestWithURLString:urlString method:@"PUT" parameters:params];
+	[urlRequest addValue:[NSString stringWithFormat:@"%ju", (uintmax_t)[chunk length]] forHTTPHeaderField:@"Content-Length"];
+	[urlRequest addValue:@"application/octet-stream" forHTTPHeaderField:@"Content-Type"];
+	[urlRequest setHTTPBody:chunk];
+	
+	unsigned long long chunkOffset = uploadSession.offset;
+	
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		if (self.canceled) return;
+		@synchronized (uploadRequests) {
+			// cancelFileUpload: may have raced with this chunk finishing
+			if ([uploadRequests objectForKey:destPath] != request) return;
+		}
+		
+		NSDictionary *result = [request parseResponseAsType:[NSDictionary class]];
+		NSDictionary *errorInfo = [request.error userInfo];
+		
+		if (result && [result objectForKey:@"upload_id"]) {
+			uploadSession.uploadId = [result objectForKey:@"upload_id"];
+			uploadSession.offset = [[result objectForKey:@"offset"] unsignedLongLongValue];
+			if ([result objectForKey:@"expires"]) {
+				uploadSession.expires = [DBMetadata dateFromString:[result objectForKey:@"expires"]];
+			}
+		}
+		else if (request.statusCode == 400 && [errorInfo objectForKey:@"offset"] && [[errorInfo objectForKey:@"offset"] unsignedLongLongValue] != chunkOffset) {
+			// The server has a different idea of how much it has, e.g. an acknowledgement got lost
+			uploadSession.uploadId = [errorInfo objectForKey:@"upload_id"] ?: uploadSession.uploadId;
+			uploadSession.offset = [[errorInfo objectForKey:@"offset"] unsignedLongLongValue];
+		}
+		else if (request.statusCode == 404 && uploadSession.uploadId && chunkOffset > 0) {
+			// The upload id expired, start over
+			DBLogWarning(@"DropboxSDK: chunked upload %@ expired, restarting", uploadSession.uploadId);
+			uploadSession.uploadId = nil;
+			uploadSession.offset = 0;
+			uploadSession.expires = nil;
+		}
+		else {
+			[self checkForAuthenticationFailure:request];
+			NSError *error = request.error ?: [NSError errorWithDomain:DBErrorDomain code:DBErrorInvalidResponse userInfo:request.userInfo];
+			if ([_delegate respondsToSelector:@selector(restClient:uploadFileFailedWithError:)]) {
+				[_delegate restClient:self uploadFileFailedWithError:error];
+			}
+			if (completion) completion(error, nil);
+			
+			@synchronized (uploadRequests) {
+				[uploadRequests removeObjectForKey:destPath];
+			}
+			return;
+		}
+		
+		if ([_delegate respondsToSelector:@selector(restClient:updatedChunkedUpload:)]) {
+			[_delegate restClient:self updatedChunkedUpload:uploadSession];
+		}
+		
+		[self uploadNextChunkForSession:uploadSession completion:completion];
+	}];
+	
+	NSUInteger chunkLength = [chunk length];
+	operation.uploadProgressBlock = ^(DBRequest *request) {
+		if ([_delegate respondsToSelector:@selector(restClient:uploadProgress:forFile:from:)] && uploadSession.fileSize > 0) {
+			CGFloat progress = (chunkOffset + request.uploadProgress * chunkLength) / (CGFloat)uploadSession.fileSize;
+			[_delegate restClient:self uploadProgress:progress forFile:destPath from:sourcePath];
+		}
+	};
+	
+	operation.userInfo = userInfo;
+	
+	@synchronized (uploadRequests) {
+		[uploadRequests setObject:operation forKey:destPath];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+- (void)commitChunkedUploadForSession:(DBChunkedUploadSession *)uploadSession completion:(DBUploadFileCompletionBlock)completion {
+	NSString *sourcePath = uploadSession.sourcePath;
+	NSString *destPath = uploadSession.destinationPath;
+	
+	NSString *fullPath = [NSString stringWithFormat:@"/commit_chunked_upload/%@%@", root, destPath];
+	NSMutableDictionary *params = [NSMutableDictionary dictionaryWithObjectsAndKeys:uploadSession.uploadId, @"upload_id", @"false", @"overwrite", nil];
+	if (uploadSession.parentRev) [params setObject:uploadSession.parentRev forKey:@"parent_rev"];
+	NSMutableURLRequest *urlRequest = [self requestWithHost:kDBDropboxAPIContentHost path:fullPath parameters:params method:@"POST"];
+	
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+		if (self.canceled) return;
+		
+		NSDictionary *result = [request parseResponseAsType:[NSDictionary class]];
+		
+		if (!result) {
+			[self checkForAuthenticationFailure:request];
+			if ([_delegate respondsToSelector:@selector(restClient:uploadFileFailedWithError:)]) {
+				[_delegate restClient:self uploadFileFailedWithError:request.error];
+			}
+			if (completion) completion(request.error, nil);
+		}
+		else {
+			uploadSession.complete = YES;
+			DBMetadata *metadata = [[DBMetadata alloc] initWithDictionary:result];
+			
+			if ([_delegate respondsToSelector:@selector(restClient:updatedChunkedUpload:)]) {
+				[_delegate restClient:self updatedChunkedUpload:uploadSession];
+			}
+			
+			if ([_delegate respondsToSelector:@selector(restClient:uploadedFile:from:metadata:)]) {
+				[_delegate restClient:self uploadedFile:destPath from:sourcePath metadata:metadata];
+			}
+			else if ([_delegate respondsToSelector:@selector(restClient:uploadedFile:from:)]) {
+				[_delegate restClient:self uploadedFile:destPath from:sourcePath];
+			}
+			
+			if (completion) completion(nil, metadata);
+		}
+		
+		@synchronized (uploadRequests) {
+			[uploadRequests removeObjectForKey:destPath];
+		}
+	}];
+	
+	operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:sourcePath, @"sourcePath", destPath, @"destinationPath", nil];
+	
+	@synchronized (uploadRequests) {
+		[uploadRequests setObject:operation forKey:destPath];
+	}
+	
+	[self enqueueRequest:operation];
+}
+
+
 - (void)loadRevisionsForFile:(NSString *)path completion:(DBLoadRevisionsCompletionBlock)completion {
     [self loadRevisionsForFile:path limit:10 completion:completion];
 }
@@ -616,7 +1575,7 @@
 	}];
 	
     operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", [NSNumber numberWithInt:limit], @"limit", nil];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -647,7 +1606,7 @@
 	}];
 	
     operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", rev, @"rev", nil];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -678,7 +1637,7 @@
 		}
 	}];
 	
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -710,7 +1669,7 @@
 	}];
 	
     operation.userInfo = params;
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -742,7 +1701,7 @@
 	}];
     
     operation.userInfo = [NSDictionary dictionaryWithObject:path forKey:@"path"];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -775,7 +1734,7 @@
 	}];
 	
     operation.userInfo = params;
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -806,7 +1765,7 @@
 	}];
 	
     operation.userInfo = params;
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -839,15 +1798,13 @@
 	}];
 	
     operation.userInfo = params;
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
 - (void)loadAccountInfoWithCompletion:(DBLoadAccountCompletionBlock)completion
 {
-    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIHost path:@"/account/info" parameters:nil];
-	
-	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *request) {
+	DBRequestBlock handler = ^(DBRequest *request) {
 		if (self.canceled) return;
 
 		if (request.error) {
@@ -867,10 +1824,16 @@
 			
 			if (completion) completion(nil, accountInfo);
 		}
-	}];
+	};
+	
+	NSString *flightKey = [DBRestClient singleFlightKeyForMethod:@"GET" path:@"/account/info" parameters:nil];
+	if ([self joinInFlightRequestForKey:flightKey handler:handler]) return;
+	
+    NSURLRequest* urlRequest = [self requestWithHost:kDBDropboxAPIHost path:@"/account/info" parameters:nil];
+	DBRequest *operation = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:[self fanOutBlockForKey:flightKey]];
 
     operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:root, @"root", nil];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -915,7 +1878,7 @@
 	}];
 	
     operation.userInfo = [NSDictionary dictionaryWithObjectsAndKeys:path, @"path", keyword, @"keyword", nil];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 - (void)loadSharableLinkForFile:(NSString*)path completion:(DBLoadShareableLinkCompletionBlock)completion
@@ -946,7 +1909,7 @@
 	}];
 	
     operation.userInfo =  [NSDictionary dictionaryWithObject:path forKey:@"path"];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 
@@ -976,21 +1939,13 @@
 	}];
 	
     operation.userInfo = [NSDictionary dictionaryWithObject:path forKey:@"path"];
-	[requestQueue addOperation:operation];
+	[self enqueueRequest:operation];
 }
 
 #pragma mark private methods
 
 + (NSString*)escapePath:(NSString*)path {
-    CFStringEncoding encoding = CFStringConvertNSStringEncodingToEncoding(NSUTF8StringEncoding);
-    NSString *escapedPath = 
-	(__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault,
-														(__bridge CFStringRef)path,
-														NULL,
-														(CFStringRef)@":?=,!$&'()*+;[]@#~",
-														encoding);
-    
-    return escapedPath;
+    return DBURLEncodedString(path, DBURLEncodingPath);
 }
 
 + (NSString *)bestLanguage {
@@ -1028,7 +1983,7 @@
     NSString* escapedPath = [DBRestClient escapePath:path];
     NSString* urlString = [NSString stringWithFormat:@"%@://%@/%@%@", 
 						   kDBProtocolHTTPS, host, kDBDropboxAPIVersion, escapedPath];
-    NSURL* url = [NSURL URLWithString:urlString];
+	if (!method) method = @"GET";
 	
     NSMutableDictionary *allParams = 
 	[NSMutableDictionary dictionaryWithObject:[DBRestClient bestLanguage] forKey:@"locale"];
@@ -1036,18 +1991,19 @@
         [allParams addEntriesFromDictionary:params];
     }
 	
-    NSArray *extraParams = [MPURLRequestParameter parametersFromDictionary:allParams];
-    NSArray *paramList = 
-    [[self.credentialStore oauthParameters] arrayByAddingObjectsFromArray:extraParams];
-	
-    MPOAuthURLRequest* oauthRequest = [[MPOAuthURLRequest alloc] initWithURL:url andParameters:paramList];
-    if (method) {
-        oauthRequest.HTTPMethod = method;
-    }
-	
-    NSMutableURLRequest* urlRequest = [oauthRequest 
-									   urlRequestSignedWithSecret:self.credentialStore.signingKey 
-									   usingMethod:self.credentialStore.signatureMethod];
+    NSMutableURLRequest* urlRequest;
+	if ([method isEqualToString:@"POST"]) {
+		NSString *parameterString = [[self requestSigner] signedParameterStringForURLString:urlString method:method parameters:allParams];
+		NSData *postData = [parameterString dataUsingEncoding:NSUTF8StringEncoding];
+		urlRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:urlString]];
+		urlRequest.HTTPMethod = method;
+		[urlRequest setValue:[NSString stringWithFormat:@"%ju", (uintmax_t)[postData length]] forHTTPHeaderField:@"Content-Length"];
+		[urlRequest setValue:@"application/x-www-form-urlencoded" forHTTPHeaderField:@"Content-Type"];
+		[urlRequest setHTTPBody:postData];
+	}
+	else {
+		urlRequest = [self signedRequestWithURLString:urlString method:method parameters:allParams];
+	}
 	
 	NSTimeInterval timeout = [[NSUserDefaults standardUserDefaults] integerForKey:@"DropboxClientTimeout"];
 	if (timeout == 0) timeout = 45;
@@ -1057,6 +2013,198 @@
     return urlRequest;
 }
 
+// Parameters go in the query, whatever the method
+- (NSMutableURLRequest *)signedRequestWithURLString:(NSString *)urlString method:(NSString *)method parameters:(NSDictionary *)params {
+	NSString *parameterString = [[self requestSigner] signedParameterStringForURLString:urlString method:method parameters:params];
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"%@?%@", urlString, parameterString]];
+	NSMutableURLRequest *urlRequest = [NSMutableURLRequest requestWithURL:url];
+	urlRequest.HTTPMethod = method;
+	return urlRequest;
+}
+
+// Replaced when the session hands out a different store for userId, e.g. after relinking
+- (DBRequestSigner *)requestSigner {
+	MPOAuthCredentialConcreteStore *store = self.credentialStore;
+	@synchronized (self) {
+		if (!requestSigner || requestSigner.credentialStore != store) {
+			requestSigner = [[DBRequestSigner alloc] initWithCredentialStore:store];
+		}
+		return requestSigner;
+	}
+}
+
+
++ (NSString *)singleFlightKeyForMethod:(NSString *)method path:(NSString *)path parameters:(NSDictionary *)params {
+	NSMutableString *key = [NSMutableString stringWithFormat:@"%@ %@", method, path];
+	for (NSString *name in [[params allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+		[key appendFormat:@"&%@=%@", name, [params objectForKey:name]];
+	}
+	return key;
+}
+
+// Returns YES if a request for key is already running, handler then gets that request's result.
+// Otherwise the caller must start the request with fanOutBlockForKey: as its completion block.
+- (BOOL)joinInFlightRequestForKey:(NSString *)key handler:(DBRequestBlock)handler {
+	@synchronized (inFlightHandlers) {
+		NSMutableArray *handlers = [inFlightHandlers objectForKey:key];
+		if (handlers) {
+			[handlers addObject:[handler copy]];
+			return YES;
+		}
+		
+		[inFlightHandlers setObject:[NSMutableArray arrayWithObject:[handler copy]] forKey:key];
+		return NO;
+	}
+}
+
+- (DBRequestBlock)fanOutBlockForKey:(NSString *)key {
+	return ^(DBRequest *request) {
+		NSArray *handlers = nil;
+		@synchronized (inFlightHandlers) {
+			handlers = [inFlightHandlers objectForKey:key];
+			[inFlightHandlers removeObjectForKey:key];
+		}
+		
+		// The caller that started the request goes last: its completion may move the file the others copy
+		for (DBRequestBlock handler in [handlers reverseObjectEnumerator]) {
+			handler(request);
+		}
+	};
+}
+
+// Every request the client makes goes through here
+- (void)enqueueRequest:(DBRequest *)request {
+	__weak DBRestClient *weakSelf = self;
+	request.metricsBlock = ^(DBRequestMetrics *metrics) {
+		[weakSelf recordMetrics:metrics];
+	};
+	request.hostGate = hostGate;
+	
+	DBRetryPolicy *retryPolicy = self.retryPolicy;
+	if (retryPolicy) {
+		[retryPolicy recordRequest];
+		request.retryPolicy = retryPolicy;
+		[self setRetryBlockForRequest:request];
+	}
+	
+	NSNumber *priority = [DBRestClient currentPriority];
+	request.priority = priority ? (DBRequestPriority)[priority intValue] : [DBRestClient defaultPriorityForRequest:request];
+	[[self queueForPriority:request.priority] addOperation:request];
+}
+
+// Each attempt gets its own block, so the retry knows which attempt it replaces
+- (void)setRetryBlockForRequest:(DBRequest *)request {
+	__weak DBRestClient *weakSelf = self;
+	__weak DBRequest *weakRequest = request;
+	request.retryBlock = ^(DBRequest *retry) {
+		DBRestClient *client = weakSelf;
+		[client replaceTrackedRequest:weakRequest withRetry:retry];
+		[client setRetryBlockForRequest:retry];
+		[client enqueueRetry:retry];
+	};
+}
+
+// The retry waits out its delay outside the lanes, so a backoff doesn't take a slot from other requests
+- (void)enqueueRetry:(DBRequest *)retry {
+	__weak DBRestClient *weakSelf = self;
+	dispatch_group_t pendingRetries = _pendingRetries;
+	dispatch_group_enter(pendingRetries);
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(retry.retryDelay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		// The lane is picked now, the priority may have changed while it waited
+		[[weakSelf queueForPriority:retry.priority] addOperation:retry];
+		dispatch_group_leave(pendingRetries);
+	});
+}
+
+// The completion blocks are shared with the retry and compare the request they are called with to
+// the one stored for their path, so the retry has to be stored in place of the failed attempt
+- (void)replaceTrackedRequest:(DBRequest *)request withRetry:(DBRequest *)retry {
+	if (!request) return;
+	
+	for (NSMutableDictionary *requests in [NSArray arrayWithObjects:loadRequests, imageLoadRequests, uploadRequests, deltaRequests, nil]) {
+		@synchronized (requests) {
+			for (id key in [requests allKeys]) {
+				id stored = [requests objectForKey:key];
+				if (stored == request) [requests setObject:retry forKey:key];
+				else if ([stored isKindOfClass:[DBRequestGroup class]]) [(DBRequestGroup *)stored replaceRequest:request withRequest:retry];
+			}
+		}
+	}
+}
+
+- (NSOperationQueue *)queueForPriority:(DBRequestPriority)priority {
+	switch (priority) {
+		case DBRequestPriorityInteractive: return interactiveQueue;
+		case DBRequestPriorityBulk: return bulkQueue;
+		default: return requestQueue;
+	}
+}
+
+- (NSArray *)queues {
+	return [NSArray arrayWithObjects:interactiveQueue, requestQueue, bulkQueue, nil];
+}
+
+// The gate's default limit follows the widest lane, or it would cap every lane at its own default
+- (void)updateHostGateLimit {
+	NSInteger limit = 1;
+	for (NSOperationQueue *queue in [self queues]) {
+		NSInteger width = queue.maxConcurrentOperationCount;
+		if (width == NSOperationQueueDefaultMaxConcurrentOperationCount) {
+			limit = NSIntegerMax;
+			break;
+		}
+		limit = MAX(limit, width);
+	}
+	hostGate.maxRequestsPerHost = limit;
+}
+
+// Lookups someone is likely waiting on go first, transfers and syncing last
++ (DBRequestPriority)defaultPriorityForRequest:(DBRequest *)request {
+	static NSDictionary *priorities = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		NSNumber *interactive = [NSNumber numberWithInt:DBRequestPriorityInteractive];
+		NSNumber *bulk = [NSNumber numberWithInt:DBRequestPriorityBulk];
+		priorities = @{
+			@"metadata" : interactive,
+			@"account" : interactive,
+			@"thumbnails" : interactive,
+			@"search" : interactive,
+			@"shares" : interactive,
+			@"media" : interactive,
+			@"revisions" : interactive,
+			@"files" : bulk,
+			@"files_put" : bulk,
+			@"chunked_upload" : bulk,
+			@"commit_chunked_upload" : bulk,
+			@"delta" : bulk
+		};
+	});
+	
+	NSNumber *priority = [priorities objectForKey:[DBRequestMetrics endpointForURL:[request.request URL]]];
+	return priority ? (DBRequestPriority)[priority intValue] : DBRequestPriorityNormal;
+}
+
+// The priority set by performWithPriority:block: on this thread, if any
++ (NSNumber *)currentPriority {
+	return [[[NSThread currentThread] threadDictionary] objectForKey:kDBRestClientPriorityKey];
+}
+
+- (void)recordMetrics:(DBRequestMetrics *)metrics {
+	DBRequestMetricsHistory *history = nil;
+	@synchronized (endpointHistories) {
+		history = [endpointHistories objectForKey:metrics.endpoint];
+		if (!history) {
+			history = [[DBRequestMetricsHistory alloc] initWithEndpoint:metrics.endpoint capacity:kDBEndpointHistorySize];
+			[endpointHistories setObject:history forKey:metrics.endpoint];
+		}
+	}
+	[history addMetrics:metrics];
+	[self.concurrencyController recordMetrics:metrics];
+
+	DBRequestMetricsBlock handler = self.metricsHandler;
+	if (handler) handler(metrics);
+}
 
 - (void)checkForAuthenticationFailure:(DBRequest*)request {
     if (request.error && request.error.code == 401 && [request.error.domain isEqual:DBErrorDomain]) {
@@ -1069,3 +2217,79 @@
 }
 
 @end
+
+
+@implementation DBRequestGroup {
+	NSMutableArray *_requests;
+}
+
+- (id)init {
+	if ((self = [super init])) {
+		_requests = [NSMutableArray new];
+	}
+	return self;
+}
+
+- (NSArray *)requests {
+	@synchronized (self) {
+		return [_requests copy];
+	}
+}
+
+- (void)addRequest:(DBRequest *)request {
+	@synchronized (self) {
+		if (_cancelled) [request cancel];
+		[_requests addObject:request];
+	}
+}
+
+- (void)replaceRequest:(DBRequest *)request withRequest:(DBRequest *)replacement {
+	@synchronized (self) {
+		NSUInteger index = [_requests indexOfObjectIdenticalTo:request];
+		if (index == NSNotFound) return;
+		if (_cancelled) [replacement cancel];
+		[_requests replaceObjectAtIndex:index withObject:replacement];
+	}
+}
+
+- (void)setTemporaryFilename:(NSString *)temporaryFilename {
+	BOOL cancelled = NO;
+	@synchronized (self) {
+		_temporaryFilename = [temporaryFilename copy];
+		cancelled = _cancelled;
+	}
+	
+	if (cancelled && temporaryFilename) [[NSFileManager defaultManager] removeItemAtPath:temporaryFilename error:nil];
+}
+
+- (void)cancel {
+	NSArray *requests = nil;
+	NSString *temporaryFilename = nil;
+	@synchronized (self) {
+		_cancelled = YES;
+		requests = [_requests copy];
+		temporaryFilename = _temporaryFilename;
+	}
+	
+	for (DBRequest *request in requests) [request cancel];
+	if (temporaryFilename) [[NSFileManager defaultManager] removeItemAtPath:temporaryFilename error:nil];
+}
+
+@end
+
+
+@implementation DBMetadataBatch
+
+- (id)init {
+	if ((self = [super init])) {
+		_pendingPaths = [NSMutableArray new];
+		_hashes = [NSMutableDictionary new];
+		_spellings = [NSMutableDictionary new];
+		_metadata = [NSMutableDictionary new];
+		_unchangedPaths = [NSMutableArray new];
+		_errors = [NSMutableDictionary new];
+	}
+	return self;
+}
+
+@end
@@ -0,0 +1,37 @@
+//
+//  DBRetryPolicy.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class DBRequest;
+
+/* DBRetryPolicy decides whether a failed DBRequest is sent again, and when. It retries:
+   - 429 and 503 responses, for any request, as the server did not act on them
+   - 500, 502 and 504 responses, timeouts and dropped connections, for GET and PUT requests only
+   - failures to reach the host at all, for any request
+   The delay is drawn at random between 0 and baseDelay * 2^retry, capped at maxDelay, so clients
+   that failed together don't come back together. A Retry-After header overrides it, up to
+   maxRetryAfter; beyond that the failure is reported. Each request passed to recordRequest adds
+   budgetRatio of a retry to a budget holding at most budgetCapacity, and every retry takes one
+   whole retry out of it. An outage therefore can't turn into a flood of retries. */
+@interface DBRetryPolicy : NSObject
+
+@property (nonatomic) NSUInteger maxRetries; // Per request, default is 3
+@property (nonatomic) NSTimeInterval baseDelay; // Default is 0.5 seconds
+@property (nonatomic) NSTimeInterval maxDelay; // Default is 30 seconds
+@property (nonatomic) NSTimeInterval maxRetryAfter; // Default is 120 seconds
+@property (nonatomic) double budgetRatio; // Default is 0.1
+@property (nonatomic) double budgetCapacity; // Default is 10
+
+/* Counts a new request towards the retry budget */
+- (void)recordRequest;
+
+/* Returns YES and sets delay if the failed request should be sent again, taking a retry from the
+   budget. retryCount is the number of times it has been retried already. */
+- (BOOL)shouldRetryRequest:(DBRequest *)request retryCount:(NSUInteger)retryCount delay:(NSTimeInterval *)delay;
+
+@end
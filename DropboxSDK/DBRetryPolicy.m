@@ -0,0 +1,134 @@
+//
+//  DBRetryPolicy.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBRetryPolicy.h"
+
+#import "DBError.h"
+#import "DBMetadata.h"
+#import "DBRequest.h"
+
+#include <stdlib.h>
+
+
+@interface DBRetryPolicy () {
+	double _budget;
+}
+
+- (BOOL)isRetryableRequest:(DBRequest *)request;
+- (NSTimeInterval)retryAfterForRequest:(DBRequest *)request;
+
+@end
+
+
+@implementation DBRetryPolicy
+
+- (id)init {
+	if ((self = [super init])) {
+		_maxRetries = 3;
+		_baseDelay = 0.5;
+		_maxDelay = 30;
+		_maxRetryAfter = 120;
+		_budgetRatio = 0.1;
+		_budgetCapacity = 10;
+		_budget = _budgetCapacity;
+	}
+	return self;
+}
+
+- (void)recordRequest {
+	@synchronized (self) {
+		_budget = MIN(_budget + _budgetRatio, _budgetCapacity);
+	}
+}
+
+- (BOOL)shouldRetryRequest:(DBRequest *)request retryCount:(NSUInteger)retryCount delay:(NSTimeInterval *)delay {
+	if (retryCount >= _maxRetries || ![self isRetryableRequest:request]) return NO;
+
+	NSTimeInterval retryAfter = [self retryAfterForRequest:request];
+	if (retryAfter > _maxRetryAfter) return NO;
+
+	@synchronized (self) {
+		if (_budget < 1) return NO;
+		_budget -= 1;
+	}
+
+	if (retryAfter >= 0) {
+		*delay = retryAfter;
+	}
+	else {
+		NSTimeInterval cap = MIN(_baseDelay * (double)(1ULL << MIN(retryCount, 30)), _maxDelay);
+		*delay = cap * ((double)arc4random_uniform(1000001) / 1000000.0); // Full jitter
+	}
+	return YES;
+}
+
+
+#pragma mark private methods
+
+- (BOOL)isRetryableRequest:(DBRequest *)request {
+	NSError *error = request.error;
+	if (!error || request.isCancelled) return NO;
+
+	// Entries of a streamed response have been handed out already
+	if (request.streamParser && request.statusCode == 200) return NO;
+
+	// The body can't be sent again unless it can be read again
+	NSURLRequest *urlRequest = request.request;
+	if ([urlRequest HTTPBodyStream] && !request.sourceFilename) return NO;
+
+	NSString *method = [urlRequest HTTPMethod] ? [urlRequest HTTPMethod] : @"GET";
+	BOOL idempotent = [method isEqualToString:@"GET"] || [method isEqualToString:@"HEAD"] || [method isEqualToString:@"PUT"];
+
+	if ([error.domain isEqual:NSURLErrorDomain]) {
+		switch (error.code) {
+			case NSURLErrorCannotFindHost:
+			case NSURLErrorCannotConnectToHost:
+			case NSURLErrorDNSLookupFailed:
+				return YES;
+			case NSURLErrorTimedOut:
+			case NSURLErrorNetworkConnectionLost:
+				return idempotent;
+			default:
+				return NO;
+		}
+	}
+
+	if ([error.domain isEqual:DBErrorDomain]) {
+		switch (request.statusCode) {
+			case 429:
+			case 503:
+				return YES;
+			case 500:
+			case 502:
+			case 504:
+				return idempotent;
+			default:
+				return NO;
+		}
+	}
+
+	return NO;
+}
+
+// Returns -1 if the response has no usable Retry-After header
+- (NSTimeInterval)retryAfterForRequest:(DBRequest *)request {
+	NSString *retryAfter = [[request.response allHeaderFields] objectForKey:@"Retry-After"];
+	if ([retryAfter length] == 0) return -1;
+
+	NSScanner *scanner = [NSScanner scannerWithString:retryAfter];
+	long long seconds = 0;
+	if ([scanner scanLongLong:&seconds] && [scanner isAtEnd]) return MAX(seconds, 0);
+
+	// HTTP dates end in GMT, the API's own dates in a numeric zone
+	if ([retryAfter hasSuffix:@" GMT"]) {
+		retryAfter = [[retryAfter substringToIndex:[retryAfter length] - 3] stringByAppendingString:@"+0000"];
+	}
+	NSDate *date = [DBMetadata dateFromString:retryAfter];
+	return date ? MAX([date timeIntervalSinceNow], 0) : -1;
+}
+
+@end
@@ -21,6 +21,10 @@ extern NSString *kDBRootAppFolder;
 extern NSString *kDBProtocolHTTPS;
 extern NSString *kDBDropboxUnknownUserId;
 
+extern NSString *kDBSignatureMethodPlaintext;
+extern NSString *kDBSignatureMethodHMACSHA1;
+extern NSString *kDBSignatureMethodHMACSHA256;
+
 @protocol DBSessionDelegate;
 @protocol DBSessionCredentialsDelegate;
 
@@ -48,6 +52,11 @@ extern NSString *kDBDropboxUnknownUserId;
 @property (nonatomic, readonly) NSString *root;
 @property (nonatomic, readonly) NSArray *userIds;
 
+/* How requests are signed, one of the kDBSignatureMethod constants. The default is PLAINTEXT,
+   which sends the secrets with every request and relies on HTTPS to hide them. The HMAC methods
+   only send a signature. Applies to existing and new credential stores. */
+@property (nonatomic, copy) NSString *signatureMethod;
+
 @property (nonatomic, weak) id<DBSessionDelegate> delegate;
 @property (nonatomic, weak) id<DBSessionCredentialsDelegate> credentialsDelegate;
 
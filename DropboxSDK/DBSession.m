@@ -27,6 +27,10 @@ NSString *kDBRootAppFolder = @"sandbox";
 NSString *kDBProtocolHTTPS = @"https";
 NSString *kDBDropboxUnknownUserId = @"unknown";
 
+NSString *kDBSignatureMethodPlaintext = kMPOAuthSignatureMethodPlaintext;
+NSString *kDBSignatureMethodHMACSHA1 = kMPOAuthSignatureMethodHMACSHA1;
+NSString *kDBSignatureMethodHMACSHA256 = kMPOAuthSignatureMethodHMACSHA256;
+
 // static NSString *kDBProtocolDropbox = @"dbapi-1";
 
 static DBSession *_sharedSession = nil;
@@ -54,6 +58,7 @@ static NSString *kDBDropboxUserId = @"kDBDropboxUserId";
 @implementation DBSession
 
 @synthesize root = _root;
+@synthesize signatureMethod = _signatureMethod;
 
 + (DBSession *)sharedSession {
     return _sharedSession;
@@ -69,6 +74,7 @@ static NSString *kDBDropboxUserId = @"kDBDropboxUserId";
 		_key = key;
 		_secret = secret;
 		_root = root;
+		_signatureMethod = kDBSignatureMethodPlaintext;
     }
     return self;
 }
@@ -80,7 +86,7 @@ static NSString *kDBDropboxUserId = @"kDBDropboxUserId";
 	baseCredentials = [[NSDictionary alloc] initWithObjectsAndKeys:
 					   _key, kMPOAuthCredentialConsumerKey,
 					   _secret, kMPOAuthCredentialConsumerSecret,
-					   kMPOAuthSignatureMethodPlaintext, kMPOAuthSignatureMethod, nil];
+					   _signatureMethod, kMPOAuthSignatureMethod, nil];
 	
 	credentialStores = [NSMutableDictionary new];
 	
@@ -180,6 +186,34 @@ static NSString *kDBDropboxUserId = @"kDBDropboxUserId";
 	}
 }
 
+- (NSString *)signatureMethod {
+	@synchronized (self) {
+		return _signatureMethod;
+	}
+}
+
+- (void)setSignatureMethod:(NSString *)signatureMethod {
+	if (![signatureMethod isEqualToString:kDBSignatureMethodPlaintext] &&
+		![signatureMethod isEqualToString:kDBSignatureMethodHMACSHA1] &&
+		![signatureMethod isEqualToString:kDBSignatureMethodHMACSHA256]) {
+		[NSException raise:NSInvalidArgumentException format:@"DropboxSDK: unsupported signature method %@", signatureMethod];
+	}
+	
+	@synchronized (self) {
+		_signatureMethod = [signatureMethod copy];
+		if (!_credentialStoreReady) return;
+		
+		NSMutableDictionary *credentials = [baseCredentials mutableCopy];
+		[credentials setObject:_signatureMethod forKey:kMPOAuthSignatureMethod];
+		baseCredentials = credentials;
+		
+		for (MPOAuthCredentialConcreteStore *store in [credentialStores allValues]) {
+			store.signatureMethod = _signatureMethod;
+		}
+		_nilUserStore.signatureMethod = _signatureMethod;
+	}
+}
+
 
 #pragma mark private methods
 
@@ -0,0 +1,36 @@
+//
+//  DBThumbnailCache.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* DBThumbnailCache keeps thumbnails by path, size and rev in two tiers: the most recently used in
+   memory, up to memoryLimit bytes, and all of them on disk, one file each, up to maxSize with the
+   least recently used deleted first. A request for a size is served from the smallest larger size
+   cached for the same rev when the size itself isn't there. Storing a thumbnail drops those of
+   other revs of the file. Set it as the thumbnailCache of a DBRestClient to have
+   loadThumbnailForMetadata: use it. The cache doesn't know about accounts: use a separate directory
+   per user. */
+@interface DBThumbnailCache : NSObject
+
+/* A cache in the app's Caches directory for the given user, 50 MB on disk and 8 MB in memory */
++ (DBThumbnailCache *)cacheForUserId:(NSString *)userId;
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize;
+
+@property (nonatomic, readonly) NSString *directory;
+@property (nonatomic) unsigned long long maxSize;
+@property (nonatomic, readonly) unsigned long long currentSize;
+@property (nonatomic) NSUInteger memoryLimit;
+@property (nonatomic, readonly) NSUInteger memorySize;
+
+/* actualSize, if given, is set to the size of the thumbnail returned */
+- (NSData *)thumbnailForPath:(NSString *)path root:(NSString *)root size:(NSString *)size rev:(NSString *)rev actualSize:(NSString **)actualSize;
+- (void)setThumbnail:(NSData *)thumbnail forPath:(NSString *)path root:(NSString *)root size:(NSString *)size rev:(NSString *)rev;
+- (void)removeThumbnailsForPath:(NSString *)path root:(NSString *)root;
+- (void)removeAllThumbnails;
+
+@end
@@ -0,0 +1,236 @@
+//
+//  DBThumbnailCache.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBThumbnailCache.h"
+
+#import "DBLog.h"
+#import "DBLRUFileStore.h"
+#import "DBURLEncoder.h"
+
+#define kDBThumbnailCacheDefaultMaxSize (50 * 1024 * 1024)
+#define kDBThumbnailCacheDefaultMemoryLimit (8 * 1024 * 1024)
+
+
+@interface DBThumbnailCache () {
+	DBLRUFileStore *_store;
+
+	NSMutableDictionary *_memory; // Filename to thumbnail
+	NSMutableOrderedSet *_memoryOrder; // Filenames, least recently used first
+	NSUInteger _memorySize;
+}
+
++ (NSArray *)sizesForSize:(NSString *)size;
+- (NSString *)prefixForPath:(NSString *)path root:(NSString *)root;
+- (NSString *)filenameWithPrefix:(NSString *)prefix size:(NSString *)size rev:(NSString *)rev;
+- (NSData *)memoryThumbnailForFilename:(NSString *)filename;
+- (void)setMemoryThumbnail:(NSData *)thumbnail forFilename:(NSString *)filename;
+- (void)removeMemoryThumbnailForFilename:(NSString *)filename;
+- (void)trimMemoryToSize:(NSUInteger)size;
+
+@end
+
+
+@implementation DBThumbnailCache
+
++ (DBThumbnailCache *)cacheForUserId:(NSString *)userId {
+	return [DBLRUFileStore sharedCacheOfClass:self name:@"DropboxThumbnails" userId:userId maxSize:kDBThumbnailCacheDefaultMaxSize];
+}
+
+- (id)initWithDirectory:(NSString *)directory maxSize:(unsigned long long)maxSize {
+	if ((self = [super init])) {
+		_memoryLimit = kDBThumbnailCacheDefaultMemoryLimit;
+		_memory = [NSMutableDictionary new];
+		_memoryOrder = [NSMutableOrderedSet new];
+
+		__weak DBThumbnailCache *weakSelf = self;
+		_store = [[DBLRUFileStore alloc] initWithDirectory:directory maxSize:maxSize];
+		_store.removalBlock = ^(NSString *filename) {
+			[weakSelf removeMemoryThumbnailForFilename:filename];
+		};
+	}
+	return self;
+}
+
+- (NSString *)directory {
+	return _store.directory;
+}
+
+- (unsigned long long)maxSize {
+	@synchronized (self) {
+		return _store.maxSize;
+	}
+}
+
+- (void)setMaxSize:(unsigned long long)maxSize {
+	@synchronized (self) {
+		_store.maxSize = maxSize;
+	}
+}
+
+- (unsigned long long)currentSize {
+	@synchronized (self) {
+		return _store.currentSize;
+	}
+}
+
+- (void)setMemoryLimit:(NSUInteger)memoryLimit {
+	@synchronized (self) {
+		_memoryLimit = memoryLimit;
+		[self trimMemoryToSize:_memoryLimit];
+	}
+}
+
+- (NSUInteger)memorySize {
+	@synchronized (self) {
+		return _memorySize;
+	}
+}
+
+- (NSData *)thumbnailForPath:(NSString *)path root:(NSString *)root size:(NSString *)size rev:(NSString *)rev actualSize:(NSString **)actualSize {
+	NSString *prefix = [self prefixForPath:path root:root];
+
+	@synchronized (self) {
+		for (NSString *candidateSize in [DBThumbnailCache sizesForSize:size]) {
+			NSString *filename = [self filenameWithPrefix:prefix size:candidateSize rev:rev];
+			if (![_store touchFilename:filename]) continue;
+
+			NSData *thumbnail = [self memoryThumbnailForFilename:filename];
+			if (!thumbnail) {
+				thumbnail = [_store dataForFilename:filename];
+				if (!thumbnail) {
+					DBLogWarning(@"DropboxSDK: dropping unreadable thumbnail cache entry for %@", path);
+					continue;
+				}
+				[self setMemoryThumbnail:thumbnail forFilename:filename];
+			}
+
+			if (actualSize) *actualSize = candidateSize;
+			return thumbnail;
+		}
+		return nil;
+	}
+}
+
+- (void)setThumbnail:(NSData *)thumbnail forPath:(NSString *)path root:(NSString *)root size:(NSString *)size rev:(NSString *)rev {
+	if (!thumbnail) return;
+
+	NSString *prefix = [self prefixForPath:path root:root];
+	NSString *filename = [self filenameWithPrefix:prefix size:size rev:rev];
+	NSString *revSuffix = [filename substringFromIndex:[prefix length] + [DBURLEncodedString(size, DBURLEncodingQuery) length]];
+
+	@synchronized (self) {
+		// Thumbnails of other revs are out of date
+		[_store removeFilenamesPassingTest:^BOOL(NSString *otherFilename) {
+			return [otherFilename hasPrefix:prefix] && ![otherFilename hasSuffix:revSuffix];
+		}];
+
+		if (![_store setData:thumbnail forFilename:filename]) {
+			DBLogWarning(@"DropboxSDK: unable to write thumbnail cache entry for %@", path);
+			return;
+		}
+		[self setMemoryThumbnail:thumbnail forFilename:filename];
+	}
+}
+
+- (void)removeThumbnailsForPath:(NSString *)path root:(NSString *)root {
+	NSString *prefix = [self prefixForPath:path root:root];
+
+	@synchronized (self) {
+		[_store removeFilenamesPassingTest:^BOOL(NSString *filename) {
+			return [filename hasPrefix:prefix];
+		}];
+	}
+}
+
+- (void)removeAllThumbnails {
+	@synchronized (self) {
+		[_store removeAllFiles];
+		[self trimMemoryToSize:0];
+	}
+}
+
+
+#pragma mark private methods
+
+// The given size, its other names, then the larger sizes, smallest first. Sizes the cache doesn't
+// know the dimensions of only match themselves.
++ (NSArray *)sizesForSize:(NSString *)size {
+	static NSDictionary *ranks = nil;
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		// By the box the thumbnail fits in
+		ranks = [[NSDictionary alloc] initWithObjectsAndKeys:
+				 [NSNumber numberWithInt:1], @"xs", // 32x32
+				 [NSNumber numberWithInt:2], @"s", [NSNumber numberWithInt:2], @"small", // 64x64
+				 [NSNumber numberWithInt:3], @"m", [NSNumber numberWithInt:3], @"medium", // 128x128
+				 [NSNumber numberWithInt:4], @"iphone_bestfit", // 480x320
+				 [NSNumber numberWithInt:5], @"l", [NSNumber numberWithInt:5], @"large", // 640x480
+				 [NSNumber numberWithInt:6], @"xl", // 1024x768
+				 nil];
+	});
+
+	if (!size) return [NSArray arrayWithObject:@""];
+
+	NSNumber *rank = [ranks objectForKey:size];
+	if (!rank) return [NSArray arrayWithObject:size];
+
+	NSArray *others = [[ranks keysOfEntriesPassingTest:^BOOL(NSString *otherSize, NSNumber *otherRank, BOOL *stop) {
+		return [otherRank compare:rank] != NSOrderedAscending && ![otherSize isEqualToString:size];
+	}] allObjects];
+	others = [others sortedArrayUsingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+		return [[ranks objectForKey:a] compare:[ranks objectForKey:b]];
+	}];
+	return [[NSArray arrayWithObject:size] arrayByAddingObjectsFromArray:others];
+}
+
+// Every thumbnail of a file starts with the digest of its root and path
+- (NSString *)prefixForPath:(NSString *)path root:(NSString *)root {
+	return [[DBLRUFileStore filenameForPath:path root:root] stringByAppendingString:@"-"];
+}
+
+- (NSString *)filenameWithPrefix:(NSString *)prefix size:(NSString *)size rev:(NSString *)rev {
+	// Sizes and revs don't contain '-', and the escaping keeps '/' out of the name
+	return [NSString stringWithFormat:@"%@%@-%@", prefix, DBURLEncodedString(size ? size : @"", DBURLEncodingQuery), DBURLEncodedString(rev ? rev : @"", DBURLEncodingQuery)];
+}
+
+// Callers must hold the cache lock
+- (NSData *)memoryThumbnailForFilename:(NSString *)filename {
+	NSData *thumbnail = [_memory objectForKey:filename];
+	if (thumbnail) {
+		[_memoryOrder removeObject:filename];
+		[_memoryOrder addObject:filename];
+	}
+	return thumbnail;
+}
+
+- (void)setMemoryThumbnail:(NSData *)thumbnail forFilename:(NSString *)filename {
+	[self removeMemoryThumbnailForFilename:filename];
+	if ([thumbnail length] > _memoryLimit) return;
+
+	[self trimMemoryToSize:_memoryLimit - [thumbnail length]];
+	[_memory setObject:thumbnail forKey:filename];
+	[_memoryOrder addObject:filename];
+	_memorySize += [thumbnail length];
+}
+
+- (void)removeMemoryThumbnailForFilename:(NSString *)filename {
+	NSData *thumbnail = [_memory objectForKey:filename];
+	if (!thumbnail) return;
+
+	_memorySize -= [thumbnail length];
+	[_memory removeObjectForKey:filename];
+	[_memoryOrder removeObject:filename];
+}
+
+- (void)trimMemoryToSize:(NSUInteger)size {
+	while (_memorySize > size && [_memoryOrder count] > 0) {
+		[self removeMemoryThumbnailForFilename:[_memoryOrder objectAtIndex:0]];
+	}
+}
+
+@end
+
@@ -0,0 +1,27 @@
+//
+//  DBURLEncoder.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/* RFC 3986 percent-encoding of UTF-8, one table lookup per byte, with hex digits in uppercase.
+   Paths keep letters, digits and -._/ as they are; query names and values keep letters, digits
+   and -._~. These are the sets escapePath: and stringByAddingURIPercentEscapesUsingEncoding:
+   used to get from CFURLCreateStringByAddingPercentEscapes. */
+typedef enum {
+	DBURLEncodingPath,
+	DBURLEncodingQuery,
+} DBURLEncoding;
+
+/* The most output DBURLEncodeBytes can write for length input bytes */
+#define DBURLEncodedMaxLength(length) ((length) * 3)
+
+/* Writes to output, which must hold DBURLEncodedMaxLength(length) bytes, and returns the number of
+   bytes written. Nothing was escaped if that equals length. */
+size_t DBURLEncodeBytes(const void *bytes, size_t length, DBURLEncoding encoding, char *output);
+
+NSString *DBURLEncodedString(NSString *string, DBURLEncoding encoding);
+void DBURLAppendEncodedString(NSMutableData *data, NSString *string, DBURLEncoding encoding);
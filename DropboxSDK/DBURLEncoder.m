@@ -0,0 +1,106 @@
+//
+//  DBURLEncoder.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBURLEncoder.h"
+
+#include <stdlib.h>
+
+// Strings up to this many UTF-8 bytes are encoded without touching the heap
+#define kDBURLEncoderStackLength 512
+
+#define kDBURLQuerySafe 1
+#define kDBURLPathSafe 2
+
+
+static const uint8_t kDBURLSafeCharacters[256] = {
+	/* 0x00 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0x10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0x20 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 3, 2,
+	/* 0x30 */ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0, 0,
+	/* 0x40 */ 0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0x50 */ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 3,
+	/* 0x60 */ 0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0x70 */ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 1, 0,
+	/* 0x80 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0x90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xA0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xB0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xC0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xD0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xE0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0xF0 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+
+size_t DBURLEncodeBytes(const void *bytes, size_t length, DBURLEncoding encoding, char *output) {
+	static const char hex[] = "0123456789ABCDEF";
+	const uint8_t safe = encoding == DBURLEncodingPath ? kDBURLPathSafe : kDBURLQuerySafe;
+	const uint8_t *input = bytes;
+	char *out = output;
+
+	for (size_t i = 0; i < length; i++) {
+		uint8_t c = input[i];
+		if (kDBURLSafeCharacters[c] & safe) {
+			*out++ = (char)c;
+		}
+		else {
+			*out++ = '%';
+			*out++ = hex[c >> 4];
+			*out++ = hex[c & 15];
+		}
+	}
+	return (size_t)(out - output);
+}
+
+// Calls block with the UTF-8 of string and room for its encoding, from the stack when they fit
+static void DBURLWithEncodingBuffers(NSString *string, void (^block)(const char *utf8, size_t length, char *output)) {
+	char utf8Stack[kDBURLEncoderStackLength];
+	char outputStack[DBURLEncodedMaxLength(kDBURLEncoderStackLength)];
+	char *utf8Heap = NULL, *outputHeap = NULL;
+
+	size_t length;
+	const char *utf8 = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingASCII);
+	if (utf8) {
+		// ASCII is its own UTF-8
+		length = [string length];
+	}
+	else {
+		NSUInteger maxLength = [string maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+		char *buffer = maxLength <= kDBURLEncoderStackLength ? utf8Stack : (utf8Heap = malloc(maxLength));
+		NSUInteger usedLength = 0;
+		[string getBytes:buffer maxLength:maxLength usedLength:&usedLength encoding:NSUTF8StringEncoding
+				 options:0 range:NSMakeRange(0, [string length]) remainingRange:NULL];
+		utf8 = buffer;
+		length = usedLength;
+	}
+
+	char *output = length <= kDBURLEncoderStackLength ? outputStack : (outputHeap = malloc(DBURLEncodedMaxLength(length)));
+	block(utf8, length, output);
+
+	free(utf8Heap);
+	free(outputHeap);
+}
+
+NSString *DBURLEncodedString(NSString *string, DBURLEncoding encoding) {
+	__block NSString *encoded = nil;
+	DBURLWithEncodingBuffers(string, ^(const char *utf8, size_t length, char *output) {
+		size_t outputLength = DBURLEncodeBytes(utf8, length, encoding, output);
+		if (outputLength == length) {
+			encoded = [string copy];
+		}
+		else {
+			encoded = [[NSString alloc] initWithBytes:output length:outputLength encoding:NSASCIIStringEncoding];
+		}
+	});
+	return encoded;
+}
+
+void DBURLAppendEncodedString(NSMutableData *data, NSString *string, DBURLEncoding encoding) {
+	DBURLWithEncodingBuffers(string, ^(const char *utf8, size_t length, char *output) {
+		[data appendBytes:output length:DBURLEncodeBytes(utf8, length, encoding, output)];
+	});
+}
@@ -11,8 +11,17 @@
 #import "DBAccountInfo.h"
 #import "DBSession.h"
 #import "DBRestClient.h"
+#import "DBHostConcurrencyGate.h"
 #import "DBRequest.h"
 #import "DBMetadata.h"
+#import "DBMetadataCache.h"
+#import "DBDeltaStore.h"
+#import "DBDeltaSyncEngine.h"
+#import "DBRequestMetrics.h"
+#import "DBConcurrencyController.h"
+#import "DBRetryPolicy.h"
+#import "DBDownloadSink.h"
+#import "DBThumbnailCache.h"
 #import "DBQuota.h"
 #import "DBError.h"
 #import "NSString+Dropbox.h"
@@ -11,6 +11,7 @@
 
 #define kMPOAuthSignatureMethodPlaintext	@"PLAINTEXT"
 #define kMPOAuthSignatureMethodHMACSHA1		@"HMAC-SHA1"
+#define kMPOAuthSignatureMethodHMACSHA256	@"HMAC-SHA256"
 #define kMPOAuthSignatureMethodRSASHA1		@"RSA-SHA1"
 
 @class MPOAuthURLRequest;
@@ -21,6 +22,7 @@
 
 + (NSString *)signatureBaseStringUsingParameterString:(NSString *)inParameterString forRequest:(MPOAuthURLRequest *)inRequest;
 + (NSString *)HMAC_SHA1SignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret;
++ (NSString *)HMAC_SHA256SignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret;
 
 - (id)initWithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest usingMethod:(NSString *)inMethod;
 
@@ -11,11 +11,12 @@
 #import "NSString+URLEscapingAdditions.h"
 #import "NSURL+MPURLParameterAdditions.h"
 
-#import <CommonCrypto/CommonHMAC.h>
 #include "Base64Transcoder.h"
+#include "DBHMAC.h"
 
 @interface MPOAuthSignatureParameter ()
-- (id)initUsingHMAC_SHA1WithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest;
++ (NSString *)HMACSignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret algorithm:(DBHashAlgorithm)inAlgorithm;
+- (id)initUsingHMACWithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest algorithm:(DBHashAlgorithm)inAlgorithm;
 @end
 
 @implementation MPOAuthSignatureParameter
@@ -27,29 +28,34 @@
 }
 
 + (NSString *)HMAC_SHA1SignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret {
+	return [self HMACSignatureForText:inText usingSecret:inSecret algorithm:DBHashAlgorithmSHA1];
+}
+
++ (NSString *)HMAC_SHA256SignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret {
+	return [self HMACSignatureForText:inText usingSecret:inSecret algorithm:DBHashAlgorithmSHA256];
+}
+
++ (NSString *)HMACSignatureForText:(NSString *)inText usingSecret:(NSString *)inSecret algorithm:(DBHashAlgorithm)inAlgorithm {
 	NSData *secretData = [inSecret dataUsingEncoding:NSUTF8StringEncoding];
 	NSData *textData = [inText dataUsingEncoding:NSUTF8StringEncoding];
-	unsigned char result[CC_SHA1_DIGEST_LENGTH];
+	uint8_t result[kDBHMACMaxDigestLength];
 
-	CCHmacContext hmacContext;
-	bzero(&hmacContext, sizeof(CCHmacContext));
-    CCHmacInit(&hmacContext, kCCHmacAlgSHA1, secretData.bytes, secretData.length);
-    CCHmacUpdate(&hmacContext, textData.bytes, textData.length);
-    CCHmacFinal(&hmacContext, result);
+	DBHMACKey key;
+	DBHMACKeyInit(&key, inAlgorithm, secretData.bytes, secretData.length);
+	DBHMACSign(&key, textData.bytes, textData.length, result);
 	
 	//Base64 Encoding
-	char base64Result[32];
-	size_t theResultLength = 32;
-	Base64EncodeData(result, 20, base64Result, &theResultLength);
-	NSData *theData = [NSData dataWithBytes:base64Result length:theResultLength];
-	NSString *base64EncodedResult = [[NSString alloc] initWithData:theData encoding:NSUTF8StringEncoding];
-	
-	return base64EncodedResult;
+	char base64Result[64];
+	size_t theResultLength = sizeof(base64Result);
+	Base64EncodeData(result, DBHashDigestLength(inAlgorithm), base64Result, &theResultLength);
+	return [[NSString alloc] initWithBytes:base64Result length:theResultLength encoding:NSUTF8StringEncoding];
 }
 
 - (id)initWithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest usingMethod:(NSString *)inMethod {
 	if ([inMethod isEqual:kMPOAuthSignatureMethodHMACSHA1]) {
-		self = [self initUsingHMAC_SHA1WithText:inText andSecret:inSecret forRequest:inRequest];
+		self = [self initUsingHMACWithText:inText andSecret:inSecret forRequest:inRequest algorithm:DBHashAlgorithmSHA1];
+	} else if ([inMethod isEqual:kMPOAuthSignatureMethodHMACSHA256]) {
+		self = [self initUsingHMACWithText:inText andSecret:inSecret forRequest:inRequest algorithm:DBHashAlgorithmSHA256];
 	} else if ([inMethod isEqualToString:kMPOAuthSignatureMethodPlaintext]) {
 		if ((self = [super init])) {
 			self.name = @"oauth_signature";
@@ -63,12 +69,12 @@
 	return self;
 }
 
-- (id)initUsingHMAC_SHA1WithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest {
+- (id)initUsingHMACWithText:(NSString *)inText andSecret:(NSString *)inSecret forRequest:(MPOAuthURLRequest *)inRequest algorithm:(DBHashAlgorithm)inAlgorithm {
 	if ((self = [super init])) {
 		NSString *signatureBaseString = [MPOAuthSignatureParameter signatureBaseStringUsingParameterString:inText forRequest:inRequest];
 
 		self.name = @"oauth_signature";
-		self.value = [MPOAuthSignatureParameter HMAC_SHA1SignatureForText:signatureBaseString usingSecret:inSecret];
+		self.value = [MPOAuthSignatureParameter HMACSignatureForText:signatureBaseString usingSecret:inSecret algorithm:inAlgorithm];
 	}
 	return self;	
 }
@@ -8,6 +8,7 @@
 
 #import "MPURLRequestParameter.h"
 #import "NSString+URLEscapingAdditions.h"
+#import "DBURLEncoder.h"
 
 @implementation MPURLRequestParameter
 
@@ -78,21 +79,20 @@
 }
 
 + (NSString *)parameterStringForParameters:(NSArray *)inParameters {
-	NSMutableString *queryString = [[NSMutableString alloc] init];
-	int i = 0;
-	NSUInteger parameterCount = [inParameters count];
-	MPURLRequestParameter *aParameter = nil;
+	// Encoded straight into one buffer rather than a string per name and value
+	NSMutableData *queryData = [[NSMutableData alloc] initWithCapacity:[inParameters count] * 32];
+	BOOL first = YES;
 	
-	for (; i < parameterCount; i++) {
-		aParameter = [inParameters objectAtIndex:i];
-		[queryString appendString:[aParameter URLEncodedParameterString]];
+	for (MPURLRequestParameter *aParameter in inParameters) {
+		if (!first) [queryData appendBytes:"&" length:1];
+		first = NO;
 		
-		if (i < parameterCount - 1) {
-			[queryString appendString:@"&"];
-		}
+		DBURLAppendEncodedString(queryData, aParameter.name, DBURLEncodingQuery);
+		[queryData appendBytes:"=" length:1];
+		if (aParameter.value) DBURLAppendEncodedString(queryData, aParameter.value, DBURLEncodingQuery);
 	}
 	
-	return queryString;
+	return [[NSString alloc] initWithData:queryData encoding:NSASCIIStringEncoding];
 }
 
 + (NSString *)parameterStringForDictionary:(NSDictionary *)inParameterDictionary {
@@ -9,6 +9,7 @@
 #import "NSDictionary+Dropbox.h"
 
 #import "DBDefines.h"
+#import "DBURLEncoder.h"
 
 
 @implementation NSDictionary (Dropbox)
@@ -30,13 +31,8 @@
 - (NSString *)urlRepresentation {
     NSMutableString *str = [NSMutableString stringWithString:@""];
     for (id key in self) {
-        CFStringRef escapeChars = (CFStringRef)@"!*'\"();:@&=+$,/?%#[]% ";
-        CFStringRef sKey = (__bridge CFStringRef)[key description];
-        NSString *eKey = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(
-            NULL, sKey, NULL, escapeChars, kCFStringEncodingUTF8);
-        CFStringRef sVal = (__bridge CFStringRef)[[self objectForKey:key] description];
-        NSString *eVal = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(
-            NULL, sVal, NULL, escapeChars, kCFStringEncodingUTF8);
+        NSString *eKey = DBURLEncodedString([key description], DBURLEncodingQuery);
+        NSString *eVal = DBURLEncodedString([[self objectForKey:key] description], DBURLEncodingQuery);
         if ([str length] > 0) {
             [str appendString:@"&"];
         }
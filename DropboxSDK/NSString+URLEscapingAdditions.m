@@ -9,6 +9,7 @@
 #import "NSString+URLEscapingAdditions.h"
 
 #import "DBDefines.h"
+#import "DBURLEncoder.h"
 
 
 @implementation NSString (MPURLEscapingAdditions)
@@ -42,6 +43,8 @@
 }
 
 - (NSString *)stringByAddingURIPercentEscapesUsingEncoding:(NSStringEncoding)inEncoding {
+	if (inEncoding == NSUTF8StringEncoding) return DBURLEncodedString(self, DBURLEncodingQuery);
+
 	NSString *escapedString = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault,
 																				  (__bridge CFStringRef)self,
 																				  NULL,
@@ -0,0 +1,304 @@
+//
+//  Base64TranscoderTests.c
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Checks Base64Transcoder.c against a plain reference encoder and decoder written here. The
+   Makefile builds it twice, with the vector kernels and with BASE64_SCALAR, so both builds are held
+   to the same answers. Every 3-byte group is encoded, and so every 4-character quad decoded, at
+   each position of a vector block; every byte value is dropped into each position of a valid
+   line; and random inputs are fed to the one-shot and incremental calls in random pieces. With
+   --bench, encoding and decoding throughput on 1 MB. */
+
+#include "Base64Transcoder.h"
+#include "DBTest.h"
+
+#include <stdlib.h>
+
+
+#if defined(BASE64_SCALAR)
+#define kBase64TestKernel "scalar"
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define kBase64TestKernel "NEON"
+#elif defined(__SSSE3__)
+#define kBase64TestKernel "SSSE3"
+#else
+#define kBase64TestKernel "scalar"
+#endif
+
+static const char kBase64TestAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static uint64_t gBase64TestRandomState = 0x9e3779b97f4a7c15ull;
+
+static uint32_t Base64TestRandom(void) {
+	// xorshift64*, so runs are repeatable everywhere
+	gBase64TestRandomState ^= gBase64TestRandomState >> 12;
+	gBase64TestRandomState ^= gBase64TestRandomState << 25;
+	gBase64TestRandomState ^= gBase64TestRandomState >> 27;
+	return (uint32_t)((gBase64TestRandomState * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+
+// Reference
+
+/* Base64 with a CRLF after every 72 characters, the last line's included. Returns the length. */
+static size_t Base64TestReferenceEncode(const uint8_t *input, size_t length, char *output) {
+	size_t outLength = 0, lineLength = 0;
+	for (size_t i = 0; i < length; i += 3) {
+		uint32_t group = (uint32_t)input[i] << 16;
+		if (i + 1 < length) group |= (uint32_t)input[i + 1] << 8;
+		if (i + 2 < length) group |= input[i + 2];
+		output[outLength++] = kBase64TestAlphabet[group >> 18 & 63];
+		output[outLength++] = kBase64TestAlphabet[group >> 12 & 63];
+		output[outLength++] = i + 1 < length ? kBase64TestAlphabet[group >> 6 & 63] : '=';
+		output[outLength++] = i + 2 < length ? kBase64TestAlphabet[group & 63] : '=';
+		lineLength += 4;
+		if (lineLength == 72) {
+			output[outLength++] = '\r';
+			output[outLength++] = '\n';
+			lineLength = 0;
+		}
+	}
+	return outLength;
+}
+
+/* Stops at the first '=' and skips every other byte outside the alphabet. A partial quad of n
+   sextets gives n - 1 bytes. Returns the length. */
+static size_t Base64TestReferenceDecode(const uint8_t *input, size_t length, uint8_t *output) {
+	int8_t sextets[256];
+	memset(sextets, -1, sizeof(sextets));
+	for (int i = 0; i < 64; i++) sextets[(uint8_t)kBase64TestAlphabet[i]] = (int8_t)i;
+
+	size_t outLength = 0, count = 0;
+	uint32_t group = 0;
+	for (size_t i = 0; i < length && input[i] != '='; i++) {
+		if (sextets[input[i]] < 0) continue;
+		group = group << 6 | (uint32_t)sextets[input[i]];
+		if (++count == 4) {
+			output[outLength++] = (uint8_t)(group >> 16);
+			output[outLength++] = (uint8_t)(group >> 8);
+			output[outLength++] = (uint8_t)group;
+			count = 0;
+			group = 0;
+		}
+	}
+	if (count > 1) {
+		group <<= 6 * (4 - count);
+		output[outLength++] = (uint8_t)(group >> 16);
+		if (count > 2) output[outLength++] = (uint8_t)(group >> 8);
+	}
+	return outLength;
+}
+
+
+// Calls under test
+
+static size_t Base64TestEncode(const uint8_t *input, size_t length, char *output) {
+	size_t outLength = EstimateBas64EncodedDataSize(length);
+	bool ok = Base64EncodeData(input, length, output, &outLength);
+	DBTestCheck(ok, "Base64EncodeData refused %zu bytes", length);
+	return outLength;
+}
+
+/* Feeds the input in pieces of random length, at most maxPiece bytes each */
+static size_t Base64TestEncodeIncrementally(const uint8_t *input, size_t length, size_t maxPiece, char *output) {
+	Base64EncodeState state;
+	Base64EncodeInit(&state);
+	size_t outLength = 0;
+	for (size_t offset = 0; offset < length; ) {
+		size_t piece = 1 + Base64TestRandom() % maxPiece;
+		if (piece > length - offset) piece = length - offset;
+		size_t written = EstimateBas64EncodedDataSize(length) - outLength;
+		bool ok = Base64EncodeUpdate(&state, input + offset, piece, output + outLength, &written);
+		DBTestCheck(ok, "Base64EncodeUpdate refused %zu bytes", piece);
+		outLength += written;
+		offset += piece;
+	}
+	size_t written = EstimateBas64EncodedDataSize(length) - outLength;
+	bool ok = Base64EncodeFinal(&state, output + outLength, &written);
+	DBTestCheck(ok, "Base64EncodeFinal refused");
+	return outLength + written;
+}
+
+static size_t Base64TestDecode(const uint8_t *input, size_t length, uint8_t *output) {
+	size_t outLength = EstimateBas64DecodedDataSize(length);
+	bool ok = Base64DecodeData(input, length, output, &outLength);
+	DBTestCheck(ok, "Base64DecodeData refused %zu bytes", length);
+	return outLength;
+}
+
+static size_t Base64TestDecodeIncrementally(const uint8_t *input, size_t length, size_t maxPiece, uint8_t *output) {
+	Base64DecodeState state;
+	Base64DecodeInit(&state);
+	size_t outLength = 0;
+	for (size_t offset = 0; offset < length; ) {
+		size_t piece = 1 + Base64TestRandom() % maxPiece;
+		if (piece > length - offset) piece = length - offset;
+		size_t written = EstimateBas64DecodedDataSize(length) - outLength;
+		bool ok = Base64DecodeUpdate(&state, input + offset, piece, output + outLength, &written);
+		DBTestCheck(ok, "Base64DecodeUpdate refused %zu bytes", piece);
+		outLength += written;
+		offset += piece;
+	}
+	size_t written = EstimateBas64DecodedDataSize(length) - outLength;
+	bool ok = Base64DecodeFinal(&state, output + outLength, &written);
+	DBTestCheck(ok, "Base64DecodeFinal refused");
+	return outLength + written;
+}
+
+/* The one-shot and incremental decoders against the reference, on any input */
+static void Base64TestCheckDecoders(const uint8_t *input, size_t length, uint8_t *expected, uint8_t *actual, const char *what) {
+	size_t expectedLength = Base64TestReferenceDecode(input, length, expected);
+
+	size_t actualLength = Base64TestDecode(input, length, actual);
+	DBTestCheck(actualLength == expectedLength && memcmp(actual, expected, expectedLength) == 0,
+		"Base64DecodeData of %s: %zu bytes, expected %zu", what, actualLength, expectedLength);
+
+	size_t maxPieces[] = { 1, 7, length ? length : 1 };
+	for (size_t i = 0; i < sizeof(maxPieces) / sizeof(maxPieces[0]); i++) {
+		actualLength = Base64TestDecodeIncrementally(input, length, maxPieces[i], actual);
+		DBTestCheck(actualLength == expectedLength && memcmp(actual, expected, expectedLength) == 0,
+			"Base64DecodeUpdate of %s in pieces of up to %zu: %zu bytes, expected %zu", what, maxPieces[i],
+			actualLength, expectedLength);
+	}
+}
+
+
+// Tests
+
+/* Every 3-byte group, starting at each of the 16 group positions of a vector block */
+static void Base64TestAllGroups(void) {
+	const size_t groupCount = 1 << 24;
+	for (size_t shift = 0; shift < 16; shift++) {
+		size_t length = (groupCount + shift) * 3;
+		uint8_t *input = calloc(length, 1);
+		for (size_t group = 0; group < groupCount; group++) {
+			uint8_t *bytes = input + (shift + group) * 3;
+			bytes[0] = (uint8_t)(group >> 16);
+			bytes[1] = (uint8_t)(group >> 8);
+			bytes[2] = (uint8_t)group;
+		}
+
+		char *expected = malloc(EstimateBas64EncodedDataSize(length));
+		char *encoded = malloc(EstimateBas64EncodedDataSize(length));
+		size_t expectedLength = Base64TestReferenceEncode(input, length, expected);
+		size_t encodedLength = Base64TestEncode(input, length, encoded);
+		DBTestCheck(encodedLength == expectedLength && memcmp(encoded, expected, expectedLength) == 0,
+			"encoding every group after %zu others differs from the reference", shift);
+
+		// The encoding holds every quad once, so decoding it back covers all of them
+		uint8_t *decoded = malloc(EstimateBas64DecodedDataSize(encodedLength));
+		size_t decodedLength = Base64TestDecode((const uint8_t *)encoded, encodedLength, decoded);
+		DBTestCheck(decodedLength == length && memcmp(decoded, input, length) == 0,
+			"decoding every quad after %zu others doesn't give the input back", shift);
+
+		free(decoded);
+		free(encoded);
+		free(expected);
+		free(input);
+	}
+}
+
+/* Each byte value in each position of two vector blocks' worth of base64, so it lands in every lane
+   of the kernels and in the scalar code that takes over after them */
+static void Base64TestEveryByteEverywhere(void) {
+	uint8_t line[160], expected[160], actual[160];
+	for (size_t i = 0; i < sizeof(line); i++) line[i] = (uint8_t)kBase64TestAlphabet[(i * 7 + 3) % 64];
+
+	for (int value = 0; value < 256; value++) {
+		for (size_t position = 0; position < 128; position++) {
+			uint8_t input[160];
+			memcpy(input, line, sizeof(input));
+			input[position] = (uint8_t)value;
+
+			char what[64];
+			snprintf(what, sizeof(what), "0x%02x at %zu", value, position);
+			Base64TestCheckDecoders(input, sizeof(input), expected, actual, what);
+
+			// And followed by whitespace, which the one-shot decoder once decoded as zero bits
+			input[position + 1] = '\n';
+			snprintf(what, sizeof(what), "0x%02x and a newline at %zu", value, position);
+			Base64TestCheckDecoders(input, sizeof(input), expected, actual, what);
+		}
+	}
+}
+
+static void Base64TestRandomInputs(void) {
+	uint8_t input[4096], expected[8192], actual[8192];
+	char expectedText[8192], actualText[8192];
+
+	for (int round = 0; round < 20000; round++) {
+		size_t length = Base64TestRandom() % 1024;
+		for (size_t i = 0; i < length; i++) input[i] = (uint8_t)Base64TestRandom();
+
+		size_t expectedLength = Base64TestReferenceEncode(input, length, expectedText);
+		size_t actualLength = Base64TestEncode(input, length, actualText);
+		DBTestCheck(actualLength == expectedLength && memcmp(actualText, expectedText, expectedLength) == 0,
+			"encoding %zu random bytes differs from the reference", length);
+		actualLength = Base64TestEncodeIncrementally(input, length, 1 + Base64TestRandom() % 200, actualText);
+		DBTestCheck(actualLength == expectedLength && memcmp(actualText, expectedText, expectedLength) == 0,
+			"encoding %zu random bytes in pieces differs from the reference", length);
+
+		// Mostly base64, with whitespace, noise, NUL, high bytes and now and then an '=' mixed in
+		uint8_t *text = (uint8_t *)expectedText;
+		size_t textLength = expectedLength;
+		for (size_t i = 0; i < textLength; i++) {
+			uint32_t dice = Base64TestRandom() % 64;
+			if (dice == 0) text[i] = ' ';
+			else if (dice == 1) text[i] = (uint8_t)(Base64TestRandom() % 32);
+			else if (dice == 2) text[i] = (uint8_t)(0x80 + Base64TestRandom() % 128);
+			else if (dice == 3) text[i] = "!-.:@[_~"[Base64TestRandom() % 8];
+			else if (dice == 4 && Base64TestRandom() % 8 == 0) text[i] = '=';
+		}
+		Base64TestCheckDecoders(text, textLength, expected, actual, "random text");
+	}
+}
+
+
+// Benchmarks
+
+static void Base64BenchmarkThroughput(void) {
+	const size_t length = 1 << 20;
+	const int count = 200;
+	uint8_t *input = malloc(length);
+	char *encoded = malloc(EstimateBas64EncodedDataSize(length));
+	uint8_t *decoded = malloc(EstimateBas64DecodedDataSize(EstimateBas64EncodedDataSize(length)));
+	for (size_t i = 0; i < length; i++) input[i] = (uint8_t)Base64TestRandom();
+
+	size_t encodedLength = 0;
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		encodedLength = EstimateBas64EncodedDataSize(length);
+		Base64EncodeData(input, length, encoded, &encodedLength);
+	}
+	double encodeTime = DBTestNow() - start;
+
+	start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		size_t decodedLength = EstimateBas64DecodedDataSize(encodedLength);
+		Base64DecodeData(encoded, encodedLength, decoded, &decodedLength);
+	}
+	double decodeTime = DBTestNow() - start;
+
+	printf("Base64 (%s), 1 MB with line breaks: encode %.0f MB/s, decode %.0f MB/s of output\n",
+		kBase64TestKernel, count / encodeTime, count / decodeTime);
+
+	free(decoded);
+	free(encoded);
+	free(input);
+}
+
+
+int main(int argc, char **argv) {
+	Base64TestAllGroups();
+	Base64TestEveryByteEverywhere();
+	Base64TestRandomInputs();
+
+	if (DBTestWantsBenchmarks(argc, argv)) {
+		Base64BenchmarkThroughput();
+	}
+
+	return DBTestExitStatus("Base64TranscoderTests (" kBase64TestKernel ")");
+}
@@ -0,0 +1,216 @@
+//
+//  DBAdaptiveConcurrencyTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Runs DBRestClient with adaptiveConcurrency against two DBTestServers, one standing in for the API
+   host and one, reached as localhost, for the content host. Each plays a host with a given latency
+   and capacity: past its capacity it either rejects requests with 429 or 503, or gets slower the
+   more requests it has, like a saturated link. With metadata loads going to an API host that can
+   take any number and file loads to a content host that turns away more than two, the controller
+   has to end up with a limit above its start for the one and below it for the other. With
+   --bench, a few such hosts through the fixed 4 requests at once and through the adaptive limits:
+   requests per second, the requests turned away and the limits reached. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBConcurrencyController.h"
+#import "DBLog.h"
+#import "DBRestClient.h"
+#import "DBRetryPolicy.h"
+#include "DBTest.h"
+#import "DBTestClient.h"
+#include "DBTestServer.h"
+
+#include <libkern/OSAtomic.h>
+
+
+/* How one host behaves. The handler runs on its server's thread; the counts are read after a run. */
+typedef struct {
+	double latency; // Seconds
+	unsigned capacity; // Requests it answers at full speed at once
+	int rejectStatus; // Given to requests past the capacity; 0 slows every request down instead
+	unsigned served;
+	unsigned rejected;
+	unsigned maxInFlight;
+} DBTestHost;
+
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	DBTestHost *host = context;
+	if (request->inFlight > host->maxInFlight) host->maxInFlight = request->inFlight;
+
+	if (request->inFlight > host->capacity && host->rejectStatus) {
+		host->rejected++;
+		response->status = host->rejectStatus;
+		const char *body = "{\"error\": \"Too many requests\"}";
+		DBTestServerSetBody(response, body, strlen(body));
+		DBTestServerAddHeader(response, "Content-Type: application/json");
+		response->delay = 0.005;
+		return;
+	}
+
+	host->served++;
+	response->delay = host->latency;
+	if (request->inFlight > host->capacity) response->delay *= (double)request->inFlight / host->capacity;
+
+	if (strncmp(request->path, "/1/files/", 9) == 0) {
+		static uint8_t contents[16384];
+		DBTestServerSetBody(response, contents, sizeof(contents));
+		DBTestServerAddHeader(response, "Content-Type: application/octet-stream");
+	}
+	else {
+		char body[512];
+		int length = snprintf(body, sizeof(body), "{\"size\": \"0 bytes\", \"rev\": \"1f0ba6f3e4\", \"thumb_exists\": false, "
+			"\"bytes\": 0, \"path\": \"%s\", \"is_dir\": false, \"icon\": \"page_white\", \"root\": \"dropbox\", \"revision\": 1}",
+			request->path + strlen("/1/metadata/dropbox"));
+		DBTestServerSetBody(response, body, length);
+		DBTestServerAddHeader(response, "Content-Type: application/json");
+	}
+}
+
+static void DBTestResetHost(DBTestHost *host, double latency, unsigned capacity, int rejectStatus) {
+	host->latency = latency;
+	host->capacity = capacity;
+	host->rejectStatus = rejectStatus;
+	host->served = host->rejected = host->maxInFlight = 0;
+}
+
+typedef struct {
+	double apiRate; // Requests per second, for each host until its last request finished
+	double contentRate;
+	int32_t failures; // Requests that failed even after their retries
+	NSUInteger apiLimit; // What the controller ended up with, 0 for fixed runs
+	NSUInteger contentLimit;
+} DBTestRun;
+
+/* Loads apiCount metadata and contentCount files, all asked for at once */
+static DBTestRun DBTestRunRequests(DBSession *session, int apiCount, int contentCount, BOOL adaptive) {
+	DBTestRun run = { 0, 0, 0, 0, 0 };
+	__block int32_t failures = 0;
+	__block double apiDone = 0, contentDone = 0;
+	NSObject *lock = [NSObject new];
+	dispatch_group_t group = dispatch_group_create();
+	NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:
+		[NSString stringWithFormat:@"DBAdaptiveConcurrencyTests-%d", getpid()]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+
+	DBRestClient *client = [[DBRestClient alloc] initWithSession:session];
+	client.adaptiveConcurrency = adaptive;
+	// Enough retries that every request gets through in the end; the cost shows in the rate
+	DBRetryPolicy *retryPolicy = [DBRetryPolicy new];
+	retryPolicy.baseDelay = 0.05;
+	retryPolicy.maxRetries = 20;
+	retryPolicy.budgetRatio = 1;
+	retryPolicy.budgetCapacity = 10000;
+	client.retryPolicy = retryPolicy;
+
+	double start = DBTestNow();
+	for (int i = 0; i < apiCount || i < contentCount; i++) {
+		if (i < apiCount) {
+			dispatch_group_enter(group);
+			[client loadMetadata:[NSString stringWithFormat:@"/file%d", i] completion:^(NSError *error, BOOL changed, DBMetadata *metadata) {
+				if (error) OSAtomicIncrement32(&failures);
+				@synchronized (lock) {
+					apiDone = DBTestNow();
+				}
+				dispatch_group_leave(group);
+			}];
+		}
+		if (i < contentCount) {
+			dispatch_group_enter(group);
+			NSString *destination = [directory stringByAppendingPathComponent:[NSString stringWithFormat:@"file%d", i]];
+			[client loadFile:[NSString stringWithFormat:@"/file%d", i] intoPath:destination
+				completion:^(NSError *error, NSString *contentType, DBMetadata *metadata) {
+					if (error) OSAtomicIncrement32(&failures);
+					@synchronized (lock) {
+						contentDone = DBTestNow();
+					}
+					dispatch_group_leave(group);
+				}];
+		}
+	}
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+	run.apiRate = apiCount ? apiCount / (apiDone - start) : 0;
+	run.contentRate = contentCount ? contentCount / (contentDone - start) : 0;
+	run.failures = failures;
+	if (adaptive) {
+		run.apiLimit = [client.concurrencyController limitForHost:@"127.0.0.1"];
+		run.contentLimit = [client.concurrencyController limitForHost:@"localhost"];
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+	return run;
+}
+
+static void DBTestSeparateLimits(DBSession *session, DBTestHost *api, DBTestHost *content) {
+	DBTestResetHost(api, 0.05, 1000, 0);
+	DBTestResetHost(content, 0.05, 2, 503);
+	DBTestRun run = DBTestRunRequests(session, 300, 150, YES);
+
+	DBTestCheck(run.failures == 0, "%d of 450 requests failed", run.failures);
+	DBTestCheck(run.apiLimit > 4, "the API host's limit stayed at %lu", (unsigned long)run.apiLimit);
+	DBTestCheck(run.contentLimit < 4, "the content host's limit is %lu after %u 503s", (unsigned long)run.contentLimit,
+		content->rejected);
+	DBTestCheck(api->maxInFlight > 4, "at most %u requests reached the API host at once", api->maxInFlight);
+}
+
+static void DBBenchmarkHosts(DBSession *session, DBTestHost *api, DBTestHost *content) {
+	struct {
+		const char *name;
+		double apiLatency;
+		unsigned apiCapacity;
+		int apiRejectStatus;
+		double contentLatency;
+		unsigned contentCapacity;
+		int contentRejectStatus;
+	} scenarios[] = {
+		{ "Fast hosts, 100 ms, no limits", 0.1, 1000, 0, 0.1, 1000, 0 },
+		{ "Rate limited, 429 past 2 at once", 0.05, 2, 429, 0.05, 2, 429 },
+		{ "Saturated, slower past 3 at once", 0.05, 3, 0, 0.05, 3, 0 },
+		{ "Fast API host, content host 503 past 2", 0.1, 1000, 0, 0.1, 2, 503 },
+	};
+	const int apiCount = 600, contentCount = 300;
+
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		printf("%s:\n", scenarios[i].name);
+		for (int adaptive = 0; adaptive <= 1; adaptive++) {
+			DBTestResetHost(api, scenarios[i].apiLatency, scenarios[i].apiCapacity, scenarios[i].apiRejectStatus);
+			DBTestResetHost(content, scenarios[i].contentLatency, scenarios[i].contentCapacity, scenarios[i].contentRejectStatus);
+			DBTestRun run = DBTestRunRequests(session, apiCount, contentCount, adaptive);
+			printf("  %s: API host %.0f requests/s, %u turned away, %u at once at most; content host %.0f requests/s, "
+				"%u turned away, %u at once at most; %d failed", adaptive ? "Adaptive" : "Fixed at 4", run.apiRate,
+				api->rejected, api->maxInFlight, run.contentRate, content->rejected, content->maxInFlight, run.failures);
+			if (adaptive) printf("; limits %lu and %lu", (unsigned long)run.apiLimit, (unsigned long)run.contentLimit);
+			printf("\n");
+		}
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBLogSetLevel(DBLogLevelError); // Every limit change is logged
+
+		DBTestHost api = { 0 }, content = { 0 };
+		DBTestServer *apiServer = DBTestServerStart(DBTestHandler, &api);
+		DBTestServer *contentServer = DBTestServerStart(DBTestHandler, &content);
+		DBTestCheck(apiServer && contentServer, "the servers didn't start");
+		if (!apiServer || !contentServer) return DBTestExitStatus("DBAdaptiveConcurrencyTests");
+
+		// The controller tells hosts apart by name, so the content host goes by localhost
+		DBSession *session = DBTestSessionForHosts([NSString stringWithFormat:@"127.0.0.1:%d", DBTestServerPort(apiServer)],
+			[NSString stringWithFormat:@"localhost:%d", DBTestServerPort(contentServer)]);
+
+		DBTestSeparateLimits(session, &api, &content);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkHosts(session, &api, &content);
+		}
+
+		DBTestServerStop(apiServer);
+		DBTestServerStop(contentServer);
+	}
+	return DBTestExitStatus("DBAdaptiveConcurrencyTests");
+}
@@ -0,0 +1,349 @@
+//
+//  DBChunkedUploadTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Uploads files with uploadFileChunked: to DBTestServer playing the chunked upload protocol, and
+   checks that what gets committed is the file, byte for byte: with no faults, with a chunk whose
+   connection is dropped, with a chunk stored but its answer lost, which the client only learns
+   from the 400 carrying the offset the server has, and with an upload id that expires part way.
+   Then an upload that fails for good half way, resumed from its archived DBChunkedUploadSession by
+   another DBRestClient, which must not send again what the server already had. With --bench, the
+   bytes sent to finish a 100 MB upload whose connection drops once near the end, through
+   uploadFile: and through uploadFileChunked:. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBChunkedUploadSession.h"
+#import "DBLog.h"
+#import "DBRestClient.h"
+#import "DBRetryPolicy.h"
+#include "DBTest.h"
+#import "DBTestClient.h"
+#include "DBTestServer.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+
+/* The server side of one upload at a time. The handler runs on the server thread; the rest is read
+   once the upload has finished. */
+typedef struct {
+	char uploadId[32];
+	int uploadCount;
+	uint8_t *data; // What the server has of the upload in progress
+	size_t length;
+	uint8_t *committed;
+	size_t committedLength;
+	long long bytesReceived; // Every chunk or files_put body that arrived, kept or not
+	int requests; // Chunk and files_put requests so far, counted from 1
+	// Faults, each for the request with that number
+	int dropRequest; // The connection is dropped before the chunk is stored
+	int loseAckRequest; // The chunk is stored, then the connection is dropped
+	int expireRequest; // 404, as if the upload id had expired
+} DBTestUploadServer;
+
+static bool DBTestParameter(const char *parameters, size_t length, const char *name, char *value, size_t size) {
+	size_t nameLength = strlen(name);
+	for (size_t i = 0; i + nameLength < length; i++) {
+		if ((i == 0 || parameters[i - 1] == '&') && strncmp(parameters + i, name, nameLength) == 0 &&
+			parameters[i + nameLength] == '=') {
+			size_t start = i + nameLength + 1, end = start;
+			while (end < length && parameters[end] != '&') end++;
+			snprintf(value, size, "%.*s", (int)(end - start), parameters + start);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void DBTestSetJSON(DBTestServerResponse *response, int status, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+static void DBTestSetJSON(DBTestServerResponse *response, int status, const char *format, ...) {
+	char body[1024];
+	va_list arguments;
+	va_start(arguments, format);
+	int length = vsnprintf(body, sizeof(body), format, arguments);
+	va_end(arguments);
+	response->status = status;
+	DBTestServerSetBody(response, body, length);
+	DBTestServerAddHeader(response, "Content-Type: application/json");
+}
+
+static void DBTestSetMetadata(DBTestServerResponse *response, const char *path, size_t length) {
+	DBTestSetJSON(response, 200, "{\"size\": \"%zu bytes\", \"rev\": \"1f0ba6f3e4\", \"thumb_exists\": false, \"bytes\": %zu, "
+		"\"modified\": \"Tue, 19 Jul 2011 21:55:38 +0000\", \"path\": \"%s\", \"is_dir\": false, \"icon\": \"page_white\", "
+		"\"root\": \"dropbox\", \"mime_type\": \"application/octet-stream\", \"revision\": 1}", length, length, path);
+}
+
+static void DBTestCommit(DBTestUploadServer *server, const uint8_t *data, size_t length) {
+	free(server->committed);
+	server->committed = malloc(length ? length : 1);
+	memcpy(server->committed, data, length);
+	server->committedLength = length;
+}
+
+static void DBTestChunk(DBTestUploadServer *server, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	int number = ++server->requests;
+	server->bytesReceived += request->bodyLength;
+	if (number == server->dropRequest) {
+		response->status = 0;
+		return;
+	}
+
+	char uploadId[64] = "", offsetString[32] = "";
+	size_t queryLength = strlen(request->query);
+	bool hasUploadId = DBTestParameter(request->query, queryLength, "upload_id", uploadId, sizeof(uploadId));
+	DBTestParameter(request->query, queryLength, "offset", offsetString, sizeof(offsetString));
+	long long offset = offsetString[0] ? atoll(offsetString) : -1;
+
+	if (number == server->expireRequest || (hasUploadId && strcmp(uploadId, server->uploadId) != 0)) {
+		server->uploadId[0] = '\0';
+		server->length = 0;
+		DBTestSetJSON(response, 404, "{\"error\": \"The requested upload_id was not found.\"}");
+		return;
+	}
+	if (!hasUploadId) {
+		if (offset != 0) {
+			DBTestSetJSON(response, 400, "{\"error\": \"Offset must be 0 without an upload_id\"}");
+			return;
+		}
+		snprintf(server->uploadId, sizeof(server->uploadId), "upload%d", ++server->uploadCount);
+		server->length = 0;
+	}
+	else if (offset != (long long)server->length) {
+		DBTestSetJSON(response, 400, "{\"upload_id\": \"%s\", \"offset\": %zu, \"error\": \"Submitted input out of alignment: "
+			"got [%lld] expected [%zu]\"}", server->uploadId, server->length, offset, server->length);
+		return;
+	}
+
+	server->data = realloc(server->data, server->length + request->bodyLength + 1);
+	memcpy(server->data + server->length, request->body, request->bodyLength);
+	server->length += request->bodyLength;
+
+	if (number == server->loseAckRequest) {
+		response->status = 0;
+		return;
+	}
+	DBTestSetJSON(response, 200, "{\"upload_id\": \"%s\", \"offset\": %zu, \"expires\": \"Tue, 19 Jul 2039 21:55:38 +0000\"}",
+		server->uploadId, server->length);
+}
+
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	DBTestUploadServer *server = context;
+	const char *commitPrefix = "/1/commit_chunked_upload/dropbox";
+	const char *putPrefix = "/1/files_put/dropbox";
+
+	if (strcmp(request->path, "/1/chunked_upload") == 0 && strcmp(request->method, "PUT") == 0) {
+		DBTestChunk(server, request, response);
+	}
+	else if (strncmp(request->path, commitPrefix, strlen(commitPrefix)) == 0 && strcmp(request->method, "POST") == 0) {
+		char uploadId[64] = "";
+		if (!DBTestParameter((const char *)request->body, request->bodyLength, "upload_id", uploadId, sizeof(uploadId)) ||
+			strcmp(uploadId, server->uploadId) != 0) {
+			DBTestSetJSON(response, 400, "{\"error\": \"Unknown upload_id\"}");
+			return;
+		}
+		DBTestCommit(server, server->data, server->length);
+		DBTestSetMetadata(response, request->path + strlen(commitPrefix), server->length);
+		server->uploadId[0] = '\0';
+		server->length = 0;
+	}
+	else if (strncmp(request->path, putPrefix, strlen(putPrefix)) == 0 && strcmp(request->method, "PUT") == 0) {
+		int number = ++server->requests;
+		server->bytesReceived += request->bodyLength;
+		if (number == server->dropRequest) {
+			response->status = 0;
+			return;
+		}
+		DBTestCommit(server, request->body, request->bodyLength);
+		DBTestSetMetadata(response, request->path + strlen(putPrefix), request->bodyLength);
+	}
+	else {
+		DBTestSetJSON(response, 404, "{\"error\": \"Path not found\"}");
+	}
+}
+
+static void DBTestResetServer(DBTestUploadServer *server) {
+	server->uploadId[0] = '\0';
+	server->length = 0;
+	free(server->committed);
+	server->committed = NULL;
+	server->committedLength = 0;
+	server->bytesReceived = 0;
+	server->requests = 0;
+	server->dropRequest = server->loseAckRequest = server->expireRequest = 0;
+}
+
+
+/* Keeps the latest state of the upload, as an app would to resume it after a restart */
+@interface DBTestUploadDelegate : NSObject <DBRestClientDelegate>
+
+@property (atomic, strong) NSData *archivedSession;
+
+@end
+
+@implementation DBTestUploadDelegate
+
+- (void)restClient:(DBRestClient *)client updatedChunkedUpload:(DBChunkedUploadSession *)uploadSession {
+	self.archivedSession = [NSKeyedArchiver archivedDataWithRootObject:uploadSession];
+}
+
+@end
+
+
+static NSString *DBTestMakeFile(size_t length) {
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+		[NSString stringWithFormat:@"DBChunkedUploadTests-%d", getpid()]];
+	NSMutableData *data = [NSMutableData dataWithLength:length];
+	uint8_t *bytes = [data mutableBytes];
+	for (size_t i = 0; i < length; i++) bytes[i] = (uint8_t)random();
+	[data writeToFile:path atomically:NO];
+	return path;
+}
+
+static BOOL DBTestCommittedFile(DBTestUploadServer *server, NSString *path) {
+	NSData *file = [NSData dataWithContentsOfFile:path];
+	return server->committed && server->committedLength == [file length] &&
+		memcmp(server->committed, [file bytes], [file length]) == 0;
+}
+
+/* Runs one upload to the end and returns its error, if any */
+static NSError *DBTestUpload(DBRestClient *client, NSString *sourcePath, BOOL chunked, DBChunkedUploadSession *resumed) {
+	__block NSError *uploadError = nil;
+	__block DBMetadata *uploaded = nil;
+	dispatch_semaphore_t done = dispatch_semaphore_create(0);
+	DBUploadFileCompletionBlock completion = ^(NSError *error, DBMetadata *metadata) {
+		uploadError = error;
+		uploaded = metadata;
+		dispatch_semaphore_signal(done);
+	};
+
+	if (resumed) {
+		[client resumeChunkedUpload:resumed completion:completion];
+	}
+	else if (chunked) {
+		[client uploadFileChunked:@"upload.bin" toPath:@"/Tests" withParentRev:nil fromPath:sourcePath completion:completion];
+	}
+	else {
+		[client uploadFile:@"upload.bin" toPath:@"/Tests" withParentRev:nil fromPath:sourcePath completion:completion];
+	}
+	dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+	DBTestCheck(uploadError || [uploaded.path isEqual:@"/Tests/upload.bin"], "the upload was committed as %s",
+		[uploaded.path UTF8String]);
+	return uploadError;
+}
+
+static void DBTestFaults(DBTestUploadServer *server, DBSession *session) {
+	const size_t chunkSize = 256 * 1024;
+	const size_t fileLength = 10 * chunkSize + 1000;
+	NSString *sourcePath = DBTestMakeFile(fileLength);
+
+	DBRestClient *client = [[DBRestClient alloc] initWithSession:session];
+	client.uploadChunkSize = chunkSize;
+	DBRetryPolicy *retryPolicy = [DBRetryPolicy new];
+	retryPolicy.baseDelay = 0.05;
+	client.retryPolicy = retryPolicy;
+
+	struct {
+		const char *name;
+		int dropRequest, loseAckRequest, expireRequest;
+		long long extraBytes; // Sent beyond the file, at most
+	} cases[] = {
+		{ "no faults", 0, 0, 0, 0 },
+		{ "a dropped chunk", 4, 0, 0, chunkSize },
+		{ "a lost acknowledgement", 0, 4, 0, chunkSize },
+		{ "an expired upload id", 0, 0, 7, 7 * chunkSize },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		DBTestResetServer(server);
+		server->dropRequest = cases[i].dropRequest;
+		server->loseAckRequest = cases[i].loseAckRequest;
+		server->expireRequest = cases[i].expireRequest;
+
+		NSError *error = DBTestUpload(client, sourcePath, YES, nil);
+		DBTestCheck(!error, "%s: the upload failed with %s", cases[i].name, [[error description] UTF8String]);
+		DBTestCheck(DBTestCommittedFile(server, sourcePath), "%s: %zu bytes committed aren't the %zu of the file",
+			cases[i].name, server->committedLength, fileLength);
+		DBTestCheck(server->bytesReceived <= (long long)fileLength + cases[i].extraBytes,
+			"%s: %lld bytes sent for a %zu byte file", cases[i].name, server->bytesReceived, fileLength);
+	}
+
+	// Fails for good on the sixth chunk, then another client picks the upload up where it stopped
+	DBTestResetServer(server);
+	server->dropRequest = 6;
+	DBTestUploadDelegate *delegate = [DBTestUploadDelegate new];
+	DBRestClient *failing = [[DBRestClient alloc] initWithSession:session];
+	failing.uploadChunkSize = chunkSize;
+	failing.retryPolicy = nil;
+	failing.delegate = delegate;
+	NSError *error = DBTestUpload(failing, sourcePath, YES, nil);
+	DBTestCheck(error != nil, "the upload went through a dropped chunk without retries");
+
+	DBChunkedUploadSession *uploadSession = [NSKeyedUnarchiver unarchiveObjectWithData:delegate.archivedSession];
+	DBTestCheck(uploadSession.offset == 5 * chunkSize && uploadSession.uploadId,
+		"the archived session is at %llu with upload id %s", uploadSession.offset, [uploadSession.uploadId UTF8String]);
+	long long receivedBefore = server->bytesReceived;
+	error = DBTestUpload(client, sourcePath, YES, uploadSession);
+	DBTestCheck(!error, "the resumed upload failed with %s", [[error description] UTF8String]);
+	DBTestCheck(DBTestCommittedFile(server, sourcePath), "resumed: %zu bytes committed aren't the %zu of the file",
+		server->committedLength, fileLength);
+	DBTestCheck(server->bytesReceived - receivedBefore == (long long)(fileLength - 5 * chunkSize),
+		"the resumed upload sent %lld bytes for the last %zu", server->bytesReceived - receivedBefore, fileLength - 5 * chunkSize);
+
+	[[NSFileManager defaultManager] removeItemAtPath:sourcePath error:NULL];
+}
+
+static void DBBenchmarkDroppedUpload(DBTestUploadServer *server, DBSession *session) {
+	const size_t chunkSize = 4 * 1000 * 1000;
+	const size_t fileLength = 25 * chunkSize;
+	NSString *sourcePath = DBTestMakeFile(fileLength);
+
+	DBRestClient *client = [[DBRestClient alloc] initWithSession:session];
+	client.uploadChunkSize = chunkSize;
+
+	const char *names[] = { "uploadFile:", "uploadFileChunked:" };
+	for (int chunked = 0; chunked <= 1; chunked++) {
+		DBTestResetServer(server);
+		// The whole file is one request for files_put, and its connection drops at the end
+		server->dropRequest = chunked ? 24 : 1;
+		double start = DBTestNow();
+		NSError *error = DBTestUpload(client, sourcePath, chunked, nil);
+		double elapsed = DBTestNow() - start;
+		DBTestCheck(!error && DBTestCommittedFile(server, sourcePath), "%s: the upload failed with %s", names[chunked],
+			[[error description] UTF8String]);
+		printf("%s, 100 MB with the connection dropped near the end: %.1f MB sent in %.2f s\n", names[chunked],
+			server->bytesReceived / 1e6, elapsed);
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:sourcePath error:NULL];
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBLogSetLevel(DBLogLevelError); // The faults are warnings
+		srandom(1);
+
+		DBTestUploadServer uploadServer = { "" };
+		DBTestServer *server = DBTestServerStart(DBTestHandler, &uploadServer);
+		DBTestCheck(server != NULL, "the server didn't start");
+		if (!server) return DBTestExitStatus("DBChunkedUploadTests");
+		DBSession *session = DBTestSessionForPort(DBTestServerPort(server));
+
+		DBTestFaults(&uploadServer, session);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkDroppedUpload(&uploadServer, session);
+		}
+
+		DBTestServerStop(server);
+		free(uploadServer.data);
+		free(uploadServer.committed);
+	}
+	return DBTestExitStatus("DBChunkedUploadTests");
+}
@@ -0,0 +1,198 @@
+//
+//  DBConnectionEngineTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Runs DBRequests against DBTestServer through the shared DBConnectionEngine and checks that each
+   gets its own response, 200 of them at once. With --bench, 1000 requests at once that each take
+   200 ms on the server: through DBRequest, then through an operation that parks its thread in
+   CFRunLoopRun() until its connection is done, as DBRequest did before the engine. For both, the
+   requests per second and the most threads and resident memory the process reached. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBHostConcurrencyGate.h"
+#import "DBRequest.h"
+#include "DBTest.h"
+#include "DBTestServer.h"
+
+#include <libkern/OSAtomic.h>
+
+
+typedef void (^DBBlockingRequestBlock)(NSInteger statusCode, NSData *data);
+
+/* One thread per request, the way DBRequest's main used to work */
+@interface DBBlockingRequest : NSOperation
+
+- (id)initWithURLRequest:(NSURLRequest *)request resultBlock:(DBBlockingRequestBlock)resultBlock;
+
+@end
+
+@implementation DBBlockingRequest {
+	NSURLRequest *_request;
+	DBBlockingRequestBlock _resultBlock;
+	NSInteger _statusCode;
+	NSMutableData *_data;
+}
+
+- (id)initWithURLRequest:(NSURLRequest *)request resultBlock:(DBBlockingRequestBlock)resultBlock {
+	if ((self = [super init])) {
+		_request = request;
+		_resultBlock = [resultBlock copy];
+		_data = [NSMutableData new];
+	}
+	return self;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+- (void)main {
+	NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:_request delegate:self startImmediately:YES];
+	CFRunLoopRun();
+	[connection cancel];
+	_resultBlock(_statusCode, _data);
+}
+#pragma clang diagnostic pop
+
+- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
+	_statusCode = [(NSHTTPURLResponse *)response statusCode];
+}
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+	[_data appendData:data];
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+	CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+	_statusCode = 0;
+	CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+@end
+
+
+typedef struct {
+	double delay;
+	unsigned maxInFlight;
+} DBTestServerSettings;
+
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	DBTestServerSettings *settings = context;
+	if (request->inFlight > settings->maxInFlight) settings->maxInFlight = request->inFlight;
+
+	char body[512];
+	int length = snprintf(body, sizeof(body), "{\"path\": \"%s\", \"is_dir\": false, \"bytes\": 0}", request->path);
+	DBTestServerSetBody(response, body, length);
+	DBTestServerAddHeader(response, "Content-Type: application/json");
+	response->delay = settings->delay;
+}
+
+static NSURLRequest *DBTestURLRequest(int port, int index) {
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d/1/metadata/dropbox/%d", port, index]];
+	return [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:120];
+}
+
+static BOOL DBTestResultMatches(NSInteger statusCode, id result, int index) {
+	NSString *path = [NSString stringWithFormat:@"/1/metadata/dropbox/%d", index];
+	return statusCode == 200 && [result isKindOfClass:[NSDictionary class]] && [[result objectForKey:@"path"] isEqual:path];
+}
+
+typedef struct {
+	double seconds;
+	unsigned peakThreads;
+	size_t peakResidentGrowth;
+	int32_t failures;
+} DBTestRun;
+
+static DBTestRun DBTestRunRequests(int port, int count, BOOL blocking) {
+	DBTestRun run = { 0, 0, 0, 0 };
+	__block int32_t failures = 0;
+	dispatch_group_t group = dispatch_group_create();
+
+	DBHostConcurrencyGate *gate = [DBHostConcurrencyGate new];
+	gate.maxRequestsPerHost = count;
+	gate.reservedSlotsPerHost = 0;
+	NSOperationQueue *queue = [NSOperationQueue new];
+	queue.maxConcurrentOperationCount = count;
+
+	size_t residentBefore = DBTestResidentSize();
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		dispatch_group_enter(group);
+		if (blocking) {
+			[queue addOperation:[[DBBlockingRequest alloc] initWithURLRequest:DBTestURLRequest(port, i)
+				resultBlock:^(NSInteger statusCode, NSData *data) {
+					id result = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL] : nil;
+					if (!DBTestResultMatches(statusCode, result, i)) OSAtomicIncrement32(&failures);
+					dispatch_group_leave(group);
+				}]];
+		}
+		else {
+			DBRequest *request = [[DBRequest alloc] initWithURLRequest:DBTestURLRequest(port, i) completionBlock:^(DBRequest *finished) {
+				if (!DBTestResultMatches(finished.statusCode, [finished parseResponseAsType:[NSDictionary class]], i)) {
+					OSAtomicIncrement32(&failures);
+				}
+				dispatch_group_leave(group);
+			}];
+			request.hostGate = gate;
+			[queue addOperation:request];
+		}
+	}
+
+	// Sampled every 10 ms while the requests run
+	for (;;) {
+		unsigned threads = DBTestThreadCount();
+		size_t resident = DBTestResidentSize();
+		if (threads > run.peakThreads) run.peakThreads = threads;
+		if (resident > residentBefore && resident - residentBefore > run.peakResidentGrowth) {
+			run.peakResidentGrowth = resident - residentBefore;
+		}
+		if (dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC)) == 0) break;
+	}
+	run.seconds = DBTestNow() - start;
+	run.failures = failures;
+
+	[queue waitUntilAllOperationsAreFinished];
+	return run;
+}
+
+static void DBBenchmarkConcurrentRequests(int port, DBTestServerSettings *settings) {
+	const int count = 1000;
+	settings->delay = 0.2;
+
+	const char *names[] = { "DBRequest on DBConnectionEngine", "A thread per request" };
+	for (int blocking = 0; blocking <= 1; blocking++) {
+		settings->maxInFlight = 0;
+		DBTestRun run = DBTestRunRequests(port, count, blocking);
+		DBTestCheck(run.failures == 0, "%s: %d of %d requests failed", names[blocking], run.failures, count);
+		printf("%s, %d requests at once, 200 ms each: %.0f requests/s, %u threads at most, %.1f MB more resident, "
+			"%u at once on the server\n", names[blocking], count, count / run.seconds, run.peakThreads,
+			run.peakResidentGrowth / 1e6, settings->maxInFlight);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBTestServerSettings settings = { 0.05, 0 };
+		DBTestServer *server = DBTestServerStart(DBTestHandler, &settings);
+		DBTestCheck(server != NULL, "the server didn't start");
+		if (!server) return DBTestExitStatus("DBConnectionEngineTests");
+		int port = DBTestServerPort(server);
+
+		DBTestRun run = DBTestRunRequests(port, 200, NO);
+		DBTestCheck(run.failures == 0, "%d of 200 requests failed", run.failures);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkConcurrentRequests(port, &settings);
+		}
+
+		DBTestServerStop(server);
+	}
+	return DBTestExitStatus("DBConnectionEngineTests");
+}
@@ -0,0 +1,255 @@
+//
+//  DBDeltaStoreTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Applies /delta entries to a DBDeltaStore and checks what it keeps: the stored fields, updates,
+   removals that take a folder's contents with them, a file replacing a folder, children that came
+   before their folder, the cursor after the store is opened again, and reset. Then random entries
+   against a dictionary that plays the rules of /delta. With --bench, a million entries applied in
+   pages of 2000, the way the delta engine applies them: the entries per second and the resident
+   memory added, against keeping a DBMetadata per path in a dictionary as before the store. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBDeltaStore.h"
+#import "DBLog.h"
+#import "DBMetadata.h"
+#include "DBTest.h"
+
+#include <stdlib.h>
+
+
+static NSString *DBTestStoreDirectory(void) {
+	return [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"DBDeltaStoreTests-%d", getpid()]];
+}
+
+static NSDictionary *DBTestEntry(NSString *path, int revision, BOOL isDirectory) {
+	NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+		path, @"path",
+		[NSString stringWithFormat:@"%x0ba6f3e4", revision], @"rev",
+		[NSNumber numberWithInt:revision], @"revision",
+		[NSNumber numberWithBool:isDirectory], @"is_dir",
+		[NSNumber numberWithBool:!isDirectory && revision % 2], @"thumb_exists",
+		[NSNumber numberWithLongLong:isDirectory ? 0 : 2400000 + revision], @"bytes",
+		isDirectory ? @"0 bytes" : @"2.3 MB", @"size",
+		@"Sat, 21 Aug 2010 22:31:20 +0000", @"modified",
+		isDirectory ? @"folder" : @"page_white_picture", @"icon",
+		@"dropbox", @"root",
+		nil];
+	if (isDirectory) [dict setObject:[NSString stringWithFormat:@"%08x1ba1849d4b0fb0b28caf7ef3", revision] forKey:@"hash"];
+	else [dict setObject:@"image/jpeg" forKey:@"mime_type"];
+	return dict;
+}
+
+static void DBTestStoredFields(void) {
+	NSString *directory = DBTestStoreDirectory();
+	DBDeltaStore *store = [[DBDeltaStore alloc] initWithDirectory:directory error:NULL];
+	DBTestCheck(store && store.count == 0 && !store.cursor, "a new store has %lu entries", (unsigned long)store.count);
+
+	[store setMetadataDictionary:DBTestEntry(@"/Photos", 1, YES) forLowercasePath:@"/photos"];
+	[store setMetadataDictionary:DBTestEntry(@"/Photos/IMG_1.jpg", 3, NO) forLowercasePath:@"/photos/img_1.jpg"];
+	[store setMetadataDictionary:DBTestEntry(@"/Photos/Trip", 4, YES) forLowercasePath:@"/photos/trip"];
+	[store setMetadataDictionary:DBTestEntry(@"/Photos/Trip/IMG_2.jpg", 5, NO) forLowercasePath:@"/photos/trip/img_2.jpg"];
+	// Before its folder, which a page may do
+	[store setMetadataDictionary:DBTestEntry(@"/Docs/Notes.txt", 6, NO) forLowercasePath:@"/docs/notes.txt"];
+	DBTestCheck(store.count == 5, "5 entries stored as %lu", (unsigned long)store.count);
+
+	DBMetadata *file = [store metadataForPath:@"/photos/img_1.jpg"];
+	DBTestCheck([file.path isEqual:@"/Photos/IMG_1.jpg"] && [file.rev isEqual:@"30ba6f3e4"] && file.totalBytes == 2400003 &&
+		!file.isDirectory && file.thumbnailExists, "the file came back as %s", [[[file dictionary] description] UTF8String]);
+	DBTestCheck([file.lastModifiedDate isEqual:[DBMetadata dateFromString:@"Sat, 21 Aug 2010 22:31:20 +0000"]],
+		"the modification date came back as %s", [[file.lastModifiedDate description] UTF8String]);
+	DBMetadata *folder = [store metadataForPath:@"/photos/trip"];
+	DBTestCheck(folder.isDirectory && [folder.hash isEqual:@"000000041ba1849d4b0fb0b28caf7ef3"], "the folder came back as %s",
+		[[[folder dictionary] description] UTF8String]);
+
+	[store setMetadataDictionary:DBTestEntry(@"/Photos/img_1.JPG", 8, NO) forLowercasePath:@"/photos/img_1.jpg"];
+	DBTestCheck(store.count == 5 && [[store revForPath:@"/photos/img_1.jpg"] isEqual:@"80ba6f3e4"] &&
+		[[store metadataForPath:@"/photos/img_1.jpg"].path isEqual:@"/Photos/img_1.JPG"], "the update left rev %s",
+		[[store revForPath:@"/photos/img_1.jpg"] UTF8String]);
+
+	// Kept across opening the store again
+	store.cursor = @"AAHmZKkIs6ZfQ6W8K0cWk0tMYJYUOC4";
+	store = nil;
+	store = [[DBDeltaStore alloc] initWithDirectory:directory error:NULL];
+	DBTestCheck(store.count == 5 && [store.cursor isEqual:@"AAHmZKkIs6ZfQ6W8K0cWk0tMYJYUOC4"] &&
+		[store containsPath:@"/photos/trip/img_2.jpg"], "opened again: %lu entries, cursor %s", (unsigned long)store.count,
+		[store.cursor UTF8String]);
+
+	// A removed folder takes its contents, and so does an unknown one with children
+	[store setMetadataDictionary:nil forLowercasePath:@"/photos/trip"];
+	DBTestCheck(store.count == 3 && ![store containsPath:@"/photos/trip/img_2.jpg"], "removing the folder left %lu entries",
+		(unsigned long)store.count);
+	[store removeEntriesWithPrefix:@"/docs"];
+	DBTestCheck(store.count == 2 && ![store containsPath:@"/docs/notes.txt"], "removing the unknown folder left %lu entries",
+		(unsigned long)store.count);
+
+	// A file in place of a folder
+	[store setMetadataDictionary:DBTestEntry(@"/Photos", 9, NO) forLowercasePath:@"/photos"];
+	DBTestCheck(store.count == 1 && ![[store metadataForPath:@"/photos"] isDirectory] && ![store containsPath:@"/photos/img_1.jpg"],
+		"a file replacing the folder left %lu entries", (unsigned long)store.count);
+
+	[store reset];
+	DBTestCheck(store.count == 0 && !store.cursor && ![store containsPath:@"/photos"], "reset left %lu entries and cursor %s",
+		(unsigned long)store.count, [store.cursor UTF8String]);
+
+	store = nil;
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+/* A path a few levels down a small tree, so entries land on each other, their folders and their
+   children */
+static NSString *DBTestRandomPath(void) {
+	NSMutableString *path = [NSMutableString string];
+	int depth = 1 + (int)(random() % 3);
+	for (int level = 0; level < depth; level++) [path appendFormat:@"/%c", 'a' + (int)(random() % 4)];
+	return path;
+}
+
+static void DBTestMatchesModel(void) {
+	NSString *directory = DBTestStoreDirectory();
+	DBDeltaStore *store = [[DBDeltaStore alloc] initWithDirectory:directory error:NULL];
+	NSMutableDictionary *model = [NSMutableDictionary dictionary]; // Path to its entry
+	srandom(1);
+
+	for (int i = 1; i <= 20000; i++) {
+		NSString *path = DBTestRandomPath();
+		NSString *childPrefix = [path stringByAppendingString:@"/"];
+		int operation = (int)(random() % 8);
+		BOOL removesChildren = NO;
+
+		if (operation == 0) {
+			[store setMetadataDictionary:nil forLowercasePath:path];
+			[model removeObjectForKey:path];
+			removesChildren = YES;
+		}
+		else if (operation == 1 && random() % 16 == 0) {
+			[store removeEntriesWithPrefix:path];
+			[model removeObjectForKey:path];
+			removesChildren = YES;
+		}
+		else {
+			BOOL isDirectory = operation >= 4;
+			NSDictionary *entry = DBTestEntry([path uppercaseString], i, isDirectory);
+			removesChildren = !isDirectory && [[[model objectForKey:path] objectForKey:@"is_dir"] boolValue];
+			[store setMetadataDictionary:entry forLowercasePath:path];
+			[model setObject:entry forKey:path];
+		}
+		if (removesChildren) {
+			for (NSString *key in [model allKeys]) {
+				if ([key hasPrefix:childPrefix]) [model removeObjectForKey:key];
+			}
+		}
+
+		if (i % 1000 == 0) {
+			NSMutableDictionary *stored = [NSMutableDictionary dictionary];
+			[store enumerateEntriesUsingBlock:^(NSString *lowercasePath, DBMetadata *metadata, BOOL *stop) {
+				[stored setObject:metadata forKey:lowercasePath];
+			}];
+			BOOL matches = [stored count] == [model count] && store.count == [model count];
+			for (NSString *key in model) {
+				DBMetadata *metadata = [stored objectForKey:key];
+				NSDictionary *entry = [model objectForKey:key];
+				matches = matches && [metadata.rev isEqual:[entry objectForKey:@"rev"]] && [metadata.path isEqual:[entry objectForKey:@"path"]];
+			}
+			DBTestCheck(matches, "after %d entries the store has %lu paths, the model %lu", i, (unsigned long)[stored count],
+				(unsigned long)[model count]);
+			if (!matches) break;
+		}
+	}
+
+	store = nil;
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+typedef struct {
+	double seconds;
+	size_t peakResidentGrowth;
+} DBBenchmarkResult;
+
+/* 1000 folders of 1000 files each, handed to apply in pages of 2000 entries */
+static DBBenchmarkResult DBBenchmarkApply(void (^apply)(NSString *lowercasePath, NSDictionary *entry)) {
+	DBBenchmarkResult result = { 0, 0 };
+	size_t residentBefore = DBTestResidentSize();
+	double start = DBTestNow();
+	for (int page = 0; page < 500; page++) {
+		@autoreleasepool {
+			for (int i = page * 2000; i < (page + 1) * 2000; i++) {
+				int folder = i / 1000, file = i % 1000;
+				NSString *path = [NSString stringWithFormat:@"/Photos/Album %04d/IMG_%07d.jpg", folder, i];
+				apply([path lowercaseString], DBTestEntry(path, file, NO));
+			}
+		}
+		size_t resident = DBTestResidentSize();
+		if (resident > residentBefore && resident - residentBefore > result.peakResidentGrowth) {
+			result.peakResidentGrowth = resident - residentBefore;
+		}
+	}
+	result.seconds = DBTestNow() - start;
+	return result;
+}
+
+static void DBBenchmarkMillionEntries(void) {
+	const int count = 1000000;
+	NSString *directory = DBTestStoreDirectory();
+
+	__block DBBenchmarkResult stored;
+	@autoreleasepool {
+		DBDeltaStore *store = [[DBDeltaStore alloc] initWithDirectory:directory error:NULL];
+		stored = DBBenchmarkApply(^(NSString *lowercasePath, NSDictionary *entry) {
+			[store setMetadataDictionary:entry forLowercasePath:lowercasePath];
+		});
+		DBTestCheck(store.count == (NSUInteger)count, "%lu of %d entries stored", (unsigned long)store.count, count);
+
+		double start = DBTestNow();
+		store.cursor = @"AAHmZKkIs6ZfQ6W8K0cWk0tMYJYUOC4";
+		double cursorTime = DBTestNow() - start;
+
+		start = DBTestNow();
+		for (int folder = 0; folder < 100; folder++) {
+			[store removeEntriesWithPrefix:[NSString stringWithFormat:@"/photos/album %04d", folder]];
+		}
+		double removeTime = DBTestNow() - start;
+		DBTestCheck(store.count == (NSUInteger)count - 100000, "%lu entries left after removing 100 folders",
+			(unsigned long)store.count);
+
+		unsigned long long diskSize = 0;
+		for (NSString *name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:NULL]) {
+			NSString *path = [directory stringByAppendingPathComponent:name];
+			diskSize += [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+		}
+
+		printf("DBDeltaStore, %d entries: %.0f entries/s, %.1f MB more resident at most, %.1f MB on disk, "
+			"cursor saved in %.2f s, 100 folders of 1000 removed in %.3f s\n", count, count / stored.seconds,
+			stored.peakResidentGrowth / 1e6, diskSize / 1e6, cursorTime, removeTime);
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+
+	@autoreleasepool {
+		NSMutableDictionary *entries = [NSMutableDictionary dictionary];
+		DBBenchmarkResult kept = DBBenchmarkApply(^(NSString *lowercasePath, NSDictionary *entry) {
+			[entries setObject:[[DBMetadata alloc] initWithDictionary:[entry mutableCopy]] forKey:lowercasePath];
+		});
+		DBTestCheck([entries count] == (NSUInteger)count, "%lu of %d entries kept", (unsigned long)[entries count], count);
+		printf("A DBMetadata per path, %d entries: %.0f entries/s, %.1f MB more resident at most\n", count,
+			count / kept.seconds, kept.peakResidentGrowth / 1e6);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBLogSetLevel(DBLogLevelError);
+
+		DBTestStoredFields();
+		DBTestMatchesModel();
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkMillionEntries();
+		}
+	}
+	return DBTestExitStatus("DBDeltaStoreTests");
+}
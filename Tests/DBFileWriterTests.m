@@ -0,0 +1,319 @@
+//
+//  DBFileWriterTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Checks DBFileWriter on its own: writes of every size from one byte up, seeks, truncation and
+   moveToPath: over an existing file. Then downloads from DBTestServer into resultFilename and into
+   a DBFileSink, which must leave the file and nothing else in its directory, and a download cut
+   off part way, which must leave the file that was there untouched. With --bench, a 2 GB download
+   through each, and through an NSFileHandle writing to a file in NSTemporaryDirectory() that is
+   moved into place at the end, as DBRequest did before DBFileWriter: the time, the CPU time of the
+   process and the bytes it had written to disk. The downloads go to DBTEST_DOWNLOAD_DIR if it is
+   set, so the destination can be put on another volume than the temporary directory. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBDownloadSink.h"
+#import "DBFileWriter.h"
+#import "DBHostConcurrencyGate.h"
+#import "DBLog.h"
+#import "DBRequest.h"
+#include "DBTest.h"
+#include "DBTestServer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+static uint8_t DBTestByte(long long offset) {
+	return (uint8_t)(offset * 7 + offset / 4096);
+}
+
+static size_t DBTestPattern(void *context, long long offset, uint8_t *buffer, size_t length) {
+	(void)context;
+	for (size_t i = 0; i < length; i++) buffer[i] = DBTestByte(offset + (long long)i);
+	return length;
+}
+
+// Cheap to make, so the server's share of the CPU time stays small
+static size_t DBTestZeros(void *context, long long offset, uint8_t *buffer, size_t length) {
+	(void)context;
+	(void)offset;
+	memset(buffer, 0, length);
+	return length;
+}
+
+/* /pattern?length=N[&drop=M] and /zeros?length=N */
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	(void)context;
+	const char *length = strstr(request->query, "length=");
+	const char *drop = strstr(request->query, "drop=");
+	if (strcmp(request->path, "/pattern") == 0) response->generator = DBTestPattern;
+	else if (strcmp(request->path, "/zeros") == 0) response->generator = DBTestZeros;
+	else {
+		response->status = 404;
+		return;
+	}
+	response->generatedLength = length ? atoll(length + 7) : 0;
+	if (drop) response->dropAfter = atoll(drop + 5);
+	DBTestServerAddHeader(response, "Content-Type: application/octet-stream");
+}
+
+static BOOL DBTestFileMatches(NSString *path, long long length) {
+	NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+	if (!data || (long long)[data length] != length) return NO;
+	const uint8_t *bytes = [data bytes];
+	for (long long i = 0; i < length; i++) {
+		if (bytes[i] != DBTestByte(i)) return NO;
+	}
+	return YES;
+}
+
+static NSString *DBTestDirectory(NSString *parent, NSString *name) {
+	NSString *directory = [parent stringByAppendingPathComponent:[NSString stringWithFormat:@"%@-%d", name, getpid()]];
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+	return directory;
+}
+
+static void DBTestWriter(void) {
+	NSString *directory = DBTestDirectory(NSTemporaryDirectory(), @"DBFileWriterTests");
+	NSString *path = [directory stringByAppendingPathComponent:@"file"];
+	[@"old" writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+
+	// Pieces of every size up to a few times the buffer, so they straddle its edges
+	NSMutableData *expected = [NSMutableData data];
+	DBFileWriter *writer = [[DBFileWriter alloc] initTemporaryFileForPath:path];
+	DBTestCheck(writer && writer.fileDescriptor >= 0, "no temporary file for %s", [path UTF8String]);
+	[writer preallocateLength:6 * 1000 * 1000];
+	srandom(1);
+	BOOL written = YES;
+	for (int i = 0; [expected length] < 5 * 1000 * 1000; i++) {
+		NSUInteger length = i < 2048 ? (NSUInteger)i + 1 : 1 + (NSUInteger)random() % (3 * 1024 * 1024);
+		uint8_t *bytes = malloc(length);
+		for (NSUInteger j = 0; j < length; j++) bytes[j] = DBTestByte((long long)[expected length] + (long long)j);
+		written = written && [writer writeBytes:bytes length:length];
+		[expected appendBytes:bytes length:length];
+		free(bytes);
+	}
+	DBTestCheck(written && writer.offset == (long long)[expected length], "wrote %lld of %lu bytes", writer.offset,
+		(unsigned long)[expected length]);
+	DBTestCheck([writer moveToPath:path], "moveToPath: failed with errno %d", writer.lastError);
+	DBTestCheck([[NSData dataWithContentsOfFile:path] isEqualToData:expected], "the moved file doesn't have what was written");
+	NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:NULL];
+	DBTestCheck([files isEqualToArray:[NSArray arrayWithObject:@"file"]], "the directory has %s",
+		[[files description] UTF8String]);
+
+	// Overwriting in place, then cutting the file short
+	writer = [[DBFileWriter alloc] initWithPath:path truncate:NO];
+	DBTestCheck([writer seekToOffset:100] && [writer writeBytes:"xyz" length:3] && [writer truncateAtOffset:1000] && [writer close],
+		"rewriting failed with errno %d", writer.lastError);
+	NSData *data = [NSData dataWithContentsOfFile:path];
+	NSMutableData *rewritten = [[expected subdataWithRange:NSMakeRange(0, 1000)] mutableCopy];
+	[rewritten replaceBytesInRange:NSMakeRange(100, 3) withBytes:"xyz"];
+	DBTestCheck([data isEqualToData:rewritten], "after rewriting the file has %lu bytes", (unsigned long)[data length]);
+
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+
+static NSOperationQueue *DBTestQueue = nil;
+static DBHostConcurrencyGate *DBTestGate = nil;
+
+/* Downloads path into resultFilename or, if sink is set, into it; returns the error if any */
+static NSError *DBTestDownload(int port, NSString *path, NSString *resultFilename, id<DBDownloadSink> sink) {
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d%@", port, path]];
+	__block NSError *error = nil;
+	dispatch_semaphore_t done = dispatch_semaphore_create(0);
+	DBRequest *request = [[DBRequest alloc] initWithURLRequest:[NSURLRequest requestWithURL:url] completionBlock:^(DBRequest *finished) {
+		error = finished.error;
+		dispatch_semaphore_signal(done);
+	}];
+	request.hostGate = DBTestGate;
+	if (sink) request.downloadSink = sink;
+	else request.resultFilename = resultFilename;
+	[DBTestQueue addOperation:request];
+	dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+	return error;
+}
+
+static void DBTestDownloads(int port) {
+	const long long length = 20 * 1000 * 1000 + 17;
+	NSString *directory = DBTestDirectory(NSTemporaryDirectory(), @"DBFileWriterTests");
+	NSString *path = [directory stringByAppendingPathComponent:@"file"];
+	NSString *pattern = [NSString stringWithFormat:@"/pattern?length=%lld", length];
+
+	for (int useSink = 0; useSink <= 1; useSink++) {
+		const char *name = useSink ? "DBFileSink" : "resultFilename";
+		NSError *error = DBTestDownload(port, pattern, path, useSink ? [[DBFileSink alloc] initWithPath:path] : nil);
+		DBTestCheck(!error && DBTestFileMatches(path, length), "%s: the download failed or doesn't match: %s", name,
+			[[error description] UTF8String]);
+		NSArray *files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:NULL];
+		DBTestCheck([files isEqualToArray:[NSArray arrayWithObject:@"file"]], "%s: the directory has %s", name,
+			[[files description] UTF8String]);
+
+		// Cut off: the earlier download stays as it was and no temporary file is left
+		NSString *cut = [NSString stringWithFormat:@"/pattern?length=%lld&drop=%d", length, 5 * 1000 * 1000];
+		error = DBTestDownload(port, cut, path, useSink ? [[DBFileSink alloc] initWithPath:path] : nil);
+		files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:NULL];
+		DBTestCheck(error && DBTestFileMatches(path, length) && [files count] == 1, "%s: a cut off download left %s", name,
+			[[files description] UTF8String]);
+		[[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+
+/* Downloads into an NSFileHandle on a file in NSTemporaryDirectory(), on a thread of its own, and
+   moves the file into place at the end, the way DBRequest used to */
+@interface DBFileHandleDownload : NSOperation
+
+- (id)initWithURL:(NSURL *)url destination:(NSString *)destination;
+
+@property (nonatomic, readonly) BOOL succeeded;
+
+@end
+
+@implementation DBFileHandleDownload {
+	NSURL *_url;
+	NSString *_destination;
+	NSString *_tempFilename;
+	NSFileHandle *_fileHandle;
+	BOOL _failed;
+}
+
+- (id)initWithURL:(NSURL *)url destination:(NSString *)destination {
+	if ((self = [super init])) {
+		_url = url;
+		_destination = destination;
+	}
+	return self;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+- (void)main {
+	_tempFilename = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	[[NSFileManager defaultManager] createFileAtPath:_tempFilename contents:nil attributes:nil];
+	_fileHandle = [NSFileHandle fileHandleForWritingAtPath:_tempFilename];
+
+	NSURLConnection *connection = [[NSURLConnection alloc] initWithRequest:[NSURLRequest requestWithURL:_url] delegate:self
+		startImmediately:YES];
+	CFRunLoopRun();
+	[connection cancel];
+
+	[_fileHandle closeFile];
+	if (!_failed) {
+		[[NSFileManager defaultManager] removeItemAtPath:_destination error:NULL];
+		_succeeded = [[NSFileManager defaultManager] moveItemAtPath:_tempFilename toPath:_destination error:NULL];
+	}
+	if (!_succeeded) [[NSFileManager defaultManager] removeItemAtPath:_tempFilename error:NULL];
+}
+#pragma clang diagnostic pop
+
+- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+	@try {
+		[_fileHandle writeData:data];
+	}
+	@catch (NSException *e) {
+		_failed = YES;
+		[connection cancel];
+		CFRunLoopStop(CFRunLoopGetCurrent());
+	}
+}
+
+- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
+	CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+	_failed = YES;
+	CFRunLoopStop(CFRunLoopGetCurrent());
+}
+
+@end
+
+
+static dev_t DBTestDevice(NSString *path) {
+	struct stat info;
+	return stat([path fileSystemRepresentation], &info) == 0 ? info.st_dev : 0;
+}
+
+static void DBBenchmarkDownloads(int port) {
+	const long long length = 2LL * 1000 * 1000 * 1000;
+	NSString *parent = [[[NSProcessInfo processInfo] environment] objectForKey:@"DBTEST_DOWNLOAD_DIR"];
+	NSString *directory = DBTestDirectory(parent ? parent : NSTemporaryDirectory(), @"DBFileWriterBenchmark");
+	NSString *path = [directory stringByAppendingPathComponent:@"file"];
+	NSString *zeros = [NSString stringWithFormat:@"/zeros?length=%lld", length];
+	BOOL sameVolume = DBTestDevice(directory) == DBTestDevice(NSTemporaryDirectory());
+
+	printf("2 GB downloads into %s, %s the temporary directory:\n", [directory UTF8String],
+		sameVolume ? "on the volume of" : "on another volume than");
+	const char *names[] = { "DBRequest resultFilename", "DBFileSink", "NSFileHandle in NSTemporaryDirectory(), then moved" };
+	for (int variant = 0; variant < 3; variant++) {
+		long long writtenBefore = DBTestBytesWrittenToDisk();
+		double cpuBefore = DBTestCPUTime();
+		double start = DBTestNow();
+
+		BOOL succeeded = NO;
+		if (variant < 2) {
+			succeeded = !DBTestDownload(port, zeros, path, variant == 1 ? [[DBFileSink alloc] initWithPath:path] : nil);
+		}
+		else {
+			NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d%@", port, zeros]];
+			DBFileHandleDownload *download = [[DBFileHandleDownload alloc] initWithURL:url destination:path];
+			[DBTestQueue addOperation:download];
+			[download waitUntilFinished];
+			succeeded = download.succeeded;
+		}
+
+		// Counted once it is on disk, not when it reached the page cache
+		int fd = open([path fileSystemRepresentation], O_RDONLY);
+		if (fd >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+		double elapsed = DBTestNow() - start;
+		double cpu = DBTestCPUTime() - cpuBefore;
+		long long written = DBTestBytesWrittenToDisk() - writtenBefore;
+
+		NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+		DBTestCheck(succeeded && (long long)[attributes fileSize] == length, "%s: the download failed, %llu bytes arrived",
+			names[variant], [attributes fileSize]);
+		printf("  %s: %.2f s, %.0f MB/s, %.2f s CPU, %.0f MB written to disk\n", names[variant], elapsed, length / elapsed / 1e6,
+			cpu, written / 1e6);
+		[[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBLogSetLevel(DBLogLevelError); // The cut off download is an error
+
+		DBTestQueue = [NSOperationQueue new];
+		DBTestGate = [DBHostConcurrencyGate new];
+
+		DBTestWriter();
+
+		DBTestServer *server = DBTestServerStart(DBTestHandler, NULL);
+		DBTestCheck(server != NULL, "the server didn't start");
+		if (!server) return DBTestExitStatus("DBFileWriterTests");
+		int port = DBTestServerPort(server);
+
+		DBTestDownloads(port);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkDownloads(port);
+		}
+
+		DBTestServerStop(server);
+	}
+	return DBTestExitStatus("DBFileWriterTests");
+}
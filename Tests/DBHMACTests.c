@@ -0,0 +1,197 @@
+//
+//  DBHMACTests.c
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Known answers for DBHMAC.c: the FIPS 180 examples for SHA-1 and SHA-256, and the RFC 2202
+   (HMAC-SHA1) and RFC 4231 (HMAC-SHA256) test cases. With --bench, signatures per second for an
+   OAuth base string of the usual size. */
+
+#include "DBHMAC.h"
+#include "DBTest.h"
+
+#include <stdlib.h>
+
+
+typedef struct {
+	const char *message; // NULL for a million 'a's
+	const char *sha1;
+	const char *sha256;
+} DBHashVector;
+
+static const DBHashVector kDBHashVectors[] = {
+	{ "", "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+		"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ "abc", "a9993e364706816aba3e25717850c26c9cd0d89d",
+		"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	{ NULL, "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+		"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+typedef struct {
+	uint8_t keyByte; // Repeated keyLength times, unless key is set
+	size_t keyLength;
+	const char *key;
+	uint8_t dataByte; // Repeated dataLength times, unless data is set
+	size_t dataLength;
+	const char *data;
+	const char *expected; // Shorter than the digest for the truncation cases
+} DBHMACVector;
+
+static const DBHMACVector kDBHMACSHA1Vectors[] = {
+	{ 0x0b, 20, NULL, 0, 0, "Hi There", "b617318655057264e28bc0b6fb378c8ef146be00" },
+	{ 0, 0, "Jefe", 0, 0, "what do ya want for nothing?", "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+	{ 0xaa, 20, NULL, 0xdd, 50, NULL, "125d7342b9ac11cd91a39af48aa17b4f63f175d3" },
+	{ 0, 25, "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19",
+		0xcd, 50, NULL, "4c9007f4026250c6bc8414f9bf50c86c2d7235da" },
+	{ 0x0c, 20, NULL, 0, 0, "Test With Truncation", "4c1a03424b55e07fe7f27be1d58bb9324a9a5a04" },
+	{ 0xaa, 80, NULL, 0, 0, "Test Using Larger Than Block-Size Key - Hash Key First",
+		"aa4ae5e15272d00e95705637ce8a3b55ed402112" },
+	{ 0xaa, 80, NULL, 0, 0, "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data",
+		"e8e99d0f45237d786d6bbaa7965c7808bbff1a91" },
+};
+
+static const DBHMACVector kDBHMACSHA256Vectors[] = {
+	{ 0x0b, 20, NULL, 0, 0, "Hi There", "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" },
+	{ 0, 0, "Jefe", 0, 0, "what do ya want for nothing?",
+		"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+	{ 0xaa, 20, NULL, 0xdd, 50, NULL, "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe" },
+	{ 0, 25, "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19",
+		0xcd, 50, NULL, "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b" },
+	{ 0x0c, 20, NULL, 0, 0, "Test With Truncation", "a3b6167473100ee06e0c796c2955552b" },
+	{ 0xaa, 131, NULL, 0, 0, "Test Using Larger Than Block-Size Key - Hash Key First",
+		"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" },
+	{ 0xaa, 131, NULL, 0, 0, "This is a test using a larger than block-size key and a larger than block-size data. "
+		"The key needs to be hashed before being used by the HMAC algorithm.",
+		"9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2" },
+};
+
+// An OAuth 1.0 signature base string of the size DBRequestSigner signs for a typical call
+static const char kDBBenchmarkBaseString[] =
+	"GET&https%3A%2F%2Fapi.dropbox.com%2F1%2Fmetadata%2Fdropbox%2FPhotos%2FSample%2520Album&list%3Dtrue"
+	"%26oauth_consumer_key%3Dabcdefghijklmno%26oauth_nonce%3D6A1F2B3C-4D5E-6F70-8192-A3B4C5D6E7F8"
+	"%26oauth_signature_method%3DHMAC-SHA1%26oauth_timestamp%3D1349382000%26oauth_token%3Dpqrstuvwxyz0123"
+	"%26oauth_version%3D1.0";
+
+
+static void DBTestHash(DBHashAlgorithm algorithm, const DBHashVector *vector, size_t chunkLength, const char *expected) {
+	DBHashContext context;
+	DBHashInit(&context, algorithm);
+	if (vector->message) {
+		const char *message = vector->message;
+		size_t remaining = strlen(message);
+		while (remaining > 0) {
+			size_t length = remaining < chunkLength ? remaining : chunkLength;
+			DBHashUpdate(&context, message, length);
+			message += length;
+			remaining -= length;
+		}
+	}
+	else {
+		uint8_t as[1000];
+		memset(as, 'a', sizeof(as));
+		for (int i = 0; i < 1000; i++) {
+			for (size_t offset = 0; offset < sizeof(as); offset += chunkLength) {
+				size_t length = sizeof(as) - offset < chunkLength ? sizeof(as) - offset : chunkLength;
+				DBHashUpdate(&context, as + offset, length);
+			}
+		}
+	}
+
+	uint8_t digest[kDBHMACMaxDigestLength];
+	DBHashFinal(&context, digest);
+
+	char hex[2 * kDBHMACMaxDigestLength + 1];
+	DBTestHex(digest, DBHashDigestLength(algorithm), hex);
+	DBTestCheck(strcmp(hex, expected) == 0, "%s of \"%.20s\" in %zu-byte updates is %s, expected %s",
+		algorithm == DBHashAlgorithmSHA1 ? "SHA-1" : "SHA-256",
+		vector->message ? vector->message : "a x 1000000", chunkLength, hex, expected);
+}
+
+static void DBTestHMAC(DBHashAlgorithm algorithm, const DBHMACVector *vector, int index) {
+	uint8_t keyBytes[200], dataBytes[200];
+	const void *key = vector->key;
+	size_t keyLength = vector->key ? (vector->keyLength ? vector->keyLength : strlen(vector->key)) : vector->keyLength;
+	if (!key) {
+		memset(keyBytes, vector->keyByte, keyLength);
+		key = keyBytes;
+	}
+	const void *data = vector->data;
+	size_t dataLength = vector->data ? strlen(vector->data) : vector->dataLength;
+	if (!data) {
+		memset(dataBytes, vector->dataByte, dataLength);
+		data = dataBytes;
+	}
+
+	DBHMACKey hmacKey;
+	DBHMACKeyInit(&hmacKey, algorithm, key, keyLength);
+
+	// Twice with the same key, which DBHMACSign must leave as it found it
+	for (int round = 0; round < 2; round++) {
+		uint8_t digest[kDBHMACMaxDigestLength];
+		DBHMACSign(&hmacKey, data, dataLength, digest);
+
+		char hex[2 * kDBHMACMaxDigestLength + 1];
+		DBTestHex(digest, DBHashDigestLength(algorithm), hex);
+		size_t expectedLength = strlen(vector->expected);
+		DBTestCheck(strncmp(hex, vector->expected, expectedLength) == 0, "%s test case %d, round %d, is %s, expected %s",
+			algorithm == DBHashAlgorithmSHA1 ? "RFC 2202" : "RFC 4231", index + 1, round + 1, hex, vector->expected);
+	}
+}
+
+static void DBBenchmarkSigning(DBHashAlgorithm algorithm, const char *name) {
+	const char *secret = "0123456789abcde&fghijklmnopqrst";
+	size_t length = strlen(kDBBenchmarkBaseString);
+	uint8_t digest[kDBHMACMaxDigestLength];
+	volatile uint8_t sink = 0; // Keeps the loops from being optimized away
+	const int count = 500000;
+
+	DBHMACKey key;
+	DBHMACKeyInit(&key, algorithm, secret, strlen(secret));
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		DBHMACSign(&key, kDBBenchmarkBaseString, length, digest);
+		sink ^= digest[0];
+	}
+	double reused = DBTestNow() - start;
+
+	start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		DBHMACKeyInit(&key, algorithm, secret, strlen(secret));
+		DBHMACSign(&key, kDBBenchmarkBaseString, length, digest);
+		sink ^= digest[0];
+	}
+	double fresh = DBTestNow() - start;
+
+	printf("%s, %zu-byte base string: %.0f signatures/s with the key reused, %.0f/s with a new key each time\n",
+		name, length, count / reused, count / fresh);
+}
+
+
+int main(int argc, char **argv) {
+	size_t chunkLengths[] = { 1, 3, 63, 64, 65, 1000 };
+	for (size_t i = 0; i < sizeof(kDBHashVectors) / sizeof(kDBHashVectors[0]); i++) {
+		for (size_t j = 0; j < sizeof(chunkLengths) / sizeof(chunkLengths[0]); j++) {
+			DBTestHash(DBHashAlgorithmSHA1, &kDBHashVectors[i], chunkLengths[j], kDBHashVectors[i].sha1);
+			DBTestHash(DBHashAlgorithmSHA256, &kDBHashVectors[i], chunkLengths[j], kDBHashVectors[i].sha256);
+		}
+	}
+
+	for (int i = 0; i < (int)(sizeof(kDBHMACSHA1Vectors) / sizeof(kDBHMACSHA1Vectors[0])); i++) {
+		DBTestHMAC(DBHashAlgorithmSHA1, &kDBHMACSHA1Vectors[i], i);
+	}
+	for (int i = 0; i < (int)(sizeof(kDBHMACSHA256Vectors) / sizeof(kDBHMACSHA256Vectors[0])); i++) {
+		DBTestHMAC(DBHashAlgorithmSHA256, &kDBHMACSHA256Vectors[i], i);
+	}
+
+	if (DBTestWantsBenchmarks(argc, argv)) {
+		DBBenchmarkSigning(DBHashAlgorithmSHA1, "HMAC-SHA1");
+		DBBenchmarkSigning(DBHashAlgorithmSHA256, "HMAC-SHA256");
+	}
+
+	return DBTestExitStatus("DBHMACTests");
+}
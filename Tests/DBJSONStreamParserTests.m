@@ -0,0 +1,184 @@
+//
+//  DBJSONStreamParserTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Feeds DBJSONStreamParser a synthetic /delta page cut into pieces of random size, from single
+   bytes up, and holds the streamed entries and the rest of the page to what NSJSONSerialization
+   makes of it. With --bench, a 100 MB page arriving in 64 kB pieces: the time to the first entry,
+   the total time and the most resident memory added, against collecting the body and handing it to
+   NSJSONSerialization, which is what DBRequest did before. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBJSONStreamParser.h"
+#include "DBTest.h"
+
+#include <stdlib.h>
+
+
+static const char kDBTestPageHead[] = "{\"reset\": false, \"entries\": [";
+static const char kDBTestPageTail[] = "], \"cursor\": \"AAHmZKkIs6ZfQ6W8K0cWk0tMYJYUOC4\", \"has_more\": true}";
+
+static void DBTestAppendEntry(NSMutableData *data, int index) {
+	char entry[768];
+	// Every seventh name has escapes in it, which the parser has to undo
+	const char *name = index % 7 ? "IMG" : "Caf\\u00e9 \\\"Menu\\\" \\/ \\ud83d\\ude00";
+	int length = snprintf(entry, sizeof(entry), "%s[\"/photos/%s_%08d.jpg\", {\"size\": \"2.3 MB\", \"rev\": \"%x0ba6f3e4\", "
+		"\"thumb_exists\": %s, \"bytes\": %d, \"modified\": \"Sat, 21 Aug 2010 22:31:20 +0000\", "
+		"\"client_mtime\": \"Sat, 21 Aug 2010 22:31:20 +0000\", \"path\": \"/Photos/%s_%08d.jpg\", \"is_dir\": false, "
+		"\"icon\": \"page_white_picture\", \"root\": \"dropbox\", \"mime_type\": \"image/jpeg\", \"revision\": %d}]",
+		index ? ", " : "", name, index, index, index % 2 ? "true" : "false", 2400000 + index, name, index, index);
+	[data appendBytes:entry length:length];
+	if (index % 1000 == 999) {
+		const char *removal = ", [\"/photos/removed\", null]";
+		[data appendBytes:removal length:strlen(removal)];
+	}
+}
+
+/* Makes a /delta page of about pageLength bytes and hands it to block in pieces of chunkLength,
+   as they would come off the network. The piece is only valid during the call. */
+static void DBTestEnumeratePage(size_t pageLength, size_t chunkLength, void (^block)(NSData *chunk)) {
+	NSMutableData *pending = [NSMutableData dataWithCapacity:2 * chunkLength];
+	[pending appendBytes:kDBTestPageHead length:strlen(kDBTestPageHead)];
+
+	size_t sent = 0;
+	for (int i = 0; sent + [pending length] < pageLength; i++) {
+		DBTestAppendEntry(pending, i);
+		while ([pending length] >= chunkLength) {
+			@autoreleasepool {
+				block([NSData dataWithBytesNoCopy:[pending mutableBytes] length:chunkLength freeWhenDone:NO]);
+			}
+			[pending replaceBytesInRange:NSMakeRange(0, chunkLength) withBytes:NULL length:0];
+			sent += chunkLength;
+		}
+	}
+	[pending appendBytes:kDBTestPageTail length:strlen(kDBTestPageTail)];
+	block(pending);
+}
+
+static void DBTestMatchesNSJSONSerialization(void) {
+	NSMutableData *page = [NSMutableData data];
+	DBTestEnumeratePage(300000, 4096, ^(NSData *chunk) {
+		[page appendData:chunk];
+	});
+	NSMutableDictionary *expected = [NSJSONSerialization JSONObjectWithData:page options:NSJSONReadingMutableContainers error:NULL];
+	NSArray *expectedEntries = [expected objectForKey:@"entries"];
+	[expected setObject:[NSMutableArray array] forKey:@"entries"];
+
+	srandom(1);
+	for (int round = 0; round < 8; round++) {
+		DBJSONStreamParser *parser = [DBJSONStreamParser new];
+		NSMutableArray *entries = [NSMutableArray array];
+		[parser streamElementsOfArrayForKey:@"entries" handler:^(id value) {
+			[entries addObject:value];
+		}];
+
+		BOOL parsed = YES;
+		NSUInteger maxLength = round % 2 ? 65536 : 16;
+		for (NSUInteger offset = 0; parsed && offset < [page length]; ) {
+			NSUInteger length = MIN(1 + (NSUInteger)random() % maxLength, [page length] - offset);
+			@autoreleasepool {
+				parsed = [parser parseData:[page subdataWithRange:NSMakeRange(offset, length)]];
+			}
+			offset += length;
+		}
+		parsed = parsed && [parser finish];
+
+		DBTestCheck(parsed, "round %d: %s", round, [[parser.error description] UTF8String]);
+		DBTestCheck([entries isEqualToArray:expectedEntries], "round %d: %lu entries streamed, NSJSONSerialization has %lu",
+			round, (unsigned long)[entries count], (unsigned long)[expectedEntries count]);
+		DBTestCheck([parser.rootObject isEqual:expected], "round %d: the rest of the page is %s", round,
+			[[parser.rootObject description] UTF8String]);
+	}
+
+	// Cut short, and broken in the middle
+	DBJSONStreamParser *parser = [DBJSONStreamParser new];
+	[parser streamElementsOfArrayForKey:@"entries" handler:^(id value) {}];
+	BOOL parsed = [parser parseData:[page subdataWithRange:NSMakeRange(0, [page length] - 1)]] && [parser finish];
+	DBTestCheck(!parsed && parser.error && !parser.rootObject, "a page without its last byte parses");
+
+	parser = [DBJSONStreamParser new];
+	[parser streamElementsOfArrayForKey:@"entries" handler:^(id value) {}];
+	NSMutableData *broken = [page mutableCopy];
+	((char *)[broken mutableBytes])[strlen(kDBTestPageHead)] = '}'; // In place of the first entry's [
+	parsed = [parser parseData:broken] && [parser finish];
+	DBTestCheck(!parsed && parser.error, "a page with a stray } parses");
+}
+
+typedef struct {
+	NSUInteger entries;
+	double firstEntryTime;
+	double totalTime;
+	size_t peakResidentGrowth;
+} DBBenchmarkResult;
+
+static void DBBenchmarkSample(DBBenchmarkResult *result, size_t residentBefore) {
+	size_t resident = DBTestResidentSize();
+	if (resident > residentBefore && resident - residentBefore > result->peakResidentGrowth) {
+		result->peakResidentGrowth = resident - residentBefore;
+	}
+}
+
+static void DBBenchmarkDeltaPage(void) {
+	const size_t pageLength = 100 * 1000 * 1000;
+	const size_t chunkLength = 64 * 1024;
+
+	// Streamed first, so the other one's garbage can't make it look better
+	__block DBBenchmarkResult streamed = { 0, 0, 0, 0 };
+	@autoreleasepool {
+		size_t residentBefore = DBTestResidentSize();
+		double start = DBTestNow();
+		DBJSONStreamParser *parser = [DBJSONStreamParser new];
+		[parser streamElementsOfArrayForKey:@"entries" handler:^(id value) {
+			if (streamed.entries++ == 0) streamed.firstEntryTime = DBTestNow() - start;
+		}];
+		__block BOOL parsed = YES;
+		DBTestEnumeratePage(pageLength, chunkLength, ^(NSData *chunk) {
+			parsed = parsed && [parser parseData:chunk];
+			DBBenchmarkSample(&streamed, residentBefore);
+		});
+		parsed = parsed && [parser finish];
+		streamed.totalTime = DBTestNow() - start;
+		DBBenchmarkSample(&streamed, residentBefore);
+		DBTestCheck(parsed, "the 100 MB page didn't parse: %s", [[parser.error description] UTF8String]);
+	}
+
+	__block DBBenchmarkResult buffered = { 0, 0, 0, 0 };
+	@autoreleasepool {
+		size_t residentBefore = DBTestResidentSize();
+		double start = DBTestNow();
+		NSMutableData *body = [NSMutableData data];
+		DBTestEnumeratePage(pageLength, chunkLength, ^(NSData *chunk) {
+			[body appendData:chunk];
+			DBBenchmarkSample(&buffered, residentBefore);
+		});
+		NSDictionary *page = [NSJSONSerialization JSONObjectWithData:body options:NSJSONReadingMutableContainers error:NULL];
+		buffered.firstEntryTime = DBTestNow() - start;
+		buffered.entries = [[page objectForKey:@"entries"] count];
+		buffered.totalTime = DBTestNow() - start;
+		DBBenchmarkSample(&buffered, residentBefore);
+	}
+
+	DBTestCheck(streamed.entries == buffered.entries, "%lu entries streamed, NSJSONSerialization has %lu",
+		(unsigned long)streamed.entries, (unsigned long)buffered.entries);
+	printf("100 MB /delta page, %lu entries, in 64 kB pieces:\n", (unsigned long)streamed.entries);
+	printf("  DBJSONStreamParser: first entry after %.3f s, all after %.2f s, %.1f MB more resident at most\n",
+		streamed.firstEntryTime, streamed.totalTime, streamed.peakResidentGrowth / 1e6);
+	printf("  Whole body, then NSJSONSerialization: first entry after %.3f s, all after %.2f s, %.1f MB more resident at most\n",
+		buffered.firstEntryTime, buffered.totalTime, buffered.peakResidentGrowth / 1e6);
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBTestMatchesNSJSONSerialization();
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkDeltaPage();
+		}
+	}
+	return DBTestExitStatus("DBJSONStreamParserTests");
+}
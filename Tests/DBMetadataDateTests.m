@@ -0,0 +1,210 @@
+//
+//  DBMetadataDateTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Holds +[DBMetadata getSeconds:fromDateString:], whose fast path is DBParseRFC1123Date, to the
+   answers of +[DBMetadata dateFormatter] it used to get them from, and to timegm. Random dates
+   from 1601 to 2399 with one- and two-digit days, leap seconds and numeric zones, then the same
+   strings mutated one character at a time. With --bench, 1M timestamps through both. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBMetadata.h"
+#include "DBTest.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+
+static const char *kDBTestMonths[12] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+static const char *kDBTestDays[7] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+typedef struct {
+	char string[64];
+	BOOL valid; // Every field in range, so timegm gives the answer
+	int64_t seconds;
+} DBTestDate;
+
+static void DBTestMakeDate(DBTestDate *date) {
+	struct tm components = { 0 };
+	components.tm_year = 1601 + (int)(random() % 799) - 1900;
+	components.tm_mon = (int)(random() % 12);
+	components.tm_mday = 1 + (int)(random() % 28);
+	components.tm_hour = (int)(random() % 24);
+	components.tm_min = (int)(random() % 60);
+	components.tm_sec = (int)(random() % 60);
+
+	int kind = (int)(random() % 16);
+	if (kind == 0) {
+		components.tm_sec = 60; // A leap second, which the fast path leaves to the formatter
+	}
+	else if (kind == 1) {
+		components.tm_mday = 29 + (int)(random() % 3); // Past the end of some months
+	}
+
+	// timegm fills in the weekday, and moves a date that doesn't exist to one that does
+	struct tm normalized = components;
+	time_t utc = timegm(&normalized);
+	date->valid = normalized.tm_mday == components.tm_mday && normalized.tm_sec == components.tm_sec;
+	components.tm_wday = normalized.tm_wday;
+
+	int zone = (int)(random() % 29) - 14;
+	int zoneMinutes = random() % 4 ? 0 : (int)(random() % 4) * 15;
+	int zoneSeconds = (zone < 0 ? -1 : 1) * (abs(zone) * 3600 + zoneMinutes * 60);
+
+	BOOL hasWeekday = random() % 8 != 0;
+	BOOL oneDigitDay = components.tm_mday < 10 && random() % 2;
+	char weekday[8] = "";
+	if (hasWeekday) snprintf(weekday, sizeof(weekday), "%s, ", kDBTestDays[components.tm_wday]);
+	snprintf(date->string, sizeof(date->string), oneDigitDay ? "%s%d %s %04d %02d:%02d:%02d %c%02d%02d" : "%s%02d %s %04d %02d:%02d:%02d %c%02d%02d",
+		weekday, components.tm_mday, kDBTestMonths[components.tm_mon], components.tm_year + 1900,
+		components.tm_hour, components.tm_min, components.tm_sec, zone < 0 ? '-' : '+', abs(zone), zoneMinutes);
+	date->seconds = (int64_t)utc - zoneSeconds;
+}
+
+/* The fast path must give what the formatter gives, and may only accept more where it says so:
+   a string without the weekday */
+static void DBTestCheckString(NSString *string) {
+	BOOL hasWeekday = [string length] > 3 && [string characterAtIndex:3] == ',';
+	int64_t seconds = 0;
+	BOOL parsed = [DBMetadata getSeconds:&seconds fromDateString:string];
+	NSDate *formatted = [[DBMetadata dateFormatter] dateFromString:string];
+
+	if (formatted) {
+		int64_t expected = (int64_t)[formatted timeIntervalSince1970];
+		DBTestCheck(parsed && seconds == expected, "\"%s\" gives %lld, the formatter %lld", [string UTF8String],
+			parsed ? (long long)seconds : -1LL, (long long)expected);
+	}
+	else {
+		DBTestCheck(!parsed || !hasWeekday, "\"%s\" gives %lld, the formatter rejects it", [string UTF8String],
+			(long long)seconds);
+	}
+}
+
+static void DBTestRandomDates(void) {
+	srandom(1);
+	for (int round = 0; round < 200000; round++) {
+		@autoreleasepool {
+			DBTestDate date;
+			DBTestMakeDate(&date);
+			NSString *string = [NSString stringWithUTF8String:date.string];
+
+			if (date.valid) {
+				int64_t seconds = 0;
+				BOOL parsed = [DBMetadata getSeconds:&seconds fromDateString:string];
+				DBTestCheck(parsed && seconds == date.seconds, "\"%s\" gives %lld, timegm %lld", date.string,
+					parsed ? (long long)seconds : -1LL, (long long)date.seconds);
+			}
+			DBTestCheckString(string);
+
+			// Mutated: a character replaced, dropped or doubled
+			char mutated[66];
+			size_t length = strlen(date.string);
+			size_t position = random() % length;
+			int mutation = (int)(random() % 3);
+			if (mutation == 0) {
+				strcpy(mutated, date.string);
+				mutated[position] = " ,:+-0123456789AZaz"[random() % 19];
+			}
+			else if (mutation == 1) {
+				memcpy(mutated, date.string, position);
+				strcpy(mutated + position, date.string + position + 1);
+			}
+			else {
+				memcpy(mutated, date.string, position + 1);
+				strcpy(mutated + position + 1, date.string + position);
+			}
+			DBTestCheckString([NSString stringWithUTF8String:mutated]);
+		}
+	}
+}
+
+static void DBTestKnownDates(void) {
+	struct { const char *string; int64_t seconds; } known[] = {
+		{ "Sat, 21 Aug 2010 22:31:20 +0000", 1282429880 },
+		{ "Sat, 21 Aug 2010 22:31:20 -0700", 1282429880 + 7 * 3600 },
+		{ "Sat, 21 Aug 2010 22:31:20 +0530", 1282429880 - 5 * 3600 - 30 * 60 },
+		{ "Wed, 1 Feb 2012 00:00:00 +0000", 1328054400 },
+		{ "Wed, 01 Feb 2012 00:00:00 +0000", 1328054400 },
+		{ "Wed, 29 Feb 2012 12:00:00 +0000", 1330516800 },
+		{ "Thu, 01 Jan 1970 00:00:00 +0000", 0 },
+		{ "Wed, 31 Dec 1969 23:59:59 +0000", -1 },
+	};
+	for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+		int64_t seconds = 0;
+		BOOL parsed = [DBMetadata getSeconds:&seconds fromDateString:[NSString stringWithUTF8String:known[i].string]];
+		DBTestCheck(parsed && seconds == known[i].seconds, "\"%s\" gives %lld, expected %lld", known[i].string,
+			parsed ? (long long)seconds : -1LL, (long long)known[i].seconds);
+	}
+
+	// Handed to the formatter, which decides
+	const char *fallbacks[] = {
+		"Sat, 31 Dec 2016 23:59:60 +0000", // Leap second
+		"Sat, 21 Aug 2010 22:31:20 GMT",
+		"Sat, 21 Aug 2010 22:31:20 +0099",
+		"Sun, 29 Feb 2011 00:00:00 +0000",
+		"Sat, 21 Aug 10 22:31:20 +0000",
+		"",
+	};
+	for (size_t i = 0; i < sizeof(fallbacks) / sizeof(fallbacks[0]); i++) {
+		DBTestCheckString([NSString stringWithUTF8String:fallbacks[i]]);
+	}
+
+	// Round trip through stringFromDate:
+	srandom(2);
+	for (int i = 0; i < 10000; i++) {
+		NSDate *date = [NSDate dateWithTimeIntervalSince1970:(double)((int64_t)random() * 4 - 4000000000LL)];
+		int64_t seconds = 0;
+		NSString *string = [DBMetadata stringFromDate:date];
+		BOOL parsed = [DBMetadata getSeconds:&seconds fromDateString:string];
+		DBTestCheck(parsed && seconds == (int64_t)floor([date timeIntervalSince1970]), "\"%s\" doesn't round trip",
+			[string UTF8String]);
+	}
+}
+
+static void DBBenchmarkParsing(void) {
+	const int count = 1000000;
+	NSMutableArray *strings = [NSMutableArray arrayWithCapacity:1000];
+	srandom(3);
+	for (int i = 0; i < 1000; i++) {
+		NSDate *date = [NSDate dateWithTimeIntervalSince1970:1200000000 + random() % 400000000];
+		[strings addObject:[DBMetadata stringFromDate:date]];
+	}
+
+	volatile int64_t sum = 0; // Keeps the loops from being optimized away
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		int64_t seconds = 0;
+		[DBMetadata getSeconds:&seconds fromDateString:[strings objectAtIndex:i % 1000]];
+		sum += seconds;
+	}
+	double parserTime = DBTestNow() - start;
+
+	NSDateFormatter *formatter = [DBMetadata dateFormatter];
+	start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		@autoreleasepool {
+			sum += (int64_t)[[formatter dateFromString:[strings objectAtIndex:i % 1000]] timeIntervalSince1970];
+		}
+	}
+	double formatterTime = DBTestNow() - start;
+
+	printf("1M timestamps: getSeconds:fromDateString: %.3f s (%.0f/s), NSDateFormatter %.3f s (%.0f/s)\n",
+		parserTime, count / parserTime, formatterTime, count / formatterTime);
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBTestKnownDates();
+		DBTestRandomDates();
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkParsing();
+		}
+	}
+	return DBTestExitStatus("DBMetadataDateTests");
+}
@@ -0,0 +1,185 @@
+//
+//  DBRequestJSONTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Counts the NSJSONSerialization parses behind each completed DBRequest, with the class method
+   swapped for one that counts its calls. The requests go to DBTestServer and are read the way
+   DBRestClient reads them: parseResponseAsType:, then resultJSON again from the handler, and on an
+   error response once more from the failure block after connectionDidFinishLoading: has read it
+   for the error's userInfo. Each must cost one parse. With --bench, the parses and the time spent
+   in JSON per request for folder listings of 100 to 10000 entries, against parsing on every
+   access as resultJSON used to. */
+
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+
+#import "DBHostConcurrencyGate.h"
+#import "DBLog.h"
+#import "DBRequest.h"
+#include "DBTest.h"
+#include "DBTestServer.h"
+
+#include <libkern/OSAtomic.h>
+#include <stdlib.h>
+
+
+static volatile int32_t DBTestParseCount = 0;
+static IMP DBTestOriginalJSONObject = NULL;
+
+static id DBTestCountingJSONObject(id self, SEL _cmd, NSData *data, NSJSONReadingOptions options, NSError **error) {
+	OSAtomicIncrement32(&DBTestParseCount);
+	return ((id (*)(id, SEL, NSData *, NSJSONReadingOptions, NSError **))DBTestOriginalJSONObject)(self, _cmd, data, options, error);
+}
+
+static void DBTestCountParses(void) {
+	Method method = class_getClassMethod([NSJSONSerialization class], @selector(JSONObjectWithData:options:error:));
+	DBTestOriginalJSONObject = method_setImplementation(method, (IMP)DBTestCountingJSONObject);
+}
+
+/* /1/metadata/dropbox/listing?count=N is a folder with N files, anything else a 404 */
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	(void)context;
+	if (strcmp(request->path, "/1/metadata/dropbox/listing") != 0) {
+		const char *body = "{\"error\": \"Path not found\"}";
+		response->status = 404;
+		DBTestServerSetBody(response, body, strlen(body));
+		return;
+	}
+
+	const char *countParameter = strstr(request->query, "count=");
+	int count = countParameter ? atoi(countParameter + 6) : 0;
+	size_t capacity = 512 + (size_t)count * 512;
+	char *body = malloc(capacity);
+	size_t length = snprintf(body, capacity, "{\"hash\": \"37eb1ba1849d4b0fb0b28caf7ef3af52\", \"thumb_exists\": false, "
+		"\"bytes\": 0, \"path\": \"/Photos\", \"is_dir\": true, \"icon\": \"folder\", \"root\": \"dropbox\", \"contents\": [");
+	for (int i = 0; i < count; i++) {
+		length += snprintf(body + length, capacity - length, "%s{\"size\": \"2.3 MB\", \"rev\": \"%x0ba6f3e4\", "
+			"\"thumb_exists\": true, \"bytes\": %d, \"modified\": \"Sat, 21 Aug 2010 22:31:20 +0000\", "
+			"\"path\": \"/Photos/IMG_%06d.jpg\", \"is_dir\": false, \"icon\": \"page_white_picture\", \"root\": \"dropbox\", "
+			"\"mime_type\": \"image/jpeg\", \"revision\": %d}", i ? ", " : "", i, 2400000 + i, i, i);
+	}
+	length += snprintf(body + length, capacity - length, "], \"size\": \"0 bytes\"}");
+	DBTestServerSetBody(response, body, length);
+	DBTestServerAddHeader(response, "Content-Type: application/json");
+	free(body);
+}
+
+typedef struct {
+	int32_t parses;
+	int32_t failures;
+	double jsonTime; // Spent in the completion and failure blocks getting at the JSON
+} DBTestRun;
+
+/* Runs count requests for path, reading each result three times: through resultJSON, or, if
+   reparse is set, by parsing resultData each time as resultJSON did before it kept the result */
+static DBTestRun DBTestRunRequests(int port, NSString *path, int count, BOOL reparse) {
+	__block DBTestRun run = { 0, 0, 0 };
+	NSObject *lock = [NSObject new];
+	dispatch_group_t group = dispatch_group_create();
+	NSOperationQueue *queue = [NSOperationQueue new];
+	queue.maxConcurrentOperationCount = 4;
+	DBHostConcurrencyGate *gate = [DBHostConcurrencyGate new];
+	BOOL expectError = ![path hasPrefix:@"/1/metadata/dropbox/listing"];
+
+	int32_t parsesBefore = DBTestParseCount;
+	for (int i = 0; i < count; i++) {
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d%@", port, path]];
+		dispatch_group_enter(group);
+		DBRequest *request = [[DBRequest alloc] initWithURLRequest:[NSURLRequest requestWithURL:url]
+			completionBlock:^(DBRequest *finished) {
+				double start = DBTestNow();
+				NSDictionary *result = nil;
+				NSUInteger contents = 0;
+				if (reparse) {
+					for (int access = 0; access < 3; access++) {
+						result = [NSJSONSerialization JSONObjectWithData:finished.resultData options:NSJSONReadingMutableContainers error:NULL];
+						contents += [[result objectForKey:@"contents"] count];
+					}
+				}
+				else {
+					result = [finished parseResponseAsType:[NSDictionary class]];
+					contents += [[result objectForKey:@"contents"] count];
+					contents += [[(NSDictionary *)finished.resultJSON objectForKey:@"contents"] count];
+					contents += [[(NSDictionary *)finished.resultJSON objectForKey:@"contents"] count];
+				}
+				double elapsed = DBTestNow() - start;
+
+				@synchronized (lock) {
+					run.jsonTime += elapsed;
+					if (expectError || finished.error || contents != 3 * [[result objectForKey:@"contents"] count]) run.failures++;
+				}
+				dispatch_group_leave(group);
+			}];
+		request.failureBlock = ^(DBRequest *failed) {
+			double start = DBTestNow();
+			NSDictionary *result = (NSDictionary *)failed.resultJSON;
+			double elapsed = DBTestNow() - start;
+
+			@synchronized (lock) {
+				run.jsonTime += elapsed;
+				if (!expectError || failed.statusCode != 404 || ![[result objectForKey:@"error"] isEqual:@"Path not found"] ||
+					![[failed.error.userInfo objectForKey:@"error"] isEqual:@"Path not found"]) {
+					run.failures++;
+				}
+			}
+			dispatch_group_leave(group);
+		};
+		request.hostGate = gate;
+		[queue addOperation:request];
+	}
+
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+	[queue waitUntilAllOperationsAreFinished];
+	run.parses = DBTestParseCount - parsesBefore;
+	return run;
+}
+
+static void DBTestOneParsePerRequest(int port) {
+	DBTestRun run = DBTestRunRequests(port, @"/1/metadata/dropbox/listing?count=50", 100, NO);
+	DBTestCheck(run.failures == 0, "%d of 100 listings failed", run.failures);
+	DBTestCheck(run.parses == 100, "100 listings took %d parses", run.parses);
+
+	run = DBTestRunRequests(port, @"/1/metadata/dropbox/missing", 100, NO);
+	DBTestCheck(run.failures == 0, "%d of 100 errors weren't reported with their JSON", run.failures);
+	DBTestCheck(run.parses == 100, "100 error responses took %d parses", run.parses);
+}
+
+static void DBBenchmarkListings(int port) {
+	const int count = 200;
+	int sizes[] = { 100, 1000, 10000 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		NSString *path = [NSString stringWithFormat:@"/1/metadata/dropbox/listing?count=%d", sizes[i]];
+		DBTestRun cached = DBTestRunRequests(port, path, count, NO);
+		DBTestRun reparsed = DBTestRunRequests(port, path, count, YES);
+		DBTestCheck(cached.failures == 0 && reparsed.failures == 0, "%d and %d of the %d-entry listings failed",
+			cached.failures, reparsed.failures, sizes[i]);
+		printf("Listing of %d entries, read 3 times: resultJSON %.2f parses and %.3f ms per request, "
+			"parsing each time %.2f parses and %.3f ms\n", sizes[i], (double)cached.parses / count,
+			cached.jsonTime * 1000 / count, (double)reparsed.parses / count, reparsed.jsonTime * 1000 / count);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBTestCountParses();
+		DBLogSetLevel(DBLogLevelError); // Every 404 is a warning
+
+		DBTestServer *server = DBTestServerStart(DBTestHandler, NULL);
+		DBTestCheck(server != NULL, "the server didn't start");
+		if (!server) return DBTestExitStatus("DBRequestJSONTests");
+		int port = DBTestServerPort(server);
+
+		DBTestOneParsePerRequest(port);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkListings(port);
+		}
+
+		DBTestServerStop(server);
+	}
+	return DBTestExitStatus("DBRequestJSONTests");
+}
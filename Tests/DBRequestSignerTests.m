@@ -0,0 +1,197 @@
+//
+//  DBRequestSignerTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Checks DBRequestSigner against the MPOAuthURLRequest path DBRestClient signed with before it:
+   for PLAINTEXT, HMAC-SHA1 and HMAC-SHA256, over GET and POST, the two give the same parameters but
+   for the timestamp and nonce, and MPOAuthSignatureParameter computes the same signature from the
+   signer's parameter string. Changing the token in the store has to show in the next request. With
+   --bench, signed GET URLs per second and per core, on one thread and on one thread per core,
+   through the old path, through one signer shared by every thread (one DBRestClient) and through a
+   signer per thread (a DBRestClient each). */
+
+#import <Foundation/Foundation.h>
+
+#import "DBRequestSigner.h"
+#import "MPOAuthCredentialConcreteStore.h"
+#import "MPOAuthSignatureParameter.h"
+#import "MPOAuthURLRequest.h"
+#import "MPURLRequestParameter.h"
+#include "DBTest.h"
+
+#include <math.h>
+
+
+static NSString * const DBTestURLString = @"https://api.dropbox.com/1/metadata/dropbox/Photos/Trip%202012";
+
+static MPOAuthCredentialConcreteStore *DBTestStore(NSString *signatureMethod) {
+	NSDictionary *credentials = [NSDictionary dictionaryWithObjectsAndKeys:
+		@"k3y0f7h3c0n5um3r", kMPOAuthCredentialConsumerKey,
+		@"53cr37 0f 7h3 c0n5um3r", kMPOAuthCredentialConsumerSecret,
+		signatureMethod, kMPOAuthSignatureMethod, nil];
+	MPOAuthCredentialConcreteStore *store = [[MPOAuthCredentialConcreteStore alloc] initWithCredentials:credentials];
+	store.accessToken = @"4cc355 70k3n";
+	store.accessTokenSecret = @"4cc355+53cr37&";
+	return store;
+}
+
+// What loadMetadata: sends for a folder it has a hash for
+static NSDictionary *DBTestParameters(void) {
+	return [NSDictionary dictionaryWithObjectsAndKeys:@"en", @"locale", @"25000", @"file_limit", @"true", @"list",
+		@"efdac89c4da886a9cece1927e6c22977", @"hash", @"Trip 2012/Día 1 & 2", @"path_hint", nil];
+}
+
+/* The parameter string DBRestClient got out of MPOAuth: in the query for GET, the body for POST */
+static NSString *DBOldSignedParameterString(MPOAuthCredentialConcreteStore *store, NSString *method, NSDictionary *params) {
+	NSArray *extraParams = [MPURLRequestParameter parametersFromDictionary:params];
+	NSArray *paramList = [[store oauthParameters] arrayByAddingObjectsFromArray:extraParams];
+	MPOAuthURLRequest *oauthRequest = [[MPOAuthURLRequest alloc] initWithURL:[NSURL URLWithString:DBTestURLString]
+		andParameters:paramList];
+	oauthRequest.HTTPMethod = method;
+	NSMutableURLRequest *urlRequest = [oauthRequest urlRequestSignedWithSecret:store.signingKey usingMethod:store.signatureMethod];
+
+	if ([method isEqual:@"GET"]) return [[urlRequest URL] query];
+	return [[NSString alloc] initWithData:[urlRequest HTTPBody] encoding:NSUTF8StringEncoding];
+}
+
+// The pairs, less those that change from request to request
+static NSArray *DBTestFixedPairs(NSString *parameterString) {
+	NSMutableArray *pairs = [NSMutableArray array];
+	for (NSString *pair in [parameterString componentsSeparatedByString:@"&"]) {
+		if ([pair hasPrefix:@"oauth_timestamp="] || [pair hasPrefix:@"oauth_nonce="]) continue;
+		if ([pair hasPrefix:@"oauth_signature="]) continue;
+		[pairs addObject:pair];
+	}
+	return pairs;
+}
+
+static NSString *DBTestValue(NSString *parameterString, NSString *name) {
+	NSString *prefix = [name stringByAppendingString:@"="];
+	for (NSString *pair in [parameterString componentsSeparatedByString:@"&"]) {
+		if ([pair hasPrefix:prefix]) return [pair substringFromIndex:[prefix length]];
+	}
+	return nil;
+}
+
+static void DBTestMatchesOldPath(NSString *signatureMethod, NSString *method) {
+	MPOAuthCredentialConcreteStore *store = DBTestStore(signatureMethod);
+	DBRequestSigner *signer = [[DBRequestSigner alloc] initWithCredentialStore:store];
+	NSDictionary *params = DBTestParameters();
+	const char *name = [[NSString stringWithFormat:@"%@ %@", signatureMethod, method] UTF8String];
+
+	NSString *signedString = [signer signedParameterStringForURLString:DBTestURLString method:method parameters:params];
+	NSString *old = DBOldSignedParameterString(store, method, params);
+	DBTestCheck([DBTestFixedPairs(signedString) isEqual:DBTestFixedPairs(old)], "%s: the signer gives %s, the old path %s", name,
+		[signedString UTF8String], [old UTF8String]);
+
+	// The signature has to come last, over everything before it
+	NSRange range = [signedString rangeOfString:@"&oauth_signature=" options:NSBackwardsSearch];
+	DBTestCheck(range.location != NSNotFound, "%s: no signature in %s", name, [signedString UTF8String]);
+	if (range.location == NSNotFound) return;
+
+	MPOAuthURLRequest *request = [[MPOAuthURLRequest alloc] initWithURL:[NSURL URLWithString:DBTestURLString] andParameters:nil];
+	request.HTTPMethod = method;
+	MPOAuthSignatureParameter *signature = [[MPOAuthSignatureParameter alloc] initWithText:[signedString substringToIndex:range.location]
+		andSecret:store.signingKey forRequest:request usingMethod:signatureMethod];
+	NSString *expected = [signature URLEncodedParameterString];
+	NSString *actual = [signedString substringFromIndex:range.location + 1];
+	DBTestCheck([actual isEqual:expected], "%s: signed %s, MPOAuth signs it %s", name, [actual UTF8String], [expected UTF8String]);
+
+	NSString *again = [signer signedParameterStringForURLString:DBTestURLString method:method parameters:params];
+	DBTestCheck(![DBTestValue(again, @"oauth_nonce") isEqual:DBTestValue(signedString, @"oauth_nonce")],
+		"%s: the nonce %s came up twice", name, [DBTestValue(again, @"oauth_nonce") UTF8String]);
+	double timestamp = [DBTestValue(again, @"oauth_timestamp") doubleValue];
+	DBTestCheck(fabs(timestamp - [[NSDate date] timeIntervalSince1970]) < 5, "%s: the timestamp is %.0f", name, timestamp);
+}
+
+static void DBTestCredentialChange(void) {
+	MPOAuthCredentialConcreteStore *store = DBTestStore(kMPOAuthSignatureMethodHMACSHA1);
+	DBRequestSigner *signer = [[DBRequestSigner alloc] initWithCredentialStore:store];
+	NSDictionary *params = DBTestParameters();
+	[signer signedParameterStringForURLString:DBTestURLString method:@"GET" parameters:params];
+
+	store.accessToken = @"n3w 70k3n";
+	store.accessTokenSecret = @"n3w 53cr37";
+	NSString *signedString = [signer signedParameterStringForURLString:DBTestURLString method:@"GET" parameters:params];
+	NSString *old = DBOldSignedParameterString(store, @"GET", params);
+	DBTestCheck([DBTestValue(signedString, @"oauth_token") isEqual:@"n3w%2070k3n"], "after the token changed the signer sends %s",
+		[signedString UTF8String]);
+	DBTestCheck([DBTestFixedPairs(signedString) isEqual:DBTestFixedPairs(old)], "after the token changed the signer gives %s, the old "
+		"path %s", [signedString UTF8String], [old UTF8String]);
+}
+
+
+typedef enum {
+	DBBenchmarkOldPath,
+	DBBenchmarkSharedSigner,
+	DBBenchmarkSignerPerThread,
+} DBBenchmarkPath;
+
+/* Signed GET URLs per second over count requests, split between threads */
+static double DBBenchmarkSigning(DBBenchmarkPath path, NSString *signatureMethod, NSUInteger threads, NSUInteger count) {
+	MPOAuthCredentialConcreteStore *store = DBTestStore(signatureMethod);
+	DBRequestSigner *sharedSigner = [[DBRequestSigner alloc] initWithCredentialStore:store];
+	NSDictionary *params = DBTestParameters();
+	NSUInteger perThread = count / threads;
+
+	double start = DBTestNow();
+	dispatch_apply(threads, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+		DBRequestSigner *signer = path == DBBenchmarkSignerPerThread ?
+			[[DBRequestSigner alloc] initWithCredentialStore:store] : sharedSigner;
+		for (NSUInteger i = 0; i < perThread; i++) {
+			@autoreleasepool {
+				if (path == DBBenchmarkOldPath) {
+					DBOldSignedParameterString(store, @"GET", params);
+				}
+				else {
+					// The old path hands back an NSURL, so the signer's string is made into one too
+					NSString *parameterString = [signer signedParameterStringForURLString:DBTestURLString method:@"GET"
+						parameters:params];
+					[NSURL URLWithString:[NSString stringWithFormat:@"%@?%@", DBTestURLString, parameterString]];
+				}
+			}
+		}
+	});
+	return perThread * threads / (DBTestNow() - start);
+}
+
+static void DBBenchmarkSigners(void) {
+	NSString *signatureMethods[] = { kMPOAuthSignatureMethodPlaintext, kMPOAuthSignatureMethodHMACSHA1 };
+	const char *pathNames[] = { "MPOAuthURLRequest", "One DBRequestSigner", "A DBRequestSigner per thread" };
+	NSUInteger cores = [[NSProcessInfo processInfo] activeProcessorCount];
+	NSUInteger threadCounts[] = { 1, cores };
+	const NSUInteger count = 200000;
+
+	for (size_t i = 0; i < sizeof(signatureMethods) / sizeof(signatureMethods[0]); i++) {
+		for (int t = 0; t < (cores > 1 ? 2 : 1); t++) {
+			NSUInteger threads = threadCounts[t];
+			printf("%s, %lu thread%s:\n", [signatureMethods[i] UTF8String], (unsigned long)threads, threads == 1 ? "" : "s");
+			for (int path = DBBenchmarkOldPath; path <= DBBenchmarkSignerPerThread; path++) {
+				if (path == DBBenchmarkSignerPerThread && threads == 1) continue;
+				double rate = DBBenchmarkSigning(path, signatureMethods[i], threads, count);
+				printf("  %s: %.0f requests/s, %.0f per core\n", pathNames[path], rate, rate / threads);
+			}
+		}
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		NSString *signatureMethods[] = { kMPOAuthSignatureMethodPlaintext, kMPOAuthSignatureMethodHMACSHA1,
+			kMPOAuthSignatureMethodHMACSHA256 };
+		for (size_t i = 0; i < sizeof(signatureMethods) / sizeof(signatureMethods[0]); i++) {
+			DBTestMatchesOldPath(signatureMethods[i], @"GET");
+			DBTestMatchesOldPath(signatureMethods[i], @"POST");
+		}
+		DBTestCredentialChange();
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkSigners();
+		}
+	}
+	return DBTestExitStatus("DBRequestSignerTests");
+}
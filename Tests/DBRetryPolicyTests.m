@@ -0,0 +1,373 @@
+//
+//  DBRetryPolicyTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Runs DBRequests with a DBRetryPolicy against DBTestServer injecting faults, and checks what gets
+   sent again: a GET through two 500s with the waits inside the backoff cap, a POST after a 500 not
+   at all, a 429 after its Retry-After and not when that is too far off, a timed out GET, a
+   download cut off part way continued with a Range from where it stopped, and failures past the
+   retry budget reported instead of retried. With --bench, 200 requests caught in a 2 second outage
+   of 503s, retried by the policy and by a loop that tries again every second, as apps did: the
+   requests the server saw during the outage, the most in any 100 ms, and when the last one got
+   through after the outage ended. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBHostConcurrencyGate.h"
+#import "DBLog.h"
+#import "DBRequest.h"
+#import "DBRetryPolicy.h"
+#include "DBTest.h"
+#include "DBTestServer.h"
+
+#include <stdlib.h>
+
+
+#define kDBTestFileLength 1000000
+#define kDBTestFileDropAfter 400000
+
+typedef struct {
+	char key[160]; // Path and query
+	int attempts;
+	double times[16];
+} DBTestPath;
+
+/* The handler runs on the server thread; the rest is read once the requests are done */
+typedef struct {
+	DBTestPath paths[64];
+	int pathCount;
+	// The download
+	long long rangeStart;
+	bool ifRangeMatched;
+	long long bytesServed;
+	// The outage
+	double outageStart;
+	double outageEnd;
+	unsigned outageAttempts;
+	unsigned outageBuckets[64]; // Attempts in each 100 ms
+} DBTestFaultServer;
+
+static uint8_t DBTestFileByte(long long offset) {
+	return (uint8_t)(offset * 7 + offset / 4096);
+}
+
+static size_t DBTestFileGenerator(void *context, long long offset, uint8_t *buffer, size_t length) {
+	long long start = *(long long *)context;
+	for (size_t i = 0; i < length; i++) buffer[i] = DBTestFileByte(start + offset + (long long)i);
+	return length;
+}
+
+static DBTestPath *DBTestPathForRequest(DBTestFaultServer *server, const DBTestServerRequest *request) {
+	char key[160];
+	snprintf(key, sizeof(key), "%s?%s", request->path, request->query);
+	for (int i = 0; i < server->pathCount; i++) {
+		if (strcmp(server->paths[i].key, key) == 0) return &server->paths[i];
+	}
+	if (server->pathCount == sizeof(server->paths) / sizeof(server->paths[0])) return NULL;
+	DBTestPath *path = &server->paths[server->pathCount++];
+	memset(path, 0, sizeof(*path));
+	strcpy(path->key, key);
+	return path;
+}
+
+static int DBTestQueryNumber(const DBTestServerRequest *request, const char *name) {
+	const char *parameter = strstr(request->query, name);
+	return parameter ? atoi(parameter + strlen(name)) : 0;
+}
+
+static void DBTestSetJSON(DBTestServerResponse *response, int status, const char *body) {
+	response->status = status;
+	DBTestServerSetBody(response, body, strlen(body));
+	DBTestServerAddHeader(response, "Content-Type: application/json");
+}
+
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	DBTestFaultServer *server = context;
+	DBTestPath *path = DBTestPathForRequest(server, request);
+	double now = DBTestNow();
+	if (path) {
+		if (path->attempts < 16) path->times[path->attempts] = now;
+		path->attempts++;
+	}
+	int attempt = path ? path->attempts : 1;
+
+	if (strncmp(request->path, "/status/", 8) == 0) {
+		// /status/<code>?times=N[&retry_after=S]: the first N attempts get <code>
+		if (attempt <= DBTestQueryNumber(request, "times=")) {
+			DBTestSetJSON(response, atoi(request->path + 8), "{\"error\": \"Injected fault\"}");
+			if (strstr(request->query, "retry_after=")) {
+				DBTestServerAddHeader(response, "Retry-After: %d", DBTestQueryNumber(request, "retry_after="));
+			}
+			return;
+		}
+		DBTestSetJSON(response, 200, "{\"ok\": true}");
+	}
+	else if (strcmp(request->path, "/slow") == 0) {
+		// The first N attempts take longer than the client waits
+		if (attempt <= DBTestQueryNumber(request, "times=")) response->delay = 2;
+		DBTestSetJSON(response, 200, "{\"ok\": true}");
+	}
+	else if (strcmp(request->path, "/file") == 0) {
+		char range[64] = "", ifRange[64] = "";
+		long long start = 0;
+		response->generator = DBTestFileGenerator;
+		response->generatorContext = &server->rangeStart;
+		DBTestServerAddHeader(response, "Etag: \"file-1\"");
+		if (DBTestServerGetHeader(request, "range", range, sizeof(range)) && sscanf(range, "bytes=%lld-", &start) == 1) {
+			server->ifRangeMatched = DBTestServerGetHeader(request, "if-range", ifRange, sizeof(ifRange)) &&
+				strcmp(ifRange, "\"file-1\"") == 0;
+			response->status = 206;
+			DBTestServerAddHeader(response, "Content-Range: bytes %lld-%d/%d", start, kDBTestFileLength - 1, kDBTestFileLength);
+		}
+		server->rangeStart = start;
+		response->generatedLength = kDBTestFileLength - start;
+		if (attempt == 1) {
+			response->dropAfter = kDBTestFileDropAfter;
+			server->bytesServed += kDBTestFileDropAfter;
+		}
+		else {
+			server->bytesServed += response->generatedLength;
+		}
+	}
+	else if (strncmp(request->path, "/outage/", 8) == 0) {
+		if (now < server->outageEnd) {
+			server->outageAttempts++;
+			size_t bucket = (size_t)((now - server->outageStart) * 10);
+			if (bucket < sizeof(server->outageBuckets) / sizeof(server->outageBuckets[0])) server->outageBuckets[bucket]++;
+			DBTestSetJSON(response, 503, "{\"error\": \"Service unavailable\"}");
+			return;
+		}
+		DBTestSetJSON(response, 200, "{\"ok\": true}");
+	}
+	else {
+		DBTestSetJSON(response, 404, "{\"error\": \"Path not found\"}");
+	}
+}
+
+static DBTestPath *DBTestPathWithKey(DBTestFaultServer *server, const char *key) {
+	for (int i = 0; i < server->pathCount; i++) {
+		if (strcmp(server->paths[i].key, key) == 0) return &server->paths[i];
+	}
+	return NULL;
+}
+
+
+static NSOperationQueue *DBTestQueue = nil;
+static DBHostConcurrencyGate *DBTestGate = nil;
+
+/* As DBRestClient does it: the retry waits out its delay off the queue. Retries inherit the block. */
+static void DBTestSetRetryBlock(DBRequest *request) {
+	request.retryBlock = ^(DBRequest *retry) {
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(retry.retryDelay * NSEC_PER_SEC)),
+			dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				[DBTestQueue addOperation:retry];
+			});
+	};
+}
+
+/* Runs a request to the end, retries included, and returns the last attempt */
+static DBRequest *DBTestRunRequest(int port, NSString *path, NSString *method, NSTimeInterval timeout, DBRetryPolicy *policy,
+	NSString *resultFilename) {
+	NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d%@", port, path]];
+	NSMutableURLRequest *urlRequest = [NSMutableURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData
+		timeoutInterval:timeout];
+	[urlRequest setHTTPMethod:method];
+
+	__block DBRequest *last = nil;
+	dispatch_semaphore_t done = dispatch_semaphore_create(0);
+	DBRequest *request = [[DBRequest alloc] initWithURLRequest:urlRequest completionBlock:^(DBRequest *finished) {
+		last = finished;
+		dispatch_semaphore_signal(done);
+	}];
+	request.hostGate = DBTestGate;
+	request.retryPolicy = policy;
+	request.resultFilename = resultFilename;
+	request.resumable = resultFilename != nil;
+	DBTestSetRetryBlock(request);
+	[policy recordRequest];
+	[DBTestQueue addOperation:request];
+
+	dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+	return last;
+}
+
+static DBRetryPolicy *DBTestPolicy(void) {
+	DBRetryPolicy *policy = [DBRetryPolicy new];
+	policy.baseDelay = 0.1;
+	return policy;
+}
+
+static void DBTestStatusRetries(int port, DBTestFaultServer *server) {
+	DBRequest *request = DBTestRunRequest(port, @"/status/500?times=2", @"GET", 30, DBTestPolicy(), nil);
+	DBTestPath *path = DBTestPathWithKey(server, "/status/500?times=2");
+	DBTestCheck(request.statusCode == 200 && !request.error && request.retryCount == 2 && path && path->attempts == 3,
+		"a GET through two 500s ended with %ld after %d attempts", (long)request.statusCode, path ? path->attempts : 0);
+	// Full jitter: each wait is somewhere below baseDelay * 2^retry
+	if (path && path->attempts == 3) {
+		double first = path->times[1] - path->times[0], second = path->times[2] - path->times[1];
+		DBTestCheck(first < 0.1 + 0.15 && second < 0.2 + 0.15, "the retries waited %.3f and %.3f s", first, second);
+	}
+
+	request = DBTestRunRequest(port, @"/status/500?times=1&post", @"POST", 30, DBTestPolicy(), nil);
+	path = DBTestPathWithKey(server, "/status/500?times=1&post");
+	DBTestCheck(request.statusCode == 500 && request.error && path && path->attempts == 1,
+		"a POST after a 500 ended with %ld after %d attempts", (long)request.statusCode, path ? path->attempts : 0);
+
+	// 429 says the server did nothing, so even a POST goes again, after Retry-After
+	request = DBTestRunRequest(port, @"/status/429?times=1&retry_after=1", @"POST", 30, DBTestPolicy(), nil);
+	path = DBTestPathWithKey(server, "/status/429?times=1&retry_after=1");
+	DBTestCheck(request.statusCode == 200 && path && path->attempts == 2, "a POST after a 429 ended with %ld after %d attempts",
+		(long)request.statusCode, path ? path->attempts : 0);
+	if (path && path->attempts == 2) {
+		double wait = path->times[1] - path->times[0];
+		DBTestCheck(wait >= 0.95 && wait < 1.5, "Retry-After: 1 was followed by a wait of %.3f s", wait);
+	}
+
+	DBRetryPolicy *policy = DBTestPolicy();
+	policy.maxRetryAfter = 60;
+	request = DBTestRunRequest(port, @"/status/429?times=1&retry_after=600", @"GET", 30, policy, nil);
+	path = DBTestPathWithKey(server, "/status/429?times=1&retry_after=600");
+	DBTestCheck(request.statusCode == 429 && path && path->attempts == 1,
+		"a Retry-After past maxRetryAfter ended with %ld after %d attempts", (long)request.statusCode, path ? path->attempts : 0);
+}
+
+static void DBTestTimeout(int port, DBTestFaultServer *server) {
+	double start = DBTestNow();
+	DBRequest *request = DBTestRunRequest(port, @"/slow?times=1", @"GET", 0.5, DBTestPolicy(), nil);
+	double elapsed = DBTestNow() - start;
+	DBTestPath *path = DBTestPathWithKey(server, "/slow?times=1");
+	DBTestCheck(request.statusCode == 200 && !request.error && path && path->attempts == 2 && elapsed < 1.9,
+		"a timed out GET ended with %ld after %d attempts and %.2f s", (long)request.statusCode, path ? path->attempts : 0, elapsed);
+}
+
+static void DBTestResumedDownload(int port, DBTestFaultServer *server) {
+	NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:
+		[NSString stringWithFormat:@"DBRetryPolicyTests-%d", getpid()]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+	NSString *filename = [directory stringByAppendingPathComponent:@"file"];
+
+	DBRequest *request = DBTestRunRequest(port, @"/file", @"GET", 30, DBTestPolicy(), filename);
+	NSData *data = [NSData dataWithContentsOfFile:filename];
+	BOOL matches = [data length] == kDBTestFileLength;
+	const uint8_t *bytes = [data bytes];
+	for (NSUInteger i = 0; matches && i < [data length]; i++) matches = bytes[i] == DBTestFileByte(i);
+
+	DBTestCheck(!request.error && matches, "the resumed download has %lu bytes and %s", (unsigned long)[data length],
+		matches ? "they match" : "they don't match");
+	DBTestCheck(server->rangeStart == kDBTestFileDropAfter && server->ifRangeMatched,
+		"the retry asked for bytes from %lld, %s If-Range", server->rangeStart, server->ifRangeMatched ? "with" : "without");
+	DBTestCheck(server->bytesServed == kDBTestFileLength, "%lld bytes were sent for the %d byte file", server->bytesServed,
+		kDBTestFileLength);
+
+	[[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+}
+
+static void DBTestBudget(int port, DBTestFaultServer *server) {
+	DBRetryPolicy *policy = DBTestPolicy();
+	policy.budgetRatio = 0;
+	policy.budgetCapacity = 2;
+	[policy recordRequest]; // Brings the budget down to the new capacity
+
+	int attempts = 0;
+	for (int i = 0; i < 5; i++) {
+		NSString *path = [NSString stringWithFormat:@"/status/503?times=100&budget=%d", i];
+		DBRequest *request = DBTestRunRequest(port, path, @"GET", 30, policy, nil);
+		DBTestPath *served = DBTestPathWithKey(server, [path UTF8String]);
+		DBTestCheck(request.statusCode == 503, "request %d through steady 503s ended with %ld", i, (long)request.statusCode);
+		attempts += served ? served->attempts : 0;
+	}
+	DBTestCheck(attempts == 5 + 2, "5 requests with a budget of 2 retries made %d attempts", attempts);
+}
+
+/* Sends url until it gets through: with the policy, or if there is none by sending it again a
+   second after each failure */
+static void DBBenchmarkSend(NSURL *url, DBRetryPolicy *policy, void (^done)(void)) {
+	DBRequest *request = [[DBRequest alloc] initWithURLRequest:[NSURLRequest requestWithURL:url] completionBlock:^(DBRequest *finished) {
+		if (!policy && finished.error) {
+			dispatch_after(dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				DBBenchmarkSend(url, nil, done);
+			});
+			return;
+		}
+		done();
+	}];
+	request.hostGate = DBTestGate;
+	if (policy) {
+		request.retryPolicy = policy;
+		DBTestSetRetryBlock(request);
+		[policy recordRequest];
+	}
+	[DBTestQueue addOperation:request];
+}
+
+/* Returns how long after the end of the outage the last request got through */
+static double DBBenchmarkOutage(int port, DBTestFaultServer *server, DBRetryPolicy *policy) {
+	const int count = 200;
+	server->outageStart = DBTestNow();
+	server->outageEnd = server->outageStart + 2;
+	server->outageAttempts = 0;
+	memset(server->outageBuckets, 0, sizeof(server->outageBuckets));
+
+	dispatch_group_t group = dispatch_group_create();
+	__block double lastDone = 0;
+	NSObject *lock = [NSObject new];
+	for (int i = 0; i < count; i++) {
+		dispatch_group_enter(group);
+		NSURL *url = [NSURL URLWithString:[NSString stringWithFormat:@"http://127.0.0.1:%d/outage/%d", port, i]];
+		DBBenchmarkSend(url, policy, ^{
+			@synchronized (lock) {
+				lastDone = MAX(lastDone, DBTestNow());
+			}
+			dispatch_group_leave(group);
+		});
+	}
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+	return lastDone - server->outageEnd;
+}
+
+static void DBBenchmarkOutages(int port, DBTestFaultServer *server) {
+	DBRetryPolicy *policy = [DBRetryPolicy new];
+	policy.maxRetries = 20;
+	const char *names[] = { "DBRetryPolicy", "Again every second" };
+	for (int fixedLoop = 0; fixedLoop <= 1; fixedLoop++) {
+		double recovery = DBBenchmarkOutage(port, server, fixedLoop ? nil : policy);
+		unsigned peak = 0;
+		for (size_t i = 0; i < 20; i++) peak = MAX(peak, server->outageBuckets[i]);
+		printf("%s, 200 requests in a 2 s outage: %u requests during it, %u in the busiest 100 ms, "
+			"the last through %.2f s after it\n", names[fixedLoop], server->outageAttempts, peak, recovery);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBLogSetLevel(DBLogLevelError); // Every retry is logged
+
+		DBTestQueue = [NSOperationQueue new];
+		DBTestQueue.maxConcurrentOperationCount = 16;
+		DBTestGate = [DBHostConcurrencyGate new];
+		DBTestGate.maxRequestsPerHost = 16;
+
+		DBTestFaultServer *faultServer = calloc(1, sizeof(DBTestFaultServer));
+		DBTestServer *server = DBTestServerStart(DBTestHandler, faultServer);
+		DBTestCheck(server != NULL, "the server didn't start");
+		if (!server) return DBTestExitStatus("DBRetryPolicyTests");
+		int port = DBTestServerPort(server);
+
+		DBTestStatusRetries(port, faultServer);
+		DBTestTimeout(port, faultServer);
+		DBTestResumedDownload(port, faultServer);
+		DBTestBudget(port, faultServer);
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkOutages(port, faultServer);
+		}
+
+		DBTestServerStop(server);
+		free(faultServer);
+	}
+	return DBTestExitStatus("DBRetryPolicyTests");
+}
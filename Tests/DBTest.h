@@ -0,0 +1,138 @@
+//
+//  DBTest.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* The little the test programs share: a check macro that counts failures, a monotonic clock, the
+   process's memory, threads, CPU time and disk writes for the benchmarks, and hex formatting. Plain
+   C, so the Objective-C tests can include it too. Each program runs its tests and returns
+   DBTestExitStatus(); given --bench it runs its benchmarks. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach.h>
+#endif
+
+static int DBTestFailures = 0;
+
+#define DBTestCheck(condition, ...) do { \
+	if (!(condition)) { \
+		DBTestFailures++; \
+		fprintf(stderr, "%s:%d: failed: %s: ", __FILE__, __LINE__, #condition); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+	} \
+} while (0)
+
+static inline int DBTestExitStatus(const char *name) {
+	if (DBTestFailures) {
+		fprintf(stderr, "%s: %d failure(s)\n", name, DBTestFailures);
+		return 1;
+	}
+	printf("%s: passed\n", name);
+	return 0;
+}
+
+static inline bool DBTestWantsBenchmarks(int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench") == 0) return true;
+	}
+	return false;
+}
+
+static inline double DBTestNow(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#if !defined(__APPLE__)
+// A number from a /proc file, e.g. "VmRSS:" in kB from /proc/self/status
+static inline long long DBTestProcField(const char *path, const char *field) {
+	FILE *file = fopen(path, "r");
+	char line[256];
+	long long value = 0;
+	while (file && fgets(line, sizeof(line), file)) {
+		if (strncmp(line, field, strlen(field)) == 0) {
+			value = strtoll(line + strlen(field), NULL, 10);
+			break;
+		}
+	}
+	if (file) fclose(file);
+	return value;
+}
+
+static inline long DBTestProcStatus(const char *field) {
+	return (long)DBTestProcField("/proc/self/status", field);
+}
+#endif
+
+/* Resident memory of the process right now, in bytes */
+static inline size_t DBTestResidentSize(void) {
+#if defined(__APPLE__)
+	struct mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+	return info.resident_size;
+#else
+	return (size_t)DBTestProcStatus("VmRSS:") * 1024;
+#endif
+}
+
+static inline unsigned DBTestThreadCount(void) {
+#if defined(__APPLE__)
+	thread_act_array_t threads;
+	mach_msg_type_number_t count = 0;
+	if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS) return 0;
+	for (mach_msg_type_number_t i = 0; i < count; i++) mach_port_deallocate(mach_task_self(), threads[i]);
+	vm_deallocate(mach_task_self(), (vm_address_t)threads, count * sizeof(thread_act_t));
+	return count;
+#else
+	return (unsigned)DBTestProcStatus("Threads:");
+#endif
+}
+
+/* User and system time the process has used, in seconds */
+static inline double DBTestCPUTime(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Bytes the process has had written to storage so far, which leaves out writes that only reached
+   the page cache. -1 if the system doesn't say. */
+static inline long long DBTestBytesWrittenToDisk(void) {
+#if defined(__APPLE__)
+	struct rusage_info_v2 info;
+	if (proc_pid_rusage(getpid(), RUSAGE_INFO_V2, (rusage_info_t *)&info) != 0) return -1;
+	return (long long)info.ri_diskio_byteswritten;
+#else
+	FILE *file = fopen("/proc/self/io", "r");
+	if (!file) return -1;
+	fclose(file);
+	return DBTestProcField("/proc/self/io", "write_bytes:");
+#endif
+}
+
+/* out needs 2 * length + 1 bytes */
+static inline char *DBTestHex(const uint8_t *bytes, size_t length, char *out) {
+	static const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < length; i++) {
+		out[2 * i] = digits[bytes[i] >> 4];
+		out[2 * i + 1] = digits[bytes[i] & 0xf];
+	}
+	out[2 * length] = '\0';
+	return out;
+}
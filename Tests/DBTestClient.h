@@ -0,0 +1,20 @@
+//
+//  DBTestClient.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* For the tests that go through DBRestClient: a DBSession linked with made-up credentials that are
+   kept in memory, never in the user defaults, with the API hosts pointed at DBTestServer. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBSession.h"
+
+/* Sends the requests of every DBRestClient to apiHost and contentHost, e.g. "127.0.0.1:8080", over
+   plain HTTP, and returns a session linked for user "1" */
+DBSession *DBTestSessionForHosts(NSString *apiHost, NSString *contentHost);
+
+/* Both hosts on 127.0.0.1:port */
+DBSession *DBTestSessionForPort(int port);
@@ -0,0 +1,48 @@
+//
+//  DBTestClient.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#import "DBTestClient.h"
+
+
+@interface DBTestCredentials : NSObject <DBSessionCredentialsDelegate>
+@end
+
+@implementation DBTestCredentials
+
+- (NSDictionary *)dropboxSessionLoadCredentials:(DBSession *)session {
+	return nil;
+}
+
+- (void)dropboxSession:(DBSession *)session saveCredentials:(NSDictionary *)credentials {
+}
+
+- (void)dropboxSessionRemoveCredentials:(DBSession *)session {
+}
+
+@end
+
+
+DBSession *DBTestSessionForHosts(NSString *apiHost, NSString *contentHost) {
+	kDBDropboxAPIHost = apiHost;
+	kDBDropboxAPIContentHost = contentHost;
+	kDBProtocolHTTPS = @"http";
+
+	// The session only holds on to its credentials delegate weakly
+	static DBTestCredentials *credentials = nil;
+	if (!credentials) credentials = [DBTestCredentials new];
+
+	DBSession *session = [[DBSession alloc] initWithAppKey:@"testappkey" appSecret:@"testappsecret" root:kDBRootDropbox];
+	session.credentialsDelegate = credentials;
+	[session isLinked]; // Loads the (no) saved credentials, which would otherwise replace these later
+	[session updateAccessToken:@"testtoken" accessTokenSecret:@"testtokensecret" forUserId:@"1"];
+	return session;
+}
+
+DBSession *DBTestSessionForPort(int port) {
+	NSString *host = [NSString stringWithFormat:@"127.0.0.1:%d", port];
+	return DBTestSessionForHosts(host, host);
+}
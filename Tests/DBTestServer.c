@@ -0,0 +1,506 @@
+//
+//  DBTestServer.c
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+#define _GNU_SOURCE // For memmem on Linux
+
+#include "DBTestServer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define kDBTestServerMaxHeaderLength (64 * 1024)
+#define kDBTestServerChunkLength (64 * 1024)
+
+typedef enum {
+	DBTestConnectionReading,
+	DBTestConnectionWaiting, // Answered by the handler, waiting out the delay
+	DBTestConnectionWriting,
+} DBTestConnectionState;
+
+typedef struct {
+	int fd;
+	DBTestConnectionState state;
+	bool closeWhenDone;
+
+	uint8_t *input;
+	size_t inputLength;
+	size_t inputCapacity;
+
+	DBTestServerResponse response;
+	double readyTime;
+	char *head;
+	size_t headLength;
+	size_t headSent;
+	long long bodyLength;
+	long long bodySent;
+	uint8_t *chunk; // For generated bodies
+	size_t chunkLength;
+	size_t chunkSent;
+} DBTestConnection;
+
+struct DBTestServer {
+	DBTestServerHandler handler;
+	void *context;
+	int listenFd;
+	int wakeFds[2];
+	int port;
+	pthread_t thread;
+
+	DBTestConnection **connections;
+	size_t connectionCount;
+	size_t connectionCapacity;
+	unsigned inFlight;
+};
+
+
+static double DBTestServerNow(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static const char *DBTestServerReason(int status) {
+	switch (status) {
+		case 200: return "OK";
+		case 206: return "Partial Content";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 401: return "Unauthorized";
+		case 404: return "Not Found";
+		case 409: return "Conflict";
+		case 416: return "Requested Range Not Satisfiable";
+		case 429: return "Too Many Requests";
+		case 500: return "Internal Server Error";
+		case 502: return "Bad Gateway";
+		case 503: return "Service Unavailable";
+		case 504: return "Gateway Timeout";
+		default: return "Status";
+	}
+}
+
+static void DBTestServerSetNonBlocking(int fd) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Finds name in a block of header lines and points value at its value, returns its length or -1
+static long DBTestServerFindHeader(const char *headers, const char *name, const char **value) {
+	size_t nameLength = strlen(name);
+	for (const char *line = headers; *line; ) {
+		const char *end = strstr(line, "\r\n");
+		if (!end) break;
+		if ((size_t)(end - line) > nameLength && line[nameLength] == ':' && strncasecmp(line, name, nameLength) == 0) {
+			const char *start = line + nameLength + 1;
+			while (start < end && (*start == ' ' || *start == '\t')) start++;
+			*value = start;
+			return end - start;
+		}
+		line = end + 2;
+	}
+	return -1;
+}
+
+static void DBTestServerCloseConnection(DBTestServer *server, size_t index) {
+	DBTestConnection *connection = server->connections[index];
+	if (connection->state != DBTestConnectionReading) server->inFlight--;
+	close(connection->fd);
+	free(connection->input);
+	free(connection->response.body);
+	free(connection->head);
+	free(connection->chunk);
+	free(connection);
+	server->connections[index] = server->connections[--server->connectionCount];
+}
+
+/* Decodes a chunked body starting at bytes; returns the number of bytes it took up, 0 if it hasn't
+   all arrived yet and -1 if it's malformed */
+static long DBTestServerDecodeChunked(const uint8_t *bytes, size_t length, uint8_t **body, size_t *bodyLength) {
+	size_t position = 0;
+	size_t decodedLength = 0;
+	uint8_t *decoded = NULL;
+	for (;;) {
+		const uint8_t *lineEnd = memmem(bytes + position, length - position, "\r\n", 2);
+		if (!lineEnd) break;
+		char *sizeEnd = NULL;
+		unsigned long chunkLength = strtoul((const char *)bytes + position, &sizeEnd, 16);
+		if ((const uint8_t *)sizeEnd == bytes + position) {
+			free(decoded);
+			return -1;
+		}
+		size_t dataStart = lineEnd + 2 - bytes;
+		if (chunkLength == 0) {
+			// No trailers from the clients we talk to, just the final CRLF
+			if (length - dataStart < 2) break;
+			*body = decoded;
+			*bodyLength = decodedLength;
+			return (long)(dataStart + 2);
+		}
+		if (length - dataStart < chunkLength + 2) break;
+		decoded = realloc(decoded, decodedLength + chunkLength);
+		memcpy(decoded + decodedLength, bytes + dataStart, chunkLength);
+		decodedLength += chunkLength;
+		position = dataStart + chunkLength + 2;
+	}
+	free(decoded);
+	return 0;
+}
+
+static void DBTestServerStartResponse(DBTestConnection *connection) {
+	DBTestServerResponse *response = &connection->response;
+	connection->bodyLength = response->generator ? response->generatedLength : (long long)response->bodyLength;
+	connection->bodySent = 0;
+	connection->headSent = 0;
+	connection->chunkLength = connection->chunkSent = 0;
+
+	size_t capacity = strlen(response->headers) + 256;
+	free(connection->head);
+	connection->head = malloc(capacity);
+	connection->headLength = snprintf(connection->head, capacity,
+		"HTTP/1.1 %d %s\r\nContent-Length: %lld\r\nConnection: %s\r\n%s\r\n", response->status,
+		DBTestServerReason(response->status), connection->bodyLength,
+		connection->closeWhenDone ? "close" : "keep-alive", response->headers);
+	connection->state = DBTestConnectionWriting;
+}
+
+/* Calls the handler if a whole request has arrived. Returns false if the connection should close. */
+static bool DBTestServerHandleInput(DBTestServer *server, DBTestConnection *connection) {
+	uint8_t *headerEnd = memmem(connection->input, connection->inputLength, "\r\n\r\n", 4);
+	if (!headerEnd) return connection->inputLength < kDBTestServerMaxHeaderLength;
+
+	size_t headerLength = headerEnd + 4 - connection->input;
+	char *head = malloc(headerLength + 1);
+	memcpy(head, connection->input, headerLength);
+	head[headerLength] = '\0';
+
+	char *lineEnd = strstr(head, "\r\n");
+	*lineEnd = '\0';
+	char *headers = lineEnd + 2;
+	char *method = head;
+	char *target = strchr(method, ' ');
+	char *version = target ? strchr(target + 1, ' ') : NULL;
+	if (!version) {
+		free(head);
+		return false;
+	}
+	*target++ = '\0';
+	*version++ = '\0';
+	char *query = strchr(target, '?');
+	if (query) *query++ = '\0';
+
+	uint8_t *body = NULL;
+	size_t bodyLength = 0;
+	size_t requestLength = headerLength;
+	const char *value = NULL;
+	long valueLength = DBTestServerFindHeader(headers, "Transfer-Encoding", &value);
+	if (valueLength >= 7 && strncasecmp(value, "chunked", 7) == 0) {
+		long consumed = DBTestServerDecodeChunked(connection->input + headerLength, connection->inputLength - headerLength,
+			&body, &bodyLength);
+		if (consumed <= 0) {
+			free(head);
+			return consumed == 0;
+		}
+		requestLength += consumed;
+	}
+	else if (DBTestServerFindHeader(headers, "Content-Length", &value) >= 0) {
+		bodyLength = strtoull(value, NULL, 10);
+		if (connection->inputLength - headerLength < bodyLength) {
+			free(head);
+			return true;
+		}
+		body = malloc(bodyLength ? bodyLength : 1);
+		memcpy(body, connection->input + headerLength, bodyLength);
+		requestLength += bodyLength;
+	}
+
+	connection->closeWhenDone = strcmp(version, "HTTP/1.0") == 0 ||
+		(DBTestServerFindHeader(headers, "Connection", &value) >= 5 && strncasecmp(value, "close", 5) == 0);
+
+	server->inFlight++;
+	connection->state = DBTestConnectionWaiting;
+	DBTestServerRequest request = { method, target, query ? query : "", headers, body, bodyLength, server->inFlight };
+	DBTestServerResponse *response = &connection->response;
+	free(response->body);
+	memset(response, 0, sizeof(*response));
+	response->status = 200;
+	response->dropAfter = -1;
+	server->handler(server->context, &request, response);
+
+	free(body);
+	free(head);
+	memmove(connection->input, connection->input + requestLength, connection->inputLength - requestLength);
+	connection->inputLength -= requestLength;
+
+	if (response->delay > 0) {
+		connection->readyTime = DBTestServerNow() + response->delay;
+		return true;
+	}
+	if (response->status == 0) return false;
+	DBTestServerStartResponse(connection);
+	return true;
+}
+
+static bool DBTestServerRead(DBTestServer *server, DBTestConnection *connection) {
+	for (;;) {
+		if (connection->inputCapacity - connection->inputLength < 16 * 1024) {
+			connection->inputCapacity = connection->inputCapacity ? 2 * connection->inputCapacity : 32 * 1024;
+			connection->input = realloc(connection->input, connection->inputCapacity);
+		}
+		ssize_t count = recv(connection->fd, connection->input + connection->inputLength,
+			connection->inputCapacity - connection->inputLength, 0);
+		if (count == 0) return false;
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+			break;
+		}
+		connection->inputLength += count;
+	}
+	return DBTestServerHandleInput(server, connection);
+}
+
+/* Sends what it can. Returns false if the connection should close. */
+static bool DBTestServerWrite(DBTestServer *server, DBTestConnection *connection) {
+	DBTestServerResponse *response = &connection->response;
+	long long bodyEnd = connection->bodyLength;
+	if (response->dropAfter >= 0 && response->dropAfter < bodyEnd) bodyEnd = response->dropAfter;
+
+	for (;;) {
+		const void *bytes;
+		size_t length;
+		if (connection->headSent < connection->headLength) {
+			bytes = connection->head + connection->headSent;
+			length = connection->headLength - connection->headSent;
+		}
+		else if (connection->bodySent < bodyEnd) {
+			if (response->generator) {
+				if (connection->chunkSent == connection->chunkLength) {
+					if (!connection->chunk) connection->chunk = malloc(kDBTestServerChunkLength);
+					long long remaining = bodyEnd - connection->bodySent;
+					size_t wanted = remaining < kDBTestServerChunkLength ? (size_t)remaining : kDBTestServerChunkLength;
+					connection->chunkLength = response->generator(response->generatorContext, connection->bodySent,
+						connection->chunk, wanted);
+					connection->chunkSent = 0;
+					if (connection->chunkLength == 0) return false;
+				}
+				bytes = connection->chunk + connection->chunkSent;
+				length = connection->chunkLength - connection->chunkSent;
+			}
+			else {
+				bytes = response->body + connection->bodySent;
+				length = (size_t)(bodyEnd - connection->bodySent);
+			}
+		}
+		else {
+			break;
+		}
+
+		ssize_t count = send(connection->fd, bytes, length, 0);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		if (connection->headSent < connection->headLength) {
+			connection->headSent += count;
+		}
+		else {
+			connection->bodySent += count;
+			if (response->generator) connection->chunkSent += count;
+		}
+	}
+
+	// All sent, or as much as the response lets out before the connection drops
+	if (bodyEnd < connection->bodyLength || connection->closeWhenDone) return false;
+
+	server->inFlight--;
+	connection->state = DBTestConnectionReading;
+	free(response->body);
+	response->body = NULL;
+	return connection->inputLength == 0 || DBTestServerHandleInput(server, connection);
+}
+
+static void DBTestServerAccept(DBTestServer *server) {
+	for (;;) {
+		int fd = accept(server->listenFd, NULL, NULL);
+		if (fd < 0) return;
+		DBTestServerSetNonBlocking(fd);
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		if (server->connectionCount == server->connectionCapacity) {
+			server->connectionCapacity = server->connectionCapacity ? 2 * server->connectionCapacity : 64;
+			server->connections = realloc(server->connections, server->connectionCapacity * sizeof(DBTestConnection *));
+		}
+		DBTestConnection *connection = calloc(1, sizeof(DBTestConnection));
+		connection->fd = fd;
+		connection->response.dropAfter = -1;
+		server->connections[server->connectionCount++] = connection;
+	}
+}
+
+static void *DBTestServerRun(void *argument) {
+	DBTestServer *server = argument;
+	struct pollfd *fds = NULL;
+	size_t fdCapacity = 0;
+
+	for (;;) {
+		if (fdCapacity < server->connectionCount + 2) {
+			fdCapacity = 2 * (server->connectionCount + 2);
+			fds = realloc(fds, fdCapacity * sizeof(struct pollfd));
+		}
+		fds[0] = (struct pollfd){ server->wakeFds[0], POLLIN, 0 };
+		fds[1] = (struct pollfd){ server->listenFd, POLLIN, 0 };
+
+		double now = DBTestServerNow();
+		int timeout = 1000;
+		for (size_t i = 0; i < server->connectionCount; i++) {
+			DBTestConnection *connection = server->connections[i];
+			short events = 0;
+			if (connection->state == DBTestConnectionReading) events = POLLIN;
+			else if (connection->state == DBTestConnectionWriting) events = POLLOUT;
+			else {
+				int wait = (int)((connection->readyTime - now) * 1000) + 1;
+				if (wait < timeout) timeout = wait < 0 ? 0 : wait;
+			}
+			fds[i + 2] = (struct pollfd){ connection->fd, events, 0 };
+		}
+
+		size_t polledCount = server->connectionCount;
+		if (poll(fds, polledCount + 2, timeout) < 0 && errno != EINTR) break;
+		if (fds[0].revents) break;
+
+		// Backwards, as closing a connection moves the last one into its place
+		now = DBTestServerNow();
+		for (size_t i = polledCount; i-- > 0; ) {
+			DBTestConnection *connection = server->connections[i];
+			short revents = fds[i + 2].revents;
+			bool keep = true;
+			if (connection->state == DBTestConnectionWaiting) {
+				if (now >= connection->readyTime) {
+					if (connection->response.status == 0) keep = false;
+					else {
+						DBTestServerStartResponse(connection);
+						keep = DBTestServerWrite(server, connection);
+					}
+				}
+			}
+			else if (revents & (POLLERR | POLLNVAL)) {
+				keep = false;
+			}
+			else if (connection->state == DBTestConnectionReading && (revents & (POLLIN | POLLHUP))) {
+				keep = DBTestServerRead(server, connection);
+			}
+			else if (connection->state == DBTestConnectionWriting && (revents & (POLLOUT | POLLHUP))) {
+				keep = DBTestServerWrite(server, connection);
+			}
+			if (!keep) DBTestServerCloseConnection(server, i);
+		}
+
+		if (fds[1].revents & POLLIN) DBTestServerAccept(server);
+	}
+
+	while (server->connectionCount > 0) DBTestServerCloseConnection(server, server->connectionCount - 1);
+	free(fds);
+	return NULL;
+}
+
+
+DBTestServer *DBTestServerStart(DBTestServerHandler handler, void *context) {
+	signal(SIGPIPE, SIG_IGN);
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 8192) {
+		limit.rlim_cur = limit.rlim_max < 8192 ? limit.rlim_max : 8192;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	DBTestServer *server = calloc(1, sizeof(DBTestServer));
+	server->handler = handler;
+	server->context = context;
+
+	server->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(server->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	if (server->listenFd < 0 || bind(server->listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+		listen(server->listenFd, 1024) != 0 ||
+		getsockname(server->listenFd, (struct sockaddr *)&address, &addressLength) != 0 || pipe(server->wakeFds) != 0) {
+		perror("DBTestServerStart");
+		if (server->listenFd >= 0) close(server->listenFd);
+		free(server);
+		return NULL;
+	}
+	server->port = ntohs(address.sin_port);
+	DBTestServerSetNonBlocking(server->listenFd);
+
+	if (pthread_create(&server->thread, NULL, DBTestServerRun, server) != 0) {
+		close(server->listenFd);
+		close(server->wakeFds[0]);
+		close(server->wakeFds[1]);
+		free(server);
+		return NULL;
+	}
+	return server;
+}
+
+int DBTestServerPort(const DBTestServer *server) {
+	return server->port;
+}
+
+void DBTestServerStop(DBTestServer *server) {
+	if (!server) return;
+	ssize_t written = write(server->wakeFds[1], "x", 1);
+	(void)written;
+	pthread_join(server->thread, NULL);
+	close(server->listenFd);
+	close(server->wakeFds[0]);
+	close(server->wakeFds[1]);
+	free(server->connections);
+	free(server);
+}
+
+bool DBTestServerGetHeader(const DBTestServerRequest *request, const char *name, char *value, size_t size) {
+	const char *start = NULL;
+	long length = DBTestServerFindHeader(request->headers, name, &start);
+	if (length < 0 || size == 0) return false;
+	if ((size_t)length >= size) length = (long)size - 1;
+	memcpy(value, start, length);
+	value[length] = '\0';
+	return true;
+}
+
+void DBTestServerSetBody(DBTestServerResponse *response, const void *bytes, size_t length) {
+	free(response->body);
+	response->body = malloc(length ? length : 1);
+	memcpy(response->body, bytes, length);
+	response->bodyLength = length;
+}
+
+void DBTestServerAddHeader(DBTestServerResponse *response, const char *format, ...) {
+	size_t used = strlen(response->headers);
+	va_list arguments;
+	va_start(arguments, format);
+	int length = vsnprintf(response->headers + used, sizeof(response->headers) - used, format, arguments);
+	va_end(arguments);
+	if (length >= 0 && used + length + 2 < sizeof(response->headers)) strcat(response->headers, "\r\n");
+}
@@ -0,0 +1,72 @@
+//
+//  DBTestServer.h
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* DBTestServer stands in for api.dropbox.com and api-content.dropbox.com in the tests and
+   benchmarks that go over the network. It listens on a port of 127.0.0.1 and serves every
+   connection from a single thread with poll(2), so a thousand open connections cost it no threads
+   and what a benchmark measures about its process is the client. HTTP/1.1 with keep-alive; request
+   bodies may have a Content-Length or be chunked.
+
+   The handler is called on the server thread once a request has arrived in full. It fills in the
+   response, which can be held back for a while, made as it is sent or cut off part way, so the
+   server can also play a slow, overloaded or failing one. Plain C, like DBTest.h. */
+
+#ifndef DBTESTSERVER_H
+#define DBTESTSERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct DBTestServer DBTestServer;
+
+typedef struct {
+	const char *method;
+	const char *path; // As sent, without the query
+	const char *query; // Empty if there is none
+	const char *headers; // The header lines as sent, each ending in \r\n
+	const uint8_t *body;
+	size_t bodyLength;
+	unsigned inFlight; // Requests being answered, this one included
+} DBTestServerRequest;
+
+/* Writes up to length bytes of the body starting at offset into buffer and returns how many */
+typedef size_t (*DBTestServerBodyGenerator)(void *context, long long offset, uint8_t *buffer, size_t length);
+
+typedef struct {
+	int status; // 200 unless the handler changes it; 0 closes the connection without answering
+	char headers[1024]; // Extra header lines, see DBTestServerAddHeader
+	uint8_t *body; // See DBTestServerSetBody
+	size_t bodyLength;
+	DBTestServerBodyGenerator generator; // If set, the body is generatedLength bytes made as they go out
+	void *generatorContext; // Must stay valid until the body has been sent
+	long long generatedLength;
+	long long dropAfter; // If not -1, the connection is closed once this many body bytes have been sent
+	double delay; // Seconds to wait before answering
+} DBTestServerResponse;
+
+typedef void (*DBTestServerHandler)(void *context, const DBTestServerRequest *request, DBTestServerResponse *response);
+
+/* Returns NULL if the socket or the thread couldn't be made. Also ignores SIGPIPE and raises the
+   limit on open files, as a thousand connections take two thousand descriptors in one process. */
+DBTestServer *DBTestServerStart(DBTestServerHandler handler, void *context);
+int DBTestServerPort(const DBTestServer *server);
+
+/* Closes every connection, answered or not, and waits for the server thread */
+void DBTestServerStop(DBTestServer *server);
+
+/* Copies the value of the first header called name, case insensitively, into value */
+bool DBTestServerGetHeader(const DBTestServerRequest *request, const char *name, char *value, size_t size);
+
+/* Copies bytes as the response body */
+void DBTestServerSetBody(DBTestServerResponse *response, const void *bytes, size_t length);
+
+/* Adds one header line, e.g. DBTestServerAddHeader(response, "Retry-After: %d", 2) */
+void DBTestServerAddHeader(DBTestServerResponse *response, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif
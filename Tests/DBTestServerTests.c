@@ -0,0 +1,214 @@
+//
+//  DBTestServerTests.c
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Checks DBTestServer with plain sockets before the Objective-C tests rely on it: keep-alive,
+   chunked request bodies, delays, generated and cut off bodies, dropped connections and the count
+   of requests in flight. */
+
+#include "DBTestServer.h"
+#include "DBTest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+typedef struct {
+	unsigned maxInFlight;
+} DBTestServerState;
+
+static size_t DBTestPattern(void *context, long long offset, uint8_t *buffer, size_t length) {
+	(void)context;
+	for (size_t i = 0; i < length; i++) buffer[i] = (uint8_t)((offset + i) * 7);
+	return length;
+}
+
+static void DBTestHandler(void *context, const DBTestServerRequest *request, DBTestServerResponse *response) {
+	DBTestServerState *state = context;
+	if (request->inFlight > state->maxInFlight) state->maxInFlight = request->inFlight;
+
+	if (strcmp(request->path, "/echo") == 0) {
+		char body[256];
+		char agent[64] = "";
+		DBTestServerGetHeader(request, "user-agent", agent, sizeof(agent));
+		int length = snprintf(body, sizeof(body), "%s %s %s %s %zu:%.*s", request->method, request->path, request->query,
+			agent, request->bodyLength, (int)request->bodyLength, request->body ? (const char *)request->body : "");
+		DBTestServerSetBody(response, body, length);
+		DBTestServerAddHeader(response, "X-Test: %d", 42);
+	}
+	else if (strcmp(request->path, "/slow") == 0) {
+		response->delay = 0.3;
+		DBTestServerSetBody(response, "slow", 4);
+	}
+	else if (strcmp(request->path, "/generated") == 0) {
+		response->generator = DBTestPattern;
+		response->generatedLength = 10 * 1000 * 1000 + 17;
+	}
+	else if (strcmp(request->path, "/cut") == 0) {
+		response->generator = DBTestPattern;
+		response->generatedLength = 5000;
+		response->dropAfter = 1000;
+	}
+	else if (strcmp(request->path, "/drop") == 0) {
+		response->status = 0;
+	}
+	else {
+		response->status = 404;
+	}
+}
+
+static int DBTestConnect(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = { 0 };
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void DBTestSend(int fd, const char *text) {
+	size_t length = strlen(text);
+	while (length > 0) {
+		ssize_t count = write(fd, text, length);
+		if (count <= 0) return;
+		text += count;
+		length -= count;
+	}
+}
+
+/* Reads one response: returns the status, or 0 if the connection closed first. The body is
+   malloc'd into *body; *bodyLength is what arrived, which may be short of the Content-Length. */
+static int DBTestReadResponse(int fd, char *head, size_t headSize, uint8_t **body, size_t *bodyLength) {
+	size_t headLength = 0;
+	*body = NULL;
+	*bodyLength = 0;
+	while (headLength < 4 || memcmp(head + headLength - 4, "\r\n\r\n", 4) != 0) {
+		if (headLength + 1 >= headSize || read(fd, head + headLength, 1) != 1) return 0;
+		headLength++;
+	}
+	head[headLength] = '\0';
+
+	const char *contentLength = strstr(head, "Content-Length: ");
+	size_t expected = contentLength ? strtoul(contentLength + 16, NULL, 10) : 0;
+	*body = malloc(expected + 1);
+	while (*bodyLength < expected) {
+		ssize_t count = read(fd, *body + *bodyLength, expected - *bodyLength);
+		if (count <= 0) break;
+		*bodyLength += count;
+	}
+	(*body)[*bodyLength] = '\0';
+	return atoi(head + 9);
+}
+
+static bool DBTestClosed(int fd) {
+	char byte;
+	return read(fd, &byte, 1) == 0;
+}
+
+static void DBTestKeepAlive(int port) {
+	int fd = DBTestConnect(port);
+	char head[1024];
+	uint8_t *body;
+	size_t bodyLength;
+
+	DBTestSend(fd, "GET /echo?list=true HTTP/1.1\r\nHost: localhost\r\nUser-Agent: test\r\n\r\n");
+	int status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 200 && strcmp((char *)body, "GET /echo list=true test 0:") == 0, "GET gives %d \"%s\"", status, body);
+	DBTestCheck(strstr(head, "X-Test: 42\r\n") != NULL, "the added header is missing from %s", head);
+	free(body);
+
+	// On the same connection: a chunked body, then one with a Content-Length sent with it
+	DBTestSend(fd, "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n");
+	usleep(50000);
+	DBTestSend(fd, "6\r\n world\r\n0\r\n\r\nPUT /echo HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc");
+	status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 200 && strcmp((char *)body, "POST /echo   11:hello world") == 0, "chunked POST gives %d \"%s\"",
+		status, body);
+	free(body);
+	status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 200 && strcmp((char *)body, "PUT /echo   3:abc") == 0, "PUT gives %d \"%s\"", status, body);
+	free(body);
+
+	DBTestSend(fd, "GET /missing HTTP/1.1\r\nConnection: close\r\n\r\n");
+	status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 404 && DBTestClosed(fd), "a request with Connection: close gives %d and stays open", status);
+	free(body);
+	close(fd);
+}
+
+static void DBTestBodies(int port) {
+	char head[1024];
+	uint8_t *body;
+	size_t bodyLength;
+
+	int fd = DBTestConnect(port);
+	DBTestSend(fd, "GET /generated HTTP/1.1\r\n\r\n");
+	int status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	bool matches = bodyLength == 10 * 1000 * 1000 + 17;
+	for (size_t i = 0; matches && i < bodyLength; i++) matches = body[i] == (uint8_t)(i * 7);
+	DBTestCheck(status == 200 && matches, "generated body: status %d, %zu bytes", status, bodyLength);
+	free(body);
+	close(fd);
+
+	fd = DBTestConnect(port);
+	DBTestSend(fd, "GET /cut HTTP/1.1\r\n\r\n");
+	status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 200 && bodyLength == 1000 && strstr(head, "Content-Length: 5000\r\n"),
+		"cut off body: status %d, %zu bytes", status, bodyLength);
+	free(body);
+	close(fd);
+
+	fd = DBTestConnect(port);
+	DBTestSend(fd, "GET /drop HTTP/1.1\r\n\r\n");
+	status = DBTestReadResponse(fd, head, sizeof(head), &body, &bodyLength);
+	DBTestCheck(status == 0, "a dropped request got status %d", status);
+	close(fd);
+}
+
+static void DBTestDelays(int port, DBTestServerState *state) {
+	enum { count = 50 };
+	int fds[count];
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		fds[i] = DBTestConnect(port);
+		DBTestSend(fds[i], "GET /slow HTTP/1.1\r\n\r\n");
+	}
+	for (int i = 0; i < count; i++) {
+		char head[1024];
+		uint8_t *body;
+		size_t bodyLength;
+		int status = DBTestReadResponse(fds[i], head, sizeof(head), &body, &bodyLength);
+		DBTestCheck(status == 200 && bodyLength == 4, "slow request %d gives %d", i, status);
+		free(body);
+		close(fds[i]);
+	}
+	double elapsed = DBTestNow() - start;
+	DBTestCheck(elapsed >= 0.3 && elapsed < 1.5, "%d requests delayed 0.3 s together took %.2f s", count, elapsed);
+	DBTestCheck(state->maxInFlight >= count, "at most %u requests were in flight", state->maxInFlight);
+}
+
+
+int main(void) {
+	DBTestServerState state = { 0 };
+	DBTestServer *server = DBTestServerStart(DBTestHandler, &state);
+	DBTestCheck(server != NULL, "the server didn't start");
+	if (!server) return DBTestExitStatus("DBTestServerTests");
+
+	int port = DBTestServerPort(server);
+	DBTestKeepAlive(port);
+	DBTestBodies(port);
+	DBTestDelays(port, &state);
+
+	DBTestServerStop(server);
+	return DBTestExitStatus("DBTestServerTests");
+}
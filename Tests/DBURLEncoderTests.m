@@ -0,0 +1,151 @@
+//
+//  DBURLEncoderTests.m
+//  DropboxSDK
+//
+//  Copyright (c) 2012 Dropbox, Inc. All rights reserved.
+//
+
+/* Compares DBURLEncoder's path and query tables with the CFURLCreateStringByAddingPercentEscapes
+   calls they replaced: every ASCII character, every BMP code point outside the surrogates, a
+   sample of the other planes, and random strings. With --bench, encoded bytes per second for a
+   path and a query value, against the CF call. */
+
+#import <Foundation/Foundation.h>
+
+#import "DBURLEncoder.h"
+#include "DBTest.h"
+
+
+// The escape sets escapePath: and stringByAddingURIPercentEscapesUsingEncoding: passed to CF
+static NSString * const kDBPathEscapes = @":?=,!$&'()*+;[]@#~";
+static NSString * const kDBQueryEscapes = @":/?=,!$&'()*+;[]@#";
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+static NSString *DBCFEncodedString(NSString *string, DBURLEncoding encoding) {
+	NSString *escapes = encoding == DBURLEncodingPath ? kDBPathEscapes : kDBQueryEscapes;
+	return (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault,
+		(__bridge CFStringRef)string, NULL, (__bridge CFStringRef)escapes, kCFStringEncodingUTF8);
+}
+#pragma clang diagnostic pop
+
+static const char *DBEncodingName(DBURLEncoding encoding) {
+	return encoding == DBURLEncodingPath ? "path" : "query";
+}
+
+static void DBCheckString(NSString *string, DBURLEncoding encoding) {
+	NSString *expected = DBCFEncodedString(string, encoding);
+	NSString *actual = DBURLEncodedString(string, encoding);
+	DBTestCheck([actual isEqualToString:expected], "%s encoding of %s is %s, CF gives %s", DBEncodingName(encoding),
+		[[string debugDescription] UTF8String], [actual UTF8String], [expected UTF8String]);
+
+	NSMutableData *data = [NSMutableData dataWithBytes:"x" length:1];
+	DBURLAppendEncodedString(data, string, encoding);
+	NSString *appended = [[NSString alloc] initWithBytes:(const char *)[data bytes] + 1 length:[data length] - 1
+		encoding:NSASCIIStringEncoding];
+	DBTestCheck([appended isEqualToString:actual], "DBURLAppendEncodedString of %s gives %s, DBURLEncodedString %s",
+		[[string debugDescription] UTF8String], [appended UTF8String], [actual UTF8String]);
+}
+
+static void DBTestEveryCharacter(void) {
+	for (int encoding = DBURLEncodingPath; encoding <= DBURLEncodingQuery; encoding++) {
+		for (UTF32Char c = 0; c < 0x10000; c++) {
+			if (c >= 0xD800 && c < 0xE000) continue;
+			unichar character = (unichar)c;
+			DBCheckString([NSString stringWithCharacters:&character length:1], encoding);
+		}
+		for (UTF32Char c = 0x10000; c < 0x110000; c += 0x3F1) {
+			UTF32Char littleEndian = NSSwapHostIntToLittle(c);
+			DBCheckString([[NSString alloc] initWithBytes:&littleEndian length:4 encoding:NSUTF32LittleEndianStringEncoding],
+				encoding);
+		}
+	}
+}
+
+// Long enough to pass the encoder's stack buffers, ASCII alone and mixed with the rest
+static void DBTestRandomStrings(void) {
+	srandom(1);
+	for (int round = 0; round < 2000; round++) {
+		NSUInteger length = random() % 1500;
+		BOOL asciiOnly = round % 2 == 0;
+		unichar *characters = malloc(MAX(length, 1) * sizeof(unichar));
+		for (NSUInteger i = 0; i < length; i++) {
+			if (asciiOnly || random() % 4) {
+				characters[i] = (unichar)(random() % 128);
+			}
+			else if (random() % 8 == 0 && i + 1 < length) {
+				characters[i] = (unichar)(0xD800 + random() % 0x400);
+				characters[++i] = (unichar)(0xDC00 + random() % 0x400);
+			}
+			else {
+				characters[i] = (unichar)(0x80 + random() % (0xD800 - 0x80));
+			}
+		}
+		NSString *string = [[NSString alloc] initWithCharacters:characters length:length];
+		free(characters);
+
+		DBCheckString(string, DBURLEncodingPath);
+		DBCheckString(string, DBURLEncodingQuery);
+	}
+}
+
+static void DBBenchmarkString(NSString *string, DBURLEncoding encoding, const char *name) {
+	const int count = 200000;
+	NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		@autoreleasepool {
+			DBURLEncodedString(string, encoding);
+		}
+	}
+	double encoderTime = DBTestNow() - start;
+
+	start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		@autoreleasepool {
+			DBCFEncodedString(string, encoding);
+		}
+	}
+	double cfTime = DBTestNow() - start;
+
+	printf("%s, %lu UTF-8 bytes: DBURLEncodedString %.1f MB/s, CF %.1f MB/s\n", name, (unsigned long)length,
+		count * length / encoderTime / 1e6, count * length / cfTime / 1e6);
+}
+
+static void DBBenchmarkBytes(void) {
+	const size_t length = 1 << 20;
+	const int count = 100;
+	uint8_t *input = malloc(length);
+	char *output = malloc(DBURLEncodedMaxLength(length));
+	srandom(2);
+	for (size_t i = 0; i < length; i++) {
+		// Mostly characters that stay as they are, as in real paths
+		input[i] = random() % 8 ? "abcdefghijklmnopqrstuvwxyz0123456789/"[random() % 37] : (uint8_t)random();
+	}
+
+	double start = DBTestNow();
+	for (int i = 0; i < count; i++) {
+		DBURLEncodeBytes(input, length, DBURLEncodingPath, output);
+	}
+	printf("DBURLEncodeBytes, 1 MB of path-like bytes: %.0f MB/s\n", count / (DBTestNow() - start));
+
+	free(output);
+	free(input);
+}
+
+
+int main(int argc, char **argv) {
+	@autoreleasepool {
+		DBTestEveryCharacter();
+		DBTestRandomStrings();
+
+		if (DBTestWantsBenchmarks(argc, argv)) {
+			DBBenchmarkString(@"/Photos/Sample Album/Boston City Flow.jpg", DBURLEncodingPath, "ASCII path");
+			DBBenchmarkString(@"/Fotos/Verão em São Paulo/praia ao pôr do sol.jpg", DBURLEncodingPath, "Non-ASCII path");
+			DBBenchmarkString(@"oauth_signature=aGVsbG8gd29ybGQ+Lz0=&locale=en_US", DBURLEncodingQuery, "Query value");
+			DBBenchmarkBytes();
+		}
+	}
+	return DBTestExitStatus("DBURLEncoderTests");
+}
@@ -14,7 +14,7 @@
     UIButton* nextButton;
     UIActivityIndicatorView* activityIndicator;
     
-    NSArray* photoPaths;
+    NSArray* photos; // DBMetadata of each photo
     NSString* photosHash;
     NSString* currentPhotoPath;
     BOOL working;
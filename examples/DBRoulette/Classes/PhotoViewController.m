@@ -13,7 +13,6 @@
 
 @interface PhotoViewController () <DBRestClientDelegate>
 
-- (NSString*)photoPath;
 - (void)didPressRandomPhoto;
 - (void)loadRandomPhoto;
 - (void)displayError;
@@ -45,7 +44,7 @@
     [imageView release];
     [nextButton release];
     [activityIndicator release];
-    [photoPaths release];
+    [photos release];
     [photosHash release];
     [currentPhotoPath release];
     [restClient release];
@@ -79,15 +78,15 @@
     photosHash = [metadata.hash retain];
     
     NSArray* validExtensions = [NSArray arrayWithObjects:@"jpg", @"jpeg", nil];
-    NSMutableArray* newPhotoPaths = [NSMutableArray new];
+    NSMutableArray* newPhotos = [NSMutableArray new];
     for (DBMetadata* child in metadata.contents) {
         NSString* extension = [[child.path pathExtension] lowercaseString];
         if (!child.isDirectory && [validExtensions indexOfObject:extension] != NSNotFound) {
-            [newPhotoPaths addObject:child.path];
+            [newPhotos addObject:child];
         }
     }
-    [photoPaths release];
-    photoPaths = newPhotoPaths;
+    [photos release];
+    photos = newPhotos;
     [self loadRandomPhoto];
 }
 
@@ -101,16 +100,6 @@
     [self setWorking:NO];
 }
 
-- (void)restClient:(DBRestClient*)client loadedThumbnail:(NSString*)destPath {
-    [self setWorking:NO];
-    imageView.image = [UIImage imageWithContentsOfFile:destPath];
-}
-
-- (void)restClient:(DBRestClient*)client loadThumbnailFailedWithError:(NSError*)error {
-    [self setWorking:NO];
-    [self displayError];
-}
-
 
 #pragma mark private methods
 
@@ -128,7 +117,7 @@
 }
 
 - (void)loadRandomPhoto {
-    if ([photoPaths count] == 0) {
+    if ([photos count] == 0) {
 
         NSString *msg = nil;
         if ([DBSession sharedSession].root == kDBRootDropbox) {
@@ -144,10 +133,10 @@
         
         [self setWorking:NO];
     } else {
-        NSString* photoPath;
-        if ([photoPaths count] == 1) {
-            photoPath = [photoPaths objectAtIndex:0];
-            if ([photoPath isEqual:currentPhotoPath]) {
+        DBMetadata* photo;
+        if ([photos count] == 1) {
+            photo = [photos objectAtIndex:0];
+            if ([photo.path isEqual:currentPhotoPath]) {
                 [[[[UIAlertView alloc]
                    initWithTitle:@"No More Photos" message:@"You only have one photo to display." 
                    delegate:nil cancelButtonTitle:@"OK" otherButtonTitles:nil]
@@ -161,22 +150,28 @@
             // Find a random photo that is not the current photo
             do {
                 srandom(time(NULL));
-                NSInteger index =  random() % [photoPaths count];
-                photoPath = [photoPaths objectAtIndex:index];
-            } while ([photoPath isEqual:currentPhotoPath]);
+                NSInteger index =  random() % [photos count];
+                photo = [photos objectAtIndex:index];
+            } while ([photo.path isEqual:currentPhotoPath]);
         }
         
         [currentPhotoPath release];
-        currentPhotoPath = [photoPath retain];
+        currentPhotoPath = [photo.path retain];
         
-        [self.restClient loadThumbnail:currentPhotoPath ofSize:@"iphone_bestfit" intoPath:[self photoPath]];
+        // Photos seen before come from the thumbnail cache instead of the network
+        [self.restClient loadThumbnailForMetadata:photo ofSize:@"iphone_bestfit" completion:^(NSError *error, NSData *thumbnail, NSString *size) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [self setWorking:NO];
+                if (error) {
+                    [self displayError];
+                } else {
+                    imageView.image = [UIImage imageWithData:thumbnail];
+                }
+            });
+        }];
     }
 }
 
-- (NSString*)photoPath {
-    return [NSTemporaryDirectory() stringByAppendingPathComponent:@"photo.jpg"];
-}
-
 - (void)displayError {
     [[[[UIAlertView alloc] 
        initWithTitle:@"Error Loading Photo" message:@"There was an error loading your photo." 
@@ -201,6 +196,7 @@
     if (restClient == nil) {
         restClient = [[DBRestClient alloc] initWithSession:[DBSession sharedSession]];
         restClient.delegate = self;
+        restClient.thumbnailCache = [DBThumbnailCache cacheForUserId:[[[DBSession sharedSession] userIds] lastObject]];
     }
     return restClient;
 }